@@ -0,0 +1,1575 @@
+//**********************************************************************
+// File:			CollisionBenchmark.cpp
+// Description:		Times the HeightField collision queries
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Each benchmark is run repeatedly until it has taken at
+//					least --min-time seconds, then reported per query in the
+//					style of Google Benchmark. Everything a query needs is
+//					generated up front so only the query itself is timed.
+//
+//					On maps up to MAX_BRUTE_FORCE_SIZE, RayCollision checks
+//					each setup's hits against BruteForce's. GridWalk and the
+//					quadtree have to match them exactly, the packet kernel
+//					to within PACKET_HIT_TOLERANCE, or it reports FAILED.
+//
+//					A --heightmap ending in .hfd is mapped as written by
+//					HeightFieldConverter, keeping the storage and layout it
+//					was saved with.
+//
+//					--paged times ground lookups and drops on a world written
+//					by HeightFieldConverter --tile-samples, loading its tiles
+//					within --budget megabytes.
+//
+//					TerrainLod builds the geomipmapped index list for a view
+//					across each map, at a range of screen errors. Its
+//					queries are whole builds, tris/query the triangles left
+//					to draw and hit % their share of the triangles in view.
+//					On maps up to MAX_MESH_UPDATE_SIZE it then builds the
+//					list for the whole map with the same levels, which has
+//					to cover it with no cracks or T-junctions where chunks
+//					at different levels meet.
+//
+//					MeshUpdate edits and highlights a copy of each map up
+//					to MAX_MESH_UPDATE_SIZE a frame at a time, keeping a
+//					vertex buffer up to date from TakeDirtyRanges as
+//					HeightMap does. Its queries are frames, tris/query the
+//					vertices rewritten a frame and hit % their share of the
+//					mesh. Afterwards the buffer has to match the mesh
+//					written out in full, or it reports FAILED and the
+//					benchmark exits with 1.
+//
+//					DrawList culls each map's chunks for DRAW_LIST_VIEWS
+//					views from above it, with its queries whole builds,
+//					tris/query the triangles drawn and hit % their share of
+//					the map. On maps up to MAX_MESH_UPDATE_SIZE it then
+//					checks every triangle with a corner in view is drawn,
+//					with heights raised between views, the same way.
+//
+//					SphereWorld steps SPHERE_WORLD_BODIES spheres dropped
+//					over each map, at 60 ticks a second, on one thread and
+//					on the pool. Its queries are bodies stepped and hit %
+//					the bodies touching the ground.
+//
+//					Usage: CollisionBenchmark [--heightmap file.bmp|file.hfd]
+//							[--max-size n] [--min-time seconds]
+//							[--filter text] [--threads n]
+//							[--storage float4|uint16] [--layout rows|tiled]
+//							[--paged world.hfw] [--budget megabytes]
+//**********************************************************************
+
+#include "HeightField.h"
+#include "HeightFieldMesh.h"
+#include "HeightFieldTools.h"
+#include "PagedHeightField.h"
+#include "QueryThreadPool.h"
+#include "Random.h"
+#include "SphereWorld.h"
+
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <math.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifndef COLLISION_RESOURCE_DIR
+#define COLLISION_RESOURCE_DIR "../Collision/Resources"
+#endif
+
+// Same settings as Application::HandleStart
+static const float GRID_SIZE = 2.0f;
+static const float HEIGHT_RANGE = 0.75f;
+
+static const int SYNTHETIC_SIZES[] = { 64, 256, 1024, 4096 };
+static const size_t NUM_SYNTHETIC_SIZES = sizeof SYNTHETIC_SIZES / sizeof SYNTHETIC_SIZES[0];
+
+// Testing every triangle is only bearable on the small maps
+static const int MAX_BRUTE_FORCE_SIZE = 256;
+static const int MAX_SPHERE_BRUTE_FORCE_SIZE = 64;
+
+// How far the packet kernel's hits may be from brute force's, as a fraction of
+// the map's width. The worst seen on the synthetic maps is about a tenth of it.
+static const float PACKET_HIT_TOLERANCE = 1.0e-5f;
+
+static const int QUERY_COUNT = 4096;
+
+// Pixels the LOD lets the terrain be out by, and the screen it's seen on
+static const float LOD_PIXEL_ERRORS[] = { 0.5f, 1.0f, 2.0f, 4.0f, 8.0f };
+static const size_t NUM_LOD_PIXEL_ERRORS = sizeof LOD_PIXEL_ERRORS / sizeof LOD_PIXEL_ERRORS[0];
+static const float LOD_SCREEN_HEIGHT = 1080.0f;
+static const float LOD_FOV = XM_PI / 4.0f;
+
+// Both meshes of a 512 map, and the buffers kept from them, are about 100 MB
+static const int MAX_MESH_UPDATE_SIZE = 512;
+static const int MESH_UPDATE_EDIT_SIZE = 8;			// Samples each way, at most
+static const int MESH_UPDATE_HIGHLIGHTS = 16;		// Faces a frame
+static const int MESH_UPDATE_MERGE_GAP = 16;			// Cells or samples, as HeightMap's
+
+static const int DRAW_LIST_VIEWS = 64;
+
+static const int SPHERE_WORLD_BODIES = 100000;
+static const float SPHERE_WORLD_TICK = 1.0f / 60.0f;
+
+struct Options
+{
+	const char* pHeightMapFile;
+	int maxSize;
+	double minTime;
+	const char* pFilter;
+	int threadCount;
+	HeightField::HeightStorage storage;
+	HeightField::HeightLayout layout;
+	const char* pPagedWorldFile;
+	size_t memoryBudget;
+};
+
+struct Ray
+{
+	XMFLOAT3 pos;
+	XMFLOAT3 dir;
+	float speed;
+};
+
+struct Triangle
+{
+	XMFLOAT3 v0;
+	XMFLOAT3 v1;
+	XMFLOAT3 v2;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Query distributions
+//////////////////////////////////////////////////////////////////////
+
+enum RayDistribution
+{
+	RAYS_DROP,			// Straight down from above the map, like the R, T and N keys
+	RAYS_GRAZING,		// Just above the surface, nearly parallel to it
+	RAYS_MISS,			// Above the map heading up and away
+	RAYS_HORIZONTAL,	// Level rays right across the map
+	NUM_RAY_DISTRIBUTIONS
+};
+
+static const char* const g_aRayDistributionNames[NUM_RAY_DISTRIBUTIONS] = {
+	"Drop",
+	"Grazing",
+	"Miss",
+	"Horizontal",
+};
+
+struct MapInfo
+{
+	float minX, maxX;
+	float minZ, maxZ;
+	float minY, maxY;
+};
+
+static void GetMapInfo( const HeightField& field, MapInfo& info )
+{
+	int sampleCount = field.GetWidth() * field.GetLength();
+
+	info.minX = XMVectorGetX(field.GetSample(0));
+	info.minZ = XMVectorGetZ(field.GetSample(0));
+	info.maxX = XMVectorGetX(field.GetSample(sampleCount-1));
+	info.maxZ = XMVectorGetZ(field.GetSample(sampleCount-1));
+	info.minY = FLT_MAX;
+	info.maxY = -FLT_MAX;
+
+	for( int i = 0; i < sampleCount; ++i )
+	{
+		float y = field.GetSampleHeight(i);
+
+		if( y < info.minY )
+			info.minY = y;
+		if( y > info.maxY )
+			info.maxY = y;
+	}
+}
+
+static void MakeRays( const HeightField& field, RayDistribution distribution, std::vector<Ray>& rays )
+{
+	MapInfo info;
+	GetMapInfo(field, info);
+
+	Random random(1234 + distribution);
+
+	float mapWidth = info.maxX - info.minX;
+	float mapLength = info.maxZ - info.minZ;
+
+	rays.resize(QUERY_COUNT);
+
+	for( size_t i = 0; i < rays.size(); ++i )
+	{
+		Ray& ray = rays[i];
+
+		switch( distribution )
+		{
+			case RAYS_DROP:
+			{
+				ray.pos = XMFLOAT3(random.Range(info.minX, info.maxX), info.maxY + 1.0f, random.Range(info.minZ, info.maxZ));
+				ray.dir = XMFLOAT3(0.0f, -1.0f, 0.0f);
+				ray.speed = (info.maxY - info.minY) + 2.0f;
+				break;
+			}
+
+			case RAYS_GRAZING:
+			{
+				// Start half a unit above a sample and skim over the next few cells
+				int sampleW = (int)(random.Next() % field.GetWidth());
+				int sampleL = (int)(random.Next() % field.GetLength());
+				XMFLOAT3 sample;
+				XMStoreFloat3(&sample, field.GetSample((sampleL * field.GetWidth()) + sampleW));
+				float angle = random.Range(0.0f, XM_2PI);
+
+				ray.pos = XMFLOAT3(sample.x, sample.y + 0.5f, sample.z);
+				ray.dir = XMFLOAT3(cosf(angle), random.Range(-0.1f, -0.02f), sinf(angle));
+				ray.speed = GRID_SIZE * 8.0f;
+				break;
+			}
+
+			case RAYS_MISS:
+			{
+				float angle = random.Range(0.0f, XM_2PI);
+
+				ray.pos = XMFLOAT3(random.Range(info.minX, info.maxX), info.maxY + 1.0f, random.Range(info.minZ, info.maxZ));
+				ray.dir = XMFLOAT3(cosf(angle), random.Range(0.05f, 1.0f), sinf(angle));
+				ray.speed = GRID_SIZE * 8.0f;
+				break;
+			}
+
+			case RAYS_HORIZONTAL:
+			{
+				// From one side of the map to the other, at a height that passes through the hills
+				float y = random.Range(info.minY, info.maxY);
+
+				if( random.Next() & 1 )
+				{
+					ray.pos = XMFLOAT3(info.minX - 1.0f, y, random.Range(info.minZ, info.maxZ));
+					ray.dir = XMFLOAT3(1.0f, 0.0f, random.Range(-0.2f, 0.2f));
+					ray.speed = mapWidth + 2.0f;
+				}
+				else
+				{
+					ray.pos = XMFLOAT3(random.Range(info.minX, info.maxX), y, info.minZ - 1.0f);
+					ray.dir = XMFLOAT3(random.Range(-0.2f, 0.2f), 0.0f, 1.0f);
+					ray.speed = mapLength + 2.0f;
+				}
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+}
+
+// Rays dropped onto the triangles of random cells, about half of them hitting,
+// and points just above or below them
+static void MakeTriangleQueries( const HeightField& field, std::vector<Triangle>& triangles, std::vector<Ray>& rays, std::vector<XMFLOAT3>& points )
+{
+	Random random(5678);
+
+	triangles.resize(QUERY_COUNT);
+	rays.resize(QUERY_COUNT);
+	points.resize(QUERY_COUNT);
+
+	for( size_t i = 0; i < triangles.size(); ++i )
+	{
+		int aSamples[3];
+		field.GetFaceSamples((int)(random.Next() % field.GetFaceCount()), aSamples);
+
+		Triangle& tri = triangles[i];
+
+		XMStoreFloat3(&tri.v0, field.GetSample(aSamples[0]));
+		XMStoreFloat3(&tri.v1, field.GetSample(aSamples[1]));
+		XMStoreFloat3(&tri.v2, field.GetSample(aSamples[2]));
+
+		// Anywhere over the cell, so the ray lands in this triangle or its neighbour
+		float minX = fminf(tri.v0.x, fminf(tri.v1.x, tri.v2.x));
+		float maxX = fmaxf(tri.v0.x, fmaxf(tri.v1.x, tri.v2.x));
+		float minZ = fminf(tri.v0.z, fminf(tri.v1.z, tri.v2.z));
+		float maxZ = fmaxf(tri.v0.z, fmaxf(tri.v1.z, tri.v2.z));
+
+		Ray& ray = rays[i];
+		ray.pos = XMFLOAT3(random.Range(minX, maxX), 50.0f, random.Range(minZ, maxZ));
+		ray.dir = XMFLOAT3(0.0f, -1.0f, 0.0f);
+		ray.speed = 100.0f;
+
+		points[i] = XMFLOAT3(ray.pos.x, tri.v0.y + random.Range(-1.0f, 1.0f), ray.pos.z);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Running and reporting
+//////////////////////////////////////////////////////////////////////
+
+struct Result
+{
+	long long queries;
+	long long trianglesTested;
+	long long hits;
+	double seconds;
+};
+
+// Checks that have failed, which main returns 1 for
+static int g_FailedChecks = 0;
+
+static bool ShouldRun( const Options& options, const std::string& name )
+{
+	return !options.pFilter || name.find(options.pFilter) != std::string::npos;
+}
+
+static void PrintHeader()
+{
+	printf("%-56s %12s %14s %12s %8s\n", "Benchmark", "ns/query", "queries/s", "tris/query", "hit %");
+	printf("-------------------------------------------------------------------------------------------------------------\n");
+}
+
+static void PrintResult( const std::string& name, const Result& result )
+{
+	double nsPerQuery = result.seconds * 1e9 / (double)result.queries;
+	double queriesPerSecond = (double)result.queries / result.seconds;
+	double trianglesPerQuery = (double)result.trianglesTested / (double)result.queries;
+	double hitPercent = 100.0 * (double)result.hits / (double)result.queries;
+
+	printf("%-56s %12.1f %14.0f %12.1f %8.1f\n", name.c_str(), nsPerQuery, queriesPerSecond, trianglesPerQuery, hitPercent);
+	fflush(stdout);
+}
+
+// Calls pass(result) over and over until minTime has gone by
+template <typename Pass>
+static Result RunTimed( double minTime, Pass pass )
+{
+	Result result;
+	memset(&result, 0, sizeof result);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	do
+	{
+		pass(result);
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	while( result.seconds < minTime );
+
+	return result;
+}
+
+// Each ray's hit, with a triangle of -1 for a miss
+static void CastRays( const HeightField& field, const std::vector<Ray>& rays, std::vector<HeightField::RayHit>& hits )
+{
+	hits.resize(rays.size());
+
+	for( size_t i = 0; i < rays.size(); ++i )
+	{
+		if( !field.RayCollision(XMLoadFloat3(&rays[i].pos), XMLoadFloat3(&rays[i].dir), rays[i].speed, hits[i]) )
+		{
+			memset(&hits[i], 0, sizeof hits[i]);
+			hits[i].triangle = -1;
+		}
+	}
+}
+
+// Rays that hit a different triangle, or the same one further than tolerance
+// away. A tolerance of 0 means the position and distance must be bit for bit
+// the same.
+static int CountRayMismatches( const std::vector<HeightField::RayHit>& reference, const std::vector<HeightField::RayHit>& hits, float tolerance )
+{
+	int mismatches = 0;
+
+	for( size_t i = 0; i < reference.size(); ++i )
+	{
+		const HeightField::RayHit& a = reference[i];
+		const HeightField::RayHit& b = hits[i];
+
+		if( a.triangle != b.triangle )
+		{
+			++mismatches;
+		}
+		else if( tolerance == 0.0f )
+		{
+			if( memcmp(&a.position, &b.position, sizeof a.position) != 0 || memcmp(&a.distance, &b.distance, sizeof a.distance) != 0 )
+				++mismatches;
+		}
+		else
+		{
+			float error = XMVectorGetX(XMVector3Length(XMLoadFloat3(&a.position) - XMLoadFloat3(&b.position)));
+
+			if( error > tolerance || fabsf(a.distance - b.distance) > tolerance )
+				++mismatches;
+		}
+	}
+
+	return mismatches;
+}
+
+// Where brute force runs, each other setup's hits are checked against it. The
+// reference kernel setups must match it exactly. The packet kernel does its
+// own Moller-Trumbore sums, so it must hit the same triangles but only within
+// PACKET_HIT_TOLERANCE of the same place.
+static void BenchmarkRayCollision( const Options& options, const std::string& mapName, HeightField& field, bool allowBruteForce )
+{
+	struct Setup
+	{
+		const char* pName;
+		HeightField::CollisionMode mode;
+		HeightField::TriangleKernel kernel;
+		bool triangleCache;
+	};
+
+	static const Setup s_aSetups[] = {
+		{ "BruteForce",			HeightField::COLLISION_BRUTE_FORCE, HeightField::TRIANGLE_KERNEL_REFERENCE,	false },
+		{ "GridWalk",			HeightField::COLLISION_GRID_WALK,	HeightField::TRIANGLE_KERNEL_REFERENCE,	false },
+		{ "QuadTree",			HeightField::COLLISION_QUADTREE,	HeightField::TRIANGLE_KERNEL_REFERENCE,	false },
+		{ "QuadTree+Cache",		HeightField::COLLISION_QUADTREE,	HeightField::TRIANGLE_KERNEL_REFERENCE,	true },
+		{ "QuadTree+Packet",	HeightField::COLLISION_QUADTREE,	HeightField::TRIANGLE_KERNEL_PACKET,	false },
+	};
+
+	float packetTolerance = PACKET_HIT_TOLERANCE * std::max(field.GetWidth(), field.GetLength()) * field.GetGridSize();
+
+	for( int distribution = 0; distribution < NUM_RAY_DISTRIBUTIONS; ++distribution )
+	{
+		std::vector<Ray> rays;
+		bool raysMade = false;
+
+		std::vector<HeightField::RayHit> bruteForceHits, hits;
+
+		for( size_t s = 0; s < sizeof s_aSetups / sizeof s_aSetups[0]; ++s )
+		{
+			const Setup& setup = s_aSetups[s];
+
+			if( setup.mode == HeightField::COLLISION_BRUTE_FORCE && !allowBruteForce )
+				continue;
+
+			std::string name = "RayCollision/" + mapName + "/" + g_aRayDistributionNames[distribution] + "/" + setup.pName;
+
+			if( !ShouldRun(options, name) )
+				continue;
+
+			if( !raysMade )
+			{
+				MakeRays(field, (RayDistribution)distribution, rays);
+				raysMade = true;
+			}
+
+			field.SetCollisionMode(setup.mode);
+			field.SetTriangleKernel(setup.kernel);
+			field.SetTriangleCache(setup.triangleCache);
+
+			Result result = RunTimed(options.minTime, [&]( Result& totals )
+			{
+				for( size_t i = 0; i < rays.size(); ++i )
+				{
+					XMVECTOR rayPos = XMLoadFloat3(&rays[i].pos);
+					XMVECTOR rayDir = XMLoadFloat3(&rays[i].dir);
+					HeightField::RayHit hit;
+					HeightField::QueryStats stats;
+
+					if( field.RayCollision(rayPos, rayDir, rays[i].speed, hit, &stats) )
+						++totals.hits;
+
+					totals.trianglesTested += stats.cellsTested * 2;
+				}
+
+				totals.queries += rays.size();
+			});
+
+			PrintResult(name, result);
+
+			if( allowBruteForce )
+			{
+				CastRays(field, rays, setup.mode == HeightField::COLLISION_BRUTE_FORCE ? bruteForceHits : hits);
+
+				if( setup.mode != HeightField::COLLISION_BRUTE_FORCE && !bruteForceHits.empty() )
+				{
+					float tolerance = setup.kernel == HeightField::TRIANGLE_KERNEL_PACKET ? packetTolerance : 0.0f;
+					int mismatches = CountRayMismatches(bruteForceHits, hits, tolerance);
+
+					if( mismatches > 0 )
+					{
+						printf("FAILED: %s differs from BruteForce on %d of %d rays\n", name.c_str(), mismatches, (int)rays.size());
+						fflush(stdout);
+						++g_FailedChecks;
+					}
+				}
+			}
+
+			field.SetTriangleCache(false);
+		}
+	}
+}
+
+// The same rays as above, swept by a sphere the size of the demo one
+static void BenchmarkSphereCollision( const Options& options, const std::string& mapName, HeightField& field, bool allowBruteForce )
+{
+	static const float SPHERE_RADIUS = 1.0f;
+
+	for( int distribution = 0; distribution < NUM_RAY_DISTRIBUTIONS; ++distribution )
+	{
+		std::vector<Ray> rays;
+		bool raysMade = false;
+
+		for( int bruteForce = 0; bruteForce < 2; ++bruteForce )
+		{
+			std::string name = "SphereCollision/" + mapName + "/" + g_aRayDistributionNames[distribution] + (bruteForce ? "/BruteForce" : "/QuadTree");
+
+			if( (bruteForce && !allowBruteForce) || !ShouldRun(options, name) )
+				continue;
+
+			if( !raysMade )
+			{
+				MakeRays(field, (RayDistribution)distribution, rays);
+				raysMade = true;
+			}
+
+			field.SetCollisionMode(bruteForce ? HeightField::COLLISION_BRUTE_FORCE : HeightField::COLLISION_QUADTREE);
+
+			Result result = RunTimed(options.minTime, [&]( Result& totals )
+			{
+				for( size_t i = 0; i < rays.size(); ++i )
+				{
+					XMVECTOR centre = XMLoadFloat3(&rays[i].pos);
+					XMVECTOR dir = XMLoadFloat3(&rays[i].dir);
+					HeightField::SphereHit hit;
+					HeightField::QueryStats stats;
+
+					if( field.SphereCollision(centre, SPHERE_RADIUS, dir, rays[i].speed, hit, &stats) )
+						++totals.hits;
+
+					totals.trianglesTested += stats.cellsTested * 2;
+				}
+
+				totals.queries += rays.size();
+			});
+
+			PrintResult(name, result);
+		}
+	}
+}
+
+// The RayCollision rays again, through RayCollisionBatch on one thread and then on
+// all of the pool's
+static void BenchmarkRayBatch( const Options& options, const std::string& mapName, HeightField& field, QueryThreadPool& pool )
+{
+	field.SetCollisionMode(HeightField::COLLISION_QUADTREE);
+	field.SetTriangleKernel(HeightField::TRIANGLE_KERNEL_PACKET);
+
+	char threadsName[32];
+	snprintf(threadsName, sizeof threadsName, "Threads%d", pool.GetThreadCount());
+
+	for( int distribution = 0; distribution < NUM_RAY_DISTRIBUTIONS; ++distribution )
+	{
+		std::string prefix = "RayBatch/" + mapName + "/" + g_aRayDistributionNames[distribution] + "/";
+		std::string singleName = prefix + "Threads1";
+		std::string poolName = prefix + threadsName;
+
+		bool runSingle = ShouldRun(options, singleName);
+		bool runPool = pool.GetThreadCount() > 1 && ShouldRun(options, poolName);
+
+		if( !runSingle && !runPool )
+			continue;
+
+		std::vector<Ray> rays;
+		MakeRays(field, (RayDistribution)distribution, rays);
+
+		std::vector<float> input(rays.size() * 7);
+		std::vector<unsigned char> hits(rays.size());
+
+		HeightField::RayBatchInput batchInput;
+		batchInput.pOriginX = &input[rays.size() * 0];
+		batchInput.pOriginY = &input[rays.size() * 1];
+		batchInput.pOriginZ = &input[rays.size() * 2];
+		batchInput.pDirX = &input[rays.size() * 3];
+		batchInput.pDirY = &input[rays.size() * 4];
+		batchInput.pDirZ = &input[rays.size() * 5];
+		batchInput.pMaxDist = &input[rays.size() * 6];
+
+		for( size_t i = 0; i < rays.size(); ++i )
+		{
+			input[(rays.size() * 0) + i] = rays[i].pos.x;
+			input[(rays.size() * 1) + i] = rays[i].pos.y;
+			input[(rays.size() * 2) + i] = rays[i].pos.z;
+			input[(rays.size() * 3) + i] = rays[i].dir.x;
+			input[(rays.size() * 4) + i] = rays[i].dir.y;
+			input[(rays.size() * 5) + i] = rays[i].dir.z;
+			input[(rays.size() * 6) + i] = rays[i].speed;
+		}
+
+		// Just the hit flags, as a line of sight check would want
+		HeightField::RayBatchOutput batchOutput;
+		memset(&batchOutput, 0, sizeof batchOutput);
+		batchOutput.pHit = &hits[0];
+
+		for( int run = 0; run < 2; ++run )
+		{
+			if( !(run == 0 ? runSingle : runPool) )
+				continue;
+
+			Result result = RunTimed(options.minTime, [&]( Result& totals )
+			{
+				HeightField::QueryStats stats;
+
+				if( run == 0 )
+					totals.hits += field.RayCollisionBatch(batchInput, batchOutput, (int)rays.size(), &stats);
+				else
+					totals.hits += field.RayCollisionBatch(batchInput, batchOutput, (int)rays.size(), pool, &stats);
+
+				totals.queries += rays.size();
+				totals.trianglesTested += stats.cellsTested * 2;
+			});
+
+			PrintResult(run == 0 ? singleName : poolName, result);
+		}
+	}
+}
+
+// Ground height and normal lookups at random points over the map, the way
+// ground snapping would use them, one at a time and then as a batch
+enum GroundDistribution
+{
+	GROUND_RANDOM,		// Anywhere on the map
+	GROUND_WALK,		// Walkers taking half cell steps, one walker after another
+	NUM_GROUND_DISTRIBUTIONS
+};
+
+static const char* const g_aGroundDistributionNames[NUM_GROUND_DISTRIBUTIONS] = {
+	"Random",
+	"Walk",
+};
+
+static const int GROUND_WALK_STEPS = 64;
+
+static void MakeGroundPoints( const MapInfo& info, GroundDistribution distribution, std::vector<float>& x, std::vector<float>& z )
+{
+	Random random(91011 + distribution);
+
+	x.resize(QUERY_COUNT);
+	z.resize(QUERY_COUNT);
+
+	for( int i = 0; i < QUERY_COUNT; ++i )
+	{
+		if( distribution == GROUND_WALK && i % GROUND_WALK_STEPS != 0 )
+		{
+			// Wander a little either side of a random heading
+			float angle = random.Range(0.0f, XM_2PI);
+			x[i] = x[i-1] + (0.5f * GRID_SIZE * cosf(angle));
+			z[i] = z[i-1] + (0.5f * GRID_SIZE * sinf(angle));
+		}
+		else
+		{
+			x[i] = random.Range(info.minX, info.maxX);
+			z[i] = random.Range(info.minZ, info.maxZ);
+		}
+	}
+}
+
+static void BenchmarkGroundDistribution( const Options& options, const std::string& prefix, const HeightField& field, GroundDistribution distribution )
+{
+	std::string scalarName = prefix + "/GetGroundAt";
+	std::string batchName = prefix + "/GetGroundBatch";
+
+	bool runScalar = ShouldRun(options, scalarName);
+	bool runBatch = ShouldRun(options, batchName);
+
+	if( !runScalar && !runBatch )
+		return;
+
+	MapInfo info;
+	GetMapInfo(field, info);
+
+	std::vector<float> x, z;
+	MakeGroundPoints(info, distribution, x, z);
+
+	std::vector<float> heights(QUERY_COUNT), normX(QUERY_COUNT), normY(QUERY_COUNT), normZ(QUERY_COUNT);
+
+	if( runScalar )
+	{
+		Result result = RunTimed(options.minTime, [&]( Result& totals )
+		{
+			for( int i = 0; i < QUERY_COUNT; ++i )
+			{
+				XMFLOAT3 normal;
+
+				if( field.GetGroundAt(x[i], z[i], heights[i], normal) )
+					++totals.hits;
+			}
+
+			totals.queries += QUERY_COUNT;
+			totals.trianglesTested += QUERY_COUNT;
+		});
+
+		PrintResult(scalarName, result);
+	}
+
+	if( runBatch )
+	{
+		Result result = RunTimed(options.minTime, [&]( Result& totals )
+		{
+			totals.hits += field.GetGroundBatch(QUERY_COUNT, &x[0], &z[0], &heights[0], &normX[0], &normY[0], &normZ[0]);
+			totals.queries += QUERY_COUNT;
+			totals.trianglesTested += QUERY_COUNT;
+		});
+
+		PrintResult(batchName, result);
+	}
+}
+
+static void BenchmarkGroundQueries( const Options& options, const std::string& mapName, const HeightField& field )
+{
+	for( int distribution = 0; distribution < NUM_GROUND_DISTRIBUTIONS; ++distribution )
+	{
+		std::string prefix = "GroundLookup/" + mapName + "/" + g_aGroundDistributionNames[distribution];
+
+		BenchmarkGroundDistribution(options, prefix, field, (GroundDistribution)distribution);
+	}
+}
+
+static void BenchmarkTriangleTests( const Options& options, const std::string& mapName, const HeightField& field )
+{
+	std::string rayTriangleName = "RayTriangle/" + mapName;
+	std::string pointPlaneName = "PointPlane/" + mapName;
+
+	bool runRayTriangle = ShouldRun(options, rayTriangleName);
+	bool runPointPlane = ShouldRun(options, pointPlaneName);
+
+	if( !runRayTriangle && !runPointPlane )
+		return;
+
+	std::vector<Triangle> triangles;
+	std::vector<Ray> rays;
+	std::vector<XMFLOAT3> points;
+	MakeTriangleQueries(field, triangles, rays, points);
+
+	if( runRayTriangle )
+	{
+		Result result = RunTimed(options.minTime, [&]( Result& totals )
+		{
+			for( size_t i = 0; i < triangles.size(); ++i )
+			{
+				XMVECTOR v0 = XMLoadFloat3(&triangles[i].v0);
+				XMVECTOR v1 = XMLoadFloat3(&triangles[i].v1);
+				XMVECTOR v2 = XMLoadFloat3(&triangles[i].v2);
+				XMVECTOR rayPos = XMLoadFloat3(&rays[i].pos);
+				XMVECTOR rayDir = XMLoadFloat3(&rays[i].dir);
+				XMVECTOR colPos, colNormN;
+				float colDist;
+
+				// Drops land on the top of the terrain, so this winding faces them
+				if( HeightField::RayTriangle(v0, v1, v2, rayPos, rayDir, colPos, colNormN, colDist) )
+					++totals.hits;
+			}
+
+			totals.queries += triangles.size();
+			totals.trianglesTested += triangles.size();
+		});
+
+		PrintResult(rayTriangleName, result);
+	}
+
+	if( runPointPlane )
+	{
+		Result result = RunTimed(options.minTime, [&]( Result& totals )
+		{
+			for( size_t i = 0; i < triangles.size(); ++i )
+			{
+				XMVECTOR v0 = XMLoadFloat3(&triangles[i].v0);
+				XMVECTOR v1 = XMLoadFloat3(&triangles[i].v1);
+				XMVECTOR v2 = XMLoadFloat3(&triangles[i].v2);
+				XMVECTOR point = XMLoadFloat3(&points[i]);
+
+				if( HeightField::PointPlane(v0, v1, v2, point) )
+					++totals.hits;
+			}
+
+			totals.queries += triangles.size();
+			totals.trianglesTested += triangles.size();
+		});
+
+		PrintResult(pointPlaneName, result);
+	}
+}
+
+static int GreatestCommonDivisor( int a, int b )
+{
+	while( b != 0 )
+	{
+		int r = a % b;
+		a = b;
+		b = r;
+	}
+
+	return a;
+}
+
+// Problems with a LOD index list that should cover the whole map: an edge
+// inside the map with no triangle going the other way along it, an edge two
+// triangles go the same way along, a sample part way along an edge (a
+// T-junction), or the triangles not adding up to the map's area
+static int CountLodCracks( const HeightField& field, const std::vector<uint32_t>& indices )
+{
+	int width = field.GetWidth();
+	int length = field.GetLength();
+
+	std::vector<uint64_t> edges;
+	edges.reserve(indices.size());
+
+	std::vector<bool> used(width * length, false);
+	long long doubleArea = 0;
+
+	for( size_t i = 0; i < indices.size(); i += 3 )
+	{
+		for( int corner = 0; corner < 3; ++corner )
+		{
+			uint32_t a = indices[i + corner];
+			uint32_t b = indices[i + ((corner + 1) % 3)];
+
+			edges.push_back(((uint64_t)a << 32) | b);
+			used[a] = true;
+		}
+
+		int wA = indices[i] % width, lA = indices[i] / width;
+		int wB = indices[i+1] % width, lB = indices[i+1] / width;
+		int wC = indices[i+2] % width, lC = indices[i+2] / width;
+
+		doubleArea += abs(((wB - wA) * (lC - lA)) - ((lB - lA) * (wC - wA)));
+	}
+
+	std::sort(edges.begin(), edges.end());
+
+	int cracks = 0;
+
+	if( doubleArea != 2LL * (width - 1) * (length - 1) )
+		++cracks;
+
+	for( size_t i = 0; i < edges.size(); ++i )
+	{
+		if( i > 0 && edges[i] == edges[i-1] )
+		{
+			++cracks;
+			continue;
+		}
+
+		uint32_t a = (uint32_t)(edges[i] >> 32);
+		uint32_t b = (uint32_t)edges[i];
+		int wA = a % width, lA = a / width;
+		int wB = b % width, lB = b / width;
+
+		bool onBorder = (wA == wB && (wA == 0 || wA == width - 1)) || (lA == lB && (lA == 0 || lA == length - 1));
+
+		if( !onBorder && !std::binary_search(edges.begin(), edges.end(), ((uint64_t)b << 32) | a) )
+		{
+			++cracks;
+			continue;
+		}
+
+		int steps = GreatestCommonDivisor(abs(wB - wA), abs(lB - lA));
+
+		for( int s = 1; s < steps; ++s )
+		{
+			int w = wA + (((wB - wA) / steps) * s);
+			int l = lA + (((lB - lA) / steps) * s);
+
+			if( used[(l * width) + w] )
+			{
+				++cracks;
+				break;
+			}
+		}
+	}
+
+	return cracks;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Looking across the map from above one corner at its middle, with the
+// far plane beyond the opposite corner. On maps up to
+// MAX_MESH_UPDATE_SIZE the same eye then picks the levels for a view
+// straight down on the whole map, whose index lists have to join up
+// everywhere.
+//////////////////////////////////////////////////////////////////////
+static void BenchmarkTerrainLod( const Options& options, const std::string& mapName, const HeightField& field )
+{
+	std::string prefix = "TerrainLod/" + mapName + "/";
+
+	if( !ShouldRun(options, prefix) )
+		return;
+
+	MapInfo info;
+	GetMapInfo(field, info);
+
+	float span = std::max(info.maxX - info.minX, info.maxZ - info.minZ);
+	XMVECTOR eye = XMVectorSet(info.minX, info.maxY + (span * 0.1f), info.minZ, 0.0f);
+	XMVECTOR target = XMVectorSet((info.minX + info.maxX) * 0.5f, info.minY, (info.minZ + info.maxZ) * 0.5f, 0.0f);
+
+	XMMATRIX viewProjection = XMMatrixLookAtLH(eye, target, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) *
+		XMMatrixPerspectiveFovLH(LOD_FOV, 16.0f / 9.0f, 1.0f, span * 2.0f);
+	float pixelsPerUnit = LOD_SCREEN_HEIGHT / (2.0f * tanf(LOD_FOV * 0.5f));
+
+	HeightFieldMesh mesh;
+	mesh.Create(&field, HeightFieldMesh::MESH_INDEXED);
+
+	// Everything in view at full detail, to compare with
+	std::vector<HeightFieldMesh::IndexRange> draws;
+	mesh.BuildDrawList(viewProjection, draws);
+
+	long long fullTriangles = 0;
+
+	for( size_t i = 0; i < draws.size(); ++i )
+		fullTriangles += draws[i].indexCount / 3;
+
+	// The first build finds every chunk's errors, which is kept out of the
+	// timings
+	std::vector<uint32_t> indices;
+	mesh.BuildLodIndices(viewProjection, eye, pixelsPerUnit, LOD_PIXEL_ERRORS[0], indices);
+
+	for( size_t i = 0; i < NUM_LOD_PIXEL_ERRORS; ++i )
+	{
+		char errorName[16];
+		snprintf(errorName, sizeof errorName, "%gpx", LOD_PIXEL_ERRORS[i]);
+
+		std::string name = prefix + errorName;
+
+		if( !ShouldRun(options, name) )
+			continue;
+
+		Result result = RunTimed(options.minTime, [&]( Result& totals )
+		{
+			mesh.BuildLodIndices(viewProjection, eye, pixelsPerUnit, LOD_PIXEL_ERRORS[i], indices);
+
+			totals.queries += 1;
+			totals.trianglesTested += (long long)indices.size() / 3;
+		});
+
+		// As PrintResult, with hit % out of the triangles in view
+		double trianglesPerBuild = (double)result.trianglesTested / (double)result.queries;
+
+		printf("%-56s %12.1f %14.0f %12.1f %8.1f\n", name.c_str(), result.seconds * 1e9 / (double)result.queries, (double)result.queries / result.seconds,
+			trianglesPerBuild, 100.0 * trianglesPerBuild / (double)std::max(fullTriangles, 1LL));
+		fflush(stdout);
+	}
+
+	if( field.GetWidth() > MAX_MESH_UPDATE_SIZE || field.GetLength() > MAX_MESH_UPDATE_SIZE )
+		return;
+
+	// Wide enough to take in the map however it's turned
+	XMVECTOR centre = XMVectorSet((info.minX + info.maxX) * 0.5f, info.maxY + span, (info.minZ + info.maxZ) * 0.5f, 0.0f);
+	XMMATRIX wholeMap = XMMatrixLookAtLH(centre, centre - XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f)) *
+		XMMatrixOrthographicLH(span * 1.5f, span * 1.5f, 1.0f, (info.maxY - info.minY) + (span * 2.0f));
+
+	bool levelsMixed = false;
+
+	for( size_t i = 0; i < NUM_LOD_PIXEL_ERRORS; ++i )
+	{
+		mesh.BuildLodIndices(wholeMap, eye, pixelsPerUnit, LOD_PIXEL_ERRORS[i], indices);
+
+		int cracks = CountLodCracks(field, indices);
+
+		if( cracks > 0 )
+		{
+			printf("FAILED: %s%gpx has %d cracks or T-junctions over the whole map\n", prefix.c_str(), LOD_PIXEL_ERRORS[i], cracks);
+			fflush(stdout);
+			++g_FailedChecks;
+		}
+
+		for( int chunk = 1; chunk < mesh.GetChunkCount(); ++chunk )
+		{
+			if( mesh.GetChunkLevel(chunk) != mesh.GetChunkLevel(0) )
+				levelsMixed = true;
+		}
+	}
+
+	// Otherwise no edge between levels has been checked
+	if( mesh.GetChunkCount() > 1 && !levelsMixed )
+	{
+		printf("FAILED: %s never has chunks at different levels\n", prefix.c_str());
+		fflush(stdout);
+		++g_FailedChecks;
+	}
+}
+
+// For the benchmarks that edit heights, so the others see the map as loaded
+static HeightField* NewFieldCopy( const HeightField& field )
+{
+	int sampleCount = field.GetWidth() * field.GetLength();
+	std::vector<float> heights(sampleCount);
+
+	for( int i = 0; i < sampleCount; ++i )
+		heights[i] = field.GetSampleHeight(i);
+
+	HeightField* pCopy = new HeightField(field.GetWidth(), field.GetLength(), field.GetGridSize(), &heights[0], field.GetHeightStorage());
+	pCopy->SetHeightLayout(field.GetHeightLayout());
+
+	return pCopy;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Each frame changes a block of heights and swaps the highlighted faces for
+// new ones, then rewrites only the dirty vertices, as HeightMap::Draw does
+//////////////////////////////////////////////////////////////////////
+static void MeshUpdateFrame( HeightField& field, HeightFieldMesh& mesh, const MapInfo& info, Random& random, float heightLimit,
+							 std::vector<int>& highlights, std::vector<HeightFieldMesh::VertexRange>& ranges, std::vector<HeightFieldVertex>& vertices, Result& totals )
+{
+	int width = 1 + (int)(random.Next() % MESH_UPDATE_EDIT_SIZE);
+	int length = 1 + (int)(random.Next() % MESH_UPDATE_EDIT_SIZE);
+	int w = (int)(random.Next() % (uint32_t)(field.GetWidth() - width + 1));
+	int l = (int)(random.Next() % (uint32_t)(field.GetLength() - length + 1));
+
+	float heights[MESH_UPDATE_EDIT_SIZE * MESH_UPDATE_EDIT_SIZE];
+
+	for( int i = 0; i < width * length; ++i )
+		heights[i] = random.Range(info.minY, heightLimit);
+
+	// As HeightMap::SetHeights
+	if( field.SetHeights(w, l, width, length, heights) )
+		mesh.MarkSamplesDirty(0, 0, field.GetWidth(), field.GetLength());
+	else
+		mesh.MarkSamplesDirty(w, l, width, length);
+
+	for( size_t i = 0; i < highlights.size(); ++i )
+		mesh.SetFaceHighlighted(highlights[i], false);
+
+	for( size_t i = 0; i < highlights.size(); ++i )
+	{
+		highlights[i] = (int)(random.Next() % (uint32_t)field.GetFaceCount());
+		mesh.SetFaceHighlighted(highlights[i], true);
+	}
+
+	mesh.TakeDirtyRanges(ranges, MESH_UPDATE_MERGE_GAP * mesh.GetVerticesPerElement());
+
+	for( size_t i = 0; i < ranges.size(); ++i )
+	{
+		mesh.WriteVertices(ranges[i].firstVertex, ranges[i].vertexCount, &vertices[ranges[i].firstVertex]);
+		totals.trianglesTested += ranges[i].vertexCount;
+	}
+
+	totals.queries += 1;
+}
+
+static void BenchmarkMeshUpdate( const Options& options, const std::string& mapName, const HeightField& field )
+{
+	static const char* const s_aModeNames[] = { "Unindexed", "Indexed" };
+
+	if( field.GetWidth() > MAX_MESH_UPDATE_SIZE || field.GetLength() > MAX_MESH_UPDATE_SIZE )
+		return;
+
+	MapInfo info;
+	GetMapInfo(field, info);
+
+	for( int mode = HeightFieldMesh::MESH_UNINDEXED; mode <= HeightFieldMesh::MESH_INDEXED; ++mode )
+	{
+		std::string name = "MeshUpdate/" + mapName + "/" + s_aModeNames[mode];
+
+		if( !ShouldRun(options, name) )
+			continue;
+
+		HeightField* pCopy = NewFieldCopy(field);
+		HeightField& copy = *pCopy;
+
+		HeightFieldMesh mesh;
+		mesh.Create(&copy, (HeightFieldMesh::MeshMode)mode);
+
+		std::vector<HeightFieldVertex> vertices(mesh.GetVertexCount());
+		std::vector<HeightFieldMesh::VertexRange> ranges;
+		std::vector<int> highlights(MESH_UPDATE_HIGHLIGHTS, 0);
+
+		mesh.WriteVertices(0, mesh.GetVertexCount(), &vertices[0]);
+		mesh.TakeDirtyRanges(ranges);
+
+		Random random(11);
+
+		// Kept within the heights there are, so a UINT16 map isn't
+		// requantised every frame
+		Result result = RunTimed(options.minTime, [&]( Result& totals )
+		{
+			MeshUpdateFrame(copy, mesh, info, random, info.maxY, highlights, ranges, vertices, totals);
+		});
+
+		// As PrintResult, with hit % out of the whole mesh
+		double verticesPerFrame = (double)result.trianglesTested / (double)result.queries;
+
+		printf("%-56s %12.1f %14.0f %12.1f %8.1f\n", name.c_str(), result.seconds * 1e9 / (double)result.queries, (double)result.queries / result.seconds,
+			verticesPerFrame, 100.0 * verticesPerFrame / (double)mesh.GetVertexCount());
+
+		// Then one frame that goes over the top, which requantises a UINT16 map
+		Result last;
+		memset(&last, 0, sizeof last);
+		MeshUpdateFrame(copy, mesh, info, random, info.maxY + (info.maxY - info.minY) + 1.0f, highlights, ranges, vertices, last);
+
+		std::vector<HeightFieldVertex> rebuilt(mesh.GetVertexCount());
+		mesh.WriteVertices(0, mesh.GetVertexCount(), &rebuilt[0]);
+
+		int differences = 0;
+
+		for( size_t i = 0; i < rebuilt.size(); ++i )
+		{
+			if( memcmp(&rebuilt[i], &vertices[i], sizeof rebuilt[i]) != 0 )
+				++differences;
+		}
+
+		if( differences > 0 )
+		{
+			printf("FAILED: %s left %d of %d vertices different from a full rebuild\n", name.c_str(), differences, (int)rebuilt.size());
+			++g_FailedChecks;
+		}
+
+		fflush(stdout);
+
+		delete pCopy;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Views from anywhere up to a map's width above it, some looking out
+// over the edge, with the far plane half the map away
+//////////////////////////////////////////////////////////////////////
+static void MakeDrawListViews( const MapInfo& info, std::vector<XMMATRIX>& views )
+{
+	float span = std::max(info.maxX - info.minX, info.maxZ - info.minZ);
+	XMMATRIX projection = XMMatrixPerspectiveFovLH(LOD_FOV, 16.0f / 9.0f, 1.0f, span * 0.5f);
+
+	Random random(13);
+
+	views.resize(DRAW_LIST_VIEWS);
+
+	for( int i = 0; i < DRAW_LIST_VIEWS; ++i )
+	{
+		XMVECTOR eye = XMVectorSet(random.Range(info.minX, info.maxX), random.Range(info.maxY, info.maxY + span), random.Range(info.minZ, info.maxZ), 0.0f);
+		XMVECTOR target = XMVectorSet(random.Range(info.minX - span, info.maxX + span), info.minY, random.Range(info.minZ - span, info.maxZ + span), 0.0f);
+
+		views[i] = XMMatrixLookAtLH(eye, target, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) * projection;
+	}
+}
+
+static bool IsInClipVolume( const XMVECTOR& position, const XMMATRIX& viewProjection )
+{
+	XMFLOAT4 clip;
+	XMStoreFloat4(&clip, XMVector3Transform(position, viewProjection));
+
+	return clip.w > 0.0f && fabsf(clip.x) < clip.w && fabsf(clip.y) < clip.w && clip.z > 0.0f && clip.z < clip.w;
+}
+
+// Counts the triangles with a corner inside the view that draws leaves
+// out, and the draws that aren't in order or overlap the one before. The
+// mesh has to be MESH_INDEXED, so an index is a sample.
+static int CountDrawListErrors( const HeightField& field, const std::vector<uint32_t>& indices, const std::vector<HeightFieldMesh::IndexRange>& draws, const XMMATRIX& viewProjection )
+{
+	int errors = 0;
+	int drawEnd = 0;
+
+	std::vector<unsigned char> drawn(indices.size() / 3, 0);
+
+	for( size_t i = 0; i < draws.size(); ++i )
+	{
+		if( draws[i].firstIndex < drawEnd || draws[i].firstIndex + draws[i].indexCount > (int)indices.size() )
+		{
+			++errors;
+			continue;
+		}
+
+		drawEnd = draws[i].firstIndex + draws[i].indexCount;
+		memset(&drawn[draws[i].firstIndex / 3], 1, draws[i].indexCount / 3);
+	}
+
+	for( size_t i = 0; i < drawn.size(); ++i )
+	{
+		if( drawn[i] )
+			continue;
+
+		for( int corner = 0; corner < 3; ++corner )
+		{
+			if( IsInClipVolume(field.GetSample(indices[(i*3) + corner]), viewProjection) )
+			{
+				++errors;
+				break;
+			}
+		}
+	}
+
+	return errors;
+}
+
+static void BenchmarkDrawList( const Options& options, const std::string& mapName, const HeightField& field )
+{
+	std::string name = "DrawList/" + mapName;
+
+	if( !ShouldRun(options, name) )
+		return;
+
+	MapInfo info;
+	GetMapInfo(field, info);
+
+	std::vector<XMMATRIX> views;
+	MakeDrawListViews(info, views);
+
+	HeightFieldMesh mesh;
+	mesh.Create(&field, HeightFieldMesh::MESH_INDEXED);
+
+	// The first build finds every chunk's bounds, which is kept out of the
+	// timings
+	std::vector<HeightFieldMesh::IndexRange> draws;
+	mesh.BuildDrawList(views[0], draws);
+
+	size_t view = 0;
+
+	Result result = RunTimed(options.minTime, [&]( Result& totals )
+	{
+		mesh.BuildDrawList(views[view], draws);
+		view = (view + 1) % views.size();
+
+		for( size_t i = 0; i < draws.size(); ++i )
+			totals.trianglesTested += draws[i].indexCount / 3;
+
+		totals.queries += 1;
+	});
+
+	// As PrintResult, with hit % out of the whole map
+	double trianglesPerBuild = (double)result.trianglesTested / (double)result.queries;
+
+	printf("%-56s %12.1f %14.0f %12.1f %8.1f\n", name.c_str(), result.seconds * 1e9 / (double)result.queries, (double)result.queries / result.seconds,
+		trianglesPerBuild, 100.0 * trianglesPerBuild / (double)field.GetFaceCount());
+	fflush(stdout);
+
+	if( field.GetWidth() > MAX_MESH_UPDATE_SIZE || field.GetLength() > MAX_MESH_UPDATE_SIZE )
+		return;
+
+	// Checked on a copy with a block raised well above the map before each
+	// view, so chunks that were out of view can come into it
+	HeightField* pCopy = NewFieldCopy(field);
+
+	HeightFieldMesh checkMesh;
+	checkMesh.Create(pCopy, HeightFieldMesh::MESH_INDEXED);
+
+	std::vector<uint32_t> indices(checkMesh.GetIndexCount());
+	checkMesh.WriteIndices(&indices[0]);
+
+	Random random(17);
+	int errors = 0;
+	float raise = (info.maxY - info.minY) + (info.maxX - info.minX);
+
+	for( size_t i = 0; i < views.size(); ++i )
+	{
+		float heights[MESH_UPDATE_EDIT_SIZE * MESH_UPDATE_EDIT_SIZE];
+
+		for( int j = 0; j < MESH_UPDATE_EDIT_SIZE * MESH_UPDATE_EDIT_SIZE; ++j )
+			heights[j] = random.Range(info.minY, info.maxY + raise);
+
+		int w = (int)(random.Next() % (uint32_t)pCopy->GetWidth());
+		int l = (int)(random.Next() % (uint32_t)pCopy->GetLength());
+
+		if( pCopy->SetHeights(w, l, MESH_UPDATE_EDIT_SIZE, MESH_UPDATE_EDIT_SIZE, heights) )
+			checkMesh.MarkSamplesDirty(0, 0, pCopy->GetWidth(), pCopy->GetLength());
+		else
+			checkMesh.MarkSamplesDirty(w, l, MESH_UPDATE_EDIT_SIZE, MESH_UPDATE_EDIT_SIZE);
+
+		checkMesh.BuildDrawList(views[i], draws);
+		errors += CountDrawListErrors(*pCopy, indices, draws, views[i]);
+	}
+
+	if( errors > 0 )
+	{
+		printf("FAILED: %s left out or misordered %d triangles or draws over %d views\n", name.c_str(), errors, (int)views.size());
+		fflush(stdout);
+		++g_FailedChecks;
+	}
+
+	delete pCopy;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Spheres dropped from a little above the ground, so they're a mix of
+// falling, landing and rolling by the time they've been timed for a while
+//////////////////////////////////////////////////////////////////////
+static void BenchmarkSphereWorld( const Options& options, const std::string& mapName, const HeightField& field, QueryThreadPool& pool )
+{
+	std::string serialName = "SphereWorld/" + mapName + "/Serial";
+	std::string pooledName = "SphereWorld/" + mapName + "/Pool";
+
+	bool runSerial = ShouldRun(options, serialName);
+	bool runPooled = ShouldRun(options, pooledName);
+
+	if( !runSerial && !runPooled )
+		return;
+
+	MapInfo info;
+	GetMapInfo(field, info);
+
+	float radius = GRID_SIZE * 0.5f;
+
+	for( int pass = 0; pass < 2; ++pass )
+	{
+		bool pooled = pass == 1;
+
+		if( !(pooled ? runPooled : runSerial) )
+			continue;
+
+		SphereWorld world(radius);
+		world.SetHeightField(&field);
+
+		Random random(7);
+
+		for( int i = 0; i < SPHERE_WORLD_BODIES; ++i )
+		{
+			XMFLOAT3 pos(random.Range(info.minX, info.maxX), 0.0f, random.Range(info.minZ, info.maxZ));
+			XMFLOAT3 vel(random.Range(-1.0f, 1.0f), 0.0f, random.Range(-1.0f, 1.0f));
+
+			float ground = 0.0f;
+			field.GetHeightAt(pos.x, pos.z, ground);
+			pos.y = ground + radius + random.Range(0.0f, radius * 4.0f);
+
+			world.AddBody(pos, vel);
+		}
+
+		Result result = RunTimed(options.minTime, [&]( Result& totals )
+		{
+			totals.hits += pooled ? world.Step(SPHERE_WORLD_TICK, pool) : world.Step(SPHERE_WORLD_TICK);
+			totals.queries += world.GetBodyCount();
+		});
+
+		PrintResult(pooled ? pooledName : serialName, result);
+	}
+}
+
+static void BenchmarkMap( const Options& options, const std::string& mapName, HeightField& field, QueryThreadPool& pool )
+{
+	field.SetHeightLayout(options.layout);
+
+	const HeightField::QuadTreeStats& treeStats = field.GetQuadTreeStats();
+
+	printf("\n%s: %dx%d samples / %.1f MB, %d triangles, quadtree %d levels / %.1f MB built in %.1f ms, %s kernel\n",
+		mapName.c_str(), field.GetWidth(), field.GetLength(), field.GetSampleMemoryBytes() / (1024.0 * 1024.0), field.GetFaceCount(),
+		treeStats.levels, treeStats.memoryBytes / (1024.0 * 1024.0), treeStats.buildTimeMs,
+		GetRayTrianglePacketKernelName());
+
+	printf("Samples %s, %s\n",
+		field.GetHeightStorage() == HeightField::HEIGHT_STORAGE_UINT16 ? "uint16" : "float4",
+		field.GetHeightLayout() == HeightField::HEIGHT_LAYOUT_TILED ? "tiled" : "row by row");
+
+	PrintHeader();
+
+	bool allowBruteForce = field.GetWidth() <= MAX_BRUTE_FORCE_SIZE && field.GetLength() <= MAX_BRUTE_FORCE_SIZE;
+
+	BenchmarkRayCollision(options, mapName, field, allowBruteForce);
+	BenchmarkRayBatch(options, mapName, field, pool);
+	BenchmarkGroundQueries(options, mapName, field);
+	BenchmarkSphereCollision(options, mapName, field, field.GetWidth() <= MAX_SPHERE_BRUTE_FORCE_SIZE && field.GetLength() <= MAX_SPHERE_BRUTE_FORCE_SIZE);
+	BenchmarkTriangleTests(options, mapName, field);
+	BenchmarkTerrainLod(options, mapName, field);
+	BenchmarkMeshUpdate(options, mapName, field);
+	BenchmarkDrawList(options, mapName, field);
+	BenchmarkSphereWorld(options, mapName, field, pool);
+}
+
+//////////////////////////////////////////////////////////////////////
+// A paged world, with the tiles loaded as the queries reach them
+//////////////////////////////////////////////////////////////////////
+
+static void PrintPagingStats( const PagedHeightField& world )
+{
+	const PagedHeightField::PagingStats& stats = world.GetPagingStats();
+
+	printf("  %lld tiles loaded in %.1f ms, %lld evicted, %d loaded / %.1f MB at the end\n",
+		stats.tilesLoaded, stats.loadTimeMs, stats.tilesEvicted, world.GetLoadedTileCount(), world.GetLoadedBytes() / (1024.0 * 1024.0));
+}
+
+static void BenchmarkPagedWorld( const Options& options )
+{
+	PagedHeightField world(options.pPagedWorldFile, options.memoryBudget);
+
+	if( !world.IsOpen() )
+	{
+		printf("\nCouldn't open %s, skipping it\n", options.pPagedWorldFile);
+		return;
+	}
+
+	printf("\npaged: %dx%d samples in %dx%d tiles of %d, %.1f MB budget\n",
+		world.GetWidth(), world.GetLength(), world.GetTilesAcross(), world.GetTilesDown(), world.GetTileSamples(),
+		world.GetMemoryBudget() / (1024.0 * 1024.0));
+
+	PrintHeader();
+
+	// The heights aren't known without loading every tile, so drops start well above anything
+	static const float DROP_HEIGHT = 1000.0f;
+
+	MapInfo info;
+	info.maxX = ((world.GetWidth()-1) / 2.0f) * world.GetGridSize();
+	info.maxZ = ((world.GetLength()-1) / 2.0f) * world.GetGridSize();
+	info.minX = -info.maxX;
+	info.minZ = -info.maxZ;
+	info.minY = -DROP_HEIGHT;
+	info.maxY = DROP_HEIGHT;
+
+	for( int distribution = 0; distribution < NUM_GROUND_DISTRIBUTIONS; ++distribution )
+	{
+		std::string name = std::string("PagedGround/paged/") + g_aGroundDistributionNames[distribution] + "/GetGroundAt";
+
+		if( !ShouldRun(options, name) )
+			continue;
+
+		std::vector<float> x, z;
+		MakeGroundPoints(info, (GroundDistribution)distribution, x, z);
+
+		world.ResetPagingStats();
+
+		Result result = RunTimed(options.minTime, [&]( Result& totals )
+		{
+			for( int i = 0; i < QUERY_COUNT; ++i )
+			{
+				float height;
+				XMFLOAT3 normal;
+
+				if( world.GetGroundAt(x[i], z[i], height, normal) == PagedHeightField::QUERY_HIT )
+					++totals.hits;
+			}
+
+			totals.queries += QUERY_COUNT;
+			totals.trianglesTested += QUERY_COUNT;
+		});
+
+		PrintResult(name, result);
+		PrintPagingStats(world);
+	}
+
+	std::string dropName = "PagedRayCollision/paged/Drop";
+
+	if( ShouldRun(options, dropName) )
+	{
+		std::vector<float> x, z;
+		MakeGroundPoints(info, GROUND_RANDOM, x, z);
+
+		world.ResetPagingStats();
+
+		Result result = RunTimed(options.minTime, [&]( Result& totals )
+		{
+			for( int i = 0; i < QUERY_COUNT; ++i )
+			{
+				HeightField::RayHit hit;
+
+				if( world.RayCollision(XMVectorSet(x[i], info.maxY, z[i], 0.0f), XMVectorSet(0.0f, -1.0f, 0.0f, 0.0f), info.maxY - info.minY, hit) == PagedHeightField::QUERY_HIT )
+					++totals.hits;
+			}
+
+			totals.queries += QUERY_COUNT;
+		});
+
+		PrintResult(dropName, result);
+		PrintPagingStats(world);
+	}
+}
+
+static bool ParseOptions( int argc, char** argv, Options& options )
+{
+	options.pHeightMapFile = COLLISION_RESOURCE_DIR "/heightmap.bmp";
+	options.maxSize = SYNTHETIC_SIZES[NUM_SYNTHETIC_SIZES-1];
+	options.minTime = 0.5;
+	options.pFilter = NULL;
+	options.threadCount = 0;
+	options.storage = HeightField::HEIGHT_STORAGE_FLOAT4;
+	options.layout = HeightField::HEIGHT_LAYOUT_ROW_MAJOR;
+	options.pPagedWorldFile = NULL;
+	options.memoryBudget = PagedHeightField::DEFAULT_MEMORY_BUDGET;
+
+	for( int i = 1; i < argc; ++i )
+	{
+		bool hasValue = i+1 < argc;
+
+		if( strcmp(argv[i], "--heightmap") == 0 && hasValue )
+			options.pHeightMapFile = argv[++i];
+		else if( strcmp(argv[i], "--max-size") == 0 && hasValue )
+			options.maxSize = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--min-time") == 0 && hasValue )
+			options.minTime = atof(argv[++i]);
+		else if( strcmp(argv[i], "--filter") == 0 && hasValue )
+			options.pFilter = argv[++i];
+		else if( strcmp(argv[i], "--threads") == 0 && hasValue )
+			options.threadCount = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--paged") == 0 && hasValue )
+			options.pPagedWorldFile = argv[++i];
+		else if( strcmp(argv[i], "--budget") == 0 && hasValue )
+			options.memoryBudget = (size_t)(atof(argv[++i]) * 1024.0 * 1024.0);
+		else if( strcmp(argv[i], "--storage") == 0 && hasValue && ParseHeightStorage(argv[i+1], options.storage) )
+			++i;
+		else if( strcmp(argv[i], "--layout") == 0 && hasValue && ParseHeightLayout(argv[i+1], options.layout) )
+			++i;
+		else
+		{
+			printf("Usage: %s [--heightmap file.bmp|file.hfd] [--max-size n] [--min-time seconds] [--filter text] [--threads n] [--storage float4|uint16] [--layout rows|tiled] [--paged world.hfw] [--budget megabytes]\n", argv[0]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main( int argc, char** argv )
+{
+	Options options;
+
+	if( !ParseOptions(argc, argv, options) )
+		return 1;
+
+	// --threads 0, the default, means one per hardware thread
+	QueryThreadPool pool(options.threadCount);
+
+	{
+		bool binary = IsBinaryHeightFieldFile(options.pHeightMapFile);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		HeightField* pField = binary ? new HeightField(options.pHeightMapFile) : new HeightField(options.pHeightMapFile, GRID_SIZE, HEIGHT_RANGE, options.storage);
+		double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if( pField->IsLoaded() )
+		{
+			Options mapOptions = options;
+
+			if( binary )
+				mapOptions.layout = pField->GetHeightLayout();
+
+			printf("Loaded %s in %.3f ms\n", options.pHeightMapFile, loadSeconds * 1000.0);
+			BenchmarkMap(mapOptions, binary ? "heightmap.hfd" : "heightmap.bmp", *pField, pool);
+		}
+		else
+			printf("Couldn't load %s, skipping it\n", options.pHeightMapFile);
+
+		delete pField;
+	}
+
+	if( options.pPagedWorldFile )
+		BenchmarkPagedWorld(options);
+
+	for( size_t i = 0; i < NUM_SYNTHETIC_SIZES; ++i )
+	{
+		int size = SYNTHETIC_SIZES[i];
+
+		if( size > options.maxSize )
+			break;
+
+		char mapName[32];
+		snprintf(mapName, sizeof mapName, "synthetic%d", size);
+
+		// The largest maps need more memory than a 32 bit build can always find
+		try
+		{
+			std::vector<float> heights;
+			MakeSyntheticHeights(size, heights);
+
+			HeightField field(size, size, GRID_SIZE, &heights[0], options.storage);
+
+			BenchmarkMap(options, mapName, field, pool);
+		}
+		catch( const std::bad_alloc& )
+		{
+			printf("\nNot enough memory for %s, skipping it\n", mapName);
+		}
+	}
+
+	if( g_FailedChecks > 0 )
+	{
+		printf("\n%d checks FAILED\n", g_FailedChecks);
+		return 1;
+	}
+
+	return 0;
+}
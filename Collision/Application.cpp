@@ -1,5 +1,8 @@
 #include "Application.h"
 #include "HeightMap.h"
+#include "SphereWorld.h"
+
+#include <algorithm>
 
 Application* Application::s_pApp = NULL;
 
@@ -7,6 +10,29 @@ const int CAMERA_TOP = 0;
 const int CAMERA_ROTATE = 1;
 const int CAMERA_MAX = 2;
 
+const char* const HEIGHTMAP_FILE = "Resources/heightmap.bmp";
+const float HEIGHTMAP_GRID_SIZE = 2.0f;
+const float HEIGHTMAP_HEIGHT_RANGE = 0.75f;
+
+const float SPHERE_RADIUS = 1.0f;
+
+// Updates a second. Frames are still drawn at 60 a second, with the
+// spheres in between where the last two updates left them.
+const int TICK_RATE = 120;
+
+// The speeds the single sphere used to have per 60th of a second: 0.2 up
+// when dropped, and 0.05 a frame faster down every frame
+const float SPHERE_DROP_SPEED = 0.2f * 60.0f;
+const float SPHERE_GRAVITY = -0.05f * 60.0f * 60.0f;
+const float SPHERE_DROP_HEIGHT = 20.0f;
+
+// How many M drops at once, and how far from the middle they can land
+const int SPHERE_SHOWER_COUNT = 1000;
+const int SPHERE_SHOWER_SIZE = 14;
+
+// Where F6, and quitting, save the session for SimulationRunner --replay
+const char* const RECORDING_FILE = "session.simrec";
+
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -18,16 +44,37 @@ bool Application::HandleStart()
 	m_frameCount = 0.0f;
 
 	m_bWireframe = true;
-	m_pHeightMap = new HeightMap( "Resources/heightmap.bmp", 2.0f, 0.75f );
+	m_pHeightFieldLoader = new HeightFieldLoader;
+	m_pHeightMap = new HeightMap( HEIGHTMAP_FILE, HEIGHTMAP_GRID_SIZE, HEIGHTMAP_HEIGHT_RANGE, m_pHeightFieldLoader );
+	m_pHeightMap->SetHighlightHits( true );
 
-	m_pSphereMesh = CommonMesh::NewSphereMesh(this, 1.0f, 16, 16);
-	mSpherePos = XMFLOAT3( -14.0, 20.0f, -14.0f );
-	mSphereVel = XMFLOAT3(0.0f, 0.0f, 0.0f);
-	mGravityAcc = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	m_pSphereMesh = CommonMesh::NewSphereMesh(this, SPHERE_RADIUS, 16, 16);
+	m_pSphereWorld = new SphereWorld(SPHERE_RADIUS);
+	m_pSphereInstanceBuffer = NULL;
+	m_SphereInstanceCapacity = 0;
 
 	m_cameraZ = 50.0f;
 	m_rotationAngle = 0.f;
 
+	this->SetTickRate(TICK_RATE);
+
+	// Everything the spheres do from here on is recorded
+	SimulationRecording::Settings settings;
+	settings.tickRate = TICK_RATE;
+	settings.radius = SPHERE_RADIUS;
+	settings.gravity = SPHERE_GRAVITY;
+	settings.restitution = 0.0f;			// SphereWorld's own
+	settings.rollingResistance = 0.5f;
+	settings.dropHeight = SPHERE_DROP_HEIGHT;
+	settings.dropSpeed = SPHERE_DROP_SPEED;
+	settings.showerSize = SPHERE_SHOWER_SIZE;
+	settings.gridSize = HEIGHTMAP_GRID_SIZE;
+	settings.heightRange = HEIGHTMAP_HEIGHT_RANGE;
+
+	m_pRecording = new SimulationRecording;
+	m_pRecording->Reset(settings, HEIGHTMAP_FILE);
+	m_pRecording->SetupWorld(*m_pSphereWorld);
+
 	m_reload = false;
 
 	ReloadShaders();
@@ -39,10 +86,6 @@ bool Application::HandleStart()
 
 	m_cameraState = CAMERA_ROTATE;
 
-	mSphereCollided = false;
-
-
-
 	return true;
 }
 
@@ -52,10 +95,18 @@ bool Application::HandleStart()
 void Application::HandleStop()
 {
 	delete m_pHeightMap;
+	delete m_pHeightFieldLoader;
 
 	if( m_pSphereMesh )
 		delete m_pSphereMesh;
 
+	Release(m_pSphereInstanceBuffer);
+
+	SaveRecording();
+
+	delete m_pRecording;
+	delete m_pSphereWorld;
+
 	this->CommonApp::HandleStop();
 }
 
@@ -69,24 +120,27 @@ void Application::ReloadShaders()
 	if( m_pHeightMap->ReloadShader() == false )
 		this->SetWindowTitle("Reload Failed - see Visual Studio output window. Press F5 to try again.");
 	else
-		this->SetWindowTitle("Collision: Zoom / Rotate Q, A / O, P, Camera C, Drop Sphere R, N and T, Wire W");
+		this->SetWindowTitle("Collision: Zoom / Rotate Q, A / O, P, Camera C, Drop Sphere R, N and T, Shower M, Wire W, Indexed I, LOD L, Save Replay F6");
 }
 
 void Application::HandleUpdate()
 {
+	// The camera moves as far a second as it used to at 60 updates a second
+	float cameraStep = this->GetTickSeconds() * 60.0f;
+
 	if( m_cameraState == CAMERA_ROTATE )
 	{
 		if (this->IsKeyPressed('Q') && m_cameraZ > 38.0f )
-			m_cameraZ -= 1.0f;
+			m_cameraZ -= 1.0f * cameraStep;
 		
 		if (this->IsKeyPressed('A'))
-			m_cameraZ += 1.0f;
+			m_cameraZ += 1.0f * cameraStep;
 
 		if (this->IsKeyPressed('O'))
-			m_rotationAngle -= .01f;
+			m_rotationAngle -= .01f * cameraStep;
 		
 		if (this->IsKeyPressed('P'))
-			m_rotationAngle += .01f;
+			m_rotationAngle += .01f * cameraStep;
 	}
 
 	
@@ -124,6 +178,37 @@ void Application::HandleUpdate()
 	}
 
 
+	static bool dbI = false;
+	if (this->IsKeyPressed('I') )	
+	{
+		if( !dbI )
+		{
+			bool indexed = m_pHeightMap->GetMeshMode() == HeightFieldMesh::MESH_INDEXED;
+			m_pHeightMap->SetMeshMode( indexed ? HeightFieldMesh::MESH_UNINDEXED : HeightFieldMesh::MESH_INDEXED );
+			dbI = true;
+		}
+	}
+	else
+	{
+		dbI = false;
+	}
+
+
+	static bool dbL = false;
+	if (this->IsKeyPressed('L') )	
+	{
+		if( !dbL )
+		{
+			m_pHeightMap->SetLod( !m_pHeightMap->GetLodEnabled() );
+			dbL = true;
+		}
+	}
+	else
+	{
+		dbL = false;
+	}
+
+
 	if (this->IsKeyPressed(VK_F5))
 	{
 		if (!m_reload)
@@ -135,17 +220,26 @@ void Application::HandleUpdate()
 	else
 		m_reload = false;
 
+	static bool dbF6 = false;
+	if (this->IsKeyPressed(VK_F6))
+	{
+		if (!dbF6)
+		{
+			SaveRecording();
+			dbF6 = true;
+		}
+	}
+	else
+	{
+		dbF6 = false;
+	}
+
 	static bool dbR = false;
 	if (this->IsKeyPressed('R') )
 	{
 		if( dbR == false )
 		{
-			static int dx = 0;
-			static int dy = 0;
-			mSpherePos = XMFLOAT3((float)((rand() % 14 - 7.0f) - 0.5), 20.0f, (float)((rand() % 14 - 7.0f) - 0.5));
-			mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
-			mGravityAcc = XMFLOAT3(0.0f, -0.05f, 0.0f);
-			mSphereCollided = false;
+			DropSphere((float)((rand() % 14 - 7.0f) - 0.5), (float)((rand() % 14 - 7.0f) - 0.5));
 			dbR = true;
 		}
 	}
@@ -154,17 +248,13 @@ void Application::HandleUpdate()
 		dbR = false;
 	}
 
+	// Drops every sphere again from where it is
 	static bool dbT = false;
 	if (this->IsKeyPressed('T'))
 	{
 		if (dbT == false)
 		{
-			static int dx = 0;
-			static int dy = 0;
-			mSpherePos = XMFLOAT3(mSpherePos.x, 20.0f, mSpherePos.z);
-			mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
-			mGravityAcc = XMFLOAT3(0.0f, -0.05f, 0.0f);
-			mSphereCollided = false;
+			RunEvent(SimulationRecording::MakeDropAgain());
 			dbT = true;
 		}
 	}
@@ -193,13 +283,10 @@ void Application::HandleUpdate()
 			}
 
 			if( seg == 0 )
-				mSpherePos = XMFLOAT3(((dx - 7.0f) * 2) - 0.5f, 20.0f, ((dy - 7.0f) * 2) - 0.5f);
+				DropSphere(((dx - 7.0f) * 2) - 0.5f, ((dy - 7.0f) * 2) - 0.5f);
 			else
-				mSpherePos = XMFLOAT3(((dx - 7.0f) * 2) + 0.5f, 20.0f, ((dy - 7.0f) * 2) + 0.5f);
+				DropSphere(((dx - 7.0f) * 2) + 0.5f, ((dy - 7.0f) * 2) + 0.5f);
 
-			mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
-			mGravityAcc = XMFLOAT3(0.0f, -0.05f, 0.0f);
-			mSphereCollided = false;
 			dbN = true;
 		}
 	}
@@ -208,33 +295,96 @@ void Application::HandleUpdate()
 		dbN = false;
 	}
 
-	// Update Sphere
-	XMVECTOR vSColPos, vSColNorm;
-	
-	if( !mSphereCollided )
+	static bool dbM = false;
+	if (this->IsKeyPressed('M') )
 	{
-		XMVECTOR vSPos = XMLoadFloat3(&mSpherePos);
-		XMVECTOR vSVel = XMLoadFloat3(&mSphereVel);
-		XMVECTOR vSAcc = XMLoadFloat3(&mGravityAcc);
+		if( dbM == false )
+		{
+			// rand() can be as little as 15 bits
+			uint32_t seed = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
 
-		vSPos += vSVel; // Really important that we add LAST FRAME'S velocity as this was how fast the collision is expecting the ball to move
-		vSVel += vSAcc; // The new velocity gets passed through to the collision so it can base its predictions on our speed NEXT FRAME
-		
+			RunEvent(SimulationRecording::MakeShower(seed, SPHERE_SHOWER_COUNT));
+			dbM = true;
+		}
+	}
+	else
+	{
+		dbM = false;
+	}
 
-		XMStoreFloat3(&mSphereVel, vSVel);
-		XMStoreFloat3(&mSpherePos, vSPos);
-	
-		mSphereSpeed = XMVectorGetX(XMVector3Length(vSVel));
+	// Update Spheres, once the ground has loaded
+	if( m_pHeightMap->IsReady() )
+	{
+		m_pHeightMap->StepSpheres(*m_pSphereWorld, this->GetTickSeconds());
+		m_pRecording->EndTick();
+	}
 
-		mSphereCollided = m_pHeightMap->RayCollision(vSPos, vSVel, mSphereSpeed, vSColPos, vSColNorm);
+}
+
+void Application::DropSphere( float x, float z )
+{
+	RunEvent(SimulationRecording::MakeDrop(x, z));
+}
+
+void Application::RunEvent( const SimulationRecording::Event& event )
+{
+	m_pRecording->AddEvent(event);
+	m_pRecording->Apply(event, *m_pSphereWorld);
+}
 
-		if( mSphereCollided )
+void Application::SaveRecording()
+{
+	m_pRecording->SetFinalChecksum(m_pSphereWorld->GetStateChecksum());
+
+	if( !m_pRecording->Save(RECORDING_FILE) )
+		dprintf("Couldn't save the session recording to %s\n", RECORDING_FILE);
+}
+
+//////////////////////////////////////////////////////////////////////
+// UploadSphereInstances
+// Once a frame, for both DrawSpheres. The buffer is DYNAMIC and
+// recreated half as big again whenever the spheres outgrow it, as
+// HeightMap's LOD indices are.
+//////////////////////////////////////////////////////////////////////
+void Application::UploadSphereInstances()
+{
+	int count = m_pSphereWorld->GetBodyCount();
+
+	if( count == 0 )
+		return;
+
+	if( count > m_SphereInstanceCapacity )
+	{
+		Release(m_pSphereInstanceBuffer);
+
+		m_SphereInstanceCapacity = count + (count / 2);
+		m_pSphereInstanceBuffer = CreateBuffer(this->GetDevice(), sizeof(XMFLOAT4) * m_SphereInstanceCapacity, D3D11_USAGE_DYNAMIC, D3D11_BIND_VERTEX_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
+
+		if( !m_pSphereInstanceBuffer )
 		{
-			mSphereVel = XMFLOAT3(0.0f, 0.0f, 0.0f);
-			XMStoreFloat3(&mSpherePos, vSColPos);
+			m_SphereInstanceCapacity = 0;
+			return;
 		}
 	}
 
+	D3D11_MAPPED_SUBRESOURCE map;
+	if( SUCCEEDED(this->GetDeviceContext()->Map(m_pSphereInstanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map)) )
+	{
+		m_pSphereWorld->WriteInstances(0, count, static_cast<XMFLOAT4*>(map.pData), this->GetTickFraction());
+		this->GetDeviceContext()->Unmap(m_pSphereInstanceBuffer, 0);
+	}
+}
+
+// Every sphere in one draw, each the mesh moved to its instance's position
+void Application::DrawSpheres()
+{
+	int count = std::min(m_pSphereWorld->GetBodyCount(), m_SphereInstanceCapacity);
+
+	if( !m_pSphereMesh || count == 0 )
+		return;
+
+	this->SetWorldMatrix(XMMatrixIdentity());
+	m_pSphereMesh->DrawInstanced(m_pSphereInstanceBuffer, sizeof(XMFLOAT4), (unsigned)count, this->GetUntexturedLitInstancedShader());
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -246,6 +396,10 @@ void Application::HandleRender()
 	XMVECTOR vUpVector = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 	XMMATRIX matProj, matView;
 
+	// For the heightmap's LOD, how many pixels a unit covers a unit away
+	float windowWidth, windowHeight, pixelsPerUnit;
+	this->GetWindowSize(&windowWidth, &windowHeight);
+
 	switch( m_cameraState )
 	{
 		case CAMERA_TOP:
@@ -253,12 +407,15 @@ void Application::HandleRender()
 			vLookat = XMVectorSet(0.0f, 0.0f, 0.0f, 0.0f);
 			matView = XMMatrixLookAtLH(vCamera, vLookat, vUpVector);
 			matProj = XMMatrixOrthographicLH(64, 36, 1.5f, 5000.0f);
+			// Orthographic, so as if everything were as far away as the ground
+			pixelsPerUnit = (windowHeight / 36.0f) * 100.0f;
 			break;
 		case CAMERA_ROTATE:
 			vCamera = XMVectorSet(sin(m_rotationAngle)*m_cameraZ, (m_cameraZ*m_cameraZ) / 50, cos(m_rotationAngle)*m_cameraZ, 0.0f);
 			vLookat = XMVectorSet(0.0f, 10.0f, 0.0f, 0.0f);
 			matView = XMMatrixLookAtLH(vCamera, vLookat, vUpVector);
 			matProj = XMMatrixPerspectiveFovLH(kMath_PI / 7.f, 2, 1.5f, 5000.0f);
+			pixelsPerUnit = windowHeight / (2.0f * tanf(kMath_PI / 14.f));
 			break;
 	}
 
@@ -270,22 +427,16 @@ void Application::HandleRender()
 
 	this->Clear(XMFLOAT4(0.05f, 0.05f, 0.5f, 1.f));
 
-	XMMATRIX worldMtx;
+	UploadSphereInstances();
 
-	worldMtx = XMMatrixTranslation(mSpherePos.x, mSpherePos.y, mSpherePos.z);
-	
-	this->SetWorldMatrix(worldMtx);
 	SetDepthStencilState( false, false );
-	if( m_pSphereMesh )
-		m_pSphereMesh->Draw();
+	DrawSpheres();
 
 	SetDepthStencilState( false, true );
-	m_pHeightMap->Draw( m_frameCount );
+	m_pHeightMap->Draw( m_frameCount, matView * matProj, vCamera, pixelsPerUnit );
 
-	this->SetWorldMatrix(worldMtx);
 	SetDepthStencilState( true, true );
-	if( m_pSphereMesh )
-		m_pSphereMesh->Draw();
+	DrawSpheres();
 
 	m_frameCount++;
 }
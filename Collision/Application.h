@@ -11,8 +11,11 @@
 
 #include "CommonApp.h"
 #include "CommonMesh.h"
+#include "SimulationRecording.h"
 
 class HeightMap;
+class HeightFieldLoader;
+class SphereWorld;
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -49,15 +52,20 @@ private:
 	int m_cameraState;
 
 	HeightMap* m_pHeightMap;
+	HeightFieldLoader* m_pHeightFieldLoader;	// Loads the heightmap while the window starts up
 
 	CommonMesh *m_pSphereMesh;
-	XMFLOAT3 mSpherePos;
-	XMFLOAT3 mSphereVel;
-	float mSphereSpeed;
-	bool mSphereCollided;
-	XMFLOAT3 mGravityAcc;
+	SphereWorld* m_pSphereWorld;			// Every sphere dropped so far
+	ID3D11Buffer* m_pSphereInstanceBuffer;	// Where each sphere is this frame, from WriteInstances
+	int m_SphereInstanceCapacity;
+	SimulationRecording* m_pRecording;		// Every drop so far, and when, for replaying
 
 	void ReloadShaders();
+	void DropSphere( float x, float z );
+	void RunEvent( const SimulationRecording::Event& event );
+	void SaveRecording( void );
+	void UploadSphereInstances();
+	void DrawSpheres();
 };
 
 #endif
\ No newline at end of file
@@ -1,20 +1,48 @@
 #include "HeightMap.h"
+#include "SphereWorld.h"
+
+// The mesh's vertices are uploaded as they are
+static_assert(sizeof(HeightFieldVertex) == sizeof(Vertex_Pos3fColour4ubNormal3fTex2f), "HeightFieldVertex doesn't match the vertex layout");
+
+// Vertices written and uploaded at a time, so a whole map goes up through
+// a small buffer. Whole cells, for MESH_UNINDEXED.
+static const int UPLOAD_CHUNK_VERTICES = 4096 * HeightFieldMesh::VERTICES_PER_CELL;
+
+// Dirty runs closer than this many cells or samples are uploaded as one
+static const int UPLOAD_MERGE_GAP_ELEMENTS = 16;
+
+const float HeightMap::DEFAULT_LOD_PIXEL_ERROR = 2.0f;
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-HeightMap::HeightMap( char* filename, float gridSize, float heightRange )
+HeightMap::HeightMap( const char* filename, float gridSize, float heightRange, HeightFieldLoader* pLoader )
 {
-	LoadHeightMap(filename, gridSize, heightRange);
+	m_pHeightField = NULL;
+	m_pLoader = pLoader;
+	m_pLoadRequest = NULL;
+
+	m_HeightMapWidth = 0;
+	m_HeightMapLength = 0;
 
 	m_pHeightMapBuffer = NULL;
+	m_pHeightMapIndexBuffer = NULL;
+	m_MeshMode = HeightFieldMesh::MESH_UNINDEXED;
+
+	m_LodEnabled = false;
+	m_LodMaxPixelError = DEFAULT_LOD_PIXEL_ERROR;
+	m_pLodIndexBuffer = NULL;
+	m_LodIndexCapacity = 0;
 
 	m_pPSCBuffer = NULL;
 	m_pVSCBuffer = NULL;
 
-	m_HeightMapFaceCount = (m_HeightMapLength-1)*(m_HeightMapWidth-1)*2;
+	m_HeightMapFaceCount = 0;
 
-	m_HeightMapVtxCount = m_HeightMapFaceCount*3;
+	m_HighlightHits = false;
+	m_HighlightsPending = false;
+
+	m_HeightMapVtxCount = 0;
 		
 	for (size_t i = 0; i < NUM_TEXTURE_FILES; ++i)
 	{
@@ -24,9 +52,15 @@ HeightMap::HeightMap( char* filename, float gridSize, float heightRange )
 
 	m_pSamplerState = NULL;
 
-	m_pHeightMapBuffer = CreateDynamicVertexBuffer(Application::s_pApp->GetDevice(), sizeof Vertex_Pos3fColour4ubNormal3fTex2f * m_HeightMapVtxCount, 0 );
-	
-	RebuildVertexData();
+	if( m_pLoader )
+	{
+		m_pLoadRequest = m_pLoader->Load(filename, gridSize, heightRange);
+	}
+	else
+	{
+		m_pHeightField = new HeightField( filename, gridSize, heightRange );
+		CreateVertexData();
+	}
 
 	for (size_t i = 0; i < NUM_TEXTURE_FILES; ++i)
 	{
@@ -38,95 +72,124 @@ HeightMap::HeightMap( char* filename, float gridSize, float heightRange )
 }
 
 
-void HeightMap::RebuildVertexData( void )
+//////////////////////////////////////////////////////////////////////
+// IsReady
+// Picks up the field once the loader has finished with it. Cheap enough
+// to call before everything that needs the field.
+//////////////////////////////////////////////////////////////////////
+bool HeightMap::IsReady()
 {
-	D3D11_MAPPED_SUBRESOURCE map;
-	
-	if (SUCCEEDED(Application::s_pApp->GetDeviceContext()->Map(m_pHeightMapBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map)))
+	if( m_pLoadRequest && m_pLoadRequest->IsReady() )
+	{
+		m_pHeightField = m_pLoadRequest->TakeHeightField();
+		m_pLoader->Release(m_pLoadRequest);
+		m_pLoadRequest = NULL;
+
+		if( m_pHeightField )
+			CreateVertexData();
+	}
+
+	return m_pHeightField != NULL;
+}
+
+// Sizes everything else to the field and fills the vertex buffer. It's a
+// DEFAULT buffer, as only the vertices that change are written after this.
+// The index buffer, which puts the cells in chunks, never changes.
+void HeightMap::CreateVertexData( void )
+{
+	m_HeightMapWidth = m_pHeightField->GetWidth();
+	m_HeightMapLength = m_pHeightField->GetLength();
+	m_HeightMapFaceCount = m_pHeightField->GetFaceCount();
+
+	m_Mesh.Create(m_pHeightField, m_MeshMode);
+
+	m_HeightMapVtxCount = m_Mesh.GetVertexCount();
+
+	m_pHeightMapBuffer = CreateBuffer(Application::s_pApp->GetDevice(), sizeof Vertex_Pos3fColour4ubNormal3fTex2f * m_HeightMapVtxCount, D3D11_USAGE_DEFAULT, D3D11_BIND_VERTEX_BUFFER, 0, NULL);
+
+	if( m_Mesh.GetIndexCount() > 0 )
 	{
-		Vertex_Pos3fColour4ubNormal3fTex2f* pMapVtxs = (Vertex_Pos3fColour4ubNormal3fTex2f*)map.pData;
+		uint32_t* pIndices = new uint32_t[m_Mesh.GetIndexCount()];
+		m_Mesh.WriteIndices(pIndices);
+
+		m_pHeightMapIndexBuffer = CreateImmutableIndexBuffer(Application::s_pApp->GetDevice(), sizeof(uint32_t) * m_Mesh.GetIndexCount(), pIndices);
 
-		int vtxIndex = 0;
-		int mapIndex = 0;
+		delete [] pIndices;
+	}
+
+	UploadDirtyVertices();
+}
 
-		XMVECTOR v0, v1, v2, v3;
-		float tX0, tY0, tX1, tY1, tX2, tY2, tX3, tY3;
-		int i0, i1, i2, i3;
+//////////////////////////////////////////////////////////////////////
+// UploadDirtyVertices
+// Regenerates the vertices changed since the last upload and copies just
+// those parts of the vertex buffer with UpdateSubresource.
+//////////////////////////////////////////////////////////////////////
+void HeightMap::UploadDirtyVertices( void )
+{
+	if( !m_pHeightMapBuffer || !m_Mesh.IsDirty() )
+		return;
 
-		VertexColour c0, c1, c2, c3;
+	m_Mesh.TakeDirtyRanges(m_DirtyRanges, UPLOAD_MERGE_GAP_ELEMENTS * m_Mesh.GetVerticesPerElement());
 
-		static VertexColour STANDARD_COLOUR(255, 255, 255, 255);
-		static VertexColour COLLISION_COLOUR(255, 0, 0, 255);
+	ID3D11DeviceContext* pContext = Application::s_pApp->GetDeviceContext();
+	const UINT vertexBytes = sizeof(HeightFieldVertex);
 
-		// This is the unstripped method, I wouldn't recommend changing this to the stripped method for the collision assignment
-		for( int l = 0; l < m_HeightMapLength; ++l )
+	for( size_t i = 0; i < m_DirtyRanges.size(); ++i )
+	{
+		int rangeEnd = m_DirtyRanges[i].firstVertex + m_DirtyRanges[i].vertexCount;
+
+		for( int firstVertex = m_DirtyRanges[i].firstVertex; firstVertex < rangeEnd; firstVertex += UPLOAD_CHUNK_VERTICES )
 		{
-			for( int w = 0; w < m_HeightMapWidth; ++w )
-			{	
-				if( w < m_HeightMapWidth-1 && l < m_HeightMapLength-1 )
-				{
-					i0 = mapIndex;
-					i1 = mapIndex + m_HeightMapWidth;
-					i2 = mapIndex + 1;
-					i3 = mapIndex + m_HeightMapWidth + 1;
-
-					v0 = XMLoadFloat4(&m_pHeightMap[i0]);
-					v1 = XMLoadFloat4(&m_pHeightMap[i1]);
-					v2 = XMLoadFloat4(&m_pHeightMap[i2]);
-					v3 = XMLoadFloat4(&m_pHeightMap[i3]);
-
-					XMVECTOR vA = v0 - v1;
-					XMVECTOR vB = v1 - v2;
-					XMVECTOR vC = v3 - v1;
-			
-					XMVECTOR vN1, vN2;
-					vN1 = XMVector3Cross(vA, vB);
-					vN1 = XMVector3Normalize(vN1);
-
-					vN2 = XMVector3Cross(vB, vC);
-					vN2 = XMVector3Normalize(vN2);
-
-					VertexColour CUBE_COLOUR;
-
-					tX0 = 0.0f;
-					tY0 = 0.0f;
-					tX1 = 0.0f;
-					tY1 = 1.0f;
-					tX2 = 1.0f;
-					tY2 = 0.0f;
-					tX3 = 1.0f;
-					tY3 = 1.0f;
-
-					// We use w for collision flag
-					c0 = (m_pHeightMap[i0].w&&m_pHeightMap[i1].w&&m_pHeightMap[i2].w)?COLLISION_COLOUR:STANDARD_COLOUR;
-					c1 = (m_pHeightMap[i2].w&&m_pHeightMap[i1].w&&m_pHeightMap[i3].w)?COLLISION_COLOUR:STANDARD_COLOUR;
-					 
-					pMapVtxs[vtxIndex + 0] = Vertex_Pos3fColour4ubNormal3fTex2f(v0, c0, vN1, XMFLOAT2(tX0, tY0));
-					pMapVtxs[vtxIndex + 1] = Vertex_Pos3fColour4ubNormal3fTex2f(v1, c0, vN1, XMFLOAT2(tX1, tY1));
-					pMapVtxs[vtxIndex + 2] = Vertex_Pos3fColour4ubNormal3fTex2f(v2, c0, vN1, XMFLOAT2(tX2, tY2));
-					pMapVtxs[vtxIndex + 3] = Vertex_Pos3fColour4ubNormal3fTex2f(v2, c1, vN2, XMFLOAT2(tX2, tY2));
-					pMapVtxs[vtxIndex + 4] = Vertex_Pos3fColour4ubNormal3fTex2f(v1, c1, vN2, XMFLOAT2(tX1, tY1));
-					pMapVtxs[vtxIndex + 5] = Vertex_Pos3fColour4ubNormal3fTex2f(v3, c1, vN2, XMFLOAT2(tX3, tY3));
-
-					vtxIndex += 6;
-				}
-				mapIndex++;
+			int vertexCount = std::min(rangeEnd - firstVertex, UPLOAD_CHUNK_VERTICES);
 
-			}
+			m_UploadVertices.resize(vertexCount);
+			m_Mesh.WriteVertices(firstVertex, vertexCount, &m_UploadVertices[0]);
+
+			D3D11_BOX box;
+			box.left = firstVertex * vertexBytes;
+			box.right = (firstVertex + vertexCount) * vertexBytes;
+			box.top = 0;
+			box.bottom = 1;
+			box.front = 0;
+			box.back = 1;
+
+			pContext->UpdateSubresource(m_pHeightMapBuffer, 0, &box, &m_UploadVertices[0], 0, 0);
 		}
 	}
-
-	Application::s_pApp->GetDeviceContext()->Unmap(m_pHeightMapBuffer, 0);
 }
 
+//////////////////////////////////////////////////////////////////////
+// UpdateHighlights
+// Swaps the highlighted faces for the pending ones. Only the cells of
+// faces whose colour changes are uploaded again.
+//////////////////////////////////////////////////////////////////////
+void HeightMap::UpdateHighlights( void )
+{
+	if( !m_HighlightsPending )
+		return;
+
+	m_HighlightsPending = false;
+
+	for( size_t i = 0; i < m_HighlightedFaces.size(); ++i )
+		m_Mesh.SetFaceHighlighted(m_HighlightedFaces[i], false);
+
+	for( size_t i = 0; i < m_PendingHighlights.size(); ++i )
+		m_Mesh.SetFaceHighlighted(m_PendingHighlights[i], true);
+
+	m_HighlightedFaces.swap(m_PendingHighlights);
+	m_PendingHighlights.clear();
+}
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
 HeightMap::~HeightMap()
 {
-	if( m_pHeightMap )
-		delete m_pHeightMap;
+	if( m_pLoader )
+		m_pLoader->Release(m_pLoadRequest);
+
+	delete m_pHeightField;
 
 	for (size_t i = 0; i < NUM_TEXTURE_FILES; ++i)
 	{
@@ -135,6 +198,8 @@ HeightMap::~HeightMap()
 	}
 
 	Release(m_pHeightMapBuffer);
+	Release(m_pHeightMapIndexBuffer);
+	Release(m_pLodIndexBuffer);
 
 	DeleteShader();
 }
@@ -142,7 +207,7 @@ HeightMap::~HeightMap()
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-void HeightMap::Draw( float frameCount )
+void HeightMap::Draw( float frameCount, const XMMATRIX& viewProjection, const XMVECTOR& eye, float pixelsPerUnit )
 {
 	XMMATRIX worldMtx = XMMatrixIdentity();
 
@@ -150,6 +215,28 @@ void HeightMap::Draw( float frameCount )
 
 	Application::s_pApp->SetWorldMatrix(worldMtx);
 
+	if( !IsReady() || !m_pHeightMapIndexBuffer )
+		return;
+
+	UpdateHighlights();
+	UploadDirtyVertices();
+
+	// The world matrix is the identity, so world space is clip space's input
+	if( m_LodEnabled )
+	{
+		if( m_Mesh.BuildLodIndices(viewProjection, eye, pixelsPerUnit, m_LodMaxPixelError, m_LodIndices) == 0 )
+			return;
+
+		UploadLodIndices();
+
+		if( !m_pLodIndexBuffer )
+			return;
+	}
+	else if( m_Mesh.BuildDrawList(viewProjection, m_Draws) == 0 )
+	{
+		return;
+	}
+
 	// Fill in the `myGlobals' cbuffer.
 	//
 	// The D3D11_MAP_WRITE_DISCARD flag is best for performance, but
@@ -222,8 +309,51 @@ void HeightMap::Draw( float frameCount )
 
 	m_pSamplerState = Application::s_pApp->GetSamplerState( true, true, true);
 
-	Application::s_pApp->DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, m_pHeightMapBuffer, sizeof( Vertex_Pos3fColour4ubNormal3fTex2f ), 
-		NULL, 0, m_HeightMapVtxCount, NULL, m_pSamplerState, &m_shader);
+	if( m_LodEnabled )
+	{
+		Application::s_pApp->DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, m_pHeightMapBuffer, sizeof( Vertex_Pos3fColour4ubNormal3fTex2f ), 
+			m_pLodIndexBuffer, 0, (unsigned)m_LodIndices.size(), NULL, m_pSamplerState, &m_shader, DXGI_FORMAT_R32_UINT);
+		return;
+	}
+
+	for( size_t i = 0; i < m_Draws.size(); ++i )
+	{
+		Application::s_pApp->DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, m_pHeightMapBuffer, sizeof( Vertex_Pos3fColour4ubNormal3fTex2f ), 
+			m_pHeightMapIndexBuffer, m_Draws[i].firstIndex, m_Draws[i].indexCount, NULL, m_pSamplerState, &m_shader, DXGI_FORMAT_R32_UINT);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// UploadLodIndices
+// The LOD indices change with the camera, so they go through a DYNAMIC
+// buffer, recreated half as big again whenever they outgrow it.
+//////////////////////////////////////////////////////////////////////
+void HeightMap::UploadLodIndices( void )
+{
+	UINT indexCount = (UINT)m_LodIndices.size();
+
+	if( indexCount > m_LodIndexCapacity )
+	{
+		Release(m_pLodIndexBuffer);
+
+		m_LodIndexCapacity = indexCount + (indexCount / 2);
+		m_pLodIndexBuffer = CreateBuffer(Application::s_pApp->GetDevice(), sizeof(uint32_t) * m_LodIndexCapacity, D3D11_USAGE_DYNAMIC, D3D11_BIND_INDEX_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
+
+		if( !m_pLodIndexBuffer )
+		{
+			m_LodIndexCapacity = 0;
+			return;
+		}
+	}
+
+	ID3D11DeviceContext* pContext = Application::s_pApp->GetDeviceContext();
+
+	D3D11_MAPPED_SUBRESOURCE map;
+	if( SUCCEEDED(pContext->Map(m_pLodIndexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map)) )
+	{
+		memcpy(map.pData, &m_LodIndices[0], sizeof(uint32_t) * indexCount);
+		pContext->Unmap(m_pLodIndexBuffer, 0);
+	}
 }
 
 bool HeightMap::ReloadShader( void )
@@ -302,153 +432,10 @@ void HeightMap::DeleteShader()
 	m_shader.Reset();
 }
 
-//////////////////////////////////////////////////////////////////////
-// LoadHeightMap
-// Original code sourced from rastertek.com
-//////////////////////////////////////////////////////////////////////
-bool HeightMap::LoadHeightMap(char* filename, float gridSize, float heightRange )
-{
-	FILE* filePtr;
-	int error;
-	int count;
-	BITMAPFILEHEADER bitmapFileHeader;
-	BITMAPINFOHEADER bitmapInfoHeader;
-	int imageSize, i, j, k, index;
-	unsigned char* bitmapImage;
-	unsigned char height;
-
-
-	// Open the height map file in binary.
-	error = fopen_s(&filePtr, filename, "rb");
-	if(error != 0)
-	{
-		return false;
-	}
-
-	// Read in the file header.
-	count = fread(&bitmapFileHeader, sizeof(BITMAPFILEHEADER), 1, filePtr);
-	if(count != 1)
-	{
-		return false;
-	}
-
-	// Read in the bitmap info header.
-	count = fread(&bitmapInfoHeader, sizeof(BITMAPINFOHEADER), 1, filePtr);
-	if(count != 1)
-	{
-		return false;
-	}
-
-	// Save the dimensions of the terrain.
-	m_HeightMapWidth = bitmapInfoHeader.biWidth;
-	m_HeightMapLength = bitmapInfoHeader.biHeight;
-
-	// Calculate the size of the bitmap image data.
-	imageSize = m_HeightMapWidth * m_HeightMapLength * 3;
-
-	// Allocate memory for the bitmap image data.
-	bitmapImage = new unsigned char[imageSize];
-	if(!bitmapImage)
-	{
-		return false;
-	}
-
-	// Move to the beginning of the bitmap data.
-	fseek(filePtr, bitmapFileHeader.bfOffBits, SEEK_SET);
-
-	// Read in the bitmap image data.
-	count = fread(bitmapImage, 1, imageSize, filePtr);
-	if(count != imageSize)
-	{
-		return false;
-	}
-
-	// Close the file.
-	error = fclose(filePtr);
-	if(error != 0)
-	{
-		return false;
-	}
-
-	// Create the structure to hold the height map data.
-	m_pHeightMap = new XMFLOAT4[m_HeightMapWidth * m_HeightMapLength];
-
-	if(!m_pHeightMap)
-	{
-		return false;
-	}
-
-	// Initialize the position in the image data buffer.
-	k=0;
-
-
-	// Read the image data into the height map.
-	for(j=0; j<m_HeightMapLength; j++)
-	{
-		for(i=0; i<m_HeightMapWidth; i++)
-		{
-			height = bitmapImage[k];
-			
-			index = (m_HeightMapWidth * j) + i;
-
-			m_pHeightMap[index].x = (i-(((float)m_HeightMapWidth-1)/2))*gridSize;
-			m_pHeightMap[index].y = (float)height/6*heightRange;
-			m_pHeightMap[index].z = (j-(((float)m_HeightMapLength-1)/2))*gridSize;
-			m_pHeightMap[index].w = 0;
-
-			k+=3;
-		}
-	}
-
-
-	// Release the bitmap image data.
-	delete [] bitmapImage;
-	bitmapImage = 0;
-
-	return true;
-}
-
-
-//////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////
-
-
-bool HeightMap::PointOverQuad(XMVECTOR& vPos, XMVECTOR& v0, XMVECTOR& v1, XMVECTOR& v2)
-{
-	if (XMVectorGetX(vPos) < max(XMVectorGetX(v1), XMVectorGetX(v2)) && XMVectorGetX(vPos) > min(XMVectorGetX(v1), XMVectorGetX(v2)))
-		if (XMVectorGetZ(vPos) < max(XMVectorGetZ(v1), XMVectorGetZ(v2)) && XMVectorGetZ(vPos) > min(XMVectorGetZ(v1), XMVectorGetZ(v2)))
-			return true;
-
-	return false;
-}
-
-int g_badIndex = 0;
-
 bool HeightMap::RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN)
 {
-
-	XMVECTOR v0, v1, v2, v3;
-	int i0, i1, i2, i3;
-	float colDist = 0.0f;
-
-	// This resets the collision colouring
-	for( int l = 0; l < m_HeightMapLength-1; ++l )
-	{
-		for( int w = 0; w < m_HeightMapWidth-1; ++w )
-		{
-			int mapIndex = (l*m_HeightMapWidth)+w;
-
-			i0 = mapIndex;
-			i1 = mapIndex+m_HeightMapWidth;
-			i2 = mapIndex+1;
-			i3 = mapIndex+m_HeightMapWidth+1;
-
-			m_pHeightMap[i0].w = 0;
-			m_pHeightMap[i1].w = 0;
-			m_pHeightMap[i2].w = 0;
-			m_pHeightMap[i3].w = 0;
-		}
-	}
+	if( m_HighlightHits )
+		m_HighlightsPending = true;
 
 #ifdef COLOURTEST
 	// This is just a piece of test code for the map colouring
@@ -459,24 +446,16 @@ bool HeightMap::RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float raySpeed,
 		for( int w = 0; w < m_HeightMapWidth-1; ++w )
 		{
 			int mapIndex = (l*m_HeightMapWidth)+w;
-
-			i0 = mapIndex;
-			i1 = mapIndex+m_HeightMapWidth;
-			i2 = mapIndex+1;
-			i3 = mapIndex+m_HeightMapWidth+1;
+			int faceIndex = ((l*(m_HeightMapWidth-1))+w)*2;
 
 			if( (int)frame%(m_HeightMapLength*m_HeightMapWidth) == mapIndex )
 			{
-				m_pHeightMap[i0].w = 1;
-				m_pHeightMap[i1].w = 1;
-				m_pHeightMap[i2].w = 1;
-				m_pHeightMap[i3].w = 1;
+				HighlightTriangle(faceIndex);
+				HighlightTriangle(faceIndex+1);
 			}
 		}
 	}
 
-	RebuildVertexData();
-
 	frame+=0.1f;
 
 	// end of test code
@@ -491,24 +470,16 @@ bool HeightMap::RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float raySpeed,
 		for (int w = 0; w < m_HeightMapWidth - 1; ++w)
 		{
 			int mapIndex = (l*m_HeightMapWidth) + w;
-
-			i0 = mapIndex;
-			i1 = mapIndex + m_HeightMapWidth;
-			i2 = mapIndex + 1;
-			i3 = mapIndex + m_HeightMapWidth + 1;
+			int faceIndex = ((l*(m_HeightMapWidth - 1)) + w) * 2;
 
 			if ((int)frame % (m_HeightMapLength*m_HeightMapWidth) == mapIndex)
 			{
-				m_pHeightMap[i0].w = 1;
-				m_pHeightMap[i1].w = 1;
-				m_pHeightMap[i2].w = 1;
-				m_pHeightMap[i3].w = 1;
+				HighlightTriangle(faceIndex);
+				HighlightTriangle(faceIndex + 1);
 			}
 		}
 	}
 
-	RebuildVertexData();
-
 	frame += 0.1f;
 
 	// end of test code
@@ -520,255 +491,169 @@ bool HeightMap::RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float raySpeed,
 	int row = ((rayPos.z+14)/2)+0.5f;
 	int col = ((rayPos.x+14)/2)+0.5f;
 
-	int mapIndex = (row*m_HeightMapWidth)+col;
-	int predictMapIndex = mapIndex;
-
-	i0 = mapIndex;
-	i1 = mapIndex+m_HeightMapWidth;
-	i2 = mapIndex+1;
-	i3 = mapIndex+m_HeightMapWidth+1;
+	int predictFaceIndex = ((row*(m_HeightMapWidth-1))+col)*2;
 
 	if( 2.0-fmod( rayPos.z+16, 2.0f ) < fmod( rayPos.x+16, 2.0f ) )
 	{
-			m_pHeightMap[i0].w = 1;
-			m_pHeightMap[i1].w = 1;
-			m_pHeightMap[i2].w = 1;
+			HighlightTriangle(predictFaceIndex);
 	}
 	else
 	{
-			m_pHeightMap[i2].w = 1;
-			m_pHeightMap[i1].w = 1;
-			m_pHeightMap[i3].w = 1;
+			HighlightTriangle(predictFaceIndex+1);
 	}
-
-	RebuildVertexData();
 	
 #endif
 
-	// This is a brute force solution that checks against every triangle in the heightmap
-	for( int l = 0; l < m_HeightMapLength-1; ++l )
+	if( !IsReady() )
+		return false;
+
+	HeightField::RayHit hit;
+
+	bool collided = m_pHeightField->RayCollision(rayPos, rayDir, raySpeed, hit);
+
+	if( collided )
 	{
-		for( int w = 0; w < m_HeightMapWidth-1; ++w )
-		{	
-			int mapIndex = (l*m_HeightMapWidth)+w;
+		colPos = XMLoadFloat3(&hit.position);
+		colNormN = XMLoadFloat3(&hit.normal);
 
-			i0 = mapIndex;
-			i1 = mapIndex+m_HeightMapWidth;
-			i2 = mapIndex+1;
-			i3 = mapIndex+m_HeightMapWidth+1;
+		if( m_HighlightHits )
+			HighlightTriangle(hit.triangle);
+	}
 
-			v0 = XMLoadFloat4(&m_pHeightMap[i0]);
-			v1 = XMLoadFloat4(&m_pHeightMap[i1]);
-			v2 = XMLoadFloat4(&m_pHeightMap[i2]);
-			v3 = XMLoadFloat4(&m_pHeightMap[i3]);
-			
-			//bool bOverQuad = PointOverQuad(rayPos, v0, v1, v2);
+	return collided;
+}
 
-			//if (mapIndex == g_badIndex)
-			//	bOverQuad = bOverQuad;
+//////////////////////////////////////////////////////////////////////
+// SphereCollision
+//////////////////////////////////////////////////////////////////////
+bool HeightMap::SphereCollision(const XMVECTOR& centre, float radius, const XMVECTOR& dir, float speed, HeightField::SphereHit& hit)
+{
+	if( m_HighlightHits )
+		m_HighlightsPending = true;
 
-			//012 213
-			if( RayTriangle( v0, v1, v2, rayPos, rayDir, colPos, colNormN, colDist ) )
-			{
-				// Needs to be >=0 
-				if( colDist <= raySpeed && colDist >= 0.0f )
-				{
-					m_pHeightMap[i0].w = 1;
-					m_pHeightMap[i1].w = 1;
-					m_pHeightMap[i2].w = 1;
-					RebuildVertexData();
-
-					return true;
-				}
-	
-			}
-			// 213
-			if( RayTriangle(v2, v1, v3, rayPos, rayDir, colPos, colNormN, colDist ) )
-			{
-				// Needs to be >=0 
-				if( colDist <= raySpeed && colDist >= 0.0f )
-				{
-					m_pHeightMap[i2].w = 1;
-					m_pHeightMap[i1].w = 1;
-					m_pHeightMap[i3].w = 1;
-					RebuildVertexData();
-
-					return true;
-				}
-			}
+	if( !IsReady() )
+		return false;
 
-			/*
-			if (bOverQuad)
-			{
-				m_pHeightMap[i0].w = 1;
-				m_pHeightMap[i2].w = 1;
-				m_pHeightMap[i1].w = 1;
-				m_pHeightMap[i3].w = 1;
-				RebuildVertexData();
-				g_badIndex = mapIndex;
-			}
-			*/
+	bool collided = m_pHeightField->SphereCollision(centre, radius, dir, speed, hit);
 
-		}
-	
+	if( collided && m_HighlightHits )
+		HighlightTriangle(hit.triangle);
+
+	return collided;
+}
+
+//////////////////////////////////////////////////////////////////////
+// StepSpheres
+//////////////////////////////////////////////////////////////////////
+int HeightMap::StepSpheres(SphereWorld& world, float dt)
+{
+	if( m_HighlightHits )
+		m_HighlightsPending = true;
+
+	if( !IsReady() )
+		return 0;
+
+	world.SetHeightField(m_pHeightField);
+
+	int touching = world.Step(dt);
+
+	if( touching == 0 || !m_HighlightHits )
+		return touching;
+
+	// A body touches the plane of the triangle under its centre, and being
+	// pushed out along that plane's normal leaves it over the same one
+	// unless it was within a fraction of the radius of an edge
+	for( int i = 0; i < world.GetBodyCount(); ++i )
+	{
+		if( !world.IsTouchingGround(i) )
+			continue;
+
+		XMFLOAT3 pos = world.GetPosition(i);
+		HighlightTriangle(m_pHeightField->GetFaceAt(pos.x, pos.z));
 	}
 
-	return false;
+	return touching;
 }
 
+//////////////////////////////////////////////////////////////////////
+// SetHighlightHits
+//////////////////////////////////////////////////////////////////////
+void HeightMap::SetHighlightHits( bool enabled )
+{
+	m_HighlightHits = enabled;
+
+	// Turning it off clears the highlights at the next Draw
+	if( !enabled )
+	{
+		m_PendingHighlights.clear();
+		m_HighlightsPending = true;
+	}
+}
 
-// Function:	rayTriangle
-// Description: Tests a ray for intersection with a triangle
-// Parameters:
-//				vert0		First vertex of triangle 
-//				vert1		Second vertex of triangle
-//				vert3		Third vertex of triangle
-//				rayPos		Start position of ray
-//				rayDir		Direction of ray
-//				colPos		Position of collision (returned)
-//				colNormN	The normalised Normal to triangle (returned)
-//				colDist		Distance from rayPos to collision (returned)
-// Returns: 	true if the intersection point lies within the bounds of the triangle.
-// Notes: 		Not for the faint-hearted :)
-
-bool HeightMap::RayTriangle(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& rayPos, const XMVECTOR& rayDir, XMVECTOR& colPos, XMVECTOR& colNormN, float& colDist)
- {
-	 // Part 1: Calculate the collision point between the ray and the plane on which the triangle lies
-	 //
-	 // If RAYPOS is a point in space and RAYDIR is a vector extending from RAYPOS towards a plane
-	 // Then COLPOS with the plane will be RAYPOS + COLDIST*|RAYDIR|
-	 // So if we can calculate COLDIST then we can calculate COLPOS
-	 //
-	 // The equation for plane is Ax + By + Cz + D = 0
-	 // Which can also be written as [ A,B,C ] dot [ x,y,z ] = -D
-	 // Where [ A,B,C ] is |COLNORM| (the normalised normal to the plane) and [ x,y,z ] is any point on that plane 
-	 // Any point includes the collision point COLPOS which equals  RAYPOS + COLDIST*|RAYDIR|
-	 // So substitute [ x,y,z ] for RAYPOS + COLDIST*|RAYDIR| and rearrange to yield COLDIST
-	 // -> |COLNORM| dot (RAYPOS + COLDIST*|RAYDIR|) also equals -D
-	 // -> (|COLNORM| dot RAYPOS) + (|COLNORM| dot (COLDIST*|RAYDIR|)) = -D
-	 // -> |COLNORM| dot (COLDIST*|RAYDIR|)) = -D -(|COLNORM| dot RAYPOS)
-	 // -> COLDIST = -(D+(|COLNORM| dot RAYPOS)) /  (|COLNORM| dot |RAYDIR|)
-	 //
-	 // Now all we only need to calculate D in order to work out COLDIST
-	 // This can be done using |COLNORM| (which remember is also [ A,B,C ] ), the plane equation and any point on the plane
-	 // |COLNORM| dot |ANYVERT| = -D
-
-	 //return false; // remove this to start
-
-	 // Step 1: Calculate |COLNORM| 
-
-	 colNormN =  XMVector3Cross((vert0 - vert1), (vert2 - vert1));
-
-	 colNormN = XMVector3Normalize(colNormN);
-
-	 // Note that the variable colNormN is passed through by reference as part of the function parameters so you can calculate and return it!
-	 // Next line is useful debug code to stop collision with the top of the inverted pyramid (which has a normal facing straight up). 
-	 XMFLOAT3 FloatTest;
-	 XMStoreFloat3(&FloatTest, colNormN);
-	 //if( abs(FloatTest.y)>0.99f ) return false;
-	 // Remember to remove it once you have implemented part 2 below...
-
-	 // ...
-
-	 // Step 2: Use |COLNORM| and any vertex on the triangle to calculate D
-	 XMVECTOR D = -XMVector3Dot(colNormN, vert0);
-	 // ...
-	 
-	 // Step 3: Calculate the demoninator of the COLDIST equation: (|COLNORM| dot |RAYDIR|) and "early out" (return false) if it is 0
-	 XMVECTOR demoninatorVector = XMVector3Dot(colNormN, XMVector3Normalize(rayDir));
-	 float demoninator;
-	 XMStoreFloat(&demoninator, demoninatorVector);
-	 if (demoninator == 0) return false;
-	 // ...
-
-	 // Step 4: Calculate the numerator of the COLDIST equation: -(D+(|COLNORM| dot RAYPOS))
-
-	 XMVECTOR numeratorVector = -(D + XMVector3Dot(colNormN, rayPos));
-	 float numerator;
-	 XMStoreFloat(&numerator, numeratorVector);
-	 // ...
-
-	 // Step 5: Calculate COLDIST and "early out" again if COLDIST is behind RAYDIR
-	 colDist = numerator / demoninator;
-	 // ...
-
-	 if (colDist < 0) return false;
-
-	 // Step 6: Use COLDIST to calculate COLPOS
-	 colPos = rayPos + (colDist * XMVector3Normalize(rayDir));
-	 // ...
-
-	 // Next two lines are useful debug code to stop collision with anywhere beneath the pyramid. 
-	 // if( min(vert0.y,vert1.y,vert2.y)>colPos.y ) return false;
-	 // Remember to remove it once you have implemented part 2 below...
-
-	 // Part 2: Work out if the intersection point falls within the triangle
-	 //
-	 // If the point is inside the triangle then it will be contained by the three new planes defined by:
-	 // 1) RAYPOS, VERT0, VERT1
-	 // 2) RAYPOS, VERT1, VERT2
-	 // 3) RAYPOS, VERT2, VERT0
-
-	 // Move the ray backwards by a tiny bit (one unit) in case the ray is already on the plane
-	 XMVECTOR rayPosMovedBack = rayPos - rayDir;
-	 // ...
-
-	 // Step 1: Test against plane 1 and return false if behind plane
-	 if (!PointPlane(rayPosMovedBack, vert0, vert1, colPos)) return false;
-	 // ...
-
-	 // Step 2: Test against plane 2 and return false if behind plane
-	 if (!PointPlane(rayPosMovedBack, vert1, vert2, colPos)) return false;
-	 // ...
-
-	 // Step 3: Test against plane 3 and return false if behind plane
-	 if (!PointPlane(rayPosMovedBack, vert2, vert0, colPos)) return false;
-	 // ...
-
-	 // Step 4: Return true! (on triangle)
-	 return true;
- }
-
-// Function:	pointPlane
-// Description: Tests a point to see if it is in front of a plane
-// Parameters:
-//				vert0		First point on plane 
-//				vert1		Second point on plane 
-//				vert3		Third point on plane 
-//				pointPos	Point to test
-// Returns: 	true if the point is in front of the plane
-
-bool HeightMap::PointPlane(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& pointPos)
- {
-	 // For any point on the plane [x,y,z] Ax + By + Cz + D = 0
-	 // So if Ax + By + Cz + D < 0 then the point is behind the plane
-	 // --> [ A,B,C ] dot [ x,y,z ] + D < 0
-	 // --> |PNORM| dot POINTPOS + D < 0
-	 // but D = -(|PNORM| dot VERT0 )
-	 // --> (|PNORM| dot POINTPOS) - (|PNORM| dot VERT0) < 0
-	 XMVECTOR sVec0, sVec1, sNormN;
-	 float sD, sNumer;
-
-	 // Step 1: Calculate PNORM
-	 XMVECTOR PNORM = XMVector3Cross((vert0 - vert1), (vert2 - vert1));
-
-	 PNORM = XMVector3Normalize(PNORM);
-	 // ...
-	
-	 // Step 2: Calculate D
-	 XMVECTOR D = -XMVector3Dot(PNORM, vert0);
-	 // ...
-	 
-	 // Step 3: Calculate full equation
-	 XMVECTOR full = (XMVector3Dot(PNORM, pointPos) - XMVector3Dot(PNORM, vert0));
-	 float dir;
-	 XMStoreFloat(&dir, full);
-	 // ...
-
-	 // Step 4: Return false if < 0 (behind plane)
-	 if (dir < 0) return false;
-	 // ...
-
-	 // Step 5: Return true! (in front of plane)
-	 return true;
- }
\ No newline at end of file
+//////////////////////////////////////////////////////////////////////
+// SetMeshMode
+//////////////////////////////////////////////////////////////////////
+void HeightMap::SetMeshMode( HeightFieldMesh::MeshMode mode )
+{
+	if( mode == m_MeshMode )
+		return;
+
+	m_MeshMode = mode;
+
+	if( m_MeshMode != HeightFieldMesh::MESH_INDEXED )
+		m_LodEnabled = false;
+
+	// Not loaded yet: CreateVertexData will use the new mode
+	if( !m_pHeightField )
+		return;
+
+	Release(m_pHeightMapBuffer);
+	Release(m_pHeightMapIndexBuffer);
+
+	CreateVertexData();
+
+	// The new mesh starts with nothing highlighted, so put them back at the
+	// next Draw unless newer ones are already waiting
+	if( !m_HighlightsPending )
+		m_PendingHighlights = m_HighlightedFaces;
+
+	m_HighlightedFaces.clear();
+	m_HighlightsPending = true;
+}
+
+void HeightMap::SetLod( bool enabled, float maxPixelError )
+{
+	if( enabled )
+		SetMeshMode(HeightFieldMesh::MESH_INDEXED);
+
+	m_LodEnabled = enabled;
+	m_LodMaxPixelError = maxPixelError;
+}
+
+//////////////////////////////////////////////////////////////////////
+// HighlightTriangle
+// Queues a face to be drawn red from the next Draw on.
+//////////////////////////////////////////////////////////////////////
+void HeightMap::HighlightTriangle( int faceIndex )
+{
+	if( faceIndex < 0 || faceIndex >= m_HeightMapFaceCount )
+		return;
+
+	m_PendingHighlights.push_back(faceIndex);
+	m_HighlightsPending = true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// SetHeights
+//////////////////////////////////////////////////////////////////////
+void HeightMap::SetHeights( int w, int l, int width, int length, const float* pHeights )
+{
+	if( !IsReady() )
+		return;
+
+	// Requantising moves every sample, not just these
+	if( m_pHeightField->SetHeights(w, l, width, length, pHeights) )
+		m_Mesh.MarkSamplesDirty(0, 0, m_pHeightField->GetWidth(), m_pHeightField->GetLength());
+	else
+		m_Mesh.MarkSamplesDirty(w, l, width, length);
+}
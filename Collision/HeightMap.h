@@ -10,6 +10,11 @@
 //**********************************************************************
 
 #include "Application.h"
+#include "HeightField.h"
+#include "HeightFieldLoader.h"
+#include "HeightFieldMesh.h"
+
+class SphereWorld;
 
 static const char *const g_aTextureFileNames[] = {
 	"Resources/Intersection.dds",       
@@ -20,35 +25,104 @@ static const char *const g_aTextureFileNames[] = {
 
 static const size_t NUM_TEXTURE_FILES = sizeof g_aTextureFileNames / sizeof g_aTextureFileNames[0];
 
+// Draws a HeightField, optionally highlighting the triangles rays hit
 class HeightMap
 {
 public:
-	HeightMap( char* filename, float gridSize, float heightRange );
+	// With a loader, the heightmap is loaded on its thread and the constructor
+	// only loads the textures and shader. Until the field arrives nothing is
+	// drawn and every query misses; IsReady says when it has.
+	HeightMap( const char* filename, float gridSize, float heightRange, HeightFieldLoader* pLoader = NULL );
 	~HeightMap();
 
-	void Draw( float frameCount );
+	bool IsReady();
+
+	// Only the chunks of the map inside viewProjection's frustum are drawn.
+	// eye and pixelsPerUnit pick the chunks' levels with LOD on; see
+	// HeightFieldMesh::BuildLodIndices.
+	void Draw( float frameCount, const XMMATRIX& viewProjection, const XMVECTOR& eye, float pixelsPerUnit );
 	bool ReloadShader();
 	void DeleteShader();
+
+	// HeightField::RayCollision, plus HighlightTriangle on a hit when
+	// highlighting is on
 	bool RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float speed, XMVECTOR& colPos, XMVECTOR& colNormN);
 
+	// HeightField::SphereCollision, highlighting the same way
+	bool SphereCollision(const XMVECTOR& centre, float radius, const XMVECTOR& dir, float speed, HeightField::SphereHit& hit);
+
+	// world.Step on this heightmap, highlighting the triangle under each body
+	// left touching the ground. Returns Step's count of them.
+	int StepSpheres(SphereWorld& world, float dt);
+
+	// Debug highlighting. The triangles hit between one Draw and the next are
+	// drawn red in place of the ones before; if nothing was queried in between
+	// the old ones stay. Off by default, so RayCollision costs nothing extra.
+	void SetHighlightHits( bool enabled );
+	bool GetHighlightHits() const { return m_HighlightHits; }
+	void HighlightTriangle( int faceIndex );
+
+	// MESH_UNINDEXED by default, which highlights exactly the faces hit.
+	// MESH_INDEXED takes about a sixth of the memory and upload, with smooth
+	// normals. Changing it rebuilds the buffers, keeping the highlights.
+	void SetMeshMode( HeightFieldMesh::MeshMode mode );
+	HeightFieldMesh::MeshMode GetMeshMode() const { return m_MeshMode; }
+
+	// Geomipmapping: chunks are drawn with fewer samples the further away
+	// they are, keeping the surface within maxPixelError pixels of the full
+	// one. It needs MESH_INDEXED, so turning it on switches to that, and
+	// switching back to MESH_UNINDEXED turns it off.
+	void SetLod( bool enabled, float maxPixelError = DEFAULT_LOD_PIXEL_ERROR );
+	bool GetLodEnabled() const { return m_LodEnabled; }
+
+	static const float DEFAULT_LOD_PIXEL_ERROR;
+
+	// HeightField::SetHeights. The cells around the changed samples, or all
+	// of them if the map was requantised, are uploaded again at the next Draw.
+	void SetHeights( int w, int l, int width, int length, const float* pHeights );
+	void SetHeight( int w, int l, float height ) { SetHeights(w, l, 1, 1, &height); }
+
+	// For the collision settings and statistics. Change heights through
+	// SetHeights above, so the vertex buffer is kept up to date. NULL until
+	// the field has loaded.
+	HeightField* GetHeightField() { return m_pHeightField; }
+	const HeightField* GetHeightField() const { return m_pHeightField; }
+
 private:
-	bool LoadHeightMap(char* filename, float gridSize, float heightRange);
-	bool RayTriangle(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& rayPos, const XMVECTOR& rayDir, XMVECTOR& colPos, XMVECTOR& colNormN, float& colDist);
-	bool PointPlane(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& pointPos);
-	void RebuildVertexData( void );
-	bool PointOverQuad(XMVECTOR& vPos, XMVECTOR& v0, XMVECTOR& v1, XMVECTOR& v2);
-
-	XMFLOAT3 GetFaceNormal( int faceIndex, int offset );
-	XMFLOAT3 GetAveragedVertexNormal(int index, int row);
-	
+	void CreateVertexData( void );
+	void UploadDirtyVertices( void );
+	void UpdateHighlights( void );
+	void UploadLodIndices( void );
+
 	ID3D11Buffer *m_pHeightMapBuffer;
+	ID3D11Buffer *m_pHeightMapIndexBuffer;	// The cells chunk by chunk
+
+	HeightField* m_pHeightField;
+
+	HeightFieldLoader* m_pLoader;
+	HeightFieldLoader::Request* m_pLoadRequest;	// Until the field arrives
+
+	bool m_HighlightHits;
+	bool m_HighlightsPending;			// Set by any query or highlight since the last Draw
+	std::vector<int> m_HighlightedFaces;	// The faces highlighted in m_Mesh
+	std::vector<int> m_PendingHighlights;	// The faces to replace them with at the next Draw
 
 	int m_HeightMapWidth;
 	int m_HeightMapLength;
 	int m_HeightMapVtxCount;
 	int m_HeightMapFaceCount;
-	XMFLOAT4* m_pHeightMap;
-	Vertex_Pos3fColour4ubNormal3fTex2f* m_pMapVtxs;
+
+	HeightFieldMesh::MeshMode m_MeshMode;
+	HeightFieldMesh m_Mesh;							// What's changed since the last upload
+	std::vector<HeightFieldMesh::VertexRange> m_DirtyRanges;
+	std::vector<HeightFieldVertex> m_UploadVertices;	// Reused between uploads
+	std::vector<HeightFieldMesh::IndexRange> m_Draws;	// Reused between Draws
+
+	bool m_LodEnabled;
+	float m_LodMaxPixelError;
+	std::vector<uint32_t> m_LodIndices;		// Built every Draw
+	ID3D11Buffer *m_pLodIndexBuffer;		// DYNAMIC, grown as needed
+	UINT m_LodIndexCapacity;
 
 	Application::Shader m_shader;
 	
@@ -89,8 +89,11 @@ void PSMain(const PSInput input, out PSOutput output)
 {
 	float4 colour = input.colour;
 
+	// 0 to 1 across each cell, whether the vertices are per cell or shared
+	float2 cellTex = frac(input.tex);
+
 	//Add a bit of a grid
-	if( input.tex.x <= 0.01f || input.tex.y <= 0.01f || input.tex.x >= 0.99f || input.tex.y >= 0.99f  )
+	if( cellTex.x <= 0.01f || cellTex.y <= 0.01f || cellTex.x >= 0.99f || cellTex.y >= 0.99f  )
 		colour = float4( 1.0f, 1.0f, 1.0f, 1.0f );
 	else
 		colour = float4( 0.6f, 0.6f, 0.6f, 1.0f );
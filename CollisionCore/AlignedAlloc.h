@@ -0,0 +1,40 @@
+#ifndef ALIGNEDALLOC_H
+#define ALIGNEDALLOC_H
+
+//**********************************************************************
+// File:			AlignedAlloc.h
+// Description:		Allocation with a guaranteed alignment, for arrays
+//					that are read with aligned SIMD loads or that should
+//					start on a cache line
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Memory from AlignedAlloc must go back to AlignedFree.
+//**********************************************************************
+
+#include <stdlib.h>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+// alignment must be a power of two, and a multiple of sizeof(void*)
+inline void* AlignedAlloc( size_t sizeBytes, size_t alignment )
+{
+#ifdef _MSC_VER
+	return _aligned_malloc(sizeBytes, alignment);
+#else
+	void* pMemory = NULL;
+	if( posix_memalign(&pMemory, alignment, sizeBytes) != 0 )
+		return NULL;
+	return pMemory;
+#endif
+}
+
+inline void AlignedFree( void* pMemory )
+{
+#ifdef _MSC_VER
+	_aligned_free(pMemory);
+#else
+	free(pMemory);
+#endif
+}
+
+#endif
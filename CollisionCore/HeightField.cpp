@@ -0,0 +1,2533 @@
+#include "HeightField.h"
+#include "AlignedAlloc.h"
+#include "HeightImage.h"
+#include "MappedFile.h"
+#include "QueryThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Tolerances used when culling cells and quadtree nodes against a ray segment, so that hits
+// landing exactly on a shared edge or at a node's height limit are never culled
+static const float EDGE_TOLERANCE = 1e-3f;		// In cells
+static const float HEIGHT_TOLERANCE = 1e-3f;	// In world units
+
+// The nearest of the 65536 steps up from offset, 1/invScale apart
+static unsigned short QuantiseHeight( float height, float offset, float invScale )
+{
+	float steps = floorf(((height - offset) * invScale) + 0.5f);
+
+	return (unsigned short)std::min(std::max(steps, 0.0f), (float)USHRT_MAX);
+}
+
+// The binary format SaveBinary writes and MapBinary maps: the header, then
+// each section starting on a cache line, so that it can be used where it
+// lies in the mapping. Everything is in the byte order of the machine that
+// saved it, which is little-endian on everything this builds for.
+static const char HEIGHTFIELD_FILE_MAGIC[4] = { 'H', 'F', 'L', 'D' };
+static const uint32_t HEIGHTFIELD_FILE_VERSION = 1;
+static const uint64_t HEIGHTFIELD_FILE_ALIGNMENT = 64;
+
+struct HeightFieldFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	int32_t width;
+	int32_t length;
+	float gridSize;
+	int32_t storage;			// HeightField::HeightStorage
+	int32_t layout;				// HeightField::HeightLayout
+	float heightOffset;			// HEIGHT_STORAGE_UINT16 only
+	float heightScale;
+	uint32_t reserved;
+	uint64_t samplesOffset;		// Exactly as HeightField stores them
+	uint64_t samplesBytes;
+	uint64_t quadTreeOffset;	// Optional, 0 bytes if not saved
+	uint64_t quadTreeBytes;
+	uint64_t packetsOffset;		// Optional, 0 bytes if not saved
+	uint64_t packetsBytes;
+};
+
+static uint64_t AlignFileOffset( uint64_t offset )
+{
+	return (offset + HEIGHTFIELD_FILE_ALIGNMENT - 1) & ~(HEIGHTFIELD_FILE_ALIGNMENT - 1);
+}
+
+// A section of the mapping, if it's there, aligned and exactly expectedBytes long
+static unsigned char* GetFileSection( const MappedFile& file, uint64_t offset, uint64_t bytes, size_t expectedBytes )
+{
+	if( expectedBytes == 0 || bytes != expectedBytes || offset % HEIGHTFIELD_FILE_ALIGNMENT != 0 )
+		return NULL;
+
+	if( offset > file.GetSize() || bytes > file.GetSize() - offset )
+		return NULL;
+
+	return file.GetData() + offset;
+}
+
+// Pads with zeros up to offset, then writes the section
+static bool WriteFileSection( FILE* pFile, uint64_t offset, const void* pData, size_t bytes )
+{
+	if( bytes == 0 )
+		return true;
+
+	long position = ftell(pFile);
+
+	if( position < 0 || (uint64_t)position > offset )
+		return false;
+
+	for( ; (uint64_t)position < offset; ++position )
+	{
+		if( fputc(0, pFile) == EOF )
+			return false;
+	}
+
+	return fwrite(pData, 1, bytes, pFile) == bytes;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+HeightField::HeightField( const char* filename, float gridSize, float heightRange, HeightStorage storage, LoadProgress* pProgress )
+{
+	Init(gridSize, storage);
+	m_pLoadProgress = pProgress;
+
+	if( LoadHeightMap(filename, gridSize, heightRange) )
+		BuildCollisionData();
+
+	m_pLoadProgress = NULL;
+}
+
+HeightField::HeightField( int width, int length, float gridSize, const float* pHeights, HeightStorage storage )
+{
+	Init(gridSize, storage);
+
+	if( width < 2 || length < 2 )
+		return;
+
+	CreateHeightMap(width, length, gridSize, pHeights);
+
+	BuildCollisionData();
+}
+
+HeightField::HeightField( const char* binaryFilename, LoadProgress* pProgress )
+{
+	Init(0.0f, HEIGHT_STORAGE_FLOAT4);
+	m_pLoadProgress = pProgress;
+
+	MapBinary(binaryFilename);
+
+	m_pLoadProgress = NULL;
+}
+
+void HeightField::Init( float gridSize, HeightStorage storage )
+{
+	m_CollisionMode = COLLISION_QUADTREE;
+
+	m_HeightMapWidth = 0;
+	m_HeightMapLength = 0;
+	m_HeightMapFaceCount = 0;
+	m_GridSize = gridSize;
+	m_HeightStorage = storage;
+	m_HeightLayout = HEIGHT_LAYOUT_ROW_MAJOR;
+	m_TilesAcross = 0;
+	m_StoredSampleCount = 0;
+	m_pHeightMap = NULL;
+	m_pQuantisedHeights = NULL;
+	m_HeightOffset = 0.0f;
+	m_HeightScale = 0.0f;
+	m_pQuadTree = NULL;
+	m_QuadTreeLevels = 0;
+	m_TriangleKernel = TRIANGLE_KERNEL_REFERENCE;
+	m_pPacketKernel = GetRayTrianglePacketKernel();
+	m_pTrianglePackets = NULL;
+	m_pTriangleCache = NULL;
+	m_pMappedFile = NULL;
+	m_pLoadProgress = NULL;
+	memset(&m_QuadTreeStats, 0, sizeof m_QuadTreeStats);
+}
+
+// Once the map's size is known: a row of samples each, then a row of cells
+// each for the quadtree and the packets
+void HeightField::BeginLoadProgress( void )
+{
+	if( m_pLoadProgress )
+		m_pLoadProgress->rowCount.store(m_HeightMapLength + (2 * (m_HeightMapLength-1)), std::memory_order_relaxed);
+}
+
+void HeightField::AddLoadProgress( int rows )
+{
+	if( m_pLoadProgress )
+		m_pLoadProgress->rowsDone.fetch_add(rows, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////
+// CreateHeightMap
+// Allocates a width x length map from pHeights, row by row, centred on
+// the origin with samples gridSize apart, stored as m_HeightStorage and
+// m_HeightLayout say.
+//////////////////////////////////////////////////////////////////////
+void HeightField::CreateHeightMap( int width, int length, float gridSize, const float* pHeights )
+{
+	FreeHeightMap();
+
+	m_HeightMapWidth = width;
+	m_HeightMapLength = length;
+	m_GridSize = gridSize;
+
+	AllocateHeightMap();
+	BeginLoadProgress();
+
+	if( m_pQuantisedHeights )
+	{
+		int sampleCount = m_HeightMapWidth * m_HeightMapLength;
+		float minHeight = FLT_MAX;
+		float maxHeight = -FLT_MAX;
+
+		for( int i = 0; i < sampleCount; ++i )
+		{
+			minHeight = std::min(minHeight, pHeights[i]);
+			maxHeight = std::max(maxHeight, pHeights[i]);
+		}
+
+		QuantiseHeights(pHeights, minHeight, maxHeight);
+		return;
+	}
+
+	for( int j = 0; j < m_HeightMapLength; ++j )
+	{
+		for( int i = 0; i < m_HeightMapWidth; ++i )
+		{
+			int index = GetStorageIndex(i, j);
+
+			m_pHeightMap[index].x = GetSampleX(i);
+			m_pHeightMap[index].y = pHeights[(m_HeightMapWidth * j) + i];
+			m_pHeightMap[index].z = GetSampleZ(j);
+			m_pHeightMap[index].w = 0;
+		}
+
+		AddLoadProgress(1);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// AllocateHeightMap
+// Storage for m_HeightMapWidth x m_HeightMapLength samples, rounded up
+// to whole tiles when tiled. The samples off the map are zeroed.
+//////////////////////////////////////////////////////////////////////
+void HeightField::AllocateHeightMap( void )
+{
+	InitStoredSampleCount();
+
+	if( m_HeightStorage == HEIGHT_STORAGE_UINT16 )
+	{
+		m_pQuantisedHeights = new unsigned short[m_StoredSampleCount];
+		memset(m_pQuantisedHeights, 0, m_StoredSampleCount * sizeof(unsigned short));
+	}
+	else
+	{
+		m_pHeightMap = new XMFLOAT4[m_StoredSampleCount];
+		memset(m_pHeightMap, 0, m_StoredSampleCount * sizeof(XMFLOAT4));
+	}
+}
+
+void HeightField::InitStoredSampleCount( void )
+{
+	if( m_HeightLayout == HEIGHT_LAYOUT_TILED )
+	{
+		const int tileSize = 1 << HEIGHT_TILE_SHIFT;
+
+		m_TilesAcross = (m_HeightMapWidth + tileSize - 1) >> HEIGHT_TILE_SHIFT;
+		int tilesDown = (m_HeightMapLength + tileSize - 1) >> HEIGHT_TILE_SHIFT;
+
+		m_StoredSampleCount = (m_TilesAcross * tilesDown) << (2*HEIGHT_TILE_SHIFT);
+	}
+	else
+	{
+		m_TilesAcross = 0;
+		m_StoredSampleCount = m_HeightMapWidth * m_HeightMapLength;
+	}
+}
+
+void HeightField::FreeHeightMap( void )
+{
+	if( !IsInMappedFile(m_pHeightMap) )
+		delete [] m_pHeightMap;
+
+	if( !IsInMappedFile(m_pQuantisedHeights) )
+		delete [] m_pQuantisedHeights;
+
+	m_pHeightMap = NULL;
+	m_pQuantisedHeights = NULL;
+
+	m_StoredSampleCount = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// QuantiseHeights
+// Fills m_pQuantisedHeights from pHeights, row by row, with the 65536
+// steps spread evenly from minHeight to maxHeight, which must cover
+// all of them.
+//////////////////////////////////////////////////////////////////////
+void HeightField::QuantiseHeights( const float* pHeights, float minHeight, float maxHeight )
+{
+	m_HeightOffset = minHeight;
+	m_HeightScale = (maxHeight - minHeight) / USHRT_MAX;
+
+	float invScale = m_HeightScale > 0.0f ? 1.0f / m_HeightScale : 0.0f;
+
+	for( int l = 0; l < m_HeightMapLength; ++l )
+	{
+		for( int w = 0; w < m_HeightMapWidth; ++w )
+			m_pQuantisedHeights[GetStorageIndex(w, l)] = QuantiseHeight(pHeights[(l*m_HeightMapWidth)+w], m_HeightOffset, invScale);
+
+		AddLoadProgress(1);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// SetHeightStorage
+//////////////////////////////////////////////////////////////////////
+void HeightField::SetHeightStorage( HeightStorage storage )
+{
+	if( storage == m_HeightStorage )
+		return;
+
+	m_HeightStorage = storage;
+
+	if( !IsLoaded() )
+		return;
+
+	int sampleCount = m_HeightMapWidth * m_HeightMapLength;
+	std::vector<float> heights(sampleCount);
+
+	for( int i = 0; i < sampleCount; ++i )
+		heights[i] = GetSampleHeight(i);
+
+	CreateHeightMap(m_HeightMapWidth, m_HeightMapLength, m_GridSize, &heights[0]);
+
+	UpdateCollisionData(0, 0, m_HeightMapWidth-2, m_HeightMapLength-2);
+}
+
+//////////////////////////////////////////////////////////////////////
+// SetHeightLayout
+// Moves the stored samples as they are, so quantised heights aren't
+// quantised again.
+//////////////////////////////////////////////////////////////////////
+void HeightField::SetHeightLayout( HeightLayout layout )
+{
+	if( layout == m_HeightLayout )
+		return;
+
+	if( !IsLoaded() )
+	{
+		m_HeightLayout = layout;
+		return;
+	}
+
+	XMFLOAT4* pOldHeightMap = m_pHeightMap;
+	unsigned short* pOldQuantisedHeights = m_pQuantisedHeights;
+	HeightLayout oldLayout = m_HeightLayout;
+	int oldTilesAcross = m_TilesAcross;
+
+	m_pHeightMap = NULL;
+	m_pQuantisedHeights = NULL;
+	m_HeightLayout = layout;
+
+	AllocateHeightMap();
+
+	for( int l = 0; l < m_HeightMapLength; ++l )
+	{
+		for( int w = 0; w < m_HeightMapWidth; ++w )
+		{
+			int oldIndex = oldLayout == HEIGHT_LAYOUT_ROW_MAJOR ? (l*m_HeightMapWidth)+w : GetTiledIndex(w, l, oldTilesAcross);
+			int newIndex = GetStorageIndex(w, l);
+
+			if( m_pHeightMap )
+				m_pHeightMap[newIndex] = pOldHeightMap[oldIndex];
+			else
+				m_pQuantisedHeights[newIndex] = pOldQuantisedHeights[oldIndex];
+		}
+	}
+
+	if( !IsInMappedFile(pOldHeightMap) )
+		delete [] pOldHeightMap;
+
+	if( !IsInMappedFile(pOldQuantisedHeights) )
+		delete [] pOldQuantisedHeights;
+}
+
+size_t HeightField::GetSampleMemoryBytes() const
+{
+	if( m_pHeightMap )
+		return (size_t)m_StoredSampleCount * sizeof(XMFLOAT4);
+
+	if( m_pQuantisedHeights )
+		return (size_t)m_StoredSampleCount * sizeof(unsigned short);
+
+	return 0;
+}
+
+size_t HeightField::GetMemoryBytes() const
+{
+	size_t bytes = GetSampleMemoryBytes();
+
+	if( m_pQuadTree )
+		bytes += m_QuadTreeStats.memoryBytes;
+
+	if( m_pTrianglePackets )
+		bytes += (size_t)m_QuadLevelWidth[1]*m_QuadLevelLength[1]*sizeof(TrianglePacket);
+
+	if( m_pTriangleCache )
+		bytes += (size_t)m_HeightMapFaceCount*sizeof(CachedTriangle);
+
+	return bytes;
+}
+
+//////////////////////////////////////////////////////////////////////
+// GetSample
+// A sample's position, with w 0, from any storage and layout.
+//////////////////////////////////////////////////////////////////////
+XMVECTOR HeightField::GetSample( int mapIndex ) const
+{
+	int w = mapIndex%m_HeightMapWidth;
+	int l = mapIndex/m_HeightMapWidth;
+
+	if( m_pHeightMap )
+		return XMLoadFloat4(&m_pHeightMap[GetStorageIndex(w, l)]);
+
+	return XMVectorSet(GetSampleX(w), m_HeightOffset + (m_pQuantisedHeights[GetStorageIndex(w, l)] * m_HeightScale), GetSampleZ(l), 0.0f);
+}
+
+float HeightField::GetSampleHeight( int mapIndex ) const
+{
+	int index = m_HeightLayout == HEIGHT_LAYOUT_ROW_MAJOR ? mapIndex : GetStorageIndex(mapIndex%m_HeightMapWidth, mapIndex/m_HeightMapWidth);
+
+	if( m_pHeightMap )
+		return m_pHeightMap[index].y;
+
+	return m_HeightOffset + (m_pQuantisedHeights[index] * m_HeightScale);
+}
+
+//////////////////////////////////////////////////////////////////////
+// GetCellSamples
+// The four corners of cell (l, w), i0 to i3 as the faces use them.
+//////////////////////////////////////////////////////////////////////
+void HeightField::GetCellSamples( int l, int w, XMVECTOR& v0, XMVECTOR& v1, XMVECTOR& v2, XMVECTOR& v3 ) const
+{
+	int i0 = GetStorageIndex(w, l);
+	int i1 = GetStorageIndex(w, l+1);
+	int i2 = GetStorageIndex(w+1, l);
+	int i3 = GetStorageIndex(w+1, l+1);
+
+	if( m_pHeightMap )
+	{
+		v0 = XMLoadFloat4(&m_pHeightMap[i0]);
+		v1 = XMLoadFloat4(&m_pHeightMap[i1]);
+		v2 = XMLoadFloat4(&m_pHeightMap[i2]);
+		v3 = XMLoadFloat4(&m_pHeightMap[i3]);
+		return;
+	}
+
+	float x0 = GetSampleX(w);
+	float x1 = GetSampleX(w+1);
+	float z0 = GetSampleZ(l);
+	float z1 = GetSampleZ(l+1);
+
+	v0 = XMVectorSet(x0, m_HeightOffset + (m_pQuantisedHeights[i0] * m_HeightScale), z0, 0.0f);
+	v1 = XMVectorSet(x0, m_HeightOffset + (m_pQuantisedHeights[i1] * m_HeightScale), z1, 0.0f);
+	v2 = XMVectorSet(x1, m_HeightOffset + (m_pQuantisedHeights[i2] * m_HeightScale), z0, 0.0f);
+	v3 = XMVectorSet(x1, m_HeightOffset + (m_pQuantisedHeights[i3] * m_HeightScale), z1, 0.0f);
+}
+
+void HeightField::GetCellHeights( int l, int w, float& h0, float& h1, float& h2, float& h3 ) const
+{
+	int i0 = GetStorageIndex(w, l);
+	int i1 = GetStorageIndex(w, l+1);
+	int i2 = GetStorageIndex(w+1, l);
+	int i3 = GetStorageIndex(w+1, l+1);
+
+	if( m_pHeightMap )
+	{
+		h0 = m_pHeightMap[i0].y;
+		h1 = m_pHeightMap[i1].y;
+		h2 = m_pHeightMap[i2].y;
+		h3 = m_pHeightMap[i3].y;
+		return;
+	}
+
+	h0 = m_HeightOffset + (m_pQuantisedHeights[i0] * m_HeightScale);
+	h1 = m_HeightOffset + (m_pQuantisedHeights[i1] * m_HeightScale);
+	h2 = m_HeightOffset + (m_pQuantisedHeights[i2] * m_HeightScale);
+	h3 = m_HeightOffset + (m_pQuantisedHeights[i3] * m_HeightScale);
+}
+
+//////////////////////////////////////////////////////////////////////
+// BuildCollisionData
+// Everything the queries need on top of the samples themselves.
+//////////////////////////////////////////////////////////////////////
+void HeightField::BuildCollisionData( void )
+{
+	m_HeightMapFaceCount = (m_HeightMapLength-1)*(m_HeightMapWidth-1)*2;
+
+	BuildQuadTree();
+	SetTriangleKernel(TRIANGLE_KERNEL_PACKET);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+HeightField::~HeightField()
+{
+	FreeHeightMap();
+
+	if( !IsInMappedFile(m_pQuadTree) )
+		delete [] m_pQuadTree;
+
+	if( !IsInMappedFile(m_pTrianglePackets) )
+		FreeTrianglePackets(m_pTrianglePackets);
+
+	AlignedFree(m_pTriangleCache);
+
+	delete m_pMappedFile;
+}
+
+//////////////////////////////////////////////////////////////////////
+// LoadHeightMap
+// Original code sourced from rastertek.com, which only read 24 bit
+// bitmaps. The images ReadHeightImage understands are listed in
+// HeightImage.h.
+//////////////////////////////////////////////////////////////////////
+bool HeightField::LoadHeightMap(const char* filename, float gridSize, float heightRange )
+{
+	int width, length;
+	float* pHeights;
+
+	if( !ReadHeightImage(filename, heightRange, width, length, pHeights) )
+	{
+		return false;
+	}
+
+	// Create the structure to hold the height map data.
+	CreateHeightMap(width, length, gridSize, pHeights);
+
+	delete [] pHeights;
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// MapBinary
+// Maps a file written by SaveBinary and points the samples, quadtree and
+// packets at their sections of it. Anything missing or the wrong size for
+// the map is built as LoadHeightMap's maps are.
+//////////////////////////////////////////////////////////////////////
+bool HeightField::MapBinary( const char* filename )
+{
+	MappedFile* pFile = new MappedFile;
+
+	if( !pFile->Open(filename) || pFile->GetSize() < sizeof(HeightFieldFileHeader) )
+	{
+		delete pFile;
+		return false;
+	}
+
+	HeightFieldFileHeader header;
+	memcpy(&header, pFile->GetData(), sizeof header);
+
+	bool valid = memcmp(header.magic, HEIGHTFIELD_FILE_MAGIC, sizeof header.magic) == 0 &&
+				 header.version == HEIGHTFIELD_FILE_VERSION &&
+				 header.width >= 2 && header.length >= 2 &&
+				 (uint64_t)header.width * (uint64_t)header.length <= INT_MAX/4 &&
+				 (header.storage == HEIGHT_STORAGE_FLOAT4 || header.storage == HEIGHT_STORAGE_UINT16) &&
+				 (header.layout == HEIGHT_LAYOUT_ROW_MAJOR || header.layout == HEIGHT_LAYOUT_TILED) &&
+				 header.gridSize > 0.0f && isfinite(header.gridSize);
+
+	// Quantised heights are offset + scale * sample; a flat map has no scale
+	if( valid && header.storage == HEIGHT_STORAGE_UINT16 )
+		valid = isfinite(header.heightOffset) && header.heightScale >= 0.0f && isfinite(header.heightScale);
+
+	if( !valid )
+	{
+		delete pFile;
+		return false;
+	}
+
+	m_HeightMapWidth = header.width;
+	m_HeightMapLength = header.length;
+	m_GridSize = header.gridSize;
+	m_HeightStorage = (HeightStorage)header.storage;
+	m_HeightLayout = (HeightLayout)header.layout;
+	m_HeightOffset = header.heightOffset;
+	m_HeightScale = header.heightScale;
+
+	InitStoredSampleCount();
+
+	size_t sampleSize = m_HeightStorage == HEIGHT_STORAGE_UINT16 ? sizeof(unsigned short) : sizeof(XMFLOAT4);
+	unsigned char* pSamples = GetFileSection(*pFile, header.samplesOffset, header.samplesBytes, (size_t)m_StoredSampleCount * sampleSize);
+
+	if( !pSamples )
+	{
+		m_HeightMapWidth = 0;
+		m_HeightMapLength = 0;
+		delete pFile;
+		return false;
+	}
+
+	m_pMappedFile = pFile;
+
+	if( m_HeightStorage == HEIGHT_STORAGE_UINT16 )
+		m_pQuantisedHeights = (unsigned short*)pSamples;
+	else
+		m_pHeightMap = (XMFLOAT4*)pSamples;
+
+	BeginLoadProgress();
+	AddLoadProgress(m_HeightMapLength);
+
+	m_HeightMapFaceCount = (m_HeightMapLength-1)*(m_HeightMapWidth-1)*2;
+
+	int nodeCount = InitQuadTreeLevels();
+	m_pQuadTree = (MinMax*)GetFileSection(*pFile, header.quadTreeOffset, header.quadTreeBytes, nodeCount * sizeof(MinMax));
+
+	if( m_pQuadTree )
+	{
+		m_QuadTreeStats.levels = m_QuadTreeLevels;
+		m_QuadTreeStats.nodeCount = nodeCount;
+		m_QuadTreeStats.memoryBytes = nodeCount * sizeof(MinMax);
+		m_QuadTreeStats.buildTimeMs = 0.0;
+
+		AddLoadProgress(m_HeightMapLength-1);
+	}
+	else
+	{
+		BuildQuadTree();
+	}
+
+	if( m_QuadTreeLevels >= 2 )
+		m_pTrianglePackets = (TrianglePacket*)GetFileSection(*pFile, header.packetsOffset, header.packetsBytes, m_QuadLevelWidth[1]*m_QuadLevelLength[1]*sizeof(TrianglePacket));
+
+	if( m_pTrianglePackets )
+		AddLoadProgress(m_HeightMapLength-1);
+
+	SetTriangleKernel(TRIANGLE_KERNEL_PACKET);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// SaveBinary
+//////////////////////////////////////////////////////////////////////
+bool HeightField::SaveBinary( const char* filename, bool withCollisionData ) const
+{
+	if( !IsLoaded() )
+		return false;
+
+	HeightFieldFileHeader header;
+	memset(&header, 0, sizeof header);
+
+	memcpy(header.magic, HEIGHTFIELD_FILE_MAGIC, sizeof header.magic);
+	header.version = HEIGHTFIELD_FILE_VERSION;
+	header.width = m_HeightMapWidth;
+	header.length = m_HeightMapLength;
+	header.gridSize = m_GridSize;
+	header.storage = m_HeightStorage;
+	header.layout = m_HeightLayout;
+	header.heightOffset = m_HeightOffset;
+	header.heightScale = m_HeightScale;
+
+	const void* pSamples = m_pHeightMap ? (const void*)m_pHeightMap : (const void*)m_pQuantisedHeights;
+	size_t sampleBytes = GetSampleMemoryBytes();
+	size_t quadTreeBytes = withCollisionData && m_pQuadTree ? m_QuadTreeStats.nodeCount * sizeof(MinMax) : 0;
+	size_t packetsBytes = withCollisionData && m_pTrianglePackets ? m_QuadLevelWidth[1]*m_QuadLevelLength[1]*sizeof(TrianglePacket) : 0;
+
+	// Sections that aren't saved are left at offset 0, size 0
+	uint64_t offset = AlignFileOffset(sizeof header);
+
+	header.samplesOffset = offset;
+	header.samplesBytes = sampleBytes;
+	offset = AlignFileOffset(offset + sampleBytes);
+
+	if( quadTreeBytes )
+	{
+		header.quadTreeOffset = offset;
+		header.quadTreeBytes = quadTreeBytes;
+		offset = AlignFileOffset(offset + quadTreeBytes);
+	}
+
+	if( packetsBytes )
+	{
+		header.packetsOffset = offset;
+		header.packetsBytes = packetsBytes;
+	}
+
+	FILE* pFile = fopen(filename, "wb");
+
+	if( !pFile )
+		return false;
+
+	bool written = WriteFileSection(pFile, 0, &header, sizeof header) &&
+				   WriteFileSection(pFile, header.samplesOffset, pSamples, sampleBytes) &&
+				   WriteFileSection(pFile, header.quadTreeOffset, m_pQuadTree, quadTreeBytes) &&
+				   WriteFileSection(pFile, header.packetsOffset, m_pTrianglePackets, packetsBytes);
+
+	if( fclose(pFile) != 0 )
+		written = false;
+
+	return written;
+}
+
+bool HeightField::IsInMappedFile( const void* p ) const
+{
+	return m_pMappedFile && m_pMappedFile->Contains(p);
+}
+
+//////////////////////////////////////////////////////////////////////
+// GetFaceSamples
+// The three sample indices of a face, in the order RayTriangle takes them.
+//////////////////////////////////////////////////////////////////////
+void HeightField::GetFaceSamples( int faceIndex, int* pSampleIndices ) const
+{
+	int cell = faceIndex/2;
+	int mapIndex = ((cell/(m_HeightMapWidth-1))*m_HeightMapWidth) + (cell%(m_HeightMapWidth-1));
+
+	if( faceIndex%2 == 0 )
+	{
+		pSampleIndices[0] = mapIndex;
+		pSampleIndices[1] = mapIndex+m_HeightMapWidth;
+		pSampleIndices[2] = mapIndex+1;
+	}
+	else
+	{
+		pSampleIndices[0] = mapIndex+1;
+		pSampleIndices[1] = mapIndex+m_HeightMapWidth;
+		pSampleIndices[2] = mapIndex+m_HeightMapWidth+1;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// Function:	FindGroundCell
+// Description: Finds the cell under (x, z), and where in it (x, z) is
+// Parameters:
+//				cellW		Column of the cell (returned)
+//				cellL		Row of the cell (returned)
+//				cellU		0 to 1 across the cell in x (returned)
+//				cellV		0 to 1 across the cell in z (returned)
+// Returns: 	true if (x, z) is over the map. If not, the results are for the nearest point
+//				on the edge of the map.
+
+bool HeightField::FindGroundCell( float x, float z, int& cellW, int& cellL, float& cellU, float& cellV ) const
+{
+	float lastU = (float)(m_HeightMapWidth - 1);
+	float lastV = (float)(m_HeightMapLength - 1);
+
+	float u = (x - GetSampleX(0)) / m_GridSize;
+	float v = (z - GetSampleZ(0)) / m_GridSize;
+
+	// Written this way round so NaNs are off the map and clamp to 0
+	bool onMap = u >= 0.0f && u <= lastU && v >= 0.0f && v <= lastV;
+
+	u = std::min(std::max(0.0f, u), lastU);
+	v = std::min(std::max(0.0f, v), lastV);
+
+	// The far edges belong to the last cells
+	float w = std::min(floorf(u), lastU - 1.0f);
+	float l = std::min(floorf(v), lastV - 1.0f);
+
+	cellW = (int)w;
+	cellL = (int)l;
+	cellU = u - w;
+	cellV = v - l;
+
+	return onMap;
+}
+
+// Function:	GetGroundAt
+// Description: Interpolates the height of the triangle under (x, z), split the same way as
+//				RebuildVertexData and the collision queries split each cell
+// Notes:		The 012 triangle covers cellU + cellV <= 1 and the 213 triangle the rest.
+//				Both are written as a corner height plus a slope along each axis, which also
+//				gives the normal directly: (-slopeU, gridSize, -slopeV), normalised.
+//				GetGroundBatch does exactly the same sums in the same order.
+
+bool HeightField::GetGroundAt( float x, float z, float& height, XMFLOAT3& normal ) const
+{
+	if( !IsLoaded() || m_HeightMapFaceCount == 0 )
+		return false;
+
+	int cellW, cellL;
+	float cellU, cellV;
+
+	bool onMap = FindGroundCell(x, z, cellW, cellL, cellU, cellV);
+
+	float h0, h1, h2, h3;
+	GetCellHeights(cellL, cellW, h0, h1, h2, h3);
+
+	float corner, slopeU, slopeV;
+
+	if( cellU + cellV > 1.0f )
+	{
+		// 213, from vertex 3
+		corner = h3;
+		slopeU = h3 - h1;
+		slopeV = h3 - h2;
+		cellU = cellU - 1.0f;
+		cellV = cellV - 1.0f;
+	}
+	else
+	{
+		// 012, from vertex 0
+		corner = h0;
+		slopeU = h2 - h0;
+		slopeV = h1 - h0;
+	}
+
+	height = (corner + (cellU * slopeU)) + (cellV * slopeV);
+
+	float nx = -slopeU;
+	float ny = m_GridSize;
+	float nz = -slopeV;
+	float length = sqrtf(((nx * nx) + (ny * ny)) + (nz * nz));
+
+	normal.x = nx / length;
+	normal.y = ny / length;
+	normal.z = nz / length;
+
+	return onMap;
+}
+
+bool HeightField::GetHeightAt( float x, float z, float& height ) const
+{
+	XMFLOAT3 normal;
+	return GetGroundAt(x, z, height, normal);
+}
+
+bool HeightField::GetNormalAt( float x, float z, XMFLOAT3& normal ) const
+{
+	float height;
+	return GetGroundAt(x, z, height, normal);
+}
+
+int HeightField::GetFaceAt( float x, float z ) const
+{
+	if( !IsLoaded() || m_HeightMapFaceCount == 0 )
+		return -1;
+
+	int cellW, cellL;
+	float cellU, cellV;
+
+	if( !FindGroundCell(x, z, cellW, cellL, cellU, cellV) )
+		return -1;
+
+	// Split as GetGroundAt splits it: 012 is half 0, 213 half 1
+	return GetFaceIndex((cellL*m_HeightMapWidth)+cellW, cellU + cellV > 1.0f ? 1 : 0);
+}
+
+// Function:	GetGroundBatch
+// Description: GetGroundAt for many points, four at a time
+// Notes:		Only fetching the four heights of each cell is done a point at a time; finding
+//				the cells and the interpolation and normalisation are done with DirectXMath
+//				on four points at once. The last count%4 points go through GetGroundAt.
+
+int HeightField::GetGroundBatch( int count, const float* pX, const float* pZ, float* pHeights, float* pNormX, float* pNormY, float* pNormZ, unsigned char* pOnMap ) const
+{
+	if( !IsLoaded() || m_HeightMapFaceCount == 0 )
+		return 0;
+
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR one = XMVectorSplatOne();
+	const XMVECTOR originX = XMVectorReplicate(GetSampleX(0));
+	const XMVECTOR originZ = XMVectorReplicate(GetSampleZ(0));
+	const XMVECTOR gridSize = XMVectorReplicate(m_GridSize);
+	const XMVECTOR lastU = XMVectorReplicate((float)(m_HeightMapWidth - 1));
+	const XMVECTOR lastV = XMVectorReplicate((float)(m_HeightMapLength - 1));
+	const XMVECTOR lastCellU = XMVectorReplicate((float)(m_HeightMapWidth - 2));
+	const XMVECTOR lastCellV = XMVectorReplicate((float)(m_HeightMapLength - 2));
+
+	int onMapCount = 0;
+	int i = 0;
+
+	for( ; i + 4 <= count; i += 4 )
+	{
+		XMVECTOR u = XMVectorDivide(XMVectorSubtract(XMLoadFloat4((const XMFLOAT4*)&pX[i]), originX), gridSize);
+		XMVECTOR v = XMVectorDivide(XMVectorSubtract(XMLoadFloat4((const XMFLOAT4*)&pZ[i]), originZ), gridSize);
+
+		XMVECTOR onMap = XMVectorAndInt(XMVectorAndInt(XMVectorGreaterOrEqual(u, zero), XMVectorLessOrEqual(u, lastU)),
+										XMVectorAndInt(XMVectorGreaterOrEqual(v, zero), XMVectorLessOrEqual(v, lastV)));
+
+		// Max(NaN, 0) is 0, as in FindGroundCell
+		u = XMVectorMin(XMVectorMax(u, zero), lastU);
+		v = XMVectorMin(XMVectorMax(v, zero), lastV);
+
+		XMVECTOR w = XMVectorMin(XMVectorFloor(u), lastCellU);
+		XMVECTOR l = XMVectorMin(XMVectorFloor(v), lastCellV);
+		XMVECTOR cellU = XMVectorSubtract(u, w);
+		XMVECTOR cellV = XMVectorSubtract(v, l);
+
+		XMFLOAT4A cellW, cellL;
+		XMStoreFloat4A(&cellW, w);
+		XMStoreFloat4A(&cellL, l);
+
+		XMFLOAT4A h0, h1, h2, h3;
+		float* apH0 = &h0.x;
+		float* apH1 = &h1.x;
+		float* apH2 = &h2.x;
+		float* apH3 = &h3.x;
+		const float* apW = &cellW.x;
+		const float* apL = &cellL.x;
+
+		for( int lane = 0; lane < 4; ++lane )
+			GetCellHeights((int)apL[lane], (int)apW[lane], apH0[lane], apH1[lane], apH2[lane], apH3[lane]);
+
+		XMVECTOR vH0 = XMLoadFloat4A(&h0);
+		XMVECTOR vH1 = XMLoadFloat4A(&h1);
+		XMVECTOR vH2 = XMLoadFloat4A(&h2);
+		XMVECTOR vH3 = XMLoadFloat4A(&h3);
+
+		// 213 where set, 012 where not
+		XMVECTOR upper = XMVectorGreater(XMVectorAdd(cellU, cellV), one);
+
+		XMVECTOR corner = XMVectorSelect(vH0, vH3, upper);
+		XMVECTOR slopeU = XMVectorSelect(XMVectorSubtract(vH2, vH0), XMVectorSubtract(vH3, vH1), upper);
+		XMVECTOR slopeV = XMVectorSelect(XMVectorSubtract(vH1, vH0), XMVectorSubtract(vH3, vH2), upper);
+		cellU = XMVectorSelect(cellU, XMVectorSubtract(cellU, one), upper);
+		cellV = XMVectorSelect(cellV, XMVectorSubtract(cellV, one), upper);
+
+		XMVECTOR height = XMVectorAdd(XMVectorAdd(corner, XMVectorMultiply(cellU, slopeU)), XMVectorMultiply(cellV, slopeV));
+		XMStoreFloat4((XMFLOAT4*)&pHeights[i], height);
+
+		if( pNormX || pNormY || pNormZ )
+		{
+			XMVECTOR nx = XMVectorNegate(slopeU);
+			XMVECTOR nz = XMVectorNegate(slopeV);
+			XMVECTOR lengthSq = XMVectorAdd(XMVectorAdd(XMVectorMultiply(nx, nx), XMVectorMultiply(gridSize, gridSize)), XMVectorMultiply(nz, nz));
+			XMVECTOR length = XMVectorSqrt(lengthSq);
+
+			if( pNormX )
+				XMStoreFloat4((XMFLOAT4*)&pNormX[i], XMVectorDivide(nx, length));
+			if( pNormY )
+				XMStoreFloat4((XMFLOAT4*)&pNormY[i], XMVectorDivide(gridSize, length));
+			if( pNormZ )
+				XMStoreFloat4((XMFLOAT4*)&pNormZ[i], XMVectorDivide(nz, length));
+		}
+
+		uint32_t apOnMap[4];
+		XMStoreInt4(apOnMap, onMap);
+
+		for( int lane = 0; lane < 4; ++lane )
+		{
+			if( apOnMap[lane] )
+				++onMapCount;
+
+			if( pOnMap )
+				pOnMap[i+lane] = apOnMap[lane] ? 1 : 0;
+		}
+	}
+
+	for( ; i < count; ++i )
+	{
+		XMFLOAT3 normal(0.0f, 1.0f, 0.0f);
+		bool onMap = GetGroundAt(pX[i], pZ[i], pHeights[i], normal);
+
+		if( pNormX )
+			pNormX[i] = normal.x;
+		if( pNormY )
+			pNormY[i] = normal.y;
+		if( pNormZ )
+			pNormZ[i] = normal.z;
+
+		if( onMap )
+			++onMapCount;
+
+		if( pOnMap )
+			pOnMap[i] = onMap ? 1 : 0;
+	}
+
+	return onMapCount;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+
+bool HeightField::PointOverQuad(XMVECTOR& vPos, XMVECTOR& v0, XMVECTOR& v1, XMVECTOR& v2)
+{
+	if (XMVectorGetX(vPos) < std::max(XMVectorGetX(v1), XMVectorGetX(v2)) && XMVectorGetX(vPos) > std::min(XMVectorGetX(v1), XMVectorGetX(v2)))
+		if (XMVectorGetZ(vPos) < std::max(XMVectorGetZ(v1), XMVectorGetZ(v2)) && XMVectorGetZ(vPos) > std::min(XMVectorGetZ(v1), XMVectorGetZ(v2)))
+			return true;
+
+	return false;
+}
+
+bool HeightField::RayCollision(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, RayHit& hit, QueryStats* pStats) const
+{
+	XMVECTOR colPos, colNormN;
+	int colIndex = 0;
+	int colHalf = 0;
+
+	QueryStats stats;
+	stats.nodesVisited = 0;
+	stats.cellsTested = 0;
+
+	bool collided = FindRayCollision(rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+
+	if( collided )
+		FillRayHit(rayPos, rayDir, colPos, colNormN, GetFaceIndex(colIndex, colHalf), hit);
+
+	if( pStats )
+		*pStats = stats;
+
+	return collided;
+}
+
+//////////////////////////////////////////////////////////////////////
+// FillRayHit
+// Works out the rest of a RayHit from where the search found it.
+//////////////////////////////////////////////////////////////////////
+void HeightField::FillRayHit(const XMVECTOR& rayPos, const XMVECTOR& rayDir, const XMVECTOR& colPos, const XMVECTOR& colNormN, int faceIndex, RayHit& hit) const
+{
+	int aSamples[3];
+	GetFaceSamples(faceIndex, aSamples);
+
+	XMFLOAT3 s0, s1, s2;
+	XMStoreFloat3(&s0, GetSample(aSamples[0]));
+	XMStoreFloat3(&s1, GetSample(aSamples[1]));
+	XMStoreFloat3(&s2, GetSample(aSamples[2]));
+
+	hit.triangle = faceIndex;
+	hit.distance = XMVectorGetX(XMVector3Dot(colPos - rayPos, XMVector3Normalize(rayDir)));
+	XMStoreFloat3(&hit.position, colPos);
+	XMStoreFloat3(&hit.normal, colNormN);
+
+	// No heightmap triangle stands on its edge, so the barycentrics can be
+	// worked out from x and z alone
+	float e1x = s1.x - s0.x;
+	float e1z = s1.z - s0.z;
+	float e2x = s2.x - s0.x;
+	float e2z = s2.z - s0.z;
+	float px = hit.position.x - s0.x;
+	float pz = hit.position.z - s0.z;
+
+	float det = (e1x * e2z) - (e2x * e1z);
+
+	hit.u = ((px * e2z) - (e2x * pz)) / det;
+	hit.v = ((e1x * pz) - (px * e1z)) / det;
+}
+
+// Function:	RayCollisionBatch
+// Description: Tests many rays for intersection with the heightmap, reading them from and
+//				writing the results to caller-provided structure-of-arrays buffers
+// Parameters:
+//				rays		Origins, directions and maximum distances of rayCount rays
+//				results		Buffers to receive rayCount results (see RayBatchOutput)
+//				rayCount	Number of rays
+//				pStats		Totals for the whole batch (optional)
+// Returns: 	The number of rays that hit
+
+int HeightField::RayCollisionBatch(const RayBatchInput& rays, const RayBatchOutput& results, int rayCount, QueryStats* pStats) const
+{
+	QueryStats stats;
+	stats.nodesVisited = 0;
+	stats.cellsTested = 0;
+
+	int hitCount = 0;
+
+	for( int i = 0; i < rayCount; ++i )
+	{
+		XMVECTOR rayPos = XMVectorSet(rays.pOriginX[i], rays.pOriginY[i], rays.pOriginZ[i], 0.0f);
+		XMVECTOR rayDir = XMVectorSet(rays.pDirX[i], rays.pDirY[i], rays.pDirZ[i], 0.0f);
+		XMVECTOR colPos, colNormN;
+		int colIndex = 0;
+		int colHalf = 0;
+
+		bool collided = FindRayCollision(rayPos, rayDir, rays.pMaxDist[i], colPos, colNormN, colIndex, colHalf, stats);
+
+		if( results.pHit )
+			results.pHit[i] = collided ? 1 : 0;
+
+		if( results.pTriangle )
+			results.pTriangle[i] = collided ? GetFaceIndex(colIndex, colHalf) : -1;
+
+		if( !collided )
+			continue;
+
+		++hitCount;
+
+		if( results.pPosX )
+			results.pPosX[i] = XMVectorGetX(colPos);
+		if( results.pPosY )
+			results.pPosY[i] = XMVectorGetY(colPos);
+		if( results.pPosZ )
+			results.pPosZ[i] = XMVectorGetZ(colPos);
+
+		if( results.pNormX )
+			results.pNormX[i] = XMVectorGetX(colNormN);
+		if( results.pNormY )
+			results.pNormY[i] = XMVectorGetY(colNormN);
+		if( results.pNormZ )
+			results.pNormZ[i] = XMVectorGetZ(colNormN);
+
+		if( results.pDistance )
+			results.pDistance[i] = XMVectorGetX(XMVector3Dot(colPos - rayPos, XMVector3Normalize(rayDir)));
+	}
+
+	if( pStats )
+		*pStats = stats;
+
+	return hitCount;
+}
+
+// One thread's totals, padded so they don't share a cache line
+struct RayBatchTotals
+{
+	HeightField::QueryStats stats;
+	int hitCount;
+	char padding[64 - sizeof(HeightField::QueryStats) - sizeof(int)];
+};
+
+struct RayBatchJob
+{
+	const HeightField* pField;
+	const HeightField::RayBatchInput* pRays;
+	const HeightField::RayBatchOutput* pResults;
+	RayBatchTotals* pTotals;
+};
+
+template <typename T>
+static T* OffsetOrNull( T* p, int offset ) { return p ? p + offset : NULL; }
+
+static void RayBatchChunk( void* pContext, int first, int last, int thread )
+{
+	const RayBatchJob& job = *(const RayBatchJob*)pContext;
+
+	HeightField::RayBatchInput rays;
+	rays.pOriginX = job.pRays->pOriginX + first;
+	rays.pOriginY = job.pRays->pOriginY + first;
+	rays.pOriginZ = job.pRays->pOriginZ + first;
+	rays.pDirX = job.pRays->pDirX + first;
+	rays.pDirY = job.pRays->pDirY + first;
+	rays.pDirZ = job.pRays->pDirZ + first;
+	rays.pMaxDist = job.pRays->pMaxDist + first;
+
+	HeightField::RayBatchOutput results;
+	results.pHit = OffsetOrNull(job.pResults->pHit, first);
+	results.pPosX = OffsetOrNull(job.pResults->pPosX, first);
+	results.pPosY = OffsetOrNull(job.pResults->pPosY, first);
+	results.pPosZ = OffsetOrNull(job.pResults->pPosZ, first);
+	results.pNormX = OffsetOrNull(job.pResults->pNormX, first);
+	results.pNormY = OffsetOrNull(job.pResults->pNormY, first);
+	results.pNormZ = OffsetOrNull(job.pResults->pNormZ, first);
+	results.pDistance = OffsetOrNull(job.pResults->pDistance, first);
+	results.pTriangle = OffsetOrNull(job.pResults->pTriangle, first);
+
+	HeightField::QueryStats stats;
+	RayBatchTotals& totals = job.pTotals[thread];
+
+	totals.hitCount += job.pField->RayCollisionBatch(rays, results, last - first, &stats);
+	totals.stats.nodesVisited += stats.nodesVisited;
+	totals.stats.cellsTested += stats.cellsTested;
+}
+
+// Function:	RayCollisionBatch
+// Description: As above, but with the rays split into chunks and tested on pool's threads
+// Parameters:
+//				pool		Threads to run the chunks on, including the calling one
+//				chunkSize	Rays per chunk. Smaller chunks balance better, bigger ones cost
+//							less to hand out.
+// Returns: 	The number of rays that hit
+
+int HeightField::RayCollisionBatch(const RayBatchInput& rays, const RayBatchOutput& results, int rayCount, QueryThreadPool& pool, QueryStats* pStats, int chunkSize) const
+{
+	std::vector<RayBatchTotals> totals(pool.GetThreadCount());
+	memset(&totals[0], 0, totals.size() * sizeof totals[0]);
+
+	RayBatchJob job;
+	job.pField = this;
+	job.pRays = &rays;
+	job.pResults = &results;
+	job.pTotals = &totals[0];
+
+	pool.ParallelFor(rayCount, chunkSize, RayBatchChunk, &job);
+
+	QueryStats stats;
+	stats.nodesVisited = 0;
+	stats.cellsTested = 0;
+
+	int hitCount = 0;
+
+	for( size_t i = 0; i < totals.size(); ++i )
+	{
+		stats.nodesVisited += totals[i].stats.nodesVisited;
+		stats.cellsTested += totals[i].stats.cellsTested;
+		hitCount += totals[i].hitCount;
+	}
+
+	if( pStats )
+		*pStats = stats;
+
+	return hitCount;
+}
+
+// Function:	FindRayCollision
+// Description: Runs the search for the current collision mode
+
+bool HeightField::FindRayCollision(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const
+{
+	if( !IsLoaded() )
+		return false;
+
+	switch( m_CollisionMode )
+	{
+		case COLLISION_BRUTE_FORCE:
+			return RayCollisionBruteForce(rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+		case COLLISION_GRID_WALK:
+			return RayCollisionGridWalk(rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+		case COLLISION_QUADTREE:
+			return RayCollisionQuadTree(rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+	}
+
+	return false;
+}
+
+// Function:	RayCollisionBruteForce
+// Description: Tests a ray for intersection with every triangle in the heightmap
+// Returns: 	true on the first hit, with colIndex set to the map index of the hit cell's
+//				first vertex and colHalf to the triangle within it (0 for 012, 1 for 213)
+
+bool HeightField::RayCollisionBruteForce(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const
+{
+	// This is a brute force solution that checks against every triangle in the heightmap
+	for( int l = 0; l < m_HeightMapLength-1; ++l )
+	{
+		for( int w = 0; w < m_HeightMapWidth-1; ++w )
+		{	
+			++stats.cellsTested;
+
+			if( RayCell( l, w, rayPos, rayDir, raySpeed, colPos, colNormN, colHalf ) )
+			{
+				colIndex = (l*m_HeightMapWidth)+w;
+				return true;
+			}
+		}
+	
+	}
+
+	return false;
+}
+
+// Function:	RayCollisionGridWalk
+// Description: Tests a ray for intersection with the heightmap, only visiting the cells
+//				that the ray segment [rayPos, rayPos + |rayDir|*raySpeed] passes over
+// Notes:		Cells are visited in the same row-by-row order as the brute force loop and
+//				every triangle the segment can hit lies in a visited cell, so the first hit
+//				found is the same triangle (and the same bits) the brute force loop returns.
+
+bool HeightField::RayCollisionGridWalk(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const
+{
+	RaySegment seg;
+	MakeRaySegment(rayPos, rayDir, raySpeed, seg);
+
+	float lastCellU = (float)(m_HeightMapWidth - 2);
+	float lastCellV = (float)(m_HeightMapLength - 2);
+
+	float vMin = std::min(seg.v0, seg.v1) - EDGE_TOLERANCE;
+	float vMax = std::max(seg.v0, seg.v1) + EDGE_TOLERANCE;
+
+	// Completely off the map (this also rejects NaNs)
+	if( !(vMax >= 0.0f && vMin < lastCellV + 1.0f) )
+		return false;
+
+	int lFirst = (int)floorf(std::max(vMin, 0.0f));
+	int lLast = (int)floorf(std::min(vMax, lastCellV));
+
+	for( int l = lFirst; l <= lLast; ++l )
+	{
+		// Clip the segment to this row of cells to find the columns it covers
+		float tA, tB;
+
+		if( !ClipRaySegment(seg, -FLT_MAX, (float)l, FLT_MAX, (float)(l + 1), tA, tB) )
+			continue;
+
+		float uA = seg.u0 + (seg.u1 - seg.u0) * tA;
+		float uB = seg.u0 + (seg.u1 - seg.u0) * tB;
+
+		float uMin = std::min(uA, uB) - EDGE_TOLERANCE;
+		float uMax = std::max(uA, uB) + EDGE_TOLERANCE;
+
+		if( !(uMax >= 0.0f && uMin < lastCellU + 1.0f) )
+			continue;
+
+		int wFirst = (int)floorf(std::max(uMin, 0.0f));
+		int wLast = (int)floorf(std::min(uMax, lastCellU));
+
+		for( int w = wFirst; w <= wLast; ++w )
+		{
+			++stats.cellsTested;
+
+			if( RayCell( l, w, rayPos, rayDir, raySpeed, colPos, colNormN, colHalf ) )
+			{
+				colIndex = (l*m_HeightMapWidth)+w;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+// Function:	RayCollisionQuadTree
+// Description: Tests a ray for intersection with the heightmap by descending the min/max
+//				quadtree, skipping any node the ray segment misses or passes above/below
+// Notes:		Returns the hit with the lowest map index, i.e. the same one the brute force
+//				loop finds first. With TRIANGLE_KERNEL_REFERENCE it's bit for bit the same hit.
+
+bool HeightField::RayCollisionQuadTree(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const
+{
+	if( !m_pQuadTree )
+		return RayCollisionGridWalk(rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+
+	RaySegment seg;
+	MakeRaySegment(rayPos, rayDir, raySpeed, seg);
+
+	colIndex = INT_MAX;
+
+	RayQuadNode(m_QuadTreeLevels-1, 0, 0, seg, rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+
+	return colIndex != INT_MAX;
+}
+
+void HeightField::RayQuadNode(int level, int x, int z, const RaySegment& seg, const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const
+{
+	int cellX0 = x << level;
+	int cellZ0 = z << level;
+
+	// Everything in this node comes after the best hit so far in brute force order
+	if( (cellZ0*m_HeightMapWidth)+cellX0 >= colIndex )
+		return;
+
+	++stats.nodesVisited;
+
+	int cellX1 = std::min((x+1) << level, m_HeightMapWidth-1);
+	int cellZ1 = std::min((z+1) << level, m_HeightMapLength-1);
+
+	// Does the segment pass over this node at all?
+	float tA, tB;
+
+	if( !ClipRaySegment(seg, (float)cellX0, (float)cellZ0, (float)cellX1, (float)cellZ1, tA, tB) )
+		return;
+
+	// And is it within the node's height range while it does?
+	const MinMax& node = m_pQuadTree[m_QuadLevelOffset[level] + (z*m_QuadLevelWidth[level]) + x];
+
+	float yA = seg.y0 + (seg.y1 - seg.y0) * tA;
+	float yB = seg.y0 + (seg.y1 - seg.y0) * tB;
+
+	if( std::max(yA, yB) + HEIGHT_TOLERANCE < node.minY || std::min(yA, yB) - HEIGHT_TOLERANCE > node.maxY )
+		return;
+
+	if( level == 1 && m_TriangleKernel == TRIANGLE_KERNEL_PACKET )
+	{
+		RayBlockPacket(x, z, seg, colPos, colNormN, colIndex, colHalf, stats);
+		return;
+	}
+
+	if( level == 0 )
+	{
+		XMVECTOR cellColPos, cellColNormN;
+		int cellColHalf;
+
+		++stats.cellsTested;
+
+		if( RayCell( cellZ0, cellX0, rayPos, rayDir, raySpeed, cellColPos, cellColNormN, cellColHalf ) )
+		{
+			colIndex = (cellZ0*m_HeightMapWidth)+cellX0;
+			colHalf = cellColHalf;
+			colPos = cellColPos;
+			colNormN = cellColNormN;
+		}
+
+		return;
+	}
+
+	// Children in brute force order, so the lowest index hit tends to be found first
+	int childLevel = level-1;
+	int childX = x*2;
+	int childZ = z*2;
+
+	RayQuadNode(childLevel, childX, childZ, seg, rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+
+	if( childX+1 < m_QuadLevelWidth[childLevel] )
+		RayQuadNode(childLevel, childX+1, childZ, seg, rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+
+	if( childZ+1 < m_QuadLevelLength[childLevel] )
+	{
+		RayQuadNode(childLevel, childX, childZ+1, seg, rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+
+		if( childX+1 < m_QuadLevelWidth[childLevel] )
+			RayQuadNode(childLevel, childX+1, childZ+1, seg, rayPos, rayDir, raySpeed, colPos, colNormN, colIndex, colHalf, stats);
+	}
+}
+
+// Function:	RayBlockPacket
+// Description: Tests a ray against all eight triangles of the 2x2 block of cells under
+//				level 1 quadtree node (x, z) with a single call to the packet kernel
+
+void HeightField::RayBlockPacket(int x, int z, const RaySegment& seg, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const
+{
+	const TrianglePacket& tris = m_pTrianglePackets[(z*m_QuadLevelWidth[1])+x];
+
+	stats.cellsTested += std::min(2, m_HeightMapWidth-1-(x*2)) * std::min(2, m_HeightMapLength-1-(z*2));
+
+	float dist[TRIANGLE_PACKET_SIZE];
+	unsigned hitMask = m_pPacketKernel(seg.packetRay, tris, dist);
+
+	// Lanes are in brute force order, so the lowest one that hit is the one to keep
+	for( int lane = 0; lane < TRIANGLE_PACKET_SIZE; ++lane )
+	{
+		if( !(hitMask & (1 << lane)) )
+			continue;
+
+		int cell = lane/2;
+		int mapIndex = (((z*2)+(cell/2))*m_HeightMapWidth) + (x*2)+(cell%2);
+
+		if( mapIndex >= colIndex )
+			return;
+
+		XMVECTOR rayPos = XMVectorSet(seg.packetRay.pos[0], seg.packetRay.pos[1], seg.packetRay.pos[2], 0.0f);
+		XMVECTOR rayDirN = XMVectorSet(seg.packetRay.dirN[0], seg.packetRay.dirN[1], seg.packetRay.dirN[2], 0.0f);
+		XMVECTOR e1 = XMVectorSet(tris.e1x[lane], tris.e1y[lane], tris.e1z[lane], 0.0f);
+		XMVECTOR e2 = XMVectorSet(tris.e2x[lane], tris.e2y[lane], tris.e2z[lane], 0.0f);
+
+		colIndex = mapIndex;
+		colHalf = lane%2;
+		colPos = rayPos + (dist[lane] * rayDirN);
+
+		// Same winding as RayTriangle: (vert0 - vert1) x (vert2 - vert1) = E2 x E1
+		colNormN = XMVector3Normalize(XMVector3Cross(e2, e1));
+		return;
+	}
+}
+
+// Function:	MakeRaySegment
+// Description: Converts the segment [rayPos, rayPos + |rayDir|*raySpeed] into grid coordinates,
+//				where cell (l, w) covers u = [w, w+1] and v = [l, l+1]
+
+void HeightField::MakeRaySegment(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, RaySegment& seg) const
+{
+	// RayTriangle normalises rayDir, so raySpeed is a distance along the unit direction
+	XMVECTOR rayEnd = rayPos + (raySpeed * XMVector3Normalize(rayDir));
+
+	seg.u0 = (XMVectorGetX(rayPos) - GetSampleX(0)) / m_GridSize;
+	seg.v0 = (XMVectorGetZ(rayPos) - GetSampleZ(0)) / m_GridSize;
+	seg.y0 = XMVectorGetY(rayPos);
+	seg.u1 = (XMVectorGetX(rayEnd) - GetSampleX(0)) / m_GridSize;
+	seg.v1 = (XMVectorGetZ(rayEnd) - GetSampleZ(0)) / m_GridSize;
+	seg.y1 = XMVectorGetY(rayEnd);
+
+	XMVECTOR rayDirN = XMVector3Normalize(rayDir);
+
+	seg.packetRay.pos[0] = XMVectorGetX(rayPos);
+	seg.packetRay.pos[1] = XMVectorGetY(rayPos);
+	seg.packetRay.pos[2] = XMVectorGetZ(rayPos);
+	seg.packetRay.dirN[0] = XMVectorGetX(rayDirN);
+	seg.packetRay.dirN[1] = XMVectorGetY(rayDirN);
+	seg.packetRay.dirN[2] = XMVectorGetZ(rayDirN);
+	seg.packetRay.maxDist = raySpeed;
+}
+
+// Function:	ClipRaySegment
+// Description: Clips a segment to the grid rectangle [uMin, uMax] x [vMin, vMax], widened by EDGE_TOLERANCE
+// Returns: 	true if any of the segment lies inside, with [tA, tB] the part that does (0 = start, 1 = end)
+
+bool HeightField::ClipRaySegment(const RaySegment& seg, float uMin, float vMin, float uMax, float vMax, float& tA, float& tB) const
+{
+	tA = 0.0f;
+	tB = 1.0f;
+
+	float start[2] = { seg.u0, seg.v0 };
+	float delta[2] = { seg.u1 - seg.u0, seg.v1 - seg.v0 };
+	float lower[2] = { uMin - EDGE_TOLERANCE, vMin - EDGE_TOLERANCE };
+	float upper[2] = { uMax + EDGE_TOLERANCE, vMax + EDGE_TOLERANCE };
+
+	for( int axis = 0; axis < 2; ++axis )
+	{
+		if( delta[axis] == 0.0f )
+		{
+			if( !(start[axis] >= lower[axis] && start[axis] <= upper[axis]) )
+				return false;
+		}
+		else
+		{
+			float t0 = (lower[axis] - start[axis]) / delta[axis];
+			float t1 = (upper[axis] - start[axis]) / delta[axis];
+
+			tA = std::max(tA, std::min(t0, t1));
+			tB = std::min(tB, std::max(t0, t1));
+		}
+	}
+
+	return tA <= tB;
+}
+
+// Function:	RayCell
+// Description: Tests a ray against the two triangles of cell (l, w)
+// Returns: 	true if either triangle is hit within raySpeed of rayPos, with colHalf set
+//				to 0 for triangle 012 or 1 for triangle 213. colPos and colNormN are only
+//				written on a hit.
+
+bool HeightField::RayCell(int l, int w, const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colHalf) const
+{
+	XMVECTOR v0, v1, v2, v3;
+	XMVECTOR triColPos, triColNormN;
+	float colDist = 0.0f;
+
+	int mapIndex = (l*m_HeightMapWidth)+w;
+
+	if( m_pTriangleCache )
+	{
+		const CachedTriangle* pTris = &m_pTriangleCache[GetFaceIndex(mapIndex, 0)];
+		XMVECTOR rayDirN = XMVector3Normalize(rayDir);
+
+		for( int half = 0; half < 2; ++half )
+		{
+			if( RayTriangleCached( pTris[half], rayPos, rayDirN, triColPos, triColNormN, colDist ) && colDist <= raySpeed )
+			{
+				colPos = triColPos;
+				colNormN = triColNormN;
+				colHalf = half;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	GetCellSamples(l, w, v0, v1, v2, v3);
+
+	//012 213
+	if( RayTriangle( v0, v1, v2, rayPos, rayDir, triColPos, triColNormN, colDist ) )
+	{
+		// Needs to be >=0 
+		if( colDist <= raySpeed && colDist >= 0.0f )
+		{
+			colPos = triColPos;
+			colNormN = triColNormN;
+			colHalf = 0;
+			return true;
+		}
+
+	}
+	// 213
+	if( RayTriangle(v2, v1, v3, rayPos, rayDir, triColPos, triColNormN, colDist ) )
+	{
+		// Needs to be >=0 
+		if( colDist <= raySpeed && colDist >= 0.0f )
+		{
+			colPos = triColPos;
+			colNormN = triColNormN;
+			colHalf = 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Function:	SphereCollision
+// Description: Sweeps a sphere through the heightmap and finds the first triangle it touches
+// Parameters:
+//				centre		Start position of the sphere's centre
+//				radius		Radius of the sphere
+//				dir			Direction of the sweep (needn't be normalised)
+//				speed		Length of the sweep, along the normalised dir
+//				hit			The first contact (returned, only written on a hit)
+//				pStats		Nodes and cells tested (optional)
+// Returns: 	true if the sphere touches the terrain before the end of the sweep
+// Notes:		Unlike the ray queries this wants the earliest contact rather than the first
+//				cell in brute force order, so the quadtree is walked front to back and any
+//				node the sweep only reaches after the best contact so far is skipped. Ties
+//				go to the triangle tested first.
+
+bool HeightField::SphereCollision(const XMVECTOR& centre, float radius, const XMVECTOR& dir, float speed, SphereHit& hit, QueryStats* pStats) const
+{
+	QueryStats stats;
+	stats.nodesVisited = 0;
+	stats.cellsTested = 0;
+
+	SphereSweep sweep;
+	sweep.colFace = -1;
+	sweep.colTime = 1.0f;
+
+	if( IsLoaded() )
+	{
+		sweep.centre = centre;
+		sweep.move = XMVector3Normalize(dir) * speed;
+		sweep.radius = radius;
+
+		MakeRaySegment(centre, dir, speed, sweep.seg);
+
+		if( m_pQuadTree && m_CollisionMode != COLLISION_BRUTE_FORCE )
+		{
+			SphereQuadNode(m_QuadTreeLevels-1, 0, 0, sweep, stats);
+		}
+		else
+		{
+			for( int l = 0; l < m_HeightMapLength-1; ++l )
+			{
+				for( int w = 0; w < m_HeightMapWidth-1; ++w )
+					SphereCell(l, w, sweep, stats);
+			}
+		}
+	}
+
+	if( pStats )
+		*pStats = stats;
+
+	if( sweep.colFace < 0 )
+		return false;
+
+	hit.triangle = sweep.colFace;
+	hit.time = sweep.colTime;
+	hit.distance = sweep.colTime * speed;
+	XMStoreFloat3(&hit.centre, centre + (sweep.colTime * sweep.move));
+	XMStoreFloat3(&hit.contact, sweep.colContact);
+	XMStoreFloat3(&hit.normal, sweep.colNormN);
+
+	return true;
+}
+
+void HeightField::SphereQuadNode(int level, int x, int z, SphereSweep& sweep, QueryStats& stats) const
+{
+	++stats.nodesVisited;
+
+	int cellX0 = x << level;
+	int cellZ0 = z << level;
+	int cellX1 = std::min((x+1) << level, m_HeightMapWidth-1);
+	int cellZ1 = std::min((z+1) << level, m_HeightMapLength-1);
+
+	// Does the centre pass within a radius of this node, before the best contact so far?
+	float radiusCells = sweep.radius / m_GridSize;
+	float tA, tB;
+
+	if( !ClipRaySegment(sweep.seg, cellX0 - radiusCells, cellZ0 - radiusCells, cellX1 + radiusCells, cellZ1 + radiusCells, tA, tB) )
+		return;
+
+	if( sweep.colFace >= 0 && tA > sweep.colTime )
+		return;
+
+	// And within a radius of the node's height range while it does?
+	const MinMax& node = m_pQuadTree[m_QuadLevelOffset[level] + (z*m_QuadLevelWidth[level]) + x];
+
+	float yA = sweep.seg.y0 + (sweep.seg.y1 - sweep.seg.y0) * tA;
+	float yB = sweep.seg.y0 + (sweep.seg.y1 - sweep.seg.y0) * tB;
+
+	if( std::max(yA, yB) + sweep.radius + HEIGHT_TOLERANCE < node.minY || std::min(yA, yB) - sweep.radius - HEIGHT_TOLERANCE > node.maxY )
+		return;
+
+	if( level == 0 )
+	{
+		SphereCell(cellZ0, cellX0, sweep, stats);
+		return;
+	}
+
+	// Children nearest the start of the sweep first, so later ones are more likely to be skipped
+	int childLevel = level-1;
+	int nearX = sweep.seg.u1 < sweep.seg.u0 ? 1 : 0;
+	int nearZ = sweep.seg.v1 < sweep.seg.v0 ? 1 : 0;
+
+	for( int child = 0; child < 4; ++child )
+	{
+		int childX = (x*2) + ((child & 1) ^ nearX);
+		int childZ = (z*2) + ((child >> 1) ^ nearZ);
+
+		if( childX < m_QuadLevelWidth[childLevel] && childZ < m_QuadLevelLength[childLevel] )
+			SphereQuadNode(childLevel, childX, childZ, sweep, stats);
+	}
+}
+
+// Function:	SphereCell
+// Description: Sweeps the sphere against the two triangles of cell (l, w), keeping the
+//				contact in sweep if it's earlier than the best so far
+
+void HeightField::SphereCell(int l, int w, SphereSweep& sweep, QueryStats& stats) const
+{
+	++stats.cellsTested;
+
+	int mapIndex = (l*m_HeightMapWidth)+w;
+
+	XMVECTOR v0, v1, v2, v3;
+	GetCellSamples(l, w, v0, v1, v2, v3);
+
+	for( int half = 0; half < 2; ++half )
+	{
+		float maxTime = sweep.colFace >= 0 ? sweep.colTime : 1.0f;
+		float colTime;
+		XMVECTOR colContact, colNormN;
+
+		//012 213
+		bool touched = half == 0 ?
+			SphereTriangle(v0, v1, v2, sweep.centre, sweep.radius, sweep.move, maxTime, colTime, colContact, colNormN) :
+			SphereTriangle(v2, v1, v3, sweep.centre, sweep.radius, sweep.move, maxTime, colTime, colContact, colNormN);
+
+		if( touched && (sweep.colFace < 0 || colTime < sweep.colTime) )
+		{
+			sweep.colFace = GetFaceIndex(mapIndex, half);
+			sweep.colTime = colTime;
+			sweep.colContact = colContact;
+			sweep.colNormN = colNormN;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// SetTriangleKernel
+// The packet kernel needs the triangles transposed into packets, which
+// are built the first time it's selected.
+//////////////////////////////////////////////////////////////////////
+void HeightField::SetTriangleKernel( TriangleKernel kernel )
+{
+	if( kernel == TRIANGLE_KERNEL_PACKET && !m_pTrianglePackets )
+		BuildTrianglePackets();
+
+	// Maps too small for a level 1 quadtree node don't get packets
+	if( kernel == TRIANGLE_KERNEL_PACKET && !m_pTrianglePackets )
+		kernel = TRIANGLE_KERNEL_REFERENCE;
+
+	m_TriangleKernel = kernel;
+}
+
+const char* HeightField::GetTriangleKernelName() const
+{
+	if( m_TriangleKernel == TRIANGLE_KERNEL_PACKET )
+		return GetRayTrianglePacketKernelName();
+
+	return "Reference";
+}
+
+//////////////////////////////////////////////////////////////////////
+// BuildTrianglePackets
+// Transposes the triangles of each 2x2 block of cells into a packet,
+// lane (cell*2)+half, with the cells in brute force order.
+//////////////////////////////////////////////////////////////////////
+void HeightField::BuildTrianglePackets( void )
+{
+	if( !IsInMappedFile(m_pTrianglePackets) )
+		FreeTrianglePackets(m_pTrianglePackets);
+
+	m_pTrianglePackets = NULL;
+
+	if( m_QuadTreeLevels < 2 )
+		return;
+
+	int blockCount = m_QuadLevelWidth[1]*m_QuadLevelLength[1];
+
+	m_pTrianglePackets = AllocTrianglePackets(blockCount);
+
+	if( !m_pTrianglePackets )
+		return;
+
+	memset(m_pTrianglePackets, 0, blockCount * sizeof(TrianglePacket));
+
+	UpdateTrianglePackets(0, 0, m_HeightMapWidth-2, m_HeightMapLength-2);
+}
+
+//////////////////////////////////////////////////////////////////////
+// UpdateTrianglePackets
+// Re-transposes every block containing cells [wFirst, wLast] x [lFirst, lLast].
+//////////////////////////////////////////////////////////////////////
+void HeightField::UpdateTrianglePackets( int wFirst, int lFirst, int wLast, int lLast )
+{
+	for( int z = lFirst/2; z <= lLast/2; ++z )
+	{
+		for( int x = wFirst/2; x <= wLast/2; ++x )
+		{
+			TrianglePacket& tris = m_pTrianglePackets[(z*m_QuadLevelWidth[1])+x];
+
+			for( int cell = 0; cell < 4; ++cell )
+			{
+				int l = (z*2)+(cell/2);
+				int w = (x*2)+(cell%2);
+
+				// Off the edge of the map, so leave the lanes empty
+				if( l >= m_HeightMapLength-1 || w >= m_HeightMapWidth-1 )
+					continue;
+
+				XMVECTOR s0, s1, s2, s3;
+				GetCellSamples(l, w, s0, s1, s2, s3);
+
+				XMFLOAT3 v0, v1, v2, v3;
+				XMStoreFloat3(&v0, s0);
+				XMStoreFloat3(&v1, s1);
+				XMStoreFloat3(&v2, s2);
+				XMStoreFloat3(&v3, s3);
+
+				// 012
+				int lane = cell*2;
+				tris.v0x[lane] = v0.x;			tris.v0y[lane] = v0.y;			tris.v0z[lane] = v0.z;
+				tris.e1x[lane] = v1.x - v0.x;	tris.e1y[lane] = v1.y - v0.y;	tris.e1z[lane] = v1.z - v0.z;
+				tris.e2x[lane] = v2.x - v0.x;	tris.e2y[lane] = v2.y - v0.y;	tris.e2z[lane] = v2.z - v0.z;
+
+				// 213
+				++lane;
+				tris.v0x[lane] = v2.x;			tris.v0y[lane] = v2.y;			tris.v0z[lane] = v2.z;
+				tris.e1x[lane] = v1.x - v2.x;	tris.e1y[lane] = v1.y - v2.y;	tris.e1z[lane] = v1.z - v2.z;
+				tris.e2x[lane] = v3.x - v2.x;	tris.e2y[lane] = v3.y - v2.y;	tris.e2z[lane] = v3.z - v2.z;
+			}
+		}
+
+		AddLoadProgress(std::min(2, lLast+1 - (z*2)));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// SetTriangleCache
+//////////////////////////////////////////////////////////////////////
+void HeightField::SetTriangleCache( bool enabled )
+{
+	AlignedFree(m_pTriangleCache);
+	m_pTriangleCache = NULL;
+
+	if( !enabled || m_HeightMapFaceCount <= 0 )
+		return;
+
+	m_pTriangleCache = (CachedTriangle*)AlignedAlloc(m_HeightMapFaceCount * sizeof(CachedTriangle), alignof(CachedTriangle));
+
+	if( m_pTriangleCache )
+		UpdateTriangleCache(0, 0, m_HeightMapWidth-2, m_HeightMapLength-2);
+}
+
+//////////////////////////////////////////////////////////////////////
+// UpdateTriangleCache
+// Recalculates both triangles of cells [wFirst, wLast] x [lFirst, lLast].
+//////////////////////////////////////////////////////////////////////
+void HeightField::UpdateTriangleCache( int wFirst, int lFirst, int wLast, int lLast )
+{
+	for( int l = lFirst; l <= lLast; ++l )
+	{
+		for( int w = wFirst; w <= wLast; ++w )
+		{
+			int mapIndex = (l*m_HeightMapWidth)+w;
+
+			XMVECTOR v0, v1, v2, v3;
+			GetCellSamples(l, w, v0, v1, v2, v3);
+
+			CachedTriangle* pTris = &m_pTriangleCache[GetFaceIndex(mapIndex, 0)];
+
+			CacheTriangle(v0, v1, v2, pTris[0]);
+			CacheTriangle(v2, v1, v3, pTris[1]);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// SetHeights
+// Writes the new heights, then refreshes the quadtree, packets and triangle
+// cache for just the cells that use those samples.
+//////////////////////////////////////////////////////////////////////
+bool HeightField::SetHeights( int w, int l, int width, int length, const float* pHeights )
+{
+	if( !IsLoaded() )
+		return false;
+
+	// Every cell with one of those samples as a corner
+	int wFirst = std::max(w-1, 0);
+	int lFirst = std::max(l-1, 0);
+	int wLast = std::min(w+width-1, m_HeightMapWidth-2);
+	int lLast = std::min(l+length-1, m_HeightMapLength-2);
+	bool inRange = true;
+
+	if( m_pQuantisedHeights )
+	{
+		// Anything within half a step rounds to the end step anyway
+		float minHeight = m_HeightOffset - (0.5f * m_HeightScale);
+		float maxHeight = m_HeightOffset + ((USHRT_MAX + 0.5f) * m_HeightScale);
+
+		for( int row = 0; row < length; ++row )
+		{
+			for( int col = 0; col < width; ++col )
+			{
+				int mapW = w+col;
+				int mapL = l+row;
+
+				if( mapW >= 0 && mapW < m_HeightMapWidth && mapL >= 0 && mapL < m_HeightMapLength )
+				{
+					float height = pHeights[(row*width)+col];
+
+					if( !(height >= minHeight && height <= maxHeight) )
+					{
+						minHeight = std::min(minHeight, height);
+						maxHeight = std::max(maxHeight, height);
+						inRange = false;
+					}
+				}
+			}
+		}
+
+		// Spread the steps over the new range, which moves every height
+		// a little, so everything has to be refreshed
+		if( !inRange )
+		{
+			int sampleCount = m_HeightMapWidth * m_HeightMapLength;
+			std::vector<float> heights(sampleCount);
+
+			for( int i = 0; i < sampleCount; ++i )
+				heights[i] = GetSampleHeight(i);
+
+			QuantiseHeights(&heights[0], minHeight, maxHeight);
+
+			wFirst = 0;
+			lFirst = 0;
+			wLast = m_HeightMapWidth-2;
+			lLast = m_HeightMapLength-2;
+		}
+	}
+
+	float invScale = m_HeightScale > 0.0f ? 1.0f / m_HeightScale : 0.0f;
+
+	for( int row = 0; row < length; ++row )
+	{
+		for( int col = 0; col < width; ++col )
+		{
+			int mapW = w+col;
+			int mapL = l+row;
+
+			if( mapW < 0 || mapW >= m_HeightMapWidth || mapL < 0 || mapL >= m_HeightMapLength )
+				continue;
+
+			int index = GetStorageIndex(mapW, mapL);
+			float height = pHeights[(row*width)+col];
+
+			if( m_pHeightMap )
+			{
+				m_pHeightMap[index].y = height;
+			}
+			else
+			{
+				m_pQuantisedHeights[index] = QuantiseHeight(height, m_HeightOffset, invScale);
+			}
+		}
+	}
+
+	if( wFirst <= wLast && lFirst <= lLast )
+		UpdateCollisionData(wFirst, lFirst, wLast, lLast);
+
+	return !inRange;
+}
+
+//////////////////////////////////////////////////////////////////////
+// UpdateCollisionData
+// Brings whatever has been built from the heights of cells
+// [wFirst, wLast] x [lFirst, lLast] up to date with them.
+//////////////////////////////////////////////////////////////////////
+void HeightField::UpdateCollisionData( int wFirst, int lFirst, int wLast, int lLast )
+{
+	if( m_pQuadTree )
+		UpdateQuadTree(wFirst, lFirst, wLast, lLast);
+
+	if( m_pTrianglePackets )
+		UpdateTrianglePackets(wFirst, lFirst, wLast, lLast);
+
+	if( m_pTriangleCache )
+		UpdateTriangleCache(wFirst, lFirst, wLast, lLast);
+}
+
+//////////////////////////////////////////////////////////////////////
+// BuildQuadTree
+// Builds an implicit min/max height pyramid over the map's cells.
+// Level 0 holds one node per cell, and each level above halves the
+// width and length (rounding up) until a single node covers the map.
+//////////////////////////////////////////////////////////////////////
+void HeightField::BuildQuadTree( void )
+{
+	std::chrono::high_resolution_clock::time_point buildStart = std::chrono::high_resolution_clock::now();
+
+	if( !IsInMappedFile(m_pQuadTree) )
+		delete [] m_pQuadTree;
+
+	m_pQuadTree = NULL;
+
+	int nodeCount = InitQuadTreeLevels();
+
+	if( nodeCount == 0 )
+		return;
+
+	m_pQuadTree = new MinMax[nodeCount];
+
+	UpdateQuadTree(0, 0, m_HeightMapWidth-2, m_HeightMapLength-2);
+
+	std::chrono::duration<double, std::milli> buildTime = std::chrono::high_resolution_clock::now() - buildStart;
+
+	m_QuadTreeStats.levels = m_QuadTreeLevels;
+	m_QuadTreeStats.nodeCount = nodeCount;
+	m_QuadTreeStats.memoryBytes = nodeCount * sizeof(MinMax);
+	m_QuadTreeStats.buildTimeMs = buildTime.count();
+}
+
+//////////////////////////////////////////////////////////////////////
+// InitQuadTreeLevels
+// Sizes the quadtree's levels for the map. Returns the total number of
+// nodes, or 0 if the map has no cells.
+//////////////////////////////////////////////////////////////////////
+int HeightField::InitQuadTreeLevels( void )
+{
+	m_QuadTreeLevels = 0;
+
+	int levelWidth = m_HeightMapWidth-1;
+	int levelLength = m_HeightMapLength-1;
+	int nodeCount = 0;
+
+	if( levelWidth < 1 || levelLength < 1 )
+		return 0;
+
+	for(;;)
+	{
+		m_QuadLevelWidth[m_QuadTreeLevels] = levelWidth;
+		m_QuadLevelLength[m_QuadTreeLevels] = levelLength;
+		m_QuadLevelOffset[m_QuadTreeLevels] = nodeCount;
+		nodeCount += levelWidth*levelLength;
+		++m_QuadTreeLevels;
+
+		if( levelWidth == 1 && levelLength == 1 )
+			break;
+
+		levelWidth = (levelWidth+1)/2;
+		levelLength = (levelLength+1)/2;
+	}
+
+	return nodeCount;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// UpdateQuadTree
+// Recalculates the nodes over cells [wFirst, wLast] x [lFirst, lLast]
+// on every level.
+//////////////////////////////////////////////////////////////////////
+void HeightField::UpdateQuadTree( int wFirst, int lFirst, int wLast, int lLast )
+{
+	// Level 0 from the four corners of each cell
+	for( int l = lFirst; l <= lLast; ++l )
+	{
+		for( int w = wFirst; w <= wLast; ++w )
+		{
+			float y0, y1, y2, y3;
+			GetCellHeights(l, w, y0, y1, y2, y3);
+
+			MinMax& node = m_pQuadTree[(l*m_QuadLevelWidth[0])+w];
+			node.minY = std::min(std::min(y0, y1), std::min(y2, y3));
+			node.maxY = std::max(std::max(y0, y1), std::max(y2, y3));
+		}
+
+		AddLoadProgress(1);
+	}
+
+	// Every other level from the (up to) four nodes below it
+	for( int level = 1; level < m_QuadTreeLevels; ++level )
+	{
+		const MinMax* pChildren = &m_pQuadTree[m_QuadLevelOffset[level-1]];
+		MinMax* pNodes = &m_pQuadTree[m_QuadLevelOffset[level]];
+
+		int childWidth = m_QuadLevelWidth[level-1];
+		int childLength = m_QuadLevelLength[level-1];
+
+		wFirst /= 2;
+		lFirst /= 2;
+		wLast /= 2;
+		lLast /= 2;
+
+		for( int z = lFirst; z <= lLast; ++z )
+		{
+			for( int x = wFirst; x <= wLast; ++x )
+			{
+				MinMax& node = pNodes[(z*m_QuadLevelWidth[level])+x];
+				node = pChildren[(z*2*childWidth)+(x*2)];
+
+				for( int cz = z*2; cz < std::min(z*2+2, childLength); ++cz )
+				{
+					for( int cx = x*2; cx < std::min(x*2+2, childWidth); ++cx )
+					{
+						const MinMax& child = pChildren[(cz*childWidth)+cx];
+						node.minY = std::min(node.minY, child.minY);
+						node.maxY = std::max(node.maxY, child.maxY);
+					}
+				}
+			}
+		}
+	}
+}
+
+// Function:	rayTriangle
+// Description: Tests a ray for intersection with a triangle
+// Parameters:
+//				vert0		First vertex of triangle 
+//				vert1		Second vertex of triangle
+//				vert3		Third vertex of triangle
+//				rayPos		Start position of ray
+//				rayDir		Direction of ray
+//				colPos		Position of collision (returned)
+//				colNormN	The normalised Normal to triangle (returned)
+//				colDist		Distance from rayPos to collision (returned)
+// Returns: 	true if the intersection point lies within the bounds of the triangle.
+// Notes: 		Not for the faint-hearted :)
+
+bool HeightField::RayTriangle(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& rayPos, const XMVECTOR& rayDir, XMVECTOR& colPos, XMVECTOR& colNormN, float& colDist)
+ {
+	 // Part 1: Calculate the collision point between the ray and the plane on which the triangle lies
+	 //
+	 // If RAYPOS is a point in space and RAYDIR is a vector extending from RAYPOS towards a plane
+	 // Then COLPOS with the plane will be RAYPOS + COLDIST*|RAYDIR|
+	 // So if we can calculate COLDIST then we can calculate COLPOS
+	 //
+	 // The equation for plane is Ax + By + Cz + D = 0
+	 // Which can also be written as [ A,B,C ] dot [ x,y,z ] = -D
+	 // Where [ A,B,C ] is |COLNORM| (the normalised normal to the plane) and [ x,y,z ] is any point on that plane 
+	 // Any point includes the collision point COLPOS which equals  RAYPOS + COLDIST*|RAYDIR|
+	 // So substitute [ x,y,z ] for RAYPOS + COLDIST*|RAYDIR| and rearrange to yield COLDIST
+	 // -> |COLNORM| dot (RAYPOS + COLDIST*|RAYDIR|) also equals -D
+	 // -> (|COLNORM| dot RAYPOS) + (|COLNORM| dot (COLDIST*|RAYDIR|)) = -D
+	 // -> |COLNORM| dot (COLDIST*|RAYDIR|)) = -D -(|COLNORM| dot RAYPOS)
+	 // -> COLDIST = -(D+(|COLNORM| dot RAYPOS)) /  (|COLNORM| dot |RAYDIR|)
+	 //
+	 // Now all we only need to calculate D in order to work out COLDIST
+	 // This can be done using |COLNORM| (which remember is also [ A,B,C ] ), the plane equation and any point on the plane
+	 // |COLNORM| dot |ANYVERT| = -D
+
+	 //return false; // remove this to start
+
+	 // Step 1: Calculate |COLNORM| 
+
+	 colNormN =  XMVector3Cross((vert0 - vert1), (vert2 - vert1));
+
+	 colNormN = XMVector3Normalize(colNormN);
+
+	 // Note that the variable colNormN is passed through by reference as part of the function parameters so you can calculate and return it!
+	 // Next line is useful debug code to stop collision with the top of the inverted pyramid (which has a normal facing straight up). 
+	 XMFLOAT3 FloatTest;
+	 XMStoreFloat3(&FloatTest, colNormN);
+	 //if( abs(FloatTest.y)>0.99f ) return false;
+	 // Remember to remove it once you have implemented part 2 below...
+
+	 // ...
+
+	 // Step 2: Use |COLNORM| and any vertex on the triangle to calculate D
+	 XMVECTOR D = -XMVector3Dot(colNormN, vert0);
+	 // ...
+	 
+	 // Step 3: Calculate the demoninator of the COLDIST equation: (|COLNORM| dot |RAYDIR|) and "early out" (return false) if it is 0
+	 XMVECTOR demoninatorVector = XMVector3Dot(colNormN, XMVector3Normalize(rayDir));
+	 float demoninator;
+	 XMStoreFloat(&demoninator, demoninatorVector);
+	 if (demoninator == 0) return false;
+	 // ...
+
+	 // Step 4: Calculate the numerator of the COLDIST equation: -(D+(|COLNORM| dot RAYPOS))
+
+	 XMVECTOR numeratorVector = -(D + XMVector3Dot(colNormN, rayPos));
+	 float numerator;
+	 XMStoreFloat(&numerator, numeratorVector);
+	 // ...
+
+	 // Step 5: Calculate COLDIST and "early out" again if COLDIST is behind RAYDIR
+	 colDist = numerator / demoninator;
+	 // ...
+
+	 if (colDist < 0) return false;
+
+	 // Step 6: Use COLDIST to calculate COLPOS
+	 colPos = rayPos + (colDist * XMVector3Normalize(rayDir));
+	 // ...
+
+	 // Next two lines are useful debug code to stop collision with anywhere beneath the pyramid. 
+	 // if( std::min(vert0.y,vert1.y,vert2.y)>colPos.y ) return false;
+	 // Remember to remove it once you have implemented part 2 below...
+
+	 // Part 2: Work out if the intersection point falls within the triangle
+	 //
+	 // If the point is inside the triangle then it will be contained by the three new planes defined by:
+	 // 1) RAYPOS, VERT0, VERT1
+	 // 2) RAYPOS, VERT1, VERT2
+	 // 3) RAYPOS, VERT2, VERT0
+
+	 // Move the ray backwards by a tiny bit (one unit) in case the ray is already on the plane
+	 XMVECTOR rayPosMovedBack = rayPos - rayDir;
+	 // ...
+
+	 // Step 1: Test against plane 1 and return false if behind plane
+	 if (!PointPlane(rayPosMovedBack, vert0, vert1, colPos)) return false;
+	 // ...
+
+	 // Step 2: Test against plane 2 and return false if behind plane
+	 if (!PointPlane(rayPosMovedBack, vert1, vert2, colPos)) return false;
+	 // ...
+
+	 // Step 3: Test against plane 3 and return false if behind plane
+	 if (!PointPlane(rayPosMovedBack, vert2, vert0, colPos)) return false;
+	 // ...
+
+	 // Step 4: Return true! (on triangle)
+	 return true;
+ }
+
+// Function:	CacheTriangle
+// Description: Works out everything RayTriangle needs from a triangle's vertices
+// Notes:		The plane is calculated exactly as RayTriangle does it, so collision points
+//				and normals come out the same. The edge planes replace the three PointPlane
+//				tests: a point on the triangle's plane is inside the triangle if it's in
+//				front of all three.
+
+void HeightField::CacheTriangle( const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, CachedTriangle& tri )
+{
+	XMVECTOR colNormN = XMVector3Normalize(XMVector3Cross((vert0 - vert1), (vert2 - vert1)));
+	XMVECTOR D = -XMVector3Dot(colNormN, vert0);
+
+	XMStoreFloat4(&tri.plane, XMVectorSetW(colNormN, XMVectorGetX(D)));
+
+	const XMVECTOR* apVerts[4] = { &vert0, &vert1, &vert2, &vert0 };
+
+	for( int edge = 0; edge < 3; ++edge )
+	{
+		const XMVECTOR& edgeStart = *apVerts[edge];
+		const XMVECTOR& edgeEnd = *apVerts[edge+1];
+		const XMVECTOR& opposite = *apVerts[(edge+2)%3];
+
+		XMVECTOR edgeNorm = XMVector3Cross(colNormN, edgeEnd - edgeStart);
+
+		// Face it towards the vertex that isn't on this edge
+		if( XMVectorGetX(XMVector3Dot(edgeNorm, opposite - edgeStart)) < 0.0f )
+			edgeNorm = -edgeNorm;
+
+		XMVECTOR edgeD = -XMVector3Dot(edgeNorm, edgeStart);
+
+		XMStoreFloat4(&tri.edgePlanes[edge], XMVectorSetW(edgeNorm, XMVectorGetX(edgeD)));
+	}
+}
+
+// Function:	RayTriangleCached
+// Description: RayTriangle, using a CachedTriangle
+// Parameters:
+//				tri			The cached triangle
+//				rayPos		Start position of ray
+//				rayDirN		Normalised direction of ray
+//				colPos		Position of collision (returned)
+//				colNormN	The normalised Normal to triangle (returned)
+//				colDist		Distance from rayPos to collision (returned)
+// Returns: 	true if the intersection point lies within the bounds of the triangle.
+// Notes: 		Like RayTriangle, this only hits the triangle from the side its plane
+//				faces away from (the top of the terrain).
+
+bool HeightField::RayTriangleCached(const CachedTriangle& tri, const XMVECTOR& rayPos, const XMVECTOR& rayDirN, XMVECTOR& colPos, XMVECTOR& colNormN, float& colDist)
+{
+	XMVECTOR plane = XMLoadFloat4(&tri.plane);
+
+	colNormN = XMVectorSetW(plane, 0.0f);
+
+	float demoninator = XMVectorGetX(XMVector3Dot(colNormN, rayDirN));
+	if( !(demoninator > 0.0f) )
+		return false;
+
+	float numerator = XMVectorGetX(-(XMVectorSplatW(plane) + XMVector3Dot(colNormN, rayPos)));
+
+	colDist = numerator / demoninator;
+
+	if( colDist < 0 )
+		return false;
+
+	colPos = rayPos + (colDist * rayDirN);
+
+	XMVECTOR colPos1 = XMVectorSetW(colPos, 1.0f);
+
+	for( int edge = 0; edge < 3; ++edge )
+	{
+		if( XMVectorGetX(XMVector4Dot(XMLoadFloat4(&tri.edgePlanes[edge]), colPos1)) < 0.0f )
+			return false;
+	}
+
+	return true;
+}
+
+// Function:	pointPlane
+// Description: Tests a point to see if it is in front of a plane
+// Parameters:
+//				vert0		First point on plane 
+//				vert1		Second point on plane 
+//				vert3		Third point on plane 
+//				pointPos	Point to test
+// Returns: 	true if the point is in front of the plane
+
+bool HeightField::PointPlane(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& pointPos)
+ {
+	 // For any point on the plane [x,y,z] Ax + By + Cz + D = 0
+	 // So if Ax + By + Cz + D < 0 then the point is behind the plane
+	 // --> [ A,B,C ] dot [ x,y,z ] + D < 0
+	 // --> |PNORM| dot POINTPOS + D < 0
+	 // but D = -(|PNORM| dot VERT0 )
+	 // --> (|PNORM| dot POINTPOS) - (|PNORM| dot VERT0) < 0
+	 XMVECTOR sVec0, sVec1, sNormN;
+	 float sD, sNumer;
+
+	 // Step 1: Calculate PNORM
+	 XMVECTOR PNORM = XMVector3Cross((vert0 - vert1), (vert2 - vert1));
+
+	 PNORM = XMVector3Normalize(PNORM);
+	 // ...
+	
+	 // Step 2: Calculate D
+	 XMVECTOR D = -XMVector3Dot(PNORM, vert0);
+	 // ...
+	 
+	 // Step 3: Calculate full equation
+	 XMVECTOR full = (XMVector3Dot(PNORM, pointPos) - XMVector3Dot(PNORM, vert0));
+	 float dir;
+	 XMStoreFloat(&dir, full);
+	 // ...
+
+	 // Step 4: Return false if < 0 (behind plane)
+	 if (dir < 0) return false;
+	 // ...
+
+	 // Step 5: Return true! (in front of plane)
+	 return true;
+ }
+
+// Smallest root of a*t*t + b*t + c = 0 in [0, maxRoot]
+static bool LowestRoot( float a, float b, float c, float maxRoot, float& root )
+{
+	float determinant = (b*b) - (4.0f*a*c);
+
+	if( determinant < 0.0f || a == 0.0f )
+		return false;
+
+	float sqrtD = sqrtf(determinant);
+	float r1 = (-b - sqrtD) / (2.0f*a);
+	float r2 = (-b + sqrtD) / (2.0f*a);
+
+	if( r1 > r2 )
+		std::swap(r1, r2);
+
+	if( r1 >= 0.0f && r1 <= maxRoot )
+	{
+		root = r1;
+		return true;
+	}
+
+	if( r2 >= 0.0f && r2 <= maxRoot )
+	{
+		root = r2;
+		return true;
+	}
+
+	return false;
+}
+
+// Closest point to pos on the segment [vertA, vertB]
+static XMVECTOR ClosestPointOnSegment( const XMVECTOR& vertA, const XMVECTOR& vertB, const XMVECTOR& pos )
+{
+	XMVECTOR edge = vertB - vertA;
+	float edgeSq = XMVectorGetX(XMVector3LengthSq(edge));
+	float f = edgeSq > 0.0f ? XMVectorGetX(XMVector3Dot(pos - vertA, edge)) / edgeSq : 0.0f;
+
+	return vertA + (std::min(std::max(f, 0.0f), 1.0f) * edge);
+}
+
+// Function:	SphereTriangle
+// Description: Sweeps a sphere along move and finds when it first touches a triangle
+// Parameters:
+//				vert0		First vertex of triangle
+//				vert1		Second vertex of triangle
+//				vert2		Third vertex of triangle
+//				centre		Start position of the sphere's centre
+//				radius		Radius of the sphere
+//				move		The whole sweep; the centre ends up at centre + move
+//				maxTime		Contacts later than this (as a fraction of move) are ignored
+//				colTime		Fraction of move at which the sphere touches (returned)
+//				colContact	Point on the triangle it touches (returned)
+//				colNormN	The normalised direction from colContact to the centre (returned)
+// Returns: 	true if the sphere touches the triangle within [0, maxTime] of the sweep
+// Notes:		Like RayTriangle, only the top of the triangle counts: the face whose normal
+//				(vert1 - vert0) x (vert2 - vert0) points at the sphere, which for heightmap
+//				triangles is the one facing up. A sphere that already overlaps the triangle
+//				touches it at time 0, but only if it's moving towards it.
+//
+//				The sphere can first touch the inside of the face, one of the three edges or
+//				one of the three vertices. The face contact, if there is one, is always the
+//				earliest; otherwise it's whichever edge or vertex is touched first.
+
+bool HeightField::SphereTriangle(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& centre, float radius, const XMVECTOR& move, float maxTime, float& colTime, XMVECTOR& colContact, XMVECTOR& colNormN)
+{
+	XMVECTOR aVerts[3] = { vert0, vert1, vert2 };
+
+	XMVECTOR normal = XMVector3Cross(vert1 - vert0, vert2 - vert0);
+
+	// Degenerate triangles can't be touched
+	if( XMVectorGetX(XMVector3LengthSq(normal)) == 0.0f )
+		return false;
+
+	normal = XMVector3Normalize(normal);
+
+	// Distance of the centre above the plane at the start, and how fast that changes
+	float startDist = XMVectorGetX(XMVector3Dot(normal, centre - vert0));
+	float normalDotMove = XMVectorGetX(XMVector3Dot(normal, move));
+
+	// Underneath
+	if( startDist < 0.0f )
+		return false;
+
+	// The face: inside the triangle's edges, in the plane
+	XMVECTOR aEdgeNormals[3];
+	for( int edge = 0; edge < 3; ++edge )
+		aEdgeNormals[edge] = XMVector3Cross(normal, aVerts[(edge+1)%3] - aVerts[edge]);
+
+	// Step 1: Already overlapping? Then it touches now, if it's moving in
+	if( startDist < radius )
+	{
+		XMVECTOR closest = centre - (startDist * normal);
+
+		for( int edge = 0; edge < 3; ++edge )
+		{
+			if( XMVectorGetX(XMVector3Dot(aEdgeNormals[edge], closest - aVerts[edge])) < 0.0f )
+			{
+				// Outside this edge, so the nearest point is on an edge
+				XMVECTOR nearest = ClosestPointOnSegment(aVerts[0], aVerts[1], centre);
+				XMVECTOR onEdge = ClosestPointOnSegment(aVerts[1], aVerts[2], centre);
+
+				if( XMVectorGetX(XMVector3LengthSq(onEdge - centre)) < XMVectorGetX(XMVector3LengthSq(nearest - centre)) )
+					nearest = onEdge;
+
+				onEdge = ClosestPointOnSegment(aVerts[2], aVerts[0], centre);
+
+				if( XMVectorGetX(XMVector3LengthSq(onEdge - centre)) < XMVectorGetX(XMVector3LengthSq(nearest - centre)) )
+					nearest = onEdge;
+
+				closest = nearest;
+				break;
+			}
+		}
+
+		XMVECTOR toClosest = closest - centre;
+
+		if( XMVectorGetX(XMVector3LengthSq(toClosest)) < radius*radius )
+		{
+			if( XMVectorGetX(XMVector3Dot(toClosest, move)) <= 0.0f )
+				return false;
+
+			colTime = 0.0f;
+			colContact = closest;
+			colNormN = XMVectorGetX(XMVector3LengthSq(toClosest)) > 0.0f ? XMVector3Normalize(-toClosest) : normal;
+			return true;
+		}
+	}
+
+	// Step 2: When is the centre within a radius of the plane? The sphere can only touch
+	// the triangle then.
+	float planeTime0, planeTime1;
+
+	if( normalDotMove == 0.0f )
+	{
+		if( startDist >= radius )
+			return false;
+
+		planeTime0 = 0.0f;
+		planeTime1 = 1.0f;
+	}
+	else
+	{
+		planeTime0 = (radius - startDist) / normalDotMove;
+		planeTime1 = (-radius - startDist) / normalDotMove;
+
+		if( planeTime0 > planeTime1 )
+			std::swap(planeTime0, planeTime1);
+
+		if( planeTime0 > maxTime || planeTime1 < 0.0f )
+			return false;
+
+		planeTime0 = std::max(planeTime0, 0.0f);
+	}
+
+	// Step 3: The face. Where the sphere first reaches the plane, is the point it touches
+	// inside the triangle?
+	if( normalDotMove < 0.0f && startDist >= radius )
+	{
+		XMVECTOR planePos = centre + (planeTime0 * move) - (radius * normal);
+		bool inside = true;
+
+		for( int edge = 0; edge < 3; ++edge )
+		{
+			if( XMVectorGetX(XMVector3Dot(aEdgeNormals[edge], planePos - aVerts[edge])) < 0.0f )
+				inside = false;
+		}
+
+		if( inside )
+		{
+			colTime = planeTime0;
+			colContact = planePos;
+			colNormN = normal;
+			return true;
+		}
+	}
+
+	// Step 4: The vertices and edges. Solve |centre + t*move - point| = radius for the
+	// earliest t, with the point either a vertex or anywhere along an edge.
+	float moveSq = XMVectorGetX(XMVector3LengthSq(move));
+	float bestTime = std::min(maxTime, planeTime1);
+	bool touched = false;
+	float t;
+
+	for( int vert = 0; vert < 3; ++vert )
+	{
+		float b = 2.0f * XMVectorGetX(XMVector3Dot(move, centre - aVerts[vert]));
+		float c = XMVectorGetX(XMVector3LengthSq(aVerts[vert] - centre)) - (radius*radius);
+
+		if( LowestRoot(moveSq, b, c, bestTime, t) )
+		{
+			bestTime = t;
+			colContact = aVerts[vert];
+			touched = true;
+		}
+	}
+
+	for( int edge = 0; edge < 3; ++edge )
+	{
+		XMVECTOR vertA = aVerts[edge];
+		XMVECTOR edgeVec = aVerts[(edge+1)%3] - vertA;
+		XMVECTOR centreToVert = vertA - centre;
+
+		float edgeSq = XMVectorGetX(XMVector3LengthSq(edgeVec));
+		float edgeDotMove = XMVectorGetX(XMVector3Dot(edgeVec, move));
+		float edgeDotCentreToVert = XMVectorGetX(XMVector3Dot(edgeVec, centreToVert));
+
+		// The infinite cylinder around the edge
+		float a = (edgeSq * -moveSq) + (edgeDotMove*edgeDotMove);
+		float b = (edgeSq * 2.0f * XMVectorGetX(XMVector3Dot(move, centreToVert))) - (2.0f * edgeDotMove * edgeDotCentreToVert);
+		float c = (edgeSq * ((radius*radius) - XMVectorGetX(XMVector3LengthSq(centreToVert)))) + (edgeDotCentreToVert*edgeDotCentreToVert);
+
+		if( LowestRoot(a, b, c, bestTime, t) )
+		{
+			// Only counts if it's between the ends of the edge
+			float f = ((edgeDotMove * t) - edgeDotCentreToVert) / edgeSq;
+
+			if( f >= 0.0f && f <= 1.0f )
+			{
+				bestTime = t;
+				colContact = vertA + (f * edgeVec);
+				touched = true;
+			}
+		}
+	}
+
+	if( !touched )
+		return false;
+
+	colTime = bestTime;
+	colNormN = XMVector3Normalize(centre + (bestTime * move) - colContact);
+	return true;
+}
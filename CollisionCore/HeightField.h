@@ -0,0 +1,382 @@
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+//**********************************************************************
+// File:			HeightField.h
+// Description:		Heightmap storage, loading and ray collision queries
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Only depends on DirectXMath, so it builds without D3D or
+//					windows.h and can be used by servers and tools as well
+//					as by HeightMap, which draws one.
+//**********************************************************************
+
+#include <atomic>
+#include <stddef.h>
+#include <DirectXMath.h>
+
+#include "RayTrianglePacket.h"
+
+using namespace DirectX;
+
+class MappedFile;
+class QueryThreadPool;
+
+class HeightField
+{
+public:
+	// How RayCollision finds the triangles to test
+	enum CollisionMode
+	{
+		COLLISION_BRUTE_FORCE,	// Every triangle in the map
+		COLLISION_GRID_WALK,	// Only the cells the ray segment passes over
+		COLLISION_QUADTREE,		// Only the min/max quadtree nodes the ray segment can touch
+	};
+
+	// How the quadtree tests the triangles under the nodes it can't cull
+	enum TriangleKernel
+	{
+		TRIANGLE_KERNEL_REFERENCE,	// RayTriangle, one cell at a time (same hits as COLLISION_BRUTE_FORCE)
+		TRIANGLE_KERNEL_PACKET,		// RayTrianglePacket, a 2x2 block of cells (8 triangles) at a time
+	};
+
+	// How the samples are kept. Only their heights differ from a flat grid,
+	// so HEIGHT_STORAGE_UINT16 keeps just those and works out x and z when
+	// they're needed, exactly as HEIGHT_STORAGE_FLOAT4 stores them.
+	enum HeightStorage
+	{
+		HEIGHT_STORAGE_FLOAT4,	// An XMFLOAT4 position per sample, 16 bytes
+		HEIGHT_STORAGE_UINT16,	// A height per sample, 2 bytes, quantised between the lowest and highest
+	};
+
+	// The order the samples are kept in. Neighbouring rows of a row-major map
+	// are a whole row apart, so anything heading along z touches a new cache
+	// line, and on big maps a new page, with every cell. Tiles of 32x32
+	// samples keep each cell's neighbours close by in every direction. Sample
+	// and face indices in the interface are row by row whichever is used.
+	enum HeightLayout
+	{
+		HEIGHT_LAYOUT_ROW_MAJOR,
+		HEIGHT_LAYOUT_TILED,
+	};
+
+	static const int HEIGHT_TILE_SHIFT = 5;		// Tiles are 1 << HEIGHT_TILE_SHIFT samples across
+
+	// Built once by LoadHeightMap
+	struct QuadTreeStats
+	{
+		int levels;
+		int nodeCount;
+		size_t memoryBytes;
+		double buildTimeMs;
+	};
+
+	// How far a constructor has got, for another thread to show while it
+	// runs. rowCount is three passes over the map: converting its rows of
+	// samples, then building the quadtree and the packets over its rows of
+	// cells. It stays 0 while an image is being read. Samples and collision
+	// data mapped from a binary file count as done as soon as they're mapped.
+	struct LoadProgress
+	{
+		std::atomic<int> rowsDone;
+		std::atomic<int> rowCount;
+
+		LoadProgress() : rowsDone(0), rowCount(0) {}
+	};
+
+	// Counted by each RayCollision call
+	struct QueryStats
+	{
+		int nodesVisited;		// Quadtree nodes visited (COLLISION_QUADTREE only)
+		int cellsTested;		// Cells whose two triangles were tested
+	};
+
+	// Everything RayCollision reports about a hit
+	struct RayHit
+	{
+		int triangle;			// Face index (see GetFaceSamples)
+		float distance;			// Along the normalised ray direction
+		float u, v;				// Barycentrics: position = s0 + u*(s1 - s0) + v*(s2 - s0), s0-s2 as GetFaceSamples
+		XMFLOAT3 position;
+		XMFLOAT3 normal;		// Normalised, facing down like RayTriangle's
+	};
+
+	// Everything SphereCollision reports about the first contact
+	struct SphereHit
+	{
+		int triangle;			// Face index (see GetFaceSamples)
+		float time;				// How far through the sweep, 0 at the start to 1 at the end
+		float distance;			// How far the centre moved along the normalised direction
+		XMFLOAT3 centre;		// The sphere's centre when it touches
+		XMFLOAT3 contact;		// The point on the triangle it touches
+		XMFLOAT3 normal;		// Normalised, from the contact towards the centre
+	};
+
+	// Structure-of-arrays input for RayCollisionBatch, one element per ray.
+	// Directions need not be normalised; maxDist is measured along the
+	// normalised direction, like RayCollision's speed.
+	struct RayBatchInput
+	{
+		const float* pOriginX;
+		const float* pOriginY;
+		const float* pOriginZ;
+		const float* pDirX;
+		const float* pDirY;
+		const float* pDirZ;
+		const float* pMaxDist;
+	};
+
+	// Structure-of-arrays output for RayCollisionBatch, one element per ray.
+	// Any of these may be NULL if the caller doesn't need them. Positions
+	// and normals are left untouched for rays that miss.
+	struct RayBatchOutput
+	{
+		unsigned char* pHit;
+		float* pPosX;
+		float* pPosY;
+		float* pPosZ;
+		float* pNormX;
+		float* pNormY;
+		float* pNormZ;
+		float* pDistance;
+		int* pTriangle;			// Face index (see GetFaceSamples), or -1 on a miss
+	};
+
+	// Loads a greyscale heightmap image, in any of the formats listed in
+	// HeightImage.h. If it can't be loaded the field is left empty,
+	// which IsLoaded reports and which every query misses.
+	HeightField( const char* filename, float gridSize, float heightRange, HeightStorage storage = HEIGHT_STORAGE_FLOAT4, LoadProgress* pProgress = NULL );
+
+	// A width x length map from pHeights, row by row, laid out like a loaded one
+	HeightField( int width, int length, float gridSize, const float* pHeights, HeightStorage storage = HEIGHT_STORAGE_FLOAT4 );
+
+	// Maps a file written by SaveBinary and uses its samples, and any collision
+	// data saved with them, where they lie in the file. Pages are only read as
+	// the queries touch them; edits are kept in memory and never written back.
+	explicit HeightField( const char* binaryFilename, LoadProgress* pProgress = NULL );
+	~HeightField();
+
+	// Writes the samples as they're stored, in the form the constructor above
+	// maps, with the quadtree and packets too if asked and they've been built
+	bool SaveBinary( const char* filename, bool withCollisionData = true ) const;
+	bool IsFileMapped() const { return m_pMappedFile != NULL; }
+
+	bool IsLoaded() const { return m_pHeightMap != NULL || m_pQuantisedHeights != NULL; }
+
+	// The queries only read the field, so any number can run at once. hit is
+	// only written on a hit; pStats, if given, always is.
+	bool RayCollision(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float speed, RayHit& hit, QueryStats* pStats = NULL) const;
+	int RayCollisionBatch(const RayBatchInput& rays, const RayBatchOutput& results, int rayCount, QueryStats* pStats = NULL) const;
+
+	// RayCollisionBatch spread over pool's threads, chunkSize rays at a time.
+	// Each ray's results go in its own slots and the totals are summed per
+	// thread, so the results are the same whatever the thread count.
+	static const int RAY_BATCH_CHUNK_SIZE = 256;
+	int RayCollisionBatch(const RayBatchInput& rays, const RayBatchOutput& results, int rayCount, QueryThreadPool& pool, QueryStats* pStats = NULL, int chunkSize = RAY_BATCH_CHUNK_SIZE) const;
+
+	// Sweeps a sphere from centre along dir for speed (along the normalised dir)
+	// and finds where it first touches the top of the terrain. Uses the quadtree,
+	// with its nodes widened by the radius, unless the mode is
+	// COLLISION_BRUTE_FORCE. A sphere that already overlaps a triangle it's
+	// moving into touches it at time 0.
+	bool SphereCollision(const XMVECTOR& centre, float radius, const XMVECTOR& dir, float speed, SphereHit& hit, QueryStats* pStats = NULL) const;
+
+	// The height and upward normal of the terrain straight above or below
+	// (x, z), worked out from the triangle under it rather than searched for.
+	// Off the map these are the nearest edge's and the functions return false;
+	// nothing is written if the field is empty.
+	bool GetHeightAt( float x, float z, float& height ) const;
+	bool GetNormalAt( float x, float z, XMFLOAT3& normal ) const;
+	bool GetGroundAt( float x, float z, float& height, XMFLOAT3& normal ) const;
+
+	// The face index of that triangle, as RayHit and SphereHit give them, or
+	// -1 off the map
+	int GetFaceAt( float x, float z ) const;
+
+	// GetGroundAt for count points, four at a time. Gives exactly the same
+	// answers. pNormX/Y/Z and pOnMap may be NULL if they're not wanted.
+	// Returns how many of the points are over the map.
+	int GetGroundBatch( int count, const float* pX, const float* pZ, float* pHeights, float* pNormX = NULL, float* pNormY = NULL, float* pNormZ = NULL, unsigned char* pOnMap = NULL ) const;
+
+	void SetCollisionMode( CollisionMode mode ) { m_CollisionMode = mode; }
+	CollisionMode GetCollisionMode() const { return m_CollisionMode; }
+
+	void SetTriangleKernel( TriangleKernel kernel );
+	TriangleKernel GetTriangleKernel() const { return m_TriangleKernel; }
+	const char* GetTriangleKernelName() const;
+
+	// The precomputed triangle planes used by RayCell (TRIANGLE_KERNEL_REFERENCE)
+	// cost 128 bytes per cell, so they're only built when asked for
+	void SetTriangleCache( bool enabled );
+	bool GetTriangleCache() const { return m_pTriangleCache != NULL; }
+
+	// Converts the samples in place. Quantising moves each height by up to half
+	// a step of 1/65535th of the map's height range, and everything built from
+	// the heights is brought up to date with them.
+	void SetHeightStorage( HeightStorage storage );
+	HeightStorage GetHeightStorage() const { return m_HeightStorage; }
+	size_t GetSampleMemoryBytes() const;
+
+	// The samples plus the quadtree, packets and triangle cache built from them
+	size_t GetMemoryBytes() const;
+
+	// Reorders the samples in place; nothing else changes
+	void SetHeightLayout( HeightLayout layout );
+	HeightLayout GetHeightLayout() const { return m_HeightLayout; }
+
+	// Changes the heights of a width x length rectangle of samples, starting at
+	// column w and row l, and brings everything built from them up to date.
+	// With HEIGHT_STORAGE_UINT16, a height outside the map's current range
+	// requantises the whole map, which moves every sample a little; that's
+	// when it returns true.
+	bool SetHeights( int w, int l, int width, int length, const float* pHeights );
+	bool SetHeight( int w, int l, float height ) { return SetHeights(w, l, 1, 1, &height); }
+
+	// The map is m_HeightMapWidth x m_HeightMapLength samples, row by row. Each
+	// cell between four samples is split into two faces, numbered row by row,
+	// cell by cell, with the (i0, i1, i2) triangle before the (i2, i1, i3) one.
+	int GetWidth() const { return m_HeightMapWidth; }
+	int GetLength() const { return m_HeightMapLength; }
+	int GetFaceCount() const { return m_HeightMapFaceCount; }
+	float GetGridSize() const { return m_GridSize; }
+	XMVECTOR GetSample( int mapIndex ) const;
+	float GetSampleHeight( int mapIndex ) const;
+	void GetFaceSamples( int faceIndex, int* pSampleIndices ) const;
+
+	const QuadTreeStats& GetQuadTreeStats() const { return m_QuadTreeStats; }
+
+	// The single triangle and plane tests the queries are built from
+	static bool RayTriangle(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& rayPos, const XMVECTOR& rayDir, XMVECTOR& colPos, XMVECTOR& colNormN, float& colDist);
+	static bool PointPlane(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& pointPos);
+	static bool SphereTriangle(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& centre, float radius, const XMVECTOR& move, float maxTime, float& colTime, XMVECTOR& colContact, XMVECTOR& colNormN);
+
+private:
+	// A ray segment in grid coordinates, see MakeRaySegment
+	struct RaySegment
+	{
+		float u0, v0, y0;
+		float u1, v1, y1;
+
+		RayPacketSetup packetRay;	// The same ray in world space, for the packet kernel
+	};
+
+	// The state of a SphereCollision query, see SphereQuadNode
+	struct SphereSweep
+	{
+		XMVECTOR centre;
+		XMVECTOR move;			// The whole sweep, normalised dir * speed
+		float radius;
+		RaySegment seg;			// The centre's path in grid coordinates
+
+		int colFace;			// -1 until something is hit
+		float colTime;
+		XMVECTOR colContact;
+		XMVECTOR colNormN;
+	};
+
+	struct MinMax
+	{
+		float minY;
+		float maxY;
+	};
+
+	// Everything RayTriangle works out from a triangle's vertices, worked out
+	// once. Exactly one cache line each, indexed by GetFaceIndex.
+	struct alignas(64) CachedTriangle
+	{
+		XMFLOAT4 plane;				// |COLNORM| and D
+		XMFLOAT4 edgePlanes[3];		// Planes through each edge at right angles to the triangle, facing inwards
+	};
+
+	static const int MAX_QUADTREE_LEVELS = 32;
+
+	void Init( float gridSize, HeightStorage storage );
+	bool LoadHeightMap(const char* filename, float gridSize, float heightRange);
+	void CreateHeightMap( int width, int length, float gridSize, const float* pHeights );
+	bool MapBinary( const char* filename );
+	void AllocateHeightMap( void );
+	void InitStoredSampleCount( void );
+	void FreeHeightMap( void );
+	bool IsInMappedFile( const void* p ) const;
+	void QuantiseHeights( const float* pHeights, float minHeight, float maxHeight );
+	void BuildCollisionData( void );
+	void BeginLoadProgress( void );
+	void AddLoadProgress( int rows );
+	void UpdateCollisionData( int wFirst, int lFirst, int wLast, int lLast );
+	void BuildQuadTree( void );
+	int InitQuadTreeLevels( void );
+	void BuildTrianglePackets( void );
+	void UpdateQuadTree( int wFirst, int lFirst, int wLast, int lLast );
+	void UpdateTrianglePackets( int wFirst, int lFirst, int wLast, int lLast );
+	void UpdateTriangleCache( int wFirst, int lFirst, int wLast, int lLast );
+	void CacheTriangle( const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, CachedTriangle& tri );
+	static bool RayTriangleCached(const CachedTriangle& tri, const XMVECTOR& rayPos, const XMVECTOR& rayDirN, XMVECTOR& colPos, XMVECTOR& colNormN, float& colDist);
+	void FillRayHit(const XMVECTOR& rayPos, const XMVECTOR& rayDir, const XMVECTOR& colPos, const XMVECTOR& colNormN, int faceIndex, RayHit& hit) const;
+	bool FindRayCollision(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const;
+	bool RayCollisionBruteForce(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const;
+	bool RayCollisionGridWalk(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const;
+	bool RayCollisionQuadTree(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const;
+	void RayQuadNode(int level, int x, int z, const RaySegment& seg, const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const;
+	void RayBlockPacket(int x, int z, const RaySegment& seg, XMVECTOR& colPos, XMVECTOR& colNormN, int& colIndex, int& colHalf, QueryStats& stats) const;
+	void MakeRaySegment(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, RaySegment& seg) const;
+	bool ClipRaySegment(const RaySegment& seg, float uMin, float vMin, float uMax, float vMax, float& tA, float& tB) const;
+	bool RayCell(int l, int w, const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN, int& colHalf) const;
+	void SphereQuadNode(int level, int x, int z, SphereSweep& sweep, QueryStats& stats) const;
+	void SphereCell(int l, int w, SphereSweep& sweep, QueryStats& stats) const;
+
+	bool FindGroundCell( float x, float z, int& cellW, int& cellL, float& cellU, float& cellV ) const;
+
+	// The same expressions CreateHeightMap lays the samples out with
+	float GetSampleX( int w ) const { return (w-(((float)m_HeightMapWidth-1)/2))*m_GridSize; }
+	float GetSampleZ( int l ) const { return (l-(((float)m_HeightMapLength-1)/2))*m_GridSize; }
+	void GetCellSamples( int l, int w, XMVECTOR& v0, XMVECTOR& v1, XMVECTOR& v2, XMVECTOR& v3 ) const;
+	void GetCellHeights( int l, int w, float& h0, float& h1, float& h2, float& h3 ) const;
+
+	// Where sample (w, l) is in m_pHeightMap or m_pQuantisedHeights
+	int GetStorageIndex( int w, int l ) const { return m_HeightLayout == HEIGHT_LAYOUT_ROW_MAJOR ? (l*m_HeightMapWidth)+w : GetTiledIndex(w, l, m_TilesAcross); }
+
+	static int GetTiledIndex( int w, int l, int tilesAcross )
+	{
+		const int tileMask = (1 << HEIGHT_TILE_SHIFT) - 1;
+		int tile = ((l >> HEIGHT_TILE_SHIFT)*tilesAcross) + (w >> HEIGHT_TILE_SHIFT);
+
+		return (tile << (2*HEIGHT_TILE_SHIFT)) + ((l & tileMask) << HEIGHT_TILE_SHIFT) + (w & tileMask);
+	}
+
+	// Face index of half 0 or 1 of the cell whose first vertex is at mapIndex
+	int GetFaceIndex( int mapIndex, int half ) const { return (((mapIndex/m_HeightMapWidth)*(m_HeightMapWidth-1)) + (mapIndex%m_HeightMapWidth))*2 + half; }
+	bool PointOverQuad(XMVECTOR& vPos, XMVECTOR& v0, XMVECTOR& v1, XMVECTOR& v2);
+
+	int m_HeightMapWidth;
+	int m_HeightMapLength;
+	int m_HeightMapFaceCount;
+	float m_GridSize;
+	HeightStorage m_HeightStorage;
+	HeightLayout m_HeightLayout;
+	int m_TilesAcross;						// HEIGHT_LAYOUT_TILED, tiles per row of the map
+	int m_StoredSampleCount;				// Including the parts of the edge tiles off the map
+	XMFLOAT4* m_pHeightMap;					// HEIGHT_STORAGE_FLOAT4, otherwise NULL
+	unsigned short* m_pQuantisedHeights;	// HEIGHT_STORAGE_UINT16, otherwise NULL
+	float m_HeightOffset;					// Height = m_HeightOffset + (quantised * m_HeightScale)
+	float m_HeightScale;
+
+	CollisionMode m_CollisionMode;
+
+	MinMax* m_pQuadTree;
+	int m_QuadTreeLevels;
+	int m_QuadLevelWidth[MAX_QUADTREE_LEVELS];
+	int m_QuadLevelLength[MAX_QUADTREE_LEVELS];
+	int m_QuadLevelOffset[MAX_QUADTREE_LEVELS];
+
+	TriangleKernel m_TriangleKernel;
+	RayTrianglePacketFn m_pPacketKernel;
+	TrianglePacket* m_pTrianglePackets;	// One per 2x2 block of cells, i.e. per node on level 1 of the quadtree
+	CachedTriangle* m_pTriangleCache;
+
+	QuadTreeStats m_QuadTreeStats;
+
+	MappedFile* m_pMappedFile;	// Set if the samples came from a binary file, see MapBinary
+
+	LoadProgress* m_pLoadProgress;	// Only while a constructor runs
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include "HeightFieldLoader.h"
+
+#include <algorithm>
+#include <new>
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+HeightFieldLoader::Request::Request()
+	: m_Ready(false)
+{
+	m_Binary = false;
+	m_GridSize = 0.0f;
+	m_HeightRange = 0.0f;
+	m_Storage = HeightField::HEIGHT_STORAGE_FLOAT4;
+
+	m_pHeightField = NULL;
+	m_Released = false;
+}
+
+HeightField* HeightFieldLoader::Request::TakeHeightField()
+{
+	if( !IsReady() )
+		return NULL;
+
+	HeightField* pHeightField = m_pHeightField;
+	m_pHeightField = NULL;
+
+	return pHeightField;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+HeightFieldLoader::HeightFieldLoader()
+{
+	m_pLoading = NULL;
+	m_Stopping = false;
+
+	m_Thread = std::thread(&HeightFieldLoader::WorkerMain, this);
+}
+
+HeightFieldLoader::~HeightFieldLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+
+	m_WorkReady.notify_all();
+	m_Thread.join();
+
+	for( size_t i = 0; i < m_NowQueue.size(); ++i )
+		delete m_NowQueue[i];
+
+	for( size_t i = 0; i < m_PrefetchQueue.size(); ++i )
+		delete m_PrefetchQueue[i];
+}
+
+HeightFieldLoader::Request* HeightFieldLoader::Load( const char* filename, float gridSize, float heightRange, HeightField::HeightStorage storage, LoadPriority priority )
+{
+	Request* pRequest = new Request;
+	pRequest->m_Filename = filename;
+	pRequest->m_GridSize = gridSize;
+	pRequest->m_HeightRange = heightRange;
+	pRequest->m_Storage = storage;
+
+	return Queue(pRequest, priority);
+}
+
+HeightFieldLoader::Request* HeightFieldLoader::Load( const char* binaryFilename, LoadPriority priority )
+{
+	Request* pRequest = new Request;
+	pRequest->m_Filename = binaryFilename;
+	pRequest->m_Binary = true;
+
+	return Queue(pRequest, priority);
+}
+
+HeightFieldLoader::Request* HeightFieldLoader::Queue( Request* pRequest, LoadPriority priority )
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		if( priority == LOAD_PRIORITY_NOW )
+			m_NowQueue.push_back(pRequest);
+		else
+			m_PrefetchQueue.push_back(pRequest);
+	}
+
+	m_WorkReady.notify_one();
+
+	return pRequest;
+}
+
+// Takes a request out of whichever queue it's in. Called with m_Mutex held.
+bool HeightFieldLoader::RemoveQueued( Request* pRequest )
+{
+	std::deque<Request*>* apQueues[] = { &m_NowQueue, &m_PrefetchQueue };
+
+	for( size_t q = 0; q < sizeof apQueues / sizeof apQueues[0]; ++q )
+	{
+		std::deque<Request*>::iterator it = std::find(apQueues[q]->begin(), apQueues[q]->end(), pRequest);
+
+		if( it != apQueues[q]->end() )
+		{
+			apQueues[q]->erase(it);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void HeightFieldLoader::Wait( Request* pRequest )
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	if( RemoveQueued(pRequest) )
+		m_NowQueue.push_front(pRequest);
+
+	m_WorkDone.wait(lock, [pRequest]() { return pRequest->IsReady(); });
+}
+
+void HeightFieldLoader::Release( Request* pRequest )
+{
+	if( !pRequest )
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		// The thread deletes it once it's finished with it
+		if( pRequest == m_pLoading )
+		{
+			pRequest->m_Released = true;
+			return;
+		}
+
+		RemoveQueued(pRequest);
+	}
+
+	delete pRequest->m_pHeightField;
+	delete pRequest;
+}
+
+int HeightFieldLoader::GetPendingCount() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	return (int)(m_NowQueue.size() + m_PrefetchQueue.size()) + (m_pLoading ? 1 : 0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// WorkerMain
+// Loads the requests one after another until the loader is destroyed.
+//////////////////////////////////////////////////////////////////////
+void HeightFieldLoader::WorkerMain( void )
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	for( ;; )
+	{
+		m_WorkReady.wait(lock, [this]() { return m_Stopping || !m_NowQueue.empty() || !m_PrefetchQueue.empty(); });
+
+		if( m_Stopping )
+			return;
+
+		std::deque<Request*>& queue = !m_NowQueue.empty() ? m_NowQueue : m_PrefetchQueue;
+		Request* pRequest = queue.front();
+		queue.pop_front();
+		m_pLoading = pRequest;
+
+		lock.unlock();
+
+		HeightField* pHeightField = NULL;
+
+		// A map too big for a 32 bit build shouldn't take the whole program down
+		try
+		{
+			if( pRequest->m_Binary )
+				pHeightField = new HeightField(pRequest->m_Filename.c_str(), &pRequest->m_Progress);
+			else
+				pHeightField = new HeightField(pRequest->m_Filename.c_str(), pRequest->m_GridSize, pRequest->m_HeightRange, pRequest->m_Storage, &pRequest->m_Progress);
+		}
+		catch( const std::bad_alloc& )
+		{
+			pHeightField = NULL;
+		}
+
+		lock.lock();
+
+		m_pLoading = NULL;
+
+		if( pRequest->m_Released )
+		{
+			delete pHeightField;
+			delete pRequest;
+		}
+		else
+		{
+			pRequest->m_pHeightField = pHeightField;
+			pRequest->m_Ready.store(true, std::memory_order_release);
+		}
+
+		m_WorkDone.notify_all();
+	}
+}
@@ -0,0 +1,111 @@
+#ifndef HEIGHTFIELDLOADER_H
+#define HEIGHTFIELDLOADER_H
+
+//**********************************************************************
+// File:			HeightFieldLoader.h
+// Description:		Loads HeightFields on a thread of its own
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Everything HeightField's constructors do, reading the
+//					file, converting the samples and building the quadtree
+//					and packets, happens on the loader's thread. The caller
+//					polls IsReady each frame, or Waits, and then takes the
+//					finished field. Requests are loaded one at a time, every
+//					LOAD_PRIORITY_NOW one before any prefetch, and each
+//					reports the rows the constructor has got through.
+//**********************************************************************
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "HeightField.h"
+
+class HeightFieldLoader
+{
+public:
+	enum LoadPriority
+	{
+		LOAD_PRIORITY_NOW,			// Needed as soon as possible
+		LOAD_PRIORITY_PREFETCH,		// Likely to be needed soon, once nothing more urgent is waiting
+	};
+
+	// One HeightField being loaded, from Load until Release
+	class Request
+	{
+	public:
+		bool IsReady() const { return m_Ready.load(std::memory_order_acquire); }
+
+		// Rows converted or built so far, out of GetRowCount, for a progress
+		// bar. Both are 0 while it's queued or its image is being read; see
+		// HeightField::LoadProgress.
+		int GetRowsLoaded() const { return m_Progress.rowsDone.load(std::memory_order_relaxed); }
+		int GetRowCount() const { return m_Progress.rowCount.load(std::memory_order_relaxed); }
+
+		// Once it's ready, hands the field over to the caller. It's empty if
+		// the file couldn't be loaded, and NULL if there wasn't the memory
+		// for it or it's already been taken.
+		HeightField* TakeHeightField();
+
+	private:
+		friend class HeightFieldLoader;
+
+		Request();
+
+		std::string m_Filename;
+		bool m_Binary;				// A SaveBinary file, so the settings below aren't used
+		float m_GridSize;
+		float m_HeightRange;
+		HeightField::HeightStorage m_Storage;
+
+		HeightField* m_pHeightField;
+		HeightField::LoadProgress m_Progress;
+		std::atomic<bool> m_Ready;
+		bool m_Released;			// Release was called while it was loading
+	};
+
+	HeightFieldLoader();
+
+	// Stops after the request being loaded, if any. Every request should have
+	// been released by then; any still queued are deleted anyway.
+	~HeightFieldLoader();
+
+	// Queues a load with HeightField's bitmap or binary file constructor
+	Request* Load( const char* filename, float gridSize, float heightRange, HeightField::HeightStorage storage = HeightField::HEIGHT_STORAGE_FLOAT4, LoadPriority priority = LOAD_PRIORITY_NOW );
+	Request* Load( const char* binaryFilename, LoadPriority priority = LOAD_PRIORITY_NOW );
+
+	// Waits until the request is ready, moving it to the front of the queue
+	// if it's still waiting
+	void Wait( Request* pRequest );
+
+	// Deletes the request, and its field unless that's been taken. One still
+	// in the queue is dropped; one being loaded is deleted when it finishes.
+	void Release( Request* pRequest );
+
+	// Requests queued or being loaded, for a progress display; how far the
+	// one being loaded has got is its own
+	int GetPendingCount() const;
+
+private:
+	// Not copyable, the thread and requests belong to one object
+	HeightFieldLoader( const HeightFieldLoader& );
+	HeightFieldLoader& operator=( const HeightFieldLoader& );
+
+	Request* Queue( Request* pRequest, LoadPriority priority );
+	bool RemoveQueued( Request* pRequest );
+	void WorkerMain( void );
+
+	std::thread m_Thread;
+
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_WorkReady;
+	std::condition_variable m_WorkDone;
+	std::deque<Request*> m_NowQueue;
+	std::deque<Request*> m_PrefetchQueue;
+	Request* m_pLoading;
+	bool m_Stopping;
+};
+
+#endif
@@ -0,0 +1,881 @@
+#include "HeightFieldMesh.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+static const uint8_t STANDARD_COLOUR[4] = { 255, 255, 255, 255 };
+static const uint8_t COLLISION_COLOUR[4] = { 255, 0, 0, 255 };
+
+static void SetVertex( HeightFieldVertex& vertex, const XMVECTOR& pos, const uint8_t* pColour, const XMVECTOR& normal, float tX, float tY )
+{
+	XMStoreFloat3(&vertex.pos, pos);
+	memcpy(vertex.colour, pColour, sizeof vertex.colour);
+	XMStoreFloat3(&vertex.normal, normal);
+	vertex.tex = XMFLOAT2(tX, tY);
+}
+
+//////////////////////////////////////////////////////////////////////
+// GetFrustumPlanes
+// The planes bounding clip space, 0 <= z <= w, pulled back to world space.
+// A point p is inside plane n when dot(n, p) + n.w >= 0.
+//////////////////////////////////////////////////////////////////////
+static void GetFrustumPlanes( const XMMATRIX& viewProjection, XMVECTOR* pPlanes )
+{
+	// Rows of the transpose are the columns that give clip x, y, z and w
+	XMMATRIX columns = XMMatrixTranspose(viewProjection);
+
+	pPlanes[0] = columns.r[3] + columns.r[0];	// Left
+	pPlanes[1] = columns.r[3] - columns.r[0];	// Right
+	pPlanes[2] = columns.r[3] + columns.r[1];	// Bottom
+	pPlanes[3] = columns.r[3] - columns.r[1];	// Top
+	pPlanes[4] = columns.r[2];					// Near
+	pPlanes[5] = columns.r[3] - columns.r[2];	// Far
+}
+
+// Whether the box is wholly outside one of the planes, going by its
+// corner furthest along the plane's normal
+static bool IsBoxOutside( const XMVECTOR* pPlanes, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax )
+{
+	XMVECTOR vMin = XMLoadFloat3(&boundsMin);
+	XMVECTOR vMax = XMLoadFloat3(&boundsMax);
+
+	for( int i = 0; i < 6; ++i )
+	{
+		XMVECTOR positive = XMVectorSelect(vMin, vMax, XMVectorGreaterOrEqual(pPlanes[i], XMVectorZero()));
+
+		if( XMVectorGetX(XMPlaneDotCoord(pPlanes[i], positive)) < 0.0f )
+			return true;
+	}
+
+	return false;
+}
+
+// A last chunk of one cell goes on the one before, as a chunk needs a row
+// of samples inside its edges to be stitched to its neighbours
+static int CountChunks( int cells, int chunkCells )
+{
+	int count = (cells + chunkCells - 1) / chunkCells;
+
+	if( count > 1 && cells - ((count - 1) * chunkCells) < 2 )
+		--count;
+
+	return count;
+}
+
+// Where block k of a row of cells starts: every step cells, except that
+// the last block stops at the end of the row
+static int BlockEdge( int block, int step, int cells )
+{
+	return std::min(block * step, cells);
+}
+
+// Orders ranges by their first vertex, for merging
+static bool IsRangeBefore( const HeightFieldMesh::VertexRange& a, const HeightFieldMesh::VertexRange& b )
+{
+	return a.firstVertex < b.firstVertex;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+HeightFieldMesh::HeightFieldMesh()
+{
+	m_pHeightField = NULL;
+	m_Mode = MESH_UNINDEXED;
+	m_CellsAcross = 0;
+	m_CellsDown = 0;
+
+	m_ElementsAcross = 0;
+	m_ElementsDown = 0;
+	m_VerticesPerElement = VERTICES_PER_CELL;
+
+	m_pFaceHighlightBits = NULL;
+
+	m_ChunkCells = DEFAULT_CHUNK_CELLS;
+	m_ChunksAcross = 0;
+	m_ChunksDown = 0;
+}
+
+HeightFieldMesh::~HeightFieldMesh()
+{
+	delete [] m_pFaceHighlightBits;
+}
+
+void HeightFieldMesh::Create( const HeightField* pField, MeshMode mode, int chunkCells )
+{
+	m_pHeightField = pField;
+	m_Mode = mode;
+	m_CellsAcross = std::max(pField->GetWidth() - 1, 0);
+	m_CellsDown = std::max(pField->GetLength() - 1, 0);
+
+	if( m_Mode == MESH_INDEXED && GetCellCount() > 0 )
+	{
+		m_ElementsAcross = pField->GetWidth();
+		m_ElementsDown = pField->GetLength();
+		m_VerticesPerElement = 1;
+	}
+	else
+	{
+		m_ElementsAcross = m_CellsAcross;
+		m_ElementsDown = m_CellsDown;
+		m_VerticesPerElement = VERTICES_PER_CELL;
+	}
+
+	int highlightWords = ((GetCellCount()*2)+31)/32;
+
+	delete [] m_pFaceHighlightBits;
+	m_pFaceHighlightBits = new unsigned int[highlightWords];
+	memset(m_pFaceHighlightBits, 0, highlightWords * sizeof(unsigned int));
+
+	// Chunks row by row, each one's indices straight after the last's
+	m_ChunkCells = std::max(chunkCells, 1);
+	m_ChunksAcross = CountChunks(m_CellsAcross, m_ChunkCells);
+	m_ChunksDown = CountChunks(m_CellsDown, m_ChunkCells);
+
+	m_Chunks.resize(m_ChunksAcross * m_ChunksDown);
+
+	int firstIndex = 0;
+
+	for( int cz = 0; cz < m_ChunksDown; ++cz )
+	{
+		for( int cx = 0; cx < m_ChunksAcross; ++cx )
+		{
+			Chunk& chunk = m_Chunks[(cz * m_ChunksAcross) + cx];
+			chunk.w0 = cx * m_ChunkCells;
+			chunk.l0 = cz * m_ChunkCells;
+			chunk.w1 = (cx == m_ChunksAcross - 1) ? m_CellsAcross : chunk.w0 + m_ChunkCells;
+			chunk.l1 = (cz == m_ChunksDown - 1) ? m_CellsDown : chunk.l0 + m_ChunkCells;
+			chunk.firstIndex = firstIndex;
+			chunk.boundsDirty = true;
+			chunk.errorsDirty = true;
+			chunk.level = 0;
+
+			// Each level's step has to leave the chunk at least two blocks
+			// each way, the last of which can be short
+			int cellsW = chunk.w1 - chunk.w0;
+			int cellsL = chunk.l1 - chunk.l0;
+
+			chunk.levelCount = 1;
+
+			while( chunk.levelCount < MAX_LOD_LEVELS && std::min(cellsW, cellsL) > (1 << chunk.levelCount) )
+				++chunk.levelCount;
+
+			firstIndex += cellsW * cellsL * INDICES_PER_CELL;
+		}
+	}
+
+	MarkAllDirty();
+}
+
+void HeightFieldMesh::WriteIndices( uint32_t* pIndices ) const
+{
+	for( size_t i = 0; i < m_Chunks.size(); ++i )
+	{
+		const Chunk& chunk = m_Chunks[i];
+
+		for( int l = chunk.l0; l < chunk.l1; ++l )
+		{
+			for( int w = chunk.w0; w < chunk.w1; ++w )
+			{
+				WriteCellIndices(w, l, pIndices);
+				pIndices += INDICES_PER_CELL;
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// WriteCellIndices
+// The cell's two faces, 012 and 213: its own six vertices in
+// MESH_UNINDEXED, its corner samples in MESH_INDEXED.
+//////////////////////////////////////////////////////////////////////
+void HeightFieldMesh::WriteCellIndices( int w, int l, uint32_t* pIndices ) const
+{
+	if( m_Mode == MESH_INDEXED )
+	{
+		uint32_t width = (uint32_t)m_pHeightField->GetWidth();
+		uint32_t i0 = ((uint32_t)l * width) + w;
+		uint32_t i1 = i0 + width;
+		uint32_t i2 = i0 + 1;
+		uint32_t i3 = i0 + width + 1;
+
+		pIndices[0] = i0;
+		pIndices[1] = i1;
+		pIndices[2] = i2;
+		pIndices[3] = i2;
+		pIndices[4] = i1;
+		pIndices[5] = i3;
+	}
+	else
+	{
+		uint32_t firstVertex = (uint32_t)((l * m_CellsAcross) + w) * VERTICES_PER_CELL;
+
+		for( int i = 0; i < INDICES_PER_CELL; ++i )
+			pIndices[i] = firstVertex + i;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// BuildDrawList
+// Chunks follow each other in the index list in the same order as in
+// m_Chunks, so visible neighbours across a row share one draw.
+//////////////////////////////////////////////////////////////////////
+int HeightFieldMesh::BuildDrawList( const XMMATRIX& viewProjection, std::vector<IndexRange>& draws )
+{
+	XMVECTOR aPlanes[6];
+	GetFrustumPlanes(viewProjection, aPlanes);
+
+	draws.clear();
+
+	int visibleChunks = 0;
+
+	for( size_t i = 0; i < m_Chunks.size(); ++i )
+	{
+		Chunk& chunk = m_Chunks[i];
+
+		if( chunk.boundsDirty )
+			UpdateChunkBounds(chunk);
+
+		if( IsBoxOutside(aPlanes, chunk.boundsMin, chunk.boundsMax) )
+			continue;
+
+		++visibleChunks;
+
+		int indexCount = (chunk.w1 - chunk.w0) * (chunk.l1 - chunk.l0) * INDICES_PER_CELL;
+
+		if( !draws.empty() && draws.back().firstIndex + draws.back().indexCount == chunk.firstIndex )
+		{
+			draws.back().indexCount += indexCount;
+		}
+		else
+		{
+			IndexRange draw;
+			draw.firstIndex = chunk.firstIndex;
+			draw.indexCount = indexCount;
+
+			draws.push_back(draw);
+		}
+	}
+
+	return visibleChunks;
+}
+
+//////////////////////////////////////////////////////////////////////
+// BuildLodIndices
+// Every chunk's level is picked first, in view or not, so each edge can
+// be matched to the chunk on the other side of it.
+//////////////////////////////////////////////////////////////////////
+int HeightFieldMesh::BuildLodIndices( const XMMATRIX& viewProjection, const XMVECTOR& eye, float pixelsPerUnit, float maxPixelError, std::vector<uint32_t>& indices )
+{
+	indices.clear();
+
+	if( m_Mode != MESH_INDEXED )
+		return 0;
+
+	for( size_t i = 0; i < m_Chunks.size(); ++i )
+	{
+		Chunk& chunk = m_Chunks[i];
+
+		if( chunk.boundsDirty )
+			UpdateChunkBounds(chunk);
+
+		if( chunk.errorsDirty )
+			UpdateChunkErrors(chunk);
+
+		// An error e at distance d covers e * pixelsPerUnit / d pixels, d
+		// being to the nearest point of the chunk
+		XMVECTOR nearest = XMVectorClamp(eye, XMLoadFloat3(&chunk.boundsMin), XMLoadFloat3(&chunk.boundsMax));
+		float distance = XMVectorGetX(XMVector3Length(eye - nearest));
+		float allowedError = pixelsPerUnit > 0.0f ? (maxPixelError * distance) / pixelsPerUnit : 0.0f;
+
+		chunk.level = 0;
+
+		while( chunk.level + 1 < chunk.levelCount && chunk.levelErrors[chunk.level + 1] <= allowedError )
+			++chunk.level;
+	}
+
+	XMVECTOR aPlanes[6];
+	GetFrustumPlanes(viewProjection, aPlanes);
+
+	int visibleChunks = 0;
+
+	for( int cz = 0; cz < m_ChunksDown; ++cz )
+	{
+		for( int cx = 0; cx < m_ChunksAcross; ++cx )
+		{
+			const Chunk& chunk = m_Chunks[(cz * m_ChunksAcross) + cx];
+
+			if( IsBoxOutside(aPlanes, chunk.boundsMin, chunk.boundsMax) )
+				continue;
+
+			++visibleChunks;
+			AddChunkLodIndices(cx, cz, indices);
+		}
+	}
+
+	return visibleChunks;
+}
+
+// The step the chunk's edge facing (chunkX, chunkZ) has to use: its own,
+// or the neighbour's if that's coarser
+int HeightFieldMesh::GetEdgeStep( int chunkX, int chunkZ, int step ) const
+{
+	if( chunkX < 0 || chunkX >= m_ChunksAcross || chunkZ < 0 || chunkZ >= m_ChunksDown )
+		return step;
+
+	return std::max(step, 1 << m_Chunks[(chunkZ * m_ChunksAcross) + chunkX].level);
+}
+
+//////////////////////////////////////////////////////////////////////
+// AddChunkLodIndices
+// Blocks of step x step cells, split like a cell. If any edge needs a
+// coarser step, the ring of blocks around the edge is replaced by four
+// strips, each joining the samples along its edge to the row of samples
+// a block inside it.
+//////////////////////////////////////////////////////////////////////
+void HeightFieldMesh::AddChunkLodIndices( int chunkX, int chunkZ, std::vector<uint32_t>& indices ) const
+{
+	const Chunk& chunk = m_Chunks[(chunkZ * m_ChunksAcross) + chunkX];
+	int step = 1 << chunk.level;
+
+	int leftStep = GetEdgeStep(chunkX - 1, chunkZ, step);
+	int rightStep = GetEdgeStep(chunkX + 1, chunkZ, step);
+	int bottomStep = GetEdgeStep(chunkX, chunkZ - 1, step);
+	int topStep = GetEdgeStep(chunkX, chunkZ + 1, step);
+
+	int cellsW = chunk.w1 - chunk.w0;
+	int cellsL = chunk.l1 - chunk.l0;
+	int blocksW = (cellsW + step - 1) / step;
+	int blocksL = (cellsL + step - 1) / step;
+
+	bool stitched = leftStep != step || rightStep != step || bottomStep != step || topStep != step;
+	int inset = stitched ? 1 : 0;
+
+	for( int bl = inset; bl < blocksL - inset; ++bl )
+	{
+		int l = chunk.l0 + BlockEdge(bl, step, cellsL);
+		int nextL = chunk.l0 + BlockEdge(bl + 1, step, cellsL);
+
+		for( int bw = inset; bw < blocksW - inset; ++bw )
+		{
+			int w = chunk.w0 + BlockEdge(bw, step, cellsW);
+			int nextW = chunk.w0 + BlockEdge(bw + 1, step, cellsW);
+
+			AddTriangle(w, l, w, nextL, nextW, l, indices);
+			AddTriangle(nextW, l, w, nextL, nextW, nextL, indices);
+		}
+	}
+
+	if( !stitched )
+		return;
+
+	// The last block each way can be short
+	int lastW = cellsW - BlockEdge(blocksW - 1, step, cellsW);
+	int lastL = cellsL - BlockEdge(blocksL - 1, step, cellsL);
+
+	AddEdgeStrip(chunk.w0, chunk.l0, 1, 0, 0, 1, cellsW, step, bottomStep, step, indices);
+	AddEdgeStrip(chunk.w0, chunk.l1, 1, 0, 0, -1, cellsW, step, topStep, lastL, indices);
+	AddEdgeStrip(chunk.w0, chunk.l0, 0, 1, 1, 0, cellsL, step, leftStep, step, indices);
+	AddEdgeStrip(chunk.w1, chunk.l0, 0, 1, -1, 0, cellsL, step, rightStep, lastW, indices);
+}
+
+// Zips the samples every edgeStep along the edge from (w, l) to the ones
+// every step along the row depth inside it, which starts and ends a block
+// in from the corners. Neighbouring strips meet on the diagonals from the
+// corners.
+void HeightFieldMesh::AddEdgeStrip( int w, int l, int alongW, int alongL, int inwardW, int inwardL, int length, int step, int edgeStep, int depth, std::vector<uint32_t>& indices ) const
+{
+	int outerCount = ((length + edgeStep - 1) / edgeStep) + 1;
+	int innerCount = ((length + step - 1) / step) - 1;
+
+	int outer = 0;
+	int inner = 0;
+
+	while( outer < outerCount - 1 || inner < innerCount - 1 )
+	{
+		int outerPos = BlockEdge(outer, edgeStep, length);
+		int nextOuterPos = BlockEdge(outer + 1, edgeStep, length);
+		int innerPos = BlockEdge(inner + 1, step, length);
+		int nextInnerPos = BlockEdge(inner + 2, step, length);
+
+		int outerW = w + (alongW * outerPos);
+		int outerL = l + (alongL * outerPos);
+		int innerW = w + (alongW * innerPos) + (inwardW * depth);
+		int innerL = l + (alongL * innerPos) + (inwardL * depth);
+
+		// Move along whichever row's next sample comes first
+		if( inner == innerCount - 1 || (outer < outerCount - 1 && nextOuterPos <= nextInnerPos) )
+		{
+			AddTriangle(outerW, outerL, w + (alongW * nextOuterPos), l + (alongL * nextOuterPos), innerW, innerL, indices);
+			++outer;
+		}
+		else
+		{
+			AddTriangle(outerW, outerL, innerW, innerL, innerW + (alongW * (nextInnerPos - innerPos)), innerL + (alongL * (nextInnerPos - innerPos)), indices);
+			++inner;
+		}
+	}
+}
+
+// Samples (wA, lA), (wB, lB) and (wC, lC), turned to wind the same way as
+// a cell's faces
+void HeightFieldMesh::AddTriangle( int wA, int lA, int wB, int lB, int wC, int lC, std::vector<uint32_t>& indices ) const
+{
+	int cross = ((wB - wA) * (lC - lA)) - ((lB - lA) * (wC - wA));
+
+	if( cross == 0 )
+		return;
+
+	if( cross > 0 )
+	{
+		std::swap(wB, wC);
+		std::swap(lB, lC);
+	}
+
+	uint32_t width = (uint32_t)m_pHeightField->GetWidth();
+
+	indices.push_back(((uint32_t)lA * width) + wA);
+	indices.push_back(((uint32_t)lB * width) + wB);
+	indices.push_back(((uint32_t)lC * width) + wC);
+}
+
+float HeightFieldMesh::GetChunkLevelError( int chunk, int level )
+{
+	if( m_Chunks[chunk].errorsDirty )
+		UpdateChunkErrors(m_Chunks[chunk]);
+
+	return m_Chunks[chunk].levelErrors[level];
+}
+
+//////////////////////////////////////////////////////////////////////
+// UpdateChunkErrors
+// For each level, the largest difference between a sample's height and
+// the height of the block triangle above or below it.
+//////////////////////////////////////////////////////////////////////
+void HeightFieldMesh::UpdateChunkErrors( Chunk& chunk ) const
+{
+	int width = m_pHeightField->GetWidth();
+	int cellsW = chunk.w1 - chunk.w0;
+	int cellsL = chunk.l1 - chunk.l0;
+
+	chunk.levelErrors[0] = 0.0f;
+
+	for( int level = 1; level < chunk.levelCount; ++level )
+	{
+		int step = 1 << level;
+		float maxError = chunk.levelErrors[level - 1];
+
+		for( int bl = 0; bl < cellsL; bl += step )
+		{
+			int blockL = BlockEdge(1, step, cellsL - bl);
+			float invBlockL = 1.0f / (float)blockL;
+
+			for( int bw = 0; bw < cellsW; bw += step )
+			{
+				int blockW = BlockEdge(1, step, cellsW - bw);
+				float invBlockW = 1.0f / (float)blockW;
+
+				int i0 = ((chunk.l0 + bl) * width) + chunk.w0 + bw;
+				float h0 = m_pHeightField->GetSampleHeight(i0);
+				float h1 = m_pHeightField->GetSampleHeight(i0 + (blockL * width));
+				float h2 = m_pHeightField->GetSampleHeight(i0 + blockW);
+				float h3 = m_pHeightField->GetSampleHeight(i0 + (blockL * width) + blockW);
+
+				for( int v = 0; v <= blockL; ++v )
+				{
+					for( int u = 0; u <= blockW; ++u )
+					{
+						// Face 012 below the diagonal from sample 1 to 2, 213 above it
+						float s = u * invBlockW;
+						float t = v * invBlockL;
+						float height;
+
+						if( s + t <= 1.0f )
+							height = h0 + ((h2 - h0) * s) + ((h1 - h0) * t);
+						else
+							height = h3 + ((h1 - h3) * (1.0f - s)) + ((h2 - h3) * (1.0f - t));
+
+						float error = fabsf(m_pHeightField->GetSampleHeight(i0 + (v * width) + u) - height);
+						maxError = std::max(maxError, error);
+					}
+				}
+			}
+		}
+
+		chunk.levelErrors[level] = maxError;
+	}
+
+	chunk.errorsDirty = false;
+}
+
+// The chunk holding the cell; a last chunk of a row or column can be a cell
+// bigger than the rest
+int HeightFieldMesh::GetChunkIndex( int cellW, int cellL ) const
+{
+	int chunkX = std::min(cellW / m_ChunkCells, m_ChunksAcross - 1);
+	int chunkZ = std::min(cellL / m_ChunkCells, m_ChunksDown - 1);
+
+	return (chunkZ * m_ChunksAcross) + chunkX;
+}
+
+void HeightFieldMesh::GetChunkBounds( int chunk, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax )
+{
+	if( m_Chunks[chunk].boundsDirty )
+		UpdateChunkBounds(m_Chunks[chunk]);
+
+	boundsMin = m_Chunks[chunk].boundsMin;
+	boundsMax = m_Chunks[chunk].boundsMax;
+}
+
+// Every sample at the corners of the chunk's cells, including the ones it
+// shares with the chunks after it
+void HeightFieldMesh::UpdateChunkBounds( Chunk& chunk ) const
+{
+	int width = m_pHeightField->GetWidth();
+
+	float minHeight = FLT_MAX;
+	float maxHeight = -FLT_MAX;
+
+	for( int l = chunk.l0; l <= chunk.l1; ++l )
+	{
+		for( int w = chunk.w0; w <= chunk.w1; ++w )
+		{
+			float height = m_pHeightField->GetSampleHeight((l * width) + w);
+
+			minHeight = std::min(minHeight, height);
+			maxHeight = std::max(maxHeight, height);
+		}
+	}
+
+	XMFLOAT3 corner0, corner1;
+	XMStoreFloat3(&corner0, m_pHeightField->GetSample((chunk.l0 * width) + chunk.w0));
+	XMStoreFloat3(&corner1, m_pHeightField->GetSample((chunk.l1 * width) + chunk.w1));
+
+	chunk.boundsMin = XMFLOAT3(std::min(corner0.x, corner1.x), minHeight, std::min(corner0.z, corner1.z));
+	chunk.boundsMax = XMFLOAT3(std::max(corner0.x, corner1.x), maxHeight, std::max(corner0.z, corner1.z));
+	chunk.boundsDirty = false;
+}
+
+void HeightFieldMesh::WriteVertices( int firstVertex, int vertexCount, HeightFieldVertex* pVertices ) const
+{
+	if( m_VerticesPerElement == 1 )
+	{
+		int lastVertex = firstVertex + vertexCount;
+
+		// A row at a time, so each cell's normals are worked out once
+		for( int sample = firstVertex; sample < lastVertex; )
+		{
+			int l = sample / m_ElementsAcross;
+			int w0 = sample - (l * m_ElementsAcross);
+			int count = std::min(lastVertex - sample, m_ElementsAcross - w0);
+
+			WriteSampleRow(l, w0, w0 + count - 1, pVertices + (sample - firstVertex));
+			sample += count;
+		}
+	}
+	else
+	{
+		int firstCell = firstVertex / VERTICES_PER_CELL;
+		int cellCount = vertexCount / VERTICES_PER_CELL;
+
+		for( int cell = firstCell; cell < firstCell + cellCount; ++cell )
+			WriteCellVertices(cell, pVertices + ((cell - firstCell) * VERTICES_PER_CELL));
+	}
+}
+
+// The flat normals of faces 012 and 213 of a cell
+void HeightFieldMesh::GetFaceNormals( int cellW, int cellL, XMVECTOR& normal0, XMVECTOR& normal1 ) const
+{
+	int i0 = (cellL * m_pHeightField->GetWidth()) + cellW;
+	int i1 = i0 + m_pHeightField->GetWidth();
+	int i2 = i0 + 1;
+	int i3 = i1 + 1;
+
+	XMVECTOR v0 = m_pHeightField->GetSample(i0);
+	XMVECTOR v1 = m_pHeightField->GetSample(i1);
+	XMVECTOR v2 = m_pHeightField->GetSample(i2);
+	XMVECTOR v3 = m_pHeightField->GetSample(i3);
+
+	XMVECTOR vA = v0 - v1;
+	XMVECTOR vB = v1 - v2;
+	XMVECTOR vC = v3 - v1;
+
+	normal0 = XMVector3Normalize(XMVector3Cross(vA, vB));
+	normal1 = XMVector3Normalize(XMVector3Cross(vB, vC));
+}
+
+//////////////////////////////////////////////////////////////////////
+// WriteCellVertices
+// The unstripped method: each of the cell's two faces gets its own three
+// vertices and a flat normal.
+//////////////////////////////////////////////////////////////////////
+void HeightFieldMesh::WriteCellVertices( int cell, HeightFieldVertex* pVertices ) const
+{
+	int width = m_pHeightField->GetWidth();
+	int l = cell / m_CellsAcross;
+	int w = cell - (l * m_CellsAcross);
+
+	int i0 = (l * width) + w;
+
+	XMVECTOR v0 = m_pHeightField->GetSample(i0);
+	XMVECTOR v1 = m_pHeightField->GetSample(i0 + width);
+	XMVECTOR v2 = m_pHeightField->GetSample(i0 + 1);
+	XMVECTOR v3 = m_pHeightField->GetSample(i0 + width + 1);
+
+	XMVECTOR vN1, vN2;
+	GetFaceNormals(w, l, vN1, vN2);
+
+	const uint8_t* c0 = IsFaceHighlighted((cell*2) + 0) ? COLLISION_COLOUR : STANDARD_COLOUR;
+	const uint8_t* c1 = IsFaceHighlighted((cell*2) + 1) ? COLLISION_COLOUR : STANDARD_COLOUR;
+
+	SetVertex(pVertices[0], v0, c0, vN1, 0.0f, 0.0f);
+	SetVertex(pVertices[1], v1, c0, vN1, 0.0f, 1.0f);
+	SetVertex(pVertices[2], v2, c0, vN1, 1.0f, 0.0f);
+	SetVertex(pVertices[3], v2, c1, vN2, 1.0f, 0.0f);
+	SetVertex(pVertices[4], v1, c1, vN2, 0.0f, 1.0f);
+	SetVertex(pVertices[5], v3, c1, vN2, 1.0f, 1.0f);
+}
+
+//////////////////////////////////////////////////////////////////////
+// WriteSampleRow
+// Samples w0 to w1 of row l. A sample is corner 0 of face 012 of the cell
+// it starts, corner 3 of face 213 of the cell diagonally before it, and in
+// both faces of the cells before it across and down. Its normal is the
+// average of theirs, and it's red if any of them is highlighted. The
+// normals of cells w0-1 to w1 in rows l-1 and l are found first, as
+// neighbouring samples share all but two of their cells.
+//////////////////////////////////////////////////////////////////////
+void HeightFieldMesh::WriteSampleRow( int l, int w0, int w1, HeightFieldVertex* pVertices ) const
+{
+	int firstCell = w0 - 1;
+	int cellCount = (w1 - w0) + 2;
+
+	// [row][cell][face], row 0 being l-1
+	std::vector<XMFLOAT3> normals(2 * cellCount * 2);
+
+	for( int row = 0; row < 2; ++row )
+	{
+		int cellL = l - 1 + row;
+
+		if( cellL < 0 || cellL >= m_CellsDown )
+			continue;
+
+		for( int i = 0; i < cellCount; ++i )
+		{
+			int cellW = firstCell + i;
+
+			if( cellW < 0 || cellW >= m_CellsAcross )
+				continue;
+
+			XMVECTOR normal0, normal1;
+			GetFaceNormals(cellW, cellL, normal0, normal1);
+
+			XMStoreFloat3(&normals[(((row * cellCount) + i) * 2) + 0], normal0);
+			XMStoreFloat3(&normals[(((row * cellCount) + i) * 2) + 1], normal1);
+		}
+	}
+
+	struct AdjacentCell
+	{
+		int w, row;
+		bool face0, face1;
+	};
+
+	const AdjacentCell aCells[] = {
+		{ 0,  1, true,  false },
+		{ -1, 1, true,  true  },
+		{ 0,  0, true,  true  },
+		{ -1, 0, false, true  },
+	};
+
+	for( int w = w0; w <= w1; ++w )
+	{
+		XMVECTOR normalSum = XMVectorZero();
+		bool highlighted = false;
+
+		for( size_t i = 0; i < sizeof aCells / sizeof aCells[0]; ++i )
+		{
+			const AdjacentCell& adjacent = aCells[i];
+			int cellW = w + adjacent.w;
+			int cellL = l - 1 + adjacent.row;
+
+			if( cellW < 0 || cellW >= m_CellsAcross || cellL < 0 || cellL >= m_CellsDown )
+				continue;
+
+			const XMFLOAT3* pNormals = &normals[((adjacent.row * cellCount) + (cellW - firstCell)) * 2];
+			int face = ((cellL * m_CellsAcross) + cellW) * 2;
+
+			if( adjacent.face0 )
+			{
+				normalSum += XMLoadFloat3(&pNormals[0]);
+				highlighted = highlighted || IsFaceHighlighted(face);
+			}
+
+			if( adjacent.face1 )
+			{
+				normalSum += XMLoadFloat3(&pNormals[1]);
+				highlighted = highlighted || IsFaceHighlighted(face + 1);
+			}
+		}
+
+		int sample = (l * m_ElementsAcross) + w;
+
+		SetVertex(pVertices[w - w0], m_pHeightField->GetSample(sample), highlighted ? COLLISION_COLOUR : STANDARD_COLOUR, XMVector3Normalize(normalSum), (float)w, (float)l);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// MarkSamplesDirty
+// Sample (w, l) is a corner of cells w-1 and w across, l-1 and l down,
+// and its height moves the averaged normals of the samples around it.
+//////////////////////////////////////////////////////////////////////
+void HeightFieldMesh::MarkSamplesDirty( int w, int l, int width, int length )
+{
+	if( m_VerticesPerElement == 1 )
+		MarkElementsDirty(w - 1, l - 1, width + 2, length + 2);
+	else
+		MarkElementsDirty(w - 1, l - 1, width + 1, length + 1);
+
+	// Chunks whose cells have any of the samples at a corner
+	int cellW0 = std::max(w - 1, 0);
+	int cellL0 = std::max(l - 1, 0);
+	int cellW1 = std::min(w + width, m_CellsAcross) - 1;
+	int cellL1 = std::min(l + length, m_CellsDown) - 1;
+
+	if( cellW0 > cellW1 || cellL0 > cellL1 )
+		return;
+
+	int first = GetChunkIndex(cellW0, cellL0);
+	int last = GetChunkIndex(cellW1, cellL1);
+
+	for( int cz = first / m_ChunksAcross; cz <= last / m_ChunksAcross; ++cz )
+	{
+		for( int cx = first % m_ChunksAcross; cx <= last % m_ChunksAcross; ++cx )
+		{
+			m_Chunks[(cz * m_ChunksAcross) + cx].boundsDirty = true;
+			m_Chunks[(cz * m_ChunksAcross) + cx].errorsDirty = true;
+		}
+	}
+}
+
+void HeightFieldMesh::MarkAllDirty( void )
+{
+	m_DirtyRects.clear();
+	MarkElementsDirty(0, 0, m_ElementsAcross, m_ElementsDown);
+}
+
+void HeightFieldMesh::MarkElementsDirty( int w, int l, int width, int length )
+{
+	ElementRect rect;
+	rect.w0 = std::max(w, 0);
+	rect.l0 = std::max(l, 0);
+	rect.w1 = std::min(w + width, m_ElementsAcross);
+	rect.l1 = std::min(l + length, m_ElementsDown);
+
+	if( rect.w0 >= rect.w1 || rect.l0 >= rect.l1 )
+		return;
+
+	// Highlights mark the same few cells over and over
+	for( size_t i = 0; i < m_DirtyRects.size(); ++i )
+	{
+		const ElementRect& dirty = m_DirtyRects[i];
+
+		if( rect.w0 >= dirty.w0 && rect.w1 <= dirty.w1 && rect.l0 >= dirty.l0 && rect.l1 <= dirty.l1 )
+			return;
+	}
+
+	if( (int)m_DirtyRects.size() < MAX_DIRTY_RECTS )
+	{
+		m_DirtyRects.push_back(rect);
+		return;
+	}
+
+	for( size_t i = 0; i < m_DirtyRects.size(); ++i )
+	{
+		rect.w0 = std::min(rect.w0, m_DirtyRects[i].w0);
+		rect.l0 = std::min(rect.l0, m_DirtyRects[i].l0);
+		rect.w1 = std::max(rect.w1, m_DirtyRects[i].w1);
+		rect.l1 = std::max(rect.l1, m_DirtyRects[i].l1);
+	}
+
+	m_DirtyRects.clear();
+	m_DirtyRects.push_back(rect);
+}
+
+void HeightFieldMesh::SetFaceHighlighted( int faceIndex, bool highlighted )
+{
+	if( IsFaceHighlighted(faceIndex) == highlighted )
+		return;
+
+	unsigned int bit = 1u << (faceIndex & 31);
+
+	if( highlighted )
+		m_pFaceHighlightBits[faceIndex >> 5] |= bit;
+	else
+		m_pFaceHighlightBits[faceIndex >> 5] &= ~bit;
+
+	int cell = faceIndex / 2;
+	int l = cell / m_CellsAcross;
+	int w = cell - (l * m_CellsAcross);
+
+	// The cell, or its four corner samples
+	if( m_VerticesPerElement == 1 )
+		MarkElementsDirty(w, l, 2, 2);
+	else
+		MarkElementsDirty(w, l, 1, 1);
+}
+
+//////////////////////////////////////////////////////////////////////
+// TakeDirtyRanges
+// A rectangle as wide as the map is one run; any narrower is a run per
+// row, which the merging joins back up where rectangles share rows.
+//////////////////////////////////////////////////////////////////////
+void HeightFieldMesh::TakeDirtyRanges( std::vector<VertexRange>& ranges, int mergeGap )
+{
+	ranges.clear();
+
+	for( size_t i = 0; i < m_DirtyRects.size(); ++i )
+	{
+		const ElementRect& rect = m_DirtyRects[i];
+
+		for( int l = rect.l0; l < rect.l1; ++l )
+		{
+			VertexRange range;
+			range.firstVertex = ((l * m_ElementsAcross) + rect.w0) * m_VerticesPerElement;
+			range.vertexCount = (rect.w1 - rect.w0) * m_VerticesPerElement;
+
+			ranges.push_back(range);
+		}
+	}
+
+	m_DirtyRects.clear();
+
+	if( ranges.empty() )
+		return;
+
+	std::sort(ranges.begin(), ranges.end(), IsRangeBefore);
+
+	// Gaps are whole elements, so the runs stay whole cells
+	int elementGap = mergeGap / m_VerticesPerElement;
+
+	size_t merged = 0;
+
+	for( size_t i = 1; i < ranges.size(); ++i )
+	{
+		VertexRange& last = ranges[merged];
+		int lastEnd = last.firstVertex + last.vertexCount;
+
+		if( ranges[i].firstVertex <= lastEnd + (elementGap * m_VerticesPerElement) )
+		{
+			last.vertexCount = std::max(lastEnd, ranges[i].firstVertex + ranges[i].vertexCount) - last.firstVertex;
+		}
+		else
+		{
+			ranges[++merged] = ranges[i];
+		}
+	}
+
+	ranges.resize(merged + 1);
+}
@@ -0,0 +1,218 @@
+#ifndef HEIGHTFIELDMESH_H
+#define HEIGHTFIELDMESH_H
+
+//**********************************************************************
+// File:			HeightFieldMesh.h
+// Description:		The vertices a HeightField is drawn with, and which of
+//					them have changed since they were last uploaded
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Nothing here touches D3D, so the vertices and the dirty
+//					tracking can be checked without a window.
+//
+//					MESH_UNINDEXED is six vertices a cell, cells in face
+//					order, so face f's vertices start at 3*f and each face
+//					has its own flat normal and colour. MESH_INDEXED is one
+//					vertex a sample, laid out like the samples, with normals
+//					averaged over the faces around it. It's about a sixth of
+//					the size, but a highlighted face's colour blends into its
+//					neighbours.
+//
+//					Either way the mesh is drawn through a 32 bit index list
+//					that never changes, which takes the cells a square chunk
+//					at a time. Each chunk is a run of indices with its own
+//					bounding box, so BuildDrawList can leave out the chunks
+//					outside the view.
+//
+//					MESH_INDEXED meshes can also be drawn with geomipmapping:
+//					BuildLodIndices draws each chunk with every 2^n th sample
+//					across and down, n chosen so the surface it leaves out is
+//					at most a few pixels from the one drawn. The edges of a
+//					chunk next to a coarser one use that chunk's samples,
+//					so the levels meet without cracks.
+//
+//					Changes are kept as rectangles of cells or samples, and
+//					handed out as runs of vertices to regenerate, one or more
+//					per row of each rectangle, merged where they overlap or
+//					nearly touch.
+//**********************************************************************
+
+#include <stdint.h>
+#include <vector>
+
+#include "HeightField.h"
+
+// Laid out like the framework's Vertex_Pos3fColour4ubNormal3fTex2f, so an
+// array of them can be uploaded as one
+struct HeightFieldVertex
+{
+	XMFLOAT3 pos;
+	uint8_t colour[4];			// r, g, b, a
+	XMFLOAT3 normal;
+	XMFLOAT2 tex;				// 0 to 1 across a cell, or in MESH_INDEXED the sample's w and l
+};
+
+class HeightFieldMesh
+{
+public:
+	enum MeshMode
+	{
+		MESH_UNINDEXED,			// Six vertices a cell
+		MESH_INDEXED,			// One vertex a sample, and an index list
+	};
+
+	static const int VERTICES_PER_CELL = 6;
+	static const int INDICES_PER_CELL = 6;
+
+	// Past this many rectangles they're replaced by the one that bounds them
+	static const int MAX_DIRTY_RECTS = 64;
+
+	static const int DEFAULT_CHUNK_CELLS = 64;
+
+	// Level n uses every 2^n th sample, and chunks go down to two blocks
+	// of samples each way
+	static const int MAX_LOD_LEVELS = 8;
+
+	// Vertices firstVertex to firstVertex+vertexCount-1
+	struct VertexRange
+	{
+		int firstVertex;
+		int vertexCount;
+	};
+
+	// Indices firstIndex to firstIndex+indexCount-1, for one draw
+	struct IndexRange
+	{
+		int firstIndex;
+		int indexCount;
+	};
+
+	HeightFieldMesh();
+	~HeightFieldMesh();
+
+	// Sizes the mesh to pField, which must outlive it or the next Create,
+	// in chunks of chunkCells x chunkCells cells, those on the far edges
+	// taking what's left over. Nothing is highlighted and every vertex is
+	// dirty.
+	void Create( const HeightField* pField, MeshMode mode = MESH_UNINDEXED, int chunkCells = DEFAULT_CHUNK_CELLS );
+
+	MeshMode GetMode() const { return m_Mode; }
+	int GetCellCount() const { return m_CellsAcross * m_CellsDown; }
+	int GetVertexCount() const { return m_ElementsAcross * m_ElementsDown * m_VerticesPerElement; }
+
+	// A cell's six vertices, or a sample's one. Dirty runs are always whole
+	// elements.
+	int GetVerticesPerElement() const { return m_VerticesPerElement; }
+
+	int GetIndexCount() const { return GetCellCount() * INDICES_PER_CELL; }
+	void WriteIndices( uint32_t* pIndices ) const;
+
+	// The index runs of the chunks any of whose bounding box is inside the
+	// frustum of viewProjection (world to clip space, D3D style), with
+	// neighbouring runs joined. Returns how many chunks that is.
+	int BuildDrawList( const XMMATRIX& viewProjection, std::vector<IndexRange>& draws );
+
+	// MESH_INDEXED only. Fills indices with the chunks BuildDrawList would
+	// draw, each at the coarsest level whose error, seen from eye, is at
+	// most maxPixelError pixels. pixelsPerUnit is how many pixels a world
+	// unit covers one unit in front of the eye: the viewport height over
+	// 2*tan(fovY/2) for a perspective projection. Returns how many chunks
+	// that is.
+	int BuildLodIndices( const XMMATRIX& viewProjection, const XMVECTOR& eye, float pixelsPerUnit, float maxPixelError, std::vector<uint32_t>& indices );
+
+	int GetChunkCount() const { return (int)m_Chunks.size(); }
+	void GetChunkBounds( int chunk, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax );
+
+	// The levels the chunk can be drawn at, and the level the last
+	// BuildLodIndices chose for it
+	int GetChunkLevelCount( int chunk ) const { return m_Chunks[chunk].levelCount; }
+	int GetChunkLevel( int chunk ) const { return m_Chunks[chunk].level; }
+
+	// How far, in height, a sample of the chunk can be from the surface
+	// drawn at level. Never less than the level below's.
+	float GetChunkLevelError( int chunk, int level );
+
+	// Writes a run of vertices, white or red where faces are highlighted.
+	// For MESH_UNINDEXED the run has to be whole cells, as TakeDirtyRanges's are.
+	void WriteVertices( int firstVertex, int vertexCount, HeightFieldVertex* pVertices ) const;
+
+	// Marks the vertices using any of a width x length block of samples, as
+	// HeightField::SetHeights changes them, and the bounds of their chunks
+	void MarkSamplesDirty( int w, int l, int width, int length );
+	void MarkAllDirty( void );
+
+	bool IsFaceHighlighted( int faceIndex ) const { return (m_pFaceHighlightBits[faceIndex >> 5] & (1u << (faceIndex & 31))) != 0; }
+
+	// Marks the face's vertices dirty if it changes
+	void SetFaceHighlighted( int faceIndex, bool highlighted );
+
+	bool IsDirty() const { return !m_DirtyRects.empty(); }
+
+	// Fills ranges with the dirty vertices in order, and clears them. Runs
+	// less than mergeGap vertices apart are joined, which rewrites the
+	// vertices between them but saves an upload. A gap in elements times
+	// GetVerticesPerElement keeps the same share of a row in either mode.
+	void TakeDirtyRanges( std::vector<VertexRange>& ranges, int mergeGap = 0 );
+
+private:
+	// Cells (MESH_UNINDEXED) or samples (MESH_INDEXED) w0 to w1-1 across,
+	// l0 to l1-1 down
+	struct ElementRect
+	{
+		int w0, l0;
+		int w1, l1;
+	};
+
+	// Cells w0 to w1-1 across, l0 to l1-1 down, and their indices
+	struct Chunk
+	{
+		int w0, l0;
+		int w1, l1;
+		int firstIndex;
+		XMFLOAT3 boundsMin;
+		XMFLOAT3 boundsMax;
+		bool boundsDirty;		// Heights have changed since the bounds were found
+		bool errorsDirty;		// ...or since levelErrors were
+		int levelCount;
+		int level;
+		float levelErrors[MAX_LOD_LEVELS];
+	};
+
+	// Not copyable, the highlight bits belong to one object
+	HeightFieldMesh( const HeightFieldMesh& );
+	HeightFieldMesh& operator=( const HeightFieldMesh& );
+
+	void MarkElementsDirty( int w, int l, int width, int length );
+
+	void WriteCellVertices( int cell, HeightFieldVertex* pVertices ) const;
+	void WriteSampleRow( int l, int w0, int w1, HeightFieldVertex* pVertices ) const;
+	void GetFaceNormals( int cellW, int cellL, XMVECTOR& normal0, XMVECTOR& normal1 ) const;
+	void UpdateChunkBounds( Chunk& chunk ) const;
+	void UpdateChunkErrors( Chunk& chunk ) const;
+	void WriteCellIndices( int w, int l, uint32_t* pIndices ) const;
+
+	int GetChunkIndex( int cellW, int cellL ) const;
+	int GetEdgeStep( int chunkX, int chunkZ, int step ) const;
+	void AddChunkLodIndices( int chunkX, int chunkZ, std::vector<uint32_t>& indices ) const;
+	void AddEdgeStrip( int w, int l, int alongW, int alongL, int inwardW, int inwardL, int length, int step, int edgeStep, int depth, std::vector<uint32_t>& indices ) const;
+	void AddTriangle( int wA, int lA, int wB, int lB, int wC, int lC, std::vector<uint32_t>& indices ) const;
+
+	const HeightField* m_pHeightField;
+	MeshMode m_Mode;
+	int m_CellsAcross;
+	int m_CellsDown;
+
+	// What the dirty rectangles count: cells, or samples
+	int m_ElementsAcross;
+	int m_ElementsDown;
+	int m_VerticesPerElement;
+
+	unsigned int* m_pFaceHighlightBits;	// One bit per face
+	std::vector<ElementRect> m_DirtyRects;
+
+	int m_ChunkCells;
+	int m_ChunksAcross;
+	int m_ChunksDown;
+	std::vector<Chunk> m_Chunks;
+};
+
+#endif
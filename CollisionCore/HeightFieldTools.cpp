@@ -0,0 +1,56 @@
+#include "HeightFieldTools.h"
+#include "Random.h"
+
+#include <math.h>
+#include <string.h>
+
+bool ParseHeightStorage( const char* pName, HeightField::HeightStorage& storage )
+{
+	if( strcmp(pName, "float4") == 0 )
+		storage = HeightField::HEIGHT_STORAGE_FLOAT4;
+	else if( strcmp(pName, "uint16") == 0 )
+		storage = HeightField::HEIGHT_STORAGE_UINT16;
+	else
+		return false;
+
+	return true;
+}
+
+bool ParseHeightLayout( const char* pName, HeightField::HeightLayout& layout )
+{
+	if( strcmp(pName, "rows") == 0 )
+		layout = HeightField::HEIGHT_LAYOUT_ROW_MAJOR;
+	else if( strcmp(pName, "tiled") == 0 )
+		layout = HeightField::HEIGHT_LAYOUT_TILED;
+	else
+		return false;
+
+	return true;
+}
+
+bool IsBinaryHeightFieldFile( const char* pFilename )
+{
+	size_t length = strlen(pFilename);
+
+	return length >= 4 && strcmp(pFilename + length - 4, ".hfd") == 0;
+}
+
+void MakeSyntheticHeights( int size, std::vector<float>& heights )
+{
+	Random random(size);
+
+	heights.resize((size_t)size * size);
+
+	for( int z = 0; z < size; ++z )
+	{
+		for( int x = 0; x < size; ++x )
+		{
+			float h = 10.0f;
+			h += 6.0f * sinf(x * 0.05f) * cosf(z * 0.07f);
+			h += 3.0f * sinf(x * 0.23f + z * 0.17f);
+			h += random.Range(0.0f, 1.5f);
+
+			heights[((size_t)z * size) + x] = h;
+		}
+	}
+}
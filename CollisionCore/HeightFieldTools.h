@@ -0,0 +1,30 @@
+#ifndef HEIGHTFIELDTOOLS_H
+#define HEIGHTFIELDTOOLS_H
+
+//**********************************************************************
+// File:			HeightFieldTools.h
+// Description:		What the command line tools share for choosing and
+//					making HeightFields
+// Module:			Real-Time 3D Techniques for Games
+//**********************************************************************
+
+#include <vector>
+
+#include "HeightField.h"
+
+// "float4" or "uint16", as --storage takes. Returns false, leaving storage
+// alone, for anything else.
+bool ParseHeightStorage( const char* pName, HeightField::HeightStorage& storage );
+
+// "rows" or "tiled", as --layout takes
+bool ParseHeightLayout( const char* pName, HeightField::HeightLayout& layout );
+
+// Whether the file ends in .hfd, so is one written by HeightField::SaveBinary
+bool IsBinaryHeightFieldFile( const char* pFilename );
+
+// Rolling hills with some noise on top, size x size samples row by row,
+// roughly the height range of Resources/heightmap.bmp. The same size
+// always gives the same map.
+void MakeSyntheticHeights( int size, std::vector<float>& heights );
+
+#endif
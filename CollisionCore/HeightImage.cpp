@@ -0,0 +1,390 @@
+#include "HeightImage.h"
+#include "MappedFile.h"
+
+#include <DirectXMath.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+using namespace DirectX;
+
+// Bitmap headers are read field by field rather than through the windows.h structs
+static const int BITMAP_FILE_HEADER_SIZE = 14;
+static const int BITMAP_INFO_HEADER_SIZE = 40;
+static const int BITMAP_MASKS_OFFSET = BITMAP_FILE_HEADER_SIZE + BITMAP_INFO_HEADER_SIZE;
+
+static const unsigned BITMAP_RGB = 0;			// biCompression values
+static const unsigned BITMAP_BITFIELDS = 3;
+
+// The value an 8 bit source's brightest sample has, which every format's
+// largest value is scaled to
+static const float FULL_LEVEL = 255.0f;
+
+// An 8 bit sample of v has always been v/6*heightRange high
+static const float LEVELS_PER_HEIGHT = 6.0f;
+
+static unsigned ReadLittleEndian16( const unsigned char* pBytes )
+{
+	return (unsigned)pBytes[0] | ((unsigned)pBytes[1] << 8);
+}
+
+static unsigned ReadLittleEndian32( const unsigned char* pBytes )
+{
+	return (unsigned)pBytes[0] | ((unsigned)pBytes[1] << 8) | ((unsigned)pBytes[2] << 16) | ((unsigned)pBytes[3] << 24);
+}
+
+// What a sample of value must be divided by before it's multiplied by
+// heightRange, for a source whose largest value is maxValue
+static float GetDivisor( float maxValue )
+{
+	return LEVELS_PER_HEIGHT * maxValue / FULL_LEVEL;
+}
+
+// Whether a width x length map is too small, or has too many samples to count with an int
+static bool IsBadSize( long long width, long long length )
+{
+	return width < 2 || length < 2 || width * length > INT_MAX;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ScaleRow
+// Turns a row of sample values into heights in place, four at a time,
+// while the row is still in the cache from being unpacked. The tail does
+// the same divide then multiply one sample at a time.
+//////////////////////////////////////////////////////////////////////
+static void ScaleRow( float* pRow, int count, float divisor, float heightRange )
+{
+	XMVECTOR vDivisor = XMVectorReplicate(divisor);
+	XMVECTOR vRange = XMVectorReplicate(heightRange);
+
+	int i = 0;
+
+	for( ; i + 4 <= count; i += 4 )
+	{
+		XMVECTOR value = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&pRow[i]));
+		XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&pRow[i]), XMVectorMultiply(XMVectorDivide(value, vDivisor), vRange));
+	}
+
+	for( ; i < count; ++i )
+		pRow[i] = pRow[i] / divisor * heightRange;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ReadBitmap
+// Rows are padded to four bytes, and stored bottom row first unless the
+// height is negative. 16 and 32 bit pixels are read through the blue
+// mask, 5 bits for 16 bit BI_RGB, so a bitmap whose blue mask covers all
+// 16 bits keeps its full precision.
+//////////////////////////////////////////////////////////////////////
+static bool ReadBitmap( const unsigned char* pFile, size_t fileSize, float heightRange, int& width, int& length, float*& pHeights )
+{
+	if( fileSize < (size_t)BITMAP_MASKS_OFFSET )
+		return false;
+
+	const unsigned char* pInfo = pFile + BITMAP_FILE_HEADER_SIZE;
+
+	unsigned dataOffset = ReadLittleEndian32(&pFile[10]);
+	unsigned infoSize = ReadLittleEndian32(&pInfo[0]);
+	long long imageWidth = (int)ReadLittleEndian32(&pInfo[4]);
+	long long imageHeight = (int)ReadLittleEndian32(&pInfo[8]);
+	unsigned bitCount = ReadLittleEndian16(&pInfo[14]);
+	unsigned compression = ReadLittleEndian32(&pInfo[16]);
+	unsigned coloursUsed = ReadLittleEndian32(&pInfo[32]);
+
+	// Older OS/2 headers are smaller and laid out differently
+	if( infoSize < (unsigned)BITMAP_INFO_HEADER_SIZE )
+		return false;
+
+	bool topDown = imageHeight < 0;
+	long long imageLength = topDown ? -imageHeight : imageHeight;
+
+	if( IsBadSize(imageWidth, imageLength) )
+		return false;
+
+	if( bitCount != 8 && bitCount != 16 && bitCount != 24 && bitCount != 32 )
+		return false;
+
+	// Run length encoded and PNG/JPEG bitmaps aren't read
+	if( compression != BITMAP_RGB && !(compression == BITMAP_BITFIELDS && (bitCount == 16 || bitCount == 32)) )
+		return false;
+
+	unsigned long long stride = ((((unsigned long long)imageWidth * bitCount) + 31) / 32) * 4;
+
+	if( dataOffset > fileSize || stride * imageLength > fileSize - dataOffset )
+		return false;
+
+	// 16 and 32 bit pixels: the blue mask, and where it starts
+	unsigned blueMask = (bitCount == 16) ? 0x001F : 0x00FF;
+
+	if( compression == BITMAP_BITFIELDS )
+	{
+		if( fileSize < (size_t)BITMAP_MASKS_OFFSET + 12 )
+			return false;
+
+		blueMask = ReadLittleEndian32(&pFile[BITMAP_MASKS_OFFSET + 8]);
+
+		if( blueMask == 0 || (bitCount == 16 && blueMask > 0xFFFF) )
+			return false;
+	}
+
+	int blueShift = 0;
+
+	while( !(blueMask & (1u << blueShift)) )
+		++blueShift;
+
+	float maxValue = (float)(blueMask >> blueShift);
+
+	// 8 bit pixels: the blue of each palette entry, black past the end of it
+	float paletteBlue[256];
+
+	if( bitCount == 8 )
+	{
+		size_t paletteOffset = BITMAP_FILE_HEADER_SIZE + (size_t)infoSize;
+		size_t paletteSize = (coloursUsed == 0 || coloursUsed > 256) ? 256 : coloursUsed;
+
+		if( paletteOffset > fileSize || paletteSize > (fileSize - paletteOffset) / 4 )
+			return false;
+
+		for( size_t i = 0; i < 256; ++i )
+			paletteBlue[i] = (i < paletteSize) ? (float)pFile[paletteOffset + (i * 4)] : 0.0f;
+
+		maxValue = FULL_LEVEL;
+	}
+	else if( bitCount == 24 )
+	{
+		maxValue = FULL_LEVEL;
+	}
+
+	width = (int)imageWidth;
+	length = (int)imageLength;
+	pHeights = new float[(size_t)width * length];
+
+	float divisor = GetDivisor(maxValue);
+
+	for( int row = 0; row < length; ++row )
+	{
+		const unsigned char* pPixels = pFile + dataOffset + (row * stride);
+		float* pRow = pHeights + ((size_t)(topDown ? (length - 1 - row) : row) * width);
+
+		switch( bitCount )
+		{
+		case 8:
+			for( int i = 0; i < width; ++i )
+				pRow[i] = paletteBlue[pPixels[i]];
+			break;
+
+		case 16:
+			for( int i = 0; i < width; ++i )
+				pRow[i] = (float)((ReadLittleEndian16(&pPixels[i * 2]) & blueMask) >> blueShift);
+			break;
+
+		case 24:
+			for( int i = 0; i < width; ++i )
+				pRow[i] = (float)pPixels[i * 3];
+			break;
+
+		case 32:
+			for( int i = 0; i < width; ++i )
+				pRow[i] = (float)((ReadLittleEndian32(&pPixels[i * 4]) & blueMask) >> blueShift);
+			break;
+		}
+
+		ScaleRow(pRow, width, divisor, heightRange);
+	}
+
+	return true;
+}
+
+// Moves past whitespace and # comments in a PGM header
+static size_t SkipPgmSpace( const unsigned char* pFile, size_t fileSize, size_t pos )
+{
+	while( pos < fileSize )
+	{
+		if( pFile[pos] == '#' )
+		{
+			while( pos < fileSize && pFile[pos] != '\n' && pFile[pos] != '\r' )
+				++pos;
+		}
+		else if( pFile[pos] == ' ' || pFile[pos] == '\t' || pFile[pos] == '\n' || pFile[pos] == '\r' )
+		{
+			++pos;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return pos;
+}
+
+// Reads one of the numbers in a PGM header, or returns -1
+static long long ReadPgmNumber( const unsigned char* pFile, size_t fileSize, size_t& pos )
+{
+	pos = SkipPgmSpace(pFile, fileSize, pos);
+
+	if( pos >= fileSize || pFile[pos] < '0' || pFile[pos] > '9' )
+		return -1;
+
+	long long value = 0;
+
+	while( pos < fileSize && pFile[pos] >= '0' && pFile[pos] <= '9' )
+	{
+		value = (value * 10) + (pFile[pos] - '0');
+
+		if( value > INT_MAX )
+			return -1;
+
+		++pos;
+	}
+
+	return value;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ReadPgm
+// Binary greyscale: the header in text, then the rows top first, one
+// byte a sample or two big-endian ones if the largest value needs them.
+//////////////////////////////////////////////////////////////////////
+static bool ReadPgm( const unsigned char* pFile, size_t fileSize, float heightRange, int& width, int& length, float*& pHeights )
+{
+	size_t pos = 2;
+
+	long long imageWidth = ReadPgmNumber(pFile, fileSize, pos);
+	long long imageLength = ReadPgmNumber(pFile, fileSize, pos);
+	long long maxValue = ReadPgmNumber(pFile, fileSize, pos);
+
+	if( IsBadSize(imageWidth, imageLength) || maxValue < 1 || maxValue > 65535 )
+		return false;
+
+	// A single whitespace character ends the header
+	if( pos >= fileSize )
+		return false;
+
+	++pos;
+
+	size_t sampleSize = (maxValue > 255) ? 2 : 1;
+	unsigned long long stride = (unsigned long long)imageWidth * sampleSize;
+
+	if( stride * imageLength > fileSize - pos )
+		return false;
+
+	width = (int)imageWidth;
+	length = (int)imageLength;
+	pHeights = new float[(size_t)width * length];
+
+	float divisor = GetDivisor((float)maxValue);
+
+	for( int row = 0; row < length; ++row )
+	{
+		const unsigned char* pSamples = pFile + pos + (row * stride);
+		float* pRow = pHeights + ((size_t)(length - 1 - row) * width);
+
+		if( sampleSize == 2 )
+		{
+			for( int i = 0; i < width; ++i )
+				pRow[i] = (float)(((unsigned)pSamples[i * 2] << 8) | pSamples[(i * 2) + 1]);
+		}
+		else
+		{
+			for( int i = 0; i < width; ++i )
+				pRow[i] = (float)pSamples[i];
+		}
+
+		ScaleRow(pRow, width, divisor, heightRange);
+	}
+
+	return true;
+}
+
+// Whether filename ends in extension, which is given in lower case
+static bool HasExtension( const char* filename, const char* extension )
+{
+	size_t nameLength = strlen(filename);
+	size_t extensionLength = strlen(extension);
+
+	if( nameLength < extensionLength )
+		return false;
+
+	for( size_t i = 0; i < extensionLength; ++i )
+	{
+		char c = filename[nameLength - extensionLength + i];
+
+		if( c >= 'A' && c <= 'Z' )
+			c = (char)(c - 'A' + 'a');
+
+		if( c != extension[i] )
+			return false;
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ReadRawFloat
+// Nothing but the heights, in the byte order of the machine that wrote
+// them, so the map has to be square for its size to be worked out.
+//////////////////////////////////////////////////////////////////////
+static bool ReadRawFloat( const unsigned char* pFile, size_t fileSize, float heightRange, int& width, int& length, float*& pHeights )
+{
+	if( fileSize % sizeof(float) != 0 )
+		return false;
+
+	long long samples = (long long)(fileSize / sizeof(float));
+	long long side = (long long)sqrt((double)samples);
+
+	while( side * side > samples )
+		--side;
+
+	while( (side + 1) * (side + 1) <= samples )
+		++side;
+
+	if( side * side != samples || IsBadSize(side, side) )
+		return false;
+
+	width = (int)side;
+	length = (int)side;
+	pHeights = new float[(size_t)width * length];
+
+	float divisor = GetDivisor(1.0f);
+
+	for( int row = 0; row < length; ++row )
+	{
+		float* pRow = pHeights + ((size_t)row * width);
+
+		memcpy(pRow, pFile + ((size_t)row * width * sizeof(float)), width * sizeof(float));
+		ScaleRow(pRow, width, divisor, heightRange);
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ReadHeightImage
+// Bitmaps and PGMs are known by their first two bytes, raw files only
+// by their extension. The file is mapped rather than read, so its pixels
+// are converted straight from where they lie.
+//////////////////////////////////////////////////////////////////////
+bool ReadHeightImage( const char* filename, float heightRange, int& width, int& length, float*& pHeights )
+{
+	MappedFile file;
+
+	if( !file.Open(filename) )
+		return false;
+
+	const unsigned char* pFile = file.GetData();
+	size_t fileSize = file.GetSize();
+
+	pHeights = NULL;
+
+	if( fileSize >= 2 && pFile[0] == 'B' && pFile[1] == 'M' )
+		return ReadBitmap(pFile, fileSize, heightRange, width, length, pHeights);
+
+	if( fileSize >= 2 && pFile[0] == 'P' && pFile[1] == '5' )
+		return ReadPgm(pFile, fileSize, heightRange, width, length, pHeights);
+
+	if( HasExtension(filename, ".r32") || HasExtension(filename, ".raw") )
+		return ReadRawFloat(pFile, fileSize, heightRange, width, length, pHeights);
+
+	return false;
+}
@@ -0,0 +1,28 @@
+#ifndef HEIGHTIMAGE_H
+#define HEIGHTIMAGE_H
+
+//**********************************************************************
+// File:			HeightImage.h
+// Description:		Reads heightmap images into one float height per sample
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Understands bitmaps of 8 (paletted), 16, 24 and 32 bits,
+//					binary PGM (P5) of 8 or 16 bits, and raw 32 bit floats
+//					(.r32 or .raw, square, no header). Colour bitmaps are
+//					read from their blue channel; heightmaps are grey, so
+//					every channel is the same.
+//
+//					Whatever its depth, a source's largest value gives the
+//					height a 255 in an 8 bit bitmap always has, 255/6 times
+//					heightRange, and a raw float of 1.0 does too. 16 bit
+//					sources cover the same heights as 8 bit ones in 257
+//					times finer steps.
+//**********************************************************************
+
+// Samples come out row by row, the first being row l = 0 of a HeightField.
+// That's the bottom row of the picture for bitmaps and PGMs, whichever way
+// up they're stored, and the first row of a raw file. pHeights is allocated
+// with new[] and belongs to the caller. Returns false, with nothing
+// allocated, if the file can't be read or isn't one of the formats above.
+bool ReadHeightImage( const char* filename, float heightRange, int& width, int& length, float*& pHeights );
+
+#endif
@@ -0,0 +1,120 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+MappedFile::MappedFile()
+{
+	m_pData = NULL;
+	m_Size = 0;
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open
+// Maps the whole of filename. Empty files can't be mapped.
+//////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+
+bool MappedFile::Open( const char* filename )
+{
+	Close();
+
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if( file == INVALID_HANDLE_VALUE )
+		return false;
+
+	LARGE_INTEGER size;
+
+	if( !GetFileSizeEx(file, &size) || size.QuadPart <= 0 || (unsigned long long)size.QuadPart > (size_t)-1 )
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+	// The view keeps the file and the mapping open by itself
+	CloseHandle(file);
+
+	if( mapping == NULL )
+		return false;
+
+	m_pData = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+
+	if( m_pData == NULL )
+		return false;
+
+	m_Size = (size_t)size.QuadPart;
+
+	return true;
+}
+
+void MappedFile::Close( void )
+{
+	if( m_pData )
+		UnmapViewOfFile(m_pData);
+
+	m_pData = NULL;
+	m_Size = 0;
+}
+
+#else
+
+bool MappedFile::Open( const char* filename )
+{
+	Close();
+
+	int file = open(filename, O_RDONLY);
+
+	if( file < 0 )
+		return false;
+
+	struct stat fileInfo;
+
+	if( fstat(file, &fileInfo) != 0 || fileInfo.st_size <= 0 )
+	{
+		close(file);
+		return false;
+	}
+
+	void* pData = mmap(NULL, (size_t)fileInfo.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+
+	// The mapping keeps the file open by itself
+	close(file);
+
+	if( pData == MAP_FAILED )
+		return false;
+
+	m_pData = (unsigned char*)pData;
+	m_Size = (size_t)fileInfo.st_size;
+
+	return true;
+}
+
+void MappedFile::Close( void )
+{
+	if( m_pData )
+		munmap(m_pData, m_Size);
+
+	m_pData = NULL;
+	m_Size = 0;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+//**********************************************************************
+// File:			MappedFile.h
+// Description:		A whole file mapped into memory
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			The mapping is copy-on-write: pages are read from the
+//					file as they're first touched, and writing to one gives
+//					this process its own copy of it, which the file never sees.
+//**********************************************************************
+
+#include <stddef.h>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open( const char* filename );
+	void Close( void );
+
+	bool IsOpen() const { return m_pData != NULL; }
+	unsigned char* GetData() const { return m_pData; }
+	size_t GetSize() const { return m_Size; }
+
+	// Whether p points somewhere inside the mapping
+	bool Contains( const void* p ) const { return p >= m_pData && p < m_pData + m_Size; }
+
+private:
+	// Not copyable, the mapping belongs to one object
+	MappedFile( const MappedFile& );
+	MappedFile& operator=( const MappedFile& );
+
+	unsigned char* m_pData;
+	size_t m_Size;
+};
+
+#endif
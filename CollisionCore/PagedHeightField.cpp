@@ -0,0 +1,774 @@
+#include "PagedHeightField.h"
+
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// The world file WriteWorld writes: just this header, the tiles are in
+// files of their own. Native byte order, like HeightField::SaveBinary's.
+static const char PAGED_WORLD_FILE_MAGIC[4] = { 'H', 'F', 'W', 'D' };
+static const uint32_t PAGED_WORLD_FILE_VERSION = 1;
+
+struct PagedWorldFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	int32_t width;
+	int32_t length;
+	float gridSize;
+	int32_t tileSamples;
+};
+
+// The tile files go next to the world file, named after it without its extension
+static std::string GetTileBase( const char* filename )
+{
+	std::string base = filename;
+	size_t dot = base.find_last_of('.');
+	size_t slash = base.find_last_of("/\\");
+
+	if( dot != std::string::npos && (slash == std::string::npos || dot > slash) )
+		base.erase(dot);
+
+	return base;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+PagedHeightField::PagedHeightField( const char* filename, size_t memoryBudget )
+{
+	m_Width = 0;
+	m_Length = 0;
+	m_GridSize = 0.0f;
+	m_TileSamples = 0;
+	m_TilesAcross = 0;
+	m_TilesDown = 0;
+
+	m_pTiles = NULL;
+	m_NewestTile = -1;
+	m_OldestTile = -1;
+	m_LoadedTileCount = 0;
+	m_LoadedBytes = 0;
+	m_MemoryBudget = memoryBudget;
+
+	m_PageFaultPolicy = PAGE_FAULT_LOAD;
+	ResetPagingStats();
+
+	m_pLoader = NULL;
+
+	Open(filename);
+}
+
+PagedHeightField::~PagedHeightField()
+{
+	for( size_t i = 0; i < m_PrefetchingTiles.size(); ++i )
+		m_pLoader->Release(m_pTiles[m_PrefetchingTiles[i]].pPrefetch);
+
+	if( m_pTiles )
+	{
+		for( int i = 0; i < m_TilesAcross*m_TilesDown; ++i )
+			delete m_pTiles[i].pField;
+	}
+
+	delete [] m_pTiles;
+}
+
+bool PagedHeightField::Open( const char* filename )
+{
+	FILE* pFile = fopen(filename, "rb");
+
+	if( !pFile )
+		return false;
+
+	PagedWorldFileHeader header;
+	bool read = fread(&header, sizeof header, 1, pFile) == 1;
+	fclose(pFile);
+
+	if( !read ||
+		memcmp(header.magic, PAGED_WORLD_FILE_MAGIC, sizeof header.magic) != 0 ||
+		header.version != PAGED_WORLD_FILE_VERSION ||
+		header.width < 2 || header.length < 2 || header.tileSamples < 2 ||
+		!(header.gridSize > 0.0f) )
+	{
+		return false;
+	}
+
+	int tilesAcross = ((header.width-2) / (header.tileSamples-1)) + 1;
+	int tilesDown = ((header.length-2) / (header.tileSamples-1)) + 1;
+
+	if( (int64_t)tilesAcross * tilesDown > INT_MAX/2 )
+		return false;
+
+	m_TileBase = GetTileBase(filename);
+	m_Width = header.width;
+	m_Length = header.length;
+	m_GridSize = header.gridSize;
+	m_TileSamples = header.tileSamples;
+	m_TilesAcross = tilesAcross;
+	m_TilesDown = tilesDown;
+
+	m_pTiles = new Tile[m_TilesAcross*m_TilesDown];
+
+	for( int i = 0; i < m_TilesAcross*m_TilesDown; ++i )
+	{
+		m_pTiles[i].pField = NULL;
+		m_pTiles[i].pPrefetch = NULL;
+		m_pTiles[i].memoryBytes = 0;
+		m_pTiles[i].newer = -1;
+		m_pTiles[i].older = -1;
+		m_pTiles[i].missing = false;
+	}
+
+	return true;
+}
+
+std::string PagedHeightField::GetTileFilename( const std::string& tileBase, int tileX, int tileZ )
+{
+	char suffix[32];
+	snprintf(suffix, sizeof suffix, "_%d_%d.hfd", tileX, tileZ);
+
+	return tileBase + suffix;
+}
+
+//////////////////////////////////////////////////////////////////////
+// WriteWorld
+// Tile (x, z) starts at sample x*(tileSamples-1), z*(tileSamples-1) of
+// source, so that it shares its first column and row with the tiles
+// before it. The tiles on the far edges get whatever is left over.
+//////////////////////////////////////////////////////////////////////
+bool PagedHeightField::WriteWorld( const char* filename, const HeightField& source, int tileSamples, bool withCollisionData )
+{
+	if( !source.IsLoaded() || tileSamples < 2 )
+		return false;
+
+	PagedWorldFileHeader header;
+	memset(&header, 0, sizeof header);
+
+	memcpy(header.magic, PAGED_WORLD_FILE_MAGIC, sizeof header.magic);
+	header.version = PAGED_WORLD_FILE_VERSION;
+	header.width = source.GetWidth();
+	header.length = source.GetLength();
+	header.gridSize = source.GetGridSize();
+	header.tileSamples = tileSamples;
+
+	FILE* pFile = fopen(filename, "wb");
+
+	if( !pFile )
+		return false;
+
+	bool written = fwrite(&header, sizeof header, 1, pFile) == 1;
+
+	if( fclose(pFile) != 0 || !written )
+		return false;
+
+	std::string tileBase = GetTileBase(filename);
+	std::vector<float> heights((size_t)tileSamples * tileSamples);
+
+	for( int firstL = 0, tileZ = 0; firstL < header.length-1; firstL += tileSamples-1, ++tileZ )
+	{
+		for( int firstW = 0, tileX = 0; firstW < header.width-1; firstW += tileSamples-1, ++tileX )
+		{
+			int tileWidth = std::min(tileSamples, header.width - firstW);
+			int tileLength = std::min(tileSamples, header.length - firstL);
+
+			for( int l = 0; l < tileLength; ++l )
+			{
+				for( int w = 0; w < tileWidth; ++w )
+					heights[(l*tileWidth) + w] = source.GetSampleHeight(((firstL+l)*header.width) + firstW + w);
+			}
+
+			HeightField tile(tileWidth, tileLength, header.gridSize, &heights[0], source.GetHeightStorage());
+			tile.SetHeightLayout(source.GetHeightLayout());
+
+			if( !tile.SaveBinary(GetTileFilename(tileBase, tileX, tileZ).c_str(), withCollisionData) )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Tile geometry
+//////////////////////////////////////////////////////////////////////
+
+int PagedHeightField::GetTileWidth( int tileX ) const
+{
+	return std::min(m_TileSamples, m_Width - GetTileFirstSample(tileX));
+}
+
+int PagedHeightField::GetTileLength( int tileZ ) const
+{
+	return std::min(m_TileSamples, m_Length - GetTileFirstSample(tileZ));
+}
+
+// How far the centre of a tile, which its HeightField is laid out around, is
+// from the centre of the world
+float PagedHeightField::GetTileOffsetX( int tileX ) const
+{
+	double centre = GetTileFirstSample(tileX) + ((GetTileWidth(tileX)-1) / 2.0);
+
+	return (float)((centre - ((m_Width-1) / 2.0)) * m_GridSize);
+}
+
+float PagedHeightField::GetTileOffsetZ( int tileZ ) const
+{
+	double centre = GetTileFirstSample(tileZ) + ((GetTileLength(tileZ)-1) / 2.0);
+
+	return (float)((centre - ((m_Length-1) / 2.0)) * m_GridSize);
+}
+
+// A tile's face index renumbered across the world, as a HeightField the
+// size of the world would number it
+int PagedHeightField::GetWorldFace( int tileX, int tileZ, int localFace ) const
+{
+	int cellsAcross = GetTileWidth(tileX)-1;
+	int cell = localFace / 2;
+	int w = GetTileFirstSample(tileX) + (cell % cellsAcross);
+	int l = GetTileFirstSample(tileZ) + (cell / cellsAcross);
+
+	return (((l*(m_Width-1)) + w) * 2) + (localFace % 2);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Loading and dropping tiles
+//////////////////////////////////////////////////////////////////////
+
+bool PagedHeightField::LoadTile( int tileX, int tileZ )
+{
+	if( !m_pTiles || tileX < 0 || tileX >= m_TilesAcross || tileZ < 0 || tileZ >= m_TilesDown )
+		return false;
+
+	int index = GetTileIndex(tileX, tileZ);
+	Tile& tile = m_pTiles[index];
+
+	if( tile.pField )
+	{
+		UnlinkTile(index);
+		LinkTileAsNewest(index);
+		return true;
+	}
+
+	if( tile.missing )
+		return false;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool added;
+
+	if( tile.pPrefetch )
+	{
+		m_pLoader->Wait(tile.pPrefetch);
+		added = FinishPrefetch(index);
+	}
+	else
+	{
+		added = AddTile(index, new HeightField(GetTileFilename(m_TileBase, tileX, tileZ).c_str()));
+	}
+
+	m_PagingStats.loadTimeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	return added;
+}
+
+//////////////////////////////////////////////////////////////////////
+// AddTile
+// Puts a newly loaded tile at the front of the list, or marks the tile
+// missing if it didn't load.
+//////////////////////////////////////////////////////////////////////
+bool PagedHeightField::AddTile( int tile, HeightField* pField )
+{
+	int tileX = tile % m_TilesAcross;
+	int tileZ = tile / m_TilesAcross;
+
+	// A tile that doesn't match its place in the world is as good as missing
+	if( !pField || !pField->IsLoaded() || pField->GetWidth() != GetTileWidth(tileX) || pField->GetLength() != GetTileLength(tileZ) )
+	{
+		delete pField;
+		m_pTiles[tile].missing = true;
+		return false;
+	}
+
+	m_pTiles[tile].pField = pField;
+	m_pTiles[tile].memoryBytes = pField->GetMemoryBytes();
+	LinkTileAsNewest(tile);
+
+	++m_LoadedTileCount;
+	m_LoadedBytes += m_pTiles[tile].memoryBytes;
+	++m_PagingStats.tilesLoaded;
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Prefetching
+//////////////////////////////////////////////////////////////////////
+
+bool PagedHeightField::PrefetchTile( int tileX, int tileZ )
+{
+	if( !m_pLoader || !m_pTiles || tileX < 0 || tileX >= m_TilesAcross || tileZ < 0 || tileZ >= m_TilesDown )
+		return false;
+
+	int index = GetTileIndex(tileX, tileZ);
+	Tile& tile = m_pTiles[index];
+
+	if( tile.pField || tile.pPrefetch || tile.missing )
+		return false;
+
+	tile.pPrefetch = m_pLoader->Load(GetTileFilename(m_TileBase, tileX, tileZ).c_str(), HeightFieldLoader::LOAD_PRIORITY_PREFETCH);
+	m_PrefetchingTiles.push_back(index);
+
+	return true;
+}
+
+// Prefetches every tile within radius of (x, z), in the order of the
+// squares around it, nearest first. Returns how many were queued.
+int PagedHeightField::PrefetchAround( float x, float z, float radius )
+{
+	if( !m_pLoader || !IsOpen() )
+		return 0;
+
+	float tileSize = m_GridSize * (m_TileSamples-1);
+	float u = (x / tileSize) + (((m_Width-1) / 2.0f) / (m_TileSamples-1));
+	float v = (z / tileSize) + (((m_Length-1) / 2.0f) / (m_TileSamples-1));
+	float reach = radius / tileSize;
+
+	if( !(reach >= 0.0f) )
+		return 0;
+
+	int centreX = (int)floorf(u);
+	int centreZ = (int)floorf(v);
+	int rings = (int)ceilf(reach);
+	int queued = 0;
+
+	for( int ring = 0; ring <= rings; ++ring )
+	{
+		for( int tileZ = centreZ-ring; tileZ <= centreZ+ring; ++tileZ )
+		{
+			for( int tileX = centreX-ring; tileX <= centreX+ring; ++tileX )
+			{
+				if( std::max(abs(tileX-centreX), abs(tileZ-centreZ)) != ring )
+					continue;
+
+				// Nearest point of the tile to (u, v)
+				float du = std::max(std::max((float)tileX - u, u - (float)(tileX+1)), 0.0f);
+				float dv = std::max(std::max((float)tileZ - v, v - (float)(tileZ+1)), 0.0f);
+
+				if( (du*du) + (dv*dv) <= reach*reach && PrefetchTile(tileX, tileZ) )
+					++queued;
+			}
+		}
+	}
+
+	return queued;
+}
+
+void PagedHeightField::CollectPrefetchedTiles( void )
+{
+	for( size_t i = 0; i < m_PrefetchingTiles.size(); )
+	{
+		if( m_pTiles[m_PrefetchingTiles[i]].pPrefetch->IsReady() )
+			FinishPrefetch(m_PrefetchingTiles[i]);
+		else
+			++i;
+	}
+}
+
+// Adds a prefetched tile, once it's ready, and forgets its request
+bool PagedHeightField::FinishPrefetch( int tile )
+{
+	HeightFieldLoader::Request* pPrefetch = m_pTiles[tile].pPrefetch;
+
+	m_PrefetchingTiles.erase(std::find(m_PrefetchingTiles.begin(), m_PrefetchingTiles.end(), tile));
+	m_pTiles[tile].pPrefetch = NULL;
+
+	HeightField* pField = pPrefetch->TakeHeightField();
+	m_pLoader->Release(pPrefetch);
+
+	bool added = AddTile(tile, pField);
+
+	if( added )
+		++m_PagingStats.tilesPrefetched;
+
+	return added;
+}
+
+bool PagedHeightField::IsTileLoaded( int tileX, int tileZ ) const
+{
+	if( !m_pTiles || tileX < 0 || tileX >= m_TilesAcross || tileZ < 0 || tileZ >= m_TilesDown )
+		return false;
+
+	return m_pTiles[GetTileIndex(tileX, tileZ)].pField != NULL;
+}
+
+//////////////////////////////////////////////////////////////////////
+// GetTile
+// The tile for a query, loaded or waited for if it has to be and the
+// policy allows, and moved to the front of the list. Sets result to
+// QUERY_UNKNOWN if the policy doesn't allow it; a missing tile just
+// returns NULL.
+//////////////////////////////////////////////////////////////////////
+const HeightField* PagedHeightField::GetTile( int tileX, int tileZ, QueryResult& result )
+{
+	int index = GetTileIndex(tileX, tileZ);
+	Tile& tile = m_pTiles[index];
+
+	if( !tile.pField && !tile.missing )
+	{
+		++m_PagingStats.tileFaults;
+
+		if( m_PageFaultPolicy == PAGE_FAULT_UNKNOWN && !(tile.pPrefetch && tile.pPrefetch->IsReady()) )
+		{
+			result = QUERY_UNKNOWN;
+			return NULL;
+		}
+	}
+
+	if( !LoadTile(tileX, tileZ) )
+		return NULL;
+
+	return tile.pField;
+}
+
+void PagedHeightField::UnlinkTile( int tile )
+{
+	Tile& unlinked = m_pTiles[tile];
+
+	if( unlinked.newer >= 0 )
+		m_pTiles[unlinked.newer].older = unlinked.older;
+	else
+		m_NewestTile = unlinked.older;
+
+	if( unlinked.older >= 0 )
+		m_pTiles[unlinked.older].newer = unlinked.newer;
+	else
+		m_OldestTile = unlinked.newer;
+
+	unlinked.newer = -1;
+	unlinked.older = -1;
+}
+
+void PagedHeightField::LinkTileAsNewest( int tile )
+{
+	m_pTiles[tile].newer = -1;
+	m_pTiles[tile].older = m_NewestTile;
+
+	if( m_NewestTile >= 0 )
+		m_pTiles[m_NewestTile].newer = tile;
+	else
+		m_OldestTile = tile;
+
+	m_NewestTile = tile;
+}
+
+void PagedHeightField::EvictTile( int tile )
+{
+	Tile& evicted = m_pTiles[tile];
+
+	UnlinkTile(tile);
+
+	delete evicted.pField;
+	evicted.pField = NULL;
+
+	--m_LoadedTileCount;
+	m_LoadedBytes -= evicted.memoryBytes;
+	evicted.memoryBytes = 0;
+	++m_PagingStats.tilesEvicted;
+}
+
+// Drops the least recently used tiles until the rest fit the budget, but
+// always keeps the newest one, however big it is
+void PagedHeightField::TrimToBudget( void )
+{
+	while( m_LoadedBytes > m_MemoryBudget && m_OldestTile >= 0 && m_OldestTile != m_NewestTile )
+		EvictTile(m_OldestTile);
+}
+
+void PagedHeightField::SetMemoryBudget( size_t bytes )
+{
+	m_MemoryBudget = bytes;
+
+	TrimToBudget();
+}
+
+void PagedHeightField::ResetPagingStats( void )
+{
+	memset(&m_PagingStats, 0, sizeof m_PagingStats);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Queries
+//////////////////////////////////////////////////////////////////////
+
+// Function:	GetGroundAt
+// Description: HeightField::GetGroundAt on the tile under (x, z)
+// Returns: 	QUERY_HIT over the world. Off it, the results are for the nearest point on
+//				its edge and it returns QUERY_MISS, as it does over a missing tile, which
+//				writes nothing.
+
+PagedHeightField::QueryResult PagedHeightField::GetGroundAt( float x, float z, float& height, XMFLOAT3& normal )
+{
+	if( !IsOpen() )
+		return QUERY_MISS;
+
+	CollectPrefetchedTiles();
+
+	float lastU = (float)(m_Width - 1);
+	float lastV = (float)(m_Length - 1);
+
+	float u = (x / m_GridSize) + (lastU / 2);
+	float v = (z / m_GridSize) + (lastV / 2);
+
+	// Written this way round so NaNs are off the map and clamp to 0
+	bool onMap = u >= 0.0f && u <= lastU && v >= 0.0f && v <= lastV;
+
+	u = std::min(std::max(0.0f, u), lastU);
+	v = std::min(std::max(0.0f, v), lastV);
+
+	int tileX = std::min((int)(u / (m_TileSamples-1)), m_TilesAcross-1);
+	int tileZ = std::min((int)(v / (m_TileSamples-1)), m_TilesDown-1);
+
+	QueryResult result = QUERY_MISS;
+	const HeightField* pTile = GetTile(tileX, tileZ, result);
+
+	if( pTile )
+	{
+		pTile->GetGroundAt(x - GetTileOffsetX(tileX), z - GetTileOffsetZ(tileZ), height, normal);
+		result = onMap ? QUERY_HIT : QUERY_MISS;
+	}
+	else if( result == QUERY_UNKNOWN )
+	{
+		++m_PagingStats.unknownQueries;
+	}
+
+	TrimToBudget();
+
+	return result;
+}
+
+PagedHeightField::QueryResult PagedHeightField::GetHeightAt( float x, float z, float& height )
+{
+	XMFLOAT3 normal;
+	return GetGroundAt(x, z, height, normal);
+}
+
+// Function:	RayCollision
+// Description: Walks the tiles under the ray segment in the order it crosses them and
+//				runs HeightField::RayCollision on each
+// Notes:		Keeps the hit with the lowest face index, which is the one a HeightField
+//				the size of the world would find. A tile the ray crosses that isn't loaded
+//				makes the answer QUERY_UNKNOWN.
+
+PagedHeightField::QueryResult PagedHeightField::RayCollision( const XMVECTOR& rayPos, const XMVECTOR& rayDir, float speed, HeightField::RayHit& hit )
+{
+	if( !IsOpen() )
+		return QUERY_MISS;
+
+	CollectPrefetchedTiles();
+
+	// The segment in tiles, from (0, 0) at the world's first sample
+	float tileSize = m_GridSize * (m_TileSamples-1);
+	float originU = ((m_Width-1) / 2.0f) / (m_TileSamples-1);
+	float originV = ((m_Length-1) / 2.0f) / (m_TileSamples-1);
+
+	XMFLOAT3 start, end;
+	XMStoreFloat3(&start, rayPos);
+	XMStoreFloat3(&end, rayPos + (XMVector3Normalize(rayDir) * speed));
+
+	float u0 = (start.x / tileSize) + originU;
+	float v0 = (start.z / tileSize) + originV;
+	float du = ((end.x / tileSize) + originU) - u0;
+	float dv = ((end.z / tileSize) + originV) - v0;
+
+	// Clip it to the world
+	float tEnter = 0.0f;
+	float tExit = 1.0f;
+	float aStart[2] = { u0, v0 };
+	float aDelta[2] = { du, dv };
+	float aSize[2] = { (float)m_TilesAcross, (float)m_TilesDown };
+
+	for( int axis = 0; axis < 2; ++axis )
+	{
+		if( aDelta[axis] == 0.0f )
+		{
+			if( aStart[axis] < 0.0f || aStart[axis] > aSize[axis] )
+				return QUERY_MISS;
+			continue;
+		}
+
+		float tA = (0.0f - aStart[axis]) / aDelta[axis];
+		float tB = (aSize[axis] - aStart[axis]) / aDelta[axis];
+
+		tEnter = std::max(tEnter, std::min(tA, tB));
+		tExit = std::min(tExit, std::max(tA, tB));
+	}
+
+	if( !(tEnter <= tExit) )
+		return QUERY_MISS;
+
+	// Then step from tile to tile along it
+	int tileX = std::min(std::max(0, (int)floorf(u0 + (tEnter * du))), m_TilesAcross-1);
+	int tileZ = std::min(std::max(0, (int)floorf(v0 + (tEnter * dv))), m_TilesDown-1);
+
+	int stepX = du > 0.0f ? 1 : -1;
+	int stepZ = dv > 0.0f ? 1 : -1;
+	float tDeltaX = du != 0.0f ? fabsf(1.0f / du) : FLT_MAX;
+	float tDeltaZ = dv != 0.0f ? fabsf(1.0f / dv) : FLT_MAX;
+	float tMaxX = du != 0.0f ? ((tileX + (du > 0.0f ? 1 : 0)) - u0) / du : FLT_MAX;
+	float tMaxZ = dv != 0.0f ? ((tileZ + (dv > 0.0f ? 1 : 0)) - v0) / dv : FLT_MAX;
+
+	QueryResult result = QUERY_MISS;
+	bool collided = false;
+
+	for( ;; )
+	{
+		const HeightField* pTile = GetTile(tileX, tileZ, result);
+
+		if( result == QUERY_UNKNOWN )
+			break;
+
+		if( pTile )
+		{
+			float offsetX = GetTileOffsetX(tileX);
+			float offsetZ = GetTileOffsetZ(tileZ);
+			XMVECTOR offset = XMVectorSet(offsetX, 0.0f, offsetZ, 0.0f);
+			HeightField::RayHit tileHit;
+
+			if( pTile->RayCollision(rayPos - offset, rayDir, speed, tileHit) )
+			{
+				int face = GetWorldFace(tileX, tileZ, tileHit.triangle);
+
+				if( !collided || face < hit.triangle )
+				{
+					hit = tileHit;
+					hit.triangle = face;
+					hit.position.x += offsetX;
+					hit.position.z += offsetZ;
+					collided = true;
+				}
+			}
+		}
+
+		if( tMaxX < tMaxZ )
+		{
+			if( tMaxX > tExit )
+				break;
+
+			tileX += stepX;
+			tMaxX += tDeltaX;
+		}
+		else
+		{
+			if( tMaxZ > tExit )
+				break;
+
+			tileZ += stepZ;
+			tMaxZ += tDeltaZ;
+		}
+
+		if( tileX < 0 || tileX >= m_TilesAcross || tileZ < 0 || tileZ >= m_TilesDown )
+			break;
+	}
+
+	if( result == QUERY_UNKNOWN )
+		++m_PagingStats.unknownQueries;
+	else if( collided )
+		result = QUERY_HIT;
+
+	TrimToBudget();
+
+	return result;
+}
+
+// Function:	SphereCollision
+// Description: HeightField::SphereCollision on every tile the swept sphere's bounds
+//				overlap, keeping the earliest contact
+// Notes:		Sweeps are short next to a tile, so the bounds are near enough. Any of
+//				those tiles not being loaded makes the answer QUERY_UNKNOWN, as the
+//				earliest contact could be in it.
+
+PagedHeightField::QueryResult PagedHeightField::SphereCollision( const XMVECTOR& centre, float radius, const XMVECTOR& dir, float speed, HeightField::SphereHit& hit )
+{
+	if( !IsOpen() )
+		return QUERY_MISS;
+
+	CollectPrefetchedTiles();
+
+	XMFLOAT3 start, end;
+	XMStoreFloat3(&start, centre);
+	XMStoreFloat3(&end, centre + (XMVector3Normalize(dir) * speed));
+
+	float tileSize = m_GridSize * (m_TileSamples-1);
+	float originU = ((m_Width-1) / 2.0f) / (m_TileSamples-1);
+	float originV = ((m_Length-1) / 2.0f) / (m_TileSamples-1);
+
+	float uMin = ((std::min(start.x, end.x) - radius) / tileSize) + originU;
+	float uMax = ((std::max(start.x, end.x) + radius) / tileSize) + originU;
+	float vMin = ((std::min(start.z, end.z) - radius) / tileSize) + originV;
+	float vMax = ((std::max(start.z, end.z) + radius) / tileSize) + originV;
+
+	// Written this way round so NaNs miss
+	if( !(uMax >= 0.0f && uMin <= m_TilesAcross && vMax >= 0.0f && vMin <= m_TilesDown) )
+		return QUERY_MISS;
+
+	int firstX = std::max(0, (int)floorf(uMin));
+	int lastX = std::min(m_TilesAcross-1, (int)floorf(uMax));
+	int firstZ = std::max(0, (int)floorf(vMin));
+	int lastZ = std::min(m_TilesDown-1, (int)floorf(vMax));
+
+	QueryResult result = QUERY_MISS;
+
+	// Make sure they're all there before testing any of them
+	for( int tileZ = firstZ; tileZ <= lastZ && result != QUERY_UNKNOWN; ++tileZ )
+	{
+		for( int tileX = firstX; tileX <= lastX && result != QUERY_UNKNOWN; ++tileX )
+			GetTile(tileX, tileZ, result);
+	}
+
+	if( result == QUERY_UNKNOWN )
+	{
+		++m_PagingStats.unknownQueries;
+		TrimToBudget();
+		return QUERY_UNKNOWN;
+	}
+
+	for( int tileZ = firstZ; tileZ <= lastZ; ++tileZ )
+	{
+		for( int tileX = firstX; tileX <= lastX; ++tileX )
+		{
+			const HeightField* pTile = m_pTiles[GetTileIndex(tileX, tileZ)].pField;
+
+			if( !pTile )
+				continue;
+
+			float offsetX = GetTileOffsetX(tileX);
+			float offsetZ = GetTileOffsetZ(tileZ);
+			XMVECTOR offset = XMVectorSet(offsetX, 0.0f, offsetZ, 0.0f);
+			HeightField::SphereHit tileHit;
+
+			if( !pTile->SphereCollision(centre - offset, radius, dir, speed, tileHit) )
+				continue;
+
+			if( result == QUERY_HIT && tileHit.time >= hit.time )
+				continue;
+
+			hit = tileHit;
+			hit.triangle = GetWorldFace(tileX, tileZ, tileHit.triangle);
+			hit.centre.x += offsetX;
+			hit.centre.z += offsetZ;
+			hit.contact.x += offsetX;
+			hit.contact.z += offsetZ;
+			result = QUERY_HIT;
+		}
+	}
+
+	TrimToBudget();
+
+	return result;
+}
@@ -0,0 +1,169 @@
+#ifndef PAGEDHEIGHTFIELD_H
+#define PAGEDHEIGHTFIELD_H
+
+//**********************************************************************
+// File:			PagedHeightField.h
+// Description:		A heightmap too big to keep in memory, split into tiles
+//					that are loaded from disk as the queries need them
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Each tile is its own HeightField, saved with SaveBinary.
+//					Neighbouring tiles share their edge samples, so every
+//					cell of the world is in exactly one tile. The tiles that
+//					were used longest ago are dropped once the loaded ones
+//					take up more than the memory budget.
+//**********************************************************************
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "HeightField.h"
+#include "HeightFieldLoader.h"
+
+class PagedHeightField
+{
+public:
+	// What a query does when it needs a tile that isn't loaded
+	enum PageFaultPolicy
+	{
+		PAGE_FAULT_LOAD,		// Load it there and then
+		PAGE_FAULT_UNKNOWN,		// Answer QUERY_UNKNOWN and leave it to LoadTile
+	};
+
+	enum QueryResult
+	{
+		QUERY_MISS,				// Nothing hit, or off the edge of the world
+		QUERY_HIT,
+		QUERY_UNKNOWN,			// The answer depends on a tile that isn't loaded
+	};
+
+	// Counted since the world was opened or ResetPagingStats
+	struct PagingStats
+	{
+		long long tileFaults;		// Queries that needed a tile that wasn't loaded
+		long long tilesLoaded;
+		long long tilesPrefetched;	// Of tilesLoaded, the ones a loader brought in
+		long long tilesEvicted;
+		long long unknownQueries;
+		double loadTimeMs;			// Spent loading tiles, or waiting for prefetches, on the calling thread
+	};
+
+	static const size_t DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+	// Splits source into tiles of up to tileSamples x tileSamples samples and
+	// writes them next to filename, which describes the world. The tiles are
+	// stored like source; HEIGHT_STORAGE_UINT16 ones are requantised over
+	// their own range, so their heights can move by half a step.
+	static bool WriteWorld( const char* filename, const HeightField& source, int tileSamples, bool withCollisionData = true );
+
+	// Opens a world written by WriteWorld. No tiles are loaded until a query
+	// or LoadTile needs them.
+	explicit PagedHeightField( const char* filename, size_t memoryBudget = DEFAULT_MEMORY_BUDGET );
+	~PagedHeightField();
+
+	bool IsOpen() const { return m_pTiles != NULL; }
+
+	// The same queries as HeightField's, in world coordinates, with face
+	// indices numbered across the whole world. Unlike HeightField's they
+	// load and drop tiles, so only one can run at a time. A query can go
+	// over the budget while it runs; it's trimmed again when it finishes.
+	QueryResult GetGroundAt( float x, float z, float& height, XMFLOAT3& normal );
+	QueryResult GetHeightAt( float x, float z, float& height );
+	QueryResult RayCollision( const XMVECTOR& rayPos, const XMVECTOR& rayDir, float speed, HeightField::RayHit& hit );
+	QueryResult SphereCollision( const XMVECTOR& centre, float radius, const XMVECTOR& dir, float speed, HeightField::SphereHit& hit );
+
+	// Loads a tile ahead of the queries that will need it. Returns false if
+	// its file is missing or damaged; the world then has a hole there.
+	bool LoadTile( int tileX, int tileZ );
+	bool IsTileLoaded( int tileX, int tileZ ) const;
+
+	// Prefetching queues tiles on a HeightFieldLoader, which must outlive
+	// this, and leaves the queries free to carry on. Finished tiles join the
+	// cache at the next query or CollectPrefetchedTiles. A query that needs a
+	// tile still on its way waits for it, or with PAGE_FAULT_UNKNOWN answers
+	// QUERY_UNKNOWN. Without a loader prefetching does nothing.
+	void SetLoader( HeightFieldLoader* pLoader ) { m_pLoader = pLoader; }
+	bool PrefetchTile( int tileX, int tileZ );
+	int PrefetchAround( float x, float z, float radius );
+	void CollectPrefetchedTiles( void );
+	int GetPrefetchingTileCount() const { return (int)m_PrefetchingTiles.size(); }
+
+	void SetMemoryBudget( size_t bytes );
+	size_t GetMemoryBudget() const { return m_MemoryBudget; }
+	size_t GetLoadedBytes() const { return m_LoadedBytes; }
+	int GetLoadedTileCount() const { return m_LoadedTileCount; }
+
+	void SetPageFaultPolicy( PageFaultPolicy policy ) { m_PageFaultPolicy = policy; }
+	PageFaultPolicy GetPageFaultPolicy() const { return m_PageFaultPolicy; }
+
+	const PagingStats& GetPagingStats() const { return m_PagingStats; }
+	void ResetPagingStats( void );
+
+	// The world is m_Width x m_Length samples, laid out like a HeightField
+	// that size, in m_TilesAcross x m_TilesDown tiles
+	int GetWidth() const { return m_Width; }
+	int GetLength() const { return m_Length; }
+	float GetGridSize() const { return m_GridSize; }
+	int GetTileSamples() const { return m_TileSamples; }
+	int GetTilesAcross() const { return m_TilesAcross; }
+	int GetTilesDown() const { return m_TilesDown; }
+
+private:
+	// Tiles are kept in a list from most to least recently used, linked by
+	// tile index, -1 ending it
+	struct Tile
+	{
+		HeightField* pField;
+		HeightFieldLoader::Request* pPrefetch;	// Set while a loader has it
+		size_t memoryBytes;
+		int newer;
+		int older;
+		bool missing;			// Its file couldn't be loaded, so it's never tried again
+	};
+
+	// Not copyable, the tiles belong to one object
+	PagedHeightField( const PagedHeightField& );
+	PagedHeightField& operator=( const PagedHeightField& );
+
+	bool Open( const char* filename );
+	static std::string GetTileFilename( const std::string& tileBase, int tileX, int tileZ );
+
+	int GetTileIndex( int tileX, int tileZ ) const { return (tileZ*m_TilesAcross) + tileX; }
+	int GetTileFirstSample( int tile ) const { return tile*(m_TileSamples-1); }
+	int GetTileWidth( int tileX ) const;
+	int GetTileLength( int tileZ ) const;
+	float GetTileOffsetX( int tileX ) const;
+	float GetTileOffsetZ( int tileZ ) const;
+	int GetWorldFace( int tileX, int tileZ, int localFace ) const;
+
+	const HeightField* GetTile( int tileX, int tileZ, QueryResult& result );
+	bool AddTile( int tile, HeightField* pField );
+	bool FinishPrefetch( int tile );
+	void UnlinkTile( int tile );
+	void LinkTileAsNewest( int tile );
+	void EvictTile( int tile );
+	void TrimToBudget( void );
+
+	std::string m_TileBase;		// Tile files are m_TileBase_x_z.hfd
+	int m_Width;
+	int m_Length;
+	float m_GridSize;
+	int m_TileSamples;
+	int m_TilesAcross;
+	int m_TilesDown;
+
+	Tile* m_pTiles;
+	int m_NewestTile;
+	int m_OldestTile;
+	int m_LoadedTileCount;
+	size_t m_LoadedBytes;
+	size_t m_MemoryBudget;
+
+	PageFaultPolicy m_PageFaultPolicy;
+	PagingStats m_PagingStats;
+
+	HeightFieldLoader* m_pLoader;
+	std::vector<int> m_PrefetchingTiles;
+};
+
+#endif
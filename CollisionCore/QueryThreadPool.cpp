@@ -0,0 +1,177 @@
+#include "QueryThreadPool.h"
+
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+QueryThreadPool::QueryThreadPool( int threadCount )
+{
+	m_ThreadCount = 0;
+	m_pQueues = NULL;
+
+	m_Generation = 0;
+	m_Running = 0;
+	m_Stopping = false;
+
+	m_pFn = NULL;
+	m_pContext = NULL;
+	m_Count = 0;
+	m_ChunkSize = 1;
+
+	StartThreads(threadCount);
+}
+
+QueryThreadPool::~QueryThreadPool()
+{
+	StopThreads();
+}
+
+void QueryThreadPool::SetThreadCount( int threadCount )
+{
+	StopThreads();
+	StartThreads(threadCount);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void QueryThreadPool::StartThreads( int threadCount )
+{
+	if( threadCount <= 0 )
+		threadCount = (int)std::thread::hardware_concurrency();
+
+	m_ThreadCount = std::max(threadCount, 1);
+	m_pQueues = new ChunkQueue[m_ThreadCount];
+	m_Stopping = false;
+
+	// The calling thread is thread 0
+	for( int thread = 1; thread < m_ThreadCount; ++thread )
+		m_Threads.push_back(std::thread(&QueryThreadPool::WorkerMain, this, thread, m_Generation));
+}
+
+void QueryThreadPool::StopThreads( void )
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+
+	m_WorkReady.notify_all();
+
+	for( size_t i = 0; i < m_Threads.size(); ++i )
+		m_Threads[i].join();
+
+	m_Threads.clear();
+
+	delete [] m_pQueues;
+	m_pQueues = NULL;
+	m_ThreadCount = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void QueryThreadPool::ParallelFor( int count, int chunkSize, ChunkFn pFn, void* pContext )
+{
+	if( count <= 0 )
+		return;
+
+	chunkSize = std::max(chunkSize, 1);
+
+	int chunkCount = (count + chunkSize - 1) / chunkSize;
+
+	// Not worth waking anyone for
+	if( m_ThreadCount == 1 || chunkCount == 1 )
+	{
+		pFn(pContext, 0, count, 0);
+		return;
+	}
+
+	for( int thread = 0; thread < m_ThreadCount; ++thread )
+	{
+		m_pQueues[thread].next.store((int)(((long long)chunkCount * thread) / m_ThreadCount), std::memory_order_relaxed);
+		m_pQueues[thread].end = (int)(((long long)chunkCount * (thread+1)) / m_ThreadCount);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		m_pFn = pFn;
+		m_pContext = pContext;
+		m_Count = count;
+		m_ChunkSize = chunkSize;
+
+		m_Running = m_ThreadCount - 1;
+		++m_Generation;
+	}
+
+	m_WorkReady.notify_all();
+
+	RunChunks(0);
+
+	// The workers still read the chunk queues until they're done with them
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	while( m_Running > 0 )
+		m_WorkDone.wait(lock);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void QueryThreadPool::WorkerMain( int thread, unsigned generation )
+{
+	for(;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			while( m_Generation == generation && !m_Stopping )
+				m_WorkReady.wait(lock);
+
+			if( m_Stopping )
+				return;
+
+			generation = m_Generation;
+		}
+
+		RunChunks(thread);
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			last = --m_Running == 0;
+		}
+
+		if( last )
+			m_WorkDone.notify_one();
+	}
+}
+
+// Function:	RunChunks
+// Description: Works through this thread's share of the chunks, then steals from the
+//				others' in turn, starting with the next thread along
+// Notes:		Every chunk number is handed out exactly once by the fetch_add, whoever
+//				asks for it. Once a share is used up its next just runs past its end.
+
+void QueryThreadPool::RunChunks( int thread )
+{
+	for( int i = 0; i < m_ThreadCount; ++i )
+	{
+		ChunkQueue& queue = m_pQueues[(thread + i) % m_ThreadCount];
+
+		for(;;)
+		{
+			int chunk = queue.next.fetch_add(1, std::memory_order_relaxed);
+
+			if( chunk >= queue.end )
+				break;
+
+			int first = chunk * m_ChunkSize;
+			int last = std::min(first + m_ChunkSize, m_Count);
+
+			m_pFn(m_pContext, first, last, thread);
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef QUERYTHREADPOOL_H
+#define QUERYTHREADPOOL_H
+
+//**********************************************************************
+// File:			QueryThreadPool.h
+// Description:		Worker threads for running many collision queries at once
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			ParallelFor cuts a range into chunks and deals them out
+//					evenly to the threads up front. A thread that finishes its
+//					share early steals chunks from the others' shares, so one
+//					slow chunk doesn't hold the rest up. The calling thread
+//					works too, so a pool of one thread starts no threads.
+//**********************************************************************
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class QueryThreadPool
+{
+public:
+	// Called for each chunk [first, last). thread is 0 to GetThreadCount()-1,
+	// 0 being the thread that called ParallelFor, for per-thread totals.
+	typedef void (*ChunkFn)(void* pContext, int first, int last, int thread);
+
+	// A threadCount of 0 means one per hardware thread
+	explicit QueryThreadPool( int threadCount = 0 );
+	~QueryThreadPool();
+
+	// Not to be called during a ParallelFor
+	void SetThreadCount( int threadCount );
+	int GetThreadCount() const { return m_ThreadCount; }
+
+	// Calls pFn for every chunk of chunkSize in [0, count) and returns once
+	// they're all done. Only one ParallelFor can run on a pool at a time.
+	void ParallelFor( int count, int chunkSize, ChunkFn pFn, void* pContext );
+
+private:
+	// One thread's share of the chunks. Its owner and any thieves all take
+	// them from the front; padded so the shares don't share cache lines.
+	struct ChunkQueue
+	{
+		std::atomic<int> next;
+		int end;
+		char padding[64 - sizeof(std::atomic<int>) - sizeof(int)];
+	};
+
+	void StartThreads( int threadCount );
+	void StopThreads( void );
+	void WorkerMain( int thread, unsigned generation );
+	void RunChunks( int thread );
+
+	int m_ThreadCount;
+	std::vector<std::thread> m_Threads;
+	ChunkQueue* m_pQueues;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WorkReady;
+	std::condition_variable m_WorkDone;
+	unsigned m_Generation;		// Goes up by one for each ParallelFor
+	int m_Running;				// Worker threads still on the current ParallelFor
+	bool m_Stopping;
+
+	// The current ParallelFor
+	ChunkFn m_pFn;
+	void* m_pContext;
+	int m_Count;
+	int m_ChunkSize;
+};
+
+#endif
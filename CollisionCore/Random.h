@@ -0,0 +1,33 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+//**********************************************************************
+// File:			Random.h
+// Description:		A small deterministic random number generator
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Xorshift, so the same seed gives the same numbers on
+//					every compiler and platform, unlike rand(). Used where a
+//					run has to be repeatable: the benchmark's queries, the
+//					runner's bodies and a recorded shower's drops.
+//**********************************************************************
+
+class Random
+{
+public:
+	explicit Random( unsigned seed ) : m_State(seed ? seed : 1) {}
+
+	unsigned Next()
+	{
+		m_State ^= m_State << 13;
+		m_State ^= m_State >> 17;
+		m_State ^= m_State << 5;
+		return m_State;
+	}
+
+	float Range( float lo, float hi ) { return lo + (hi - lo) * ((Next() & 0xffffff) / 16777216.0f); }
+
+private:
+	unsigned m_State;
+};
+
+#endif
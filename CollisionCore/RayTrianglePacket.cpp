@@ -0,0 +1,179 @@
+#include "RayTrianglePacket.h"
+#include "AlignedAlloc.h"
+
+#include <float.h>
+
+#ifdef RAYTRIANGLEPACKET_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// Function:	RayTrianglePacket_Scalar
+// Description: Moller-Trumbore, one lane at a time
+// Notes:		The SSE4 and AVX2 kernels do exactly the same sums in exactly the same
+//				order, lane by lane, so keep them in step if this changes.
+//
+//				With P = DIR x E2, T = POS - V0 and Q = T x E1:
+//				DET = E1 dot P, U = (T dot P)/DET, V = (DIR dot Q)/DET and DIST = (E2 dot Q)/DET
+//				and the ray hits if DET > 0, U >= 0, V >= 0, U+V <= 1 and 0 <= DIST <= MAXDIST.
+//				DET is 0 when the ray is parallel to the triangle (or the triangle is degenerate),
+//				and negative when the ray comes from underneath, which RayTriangle doesn't count
+//				as a hit either.
+
+unsigned RayTrianglePacket_Scalar(const RayPacketSetup& ray, const TrianglePacket& tris, float* pDist)
+{
+	unsigned hitMask = 0;
+
+	for( int i = 0; i < TRIANGLE_PACKET_SIZE; ++i )
+	{
+		float px = ray.dirN[1]*tris.e2z[i] - ray.dirN[2]*tris.e2y[i];
+		float py = ray.dirN[2]*tris.e2x[i] - ray.dirN[0]*tris.e2z[i];
+		float pz = ray.dirN[0]*tris.e2y[i] - ray.dirN[1]*tris.e2x[i];
+
+		float det = tris.e1x[i]*px + tris.e1y[i]*py + tris.e1z[i]*pz;
+
+		pDist[i] = FLT_MAX;
+
+		if( !(det > 0.0f) )
+			continue;
+
+		float invDet = 1.0f / det;
+
+		float tx = ray.pos[0] - tris.v0x[i];
+		float ty = ray.pos[1] - tris.v0y[i];
+		float tz = ray.pos[2] - tris.v0z[i];
+
+		float u = (tx*px + ty*py + tz*pz) * invDet;
+
+		float qx = ty*tris.e1z[i] - tz*tris.e1y[i];
+		float qy = tz*tris.e1x[i] - tx*tris.e1z[i];
+		float qz = tx*tris.e1y[i] - ty*tris.e1x[i];
+
+		float v = (ray.dirN[0]*qx + ray.dirN[1]*qy + ray.dirN[2]*qz) * invDet;
+		float dist = (tris.e2x[i]*qx + tris.e2y[i]*qy + tris.e2z[i]*qz) * invDet;
+
+		if( u >= 0.0f && v >= 0.0f && u + v <= 1.0f && dist >= 0.0f && dist <= ray.maxDist )
+		{
+			pDist[i] = dist;
+			hitMask |= 1 << i;
+		}
+	}
+
+	return hitMask;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#ifdef RAYTRIANGLEPACKET_X86
+
+static void CpuId( int leaf, int subLeaf, unsigned regs[4] )
+{
+#ifdef _MSC_VER
+	int msRegs[4];
+	__cpuidex(msRegs, leaf, subLeaf);
+	for( int i = 0; i < 4; ++i )
+		regs[i] = (unsigned)msRegs[i];
+#else
+	__cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long GetXCR0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+struct RayTrianglePacketKernel
+{
+	RayTrianglePacketFn pFn;
+	const char* pName;
+};
+
+static RayTrianglePacketKernel ChooseRayTrianglePacketKernel()
+{
+	RayTrianglePacketKernel kernel = { RayTrianglePacket_Scalar, "Scalar" };
+
+#ifdef RAYTRIANGLEPACKET_X86
+	unsigned regs[4];
+
+	CpuId(0, 0, regs);
+	unsigned maxLeaf = regs[0];
+
+	if( maxLeaf < 1 )
+		return kernel;
+
+	CpuId(1, 0, regs);
+
+	bool sse41 = (regs[2] & (1 << 19)) != 0;
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx = (regs[2] & (1 << 28)) != 0;
+
+	if( sse41 )
+	{
+		kernel.pFn = RayTrianglePacket_SSE4;
+		kernel.pName = "SSE4";
+	}
+
+	// AVX2 also needs the OS to save the upper halves of the YMM registers
+	if( maxLeaf >= 7 && osxsave && avx && (GetXCR0() & 6) == 6 )
+	{
+		CpuId(7, 0, regs);
+
+		if( regs[1] & (1 << 5) )
+		{
+			kernel.pFn = RayTrianglePacket_AVX2;
+			kernel.pName = "AVX2";
+		}
+	}
+#endif
+
+	return kernel;
+}
+
+static const RayTrianglePacketKernel& GetKernel()
+{
+	static const RayTrianglePacketKernel s_kernel = ChooseRayTrianglePacketKernel();
+
+	return s_kernel;
+}
+
+RayTrianglePacketFn GetRayTrianglePacketKernel()
+{
+	return GetKernel().pFn;
+}
+
+const char* GetRayTrianglePacketKernelName()
+{
+	return GetKernel().pName;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+TrianglePacket* AllocTrianglePackets( size_t count )
+{
+	return (TrianglePacket*)AlignedAlloc(count * sizeof(TrianglePacket), alignof(TrianglePacket));
+}
+
+void FreeTrianglePackets( TrianglePacket* pPackets )
+{
+	AlignedFree(pPackets);
+}
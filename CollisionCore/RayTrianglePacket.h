@@ -0,0 +1,64 @@
+#ifndef RAYTRIANGLEPACKET_H
+#define RAYTRIANGLEPACKET_H
+
+//**********************************************************************
+// File:			RayTrianglePacket.h
+// Description:		Tests one ray against eight triangles at a time
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			The kernel is chosen at runtime: AVX2 tests all eight
+//					triangles at once, SSE4 tests them four at a time, and
+//					there is a plain C++ version for everything else.
+//					All three use the same Moller-Trumbore formulation with
+//					no square roots, so they give the same answers, and like
+//					HeightMap::RayTriangle they only hit triangles from above.
+//**********************************************************************
+
+#include <stddef.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define RAYTRIANGLEPACKET_X86
+#endif
+
+static const int TRIANGLE_PACKET_SIZE = 8;
+
+// Eight triangles, transposed so that each component of each vertex/edge
+// is contiguous. Unused lanes should have zero edges, which never hit.
+struct alignas(32) TrianglePacket
+{
+	float v0x[TRIANGLE_PACKET_SIZE];
+	float v0y[TRIANGLE_PACKET_SIZE];
+	float v0z[TRIANGLE_PACKET_SIZE];
+	float e1x[TRIANGLE_PACKET_SIZE];	// vert1 - vert0
+	float e1y[TRIANGLE_PACKET_SIZE];
+	float e1z[TRIANGLE_PACKET_SIZE];
+	float e2x[TRIANGLE_PACKET_SIZE];	// vert2 - vert0
+	float e2y[TRIANGLE_PACKET_SIZE];
+	float e2z[TRIANGLE_PACKET_SIZE];
+};
+
+// The ray, set up once and shared by every packet it's tested against
+struct RayPacketSetup
+{
+	float pos[3];
+	float dirN[3];		// Must be normalised, so that distances come out in world units
+	float maxDist;
+};
+
+// Returns a mask with bit n set if the ray hits triangle n at a distance in [0, maxDist].
+// pDist receives TRIANGLE_PACKET_SIZE distances, with FLT_MAX for the lanes that miss.
+typedef unsigned (*RayTrianglePacketFn)(const RayPacketSetup& ray, const TrianglePacket& tris, float* pDist);
+
+// The best kernel this CPU supports, and its name for display
+RayTrianglePacketFn GetRayTrianglePacketKernel();
+const char* GetRayTrianglePacketKernelName();
+
+// The individual kernels. Only call the SSE4/AVX2 ones if the CPU supports them.
+unsigned RayTrianglePacket_Scalar(const RayPacketSetup& ray, const TrianglePacket& tris, float* pDist);
+unsigned RayTrianglePacket_SSE4(const RayPacketSetup& ray, const TrianglePacket& tris, float* pDist);
+unsigned RayTrianglePacket_AVX2(const RayPacketSetup& ray, const TrianglePacket& tris, float* pDist);
+
+// Allocation for arrays of packets, which need 32 byte alignment
+TrianglePacket* AllocTrianglePackets( size_t count );
+void FreeTrianglePackets( TrianglePacket* pPackets );
+
+#endif
@@ -0,0 +1,74 @@
+#include "RayTrianglePacket.h"
+
+//////////////////////////////////////////////////////////////////////
+// AVX2 version of RayTrianglePacket_Scalar, all eight lanes at once.
+// See RayTrianglePacket.cpp for the maths.
+//
+// This file is compiled with AVX2 code generation enabled, so nothing
+// in it may be called without checking the CPU first.
+//////////////////////////////////////////////////////////////////////
+
+#ifdef RAYTRIANGLEPACKET_X86
+
+#include <float.h>
+#include <immintrin.h>
+
+unsigned RayTrianglePacket_AVX2(const RayPacketSetup& ray, const TrianglePacket& tris, float* pDist)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 noHit = _mm256_set1_ps(FLT_MAX);
+	const __m256 maxDist = _mm256_set1_ps(ray.maxDist);
+
+	const __m256 dx = _mm256_set1_ps(ray.dirN[0]);
+	const __m256 dy = _mm256_set1_ps(ray.dirN[1]);
+	const __m256 dz = _mm256_set1_ps(ray.dirN[2]);
+
+	__m256 e1x = _mm256_load_ps(tris.e1x);
+	__m256 e1y = _mm256_load_ps(tris.e1y);
+	__m256 e1z = _mm256_load_ps(tris.e1z);
+	__m256 e2x = _mm256_load_ps(tris.e2x);
+	__m256 e2y = _mm256_load_ps(tris.e2y);
+	__m256 e2z = _mm256_load_ps(tris.e2z);
+
+	__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+	__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+	__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+	__m256 invDet = _mm256_div_ps(one, det);
+
+	__m256 tx = _mm256_sub_ps(_mm256_set1_ps(ray.pos[0]), _mm256_load_ps(tris.v0x));
+	__m256 ty = _mm256_sub_ps(_mm256_set1_ps(ray.pos[1]), _mm256_load_ps(tris.v0y));
+	__m256 tz = _mm256_sub_ps(_mm256_set1_ps(ray.pos[2]), _mm256_load_ps(tris.v0z));
+
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+	__m256 dist = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+	// Lanes where DET <= 0 can hold infinities and NaNs above, but never pass the DET test
+	__m256 hit = _mm256_cmp_ps(det, zero, _CMP_GT_OQ);
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, zero, _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, maxDist, _CMP_LE_OQ));
+
+	_mm256_storeu_ps(pDist, _mm256_blendv_ps(noHit, dist, hit));
+
+	return (unsigned)_mm256_movemask_ps(hit);
+}
+
+#else
+
+unsigned RayTrianglePacket_AVX2(const RayPacketSetup& ray, const TrianglePacket& tris, float* pDist)
+{
+	return RayTrianglePacket_Scalar(ray, tris, pDist);
+}
+
+#endif
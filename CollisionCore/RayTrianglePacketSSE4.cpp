@@ -0,0 +1,82 @@
+#include "RayTrianglePacket.h"
+
+//////////////////////////////////////////////////////////////////////
+// SSE4 version of RayTrianglePacket_Scalar, four lanes at a time.
+// See RayTrianglePacket.cpp for the maths.
+//////////////////////////////////////////////////////////////////////
+
+#ifdef RAYTRIANGLEPACKET_X86
+
+#include <float.h>
+#include <smmintrin.h>
+
+unsigned RayTrianglePacket_SSE4(const RayPacketSetup& ray, const TrianglePacket& tris, float* pDist)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 noHit = _mm_set1_ps(FLT_MAX);
+	const __m128 maxDist = _mm_set1_ps(ray.maxDist);
+
+	const __m128 dx = _mm_set1_ps(ray.dirN[0]);
+	const __m128 dy = _mm_set1_ps(ray.dirN[1]);
+	const __m128 dz = _mm_set1_ps(ray.dirN[2]);
+
+	const __m128 ox = _mm_set1_ps(ray.pos[0]);
+	const __m128 oy = _mm_set1_ps(ray.pos[1]);
+	const __m128 oz = _mm_set1_ps(ray.pos[2]);
+
+	unsigned hitMask = 0;
+
+	for( int i = 0; i < TRIANGLE_PACKET_SIZE; i += 4 )
+	{
+		__m128 e1x = _mm_load_ps(&tris.e1x[i]);
+		__m128 e1y = _mm_load_ps(&tris.e1y[i]);
+		__m128 e1z = _mm_load_ps(&tris.e1z[i]);
+		__m128 e2x = _mm_load_ps(&tris.e2x[i]);
+		__m128 e2y = _mm_load_ps(&tris.e2y[i]);
+		__m128 e2z = _mm_load_ps(&tris.e2z[i]);
+
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 invDet = _mm_div_ps(one, det);
+
+		__m128 tx = _mm_sub_ps(ox, _mm_load_ps(&tris.v0x[i]));
+		__m128 ty = _mm_sub_ps(oy, _mm_load_ps(&tris.v0y[i]));
+		__m128 tz = _mm_sub_ps(oz, _mm_load_ps(&tris.v0z[i]));
+
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+		__m128 dist = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+		// Lanes where DET <= 0 can hold infinities and NaNs above, but never pass the DET test
+		__m128 hit = _mm_cmpgt_ps(det, zero);
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(dist, zero));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(dist, maxDist));
+
+		_mm_storeu_ps(&pDist[i], _mm_blendv_ps(noHit, dist, hit));
+
+		hitMask |= (unsigned)_mm_movemask_ps(hit) << i;
+	}
+
+	return hitMask;
+}
+
+#else
+
+unsigned RayTrianglePacket_SSE4(const RayPacketSetup& ray, const TrianglePacket& tris, float* pDist)
+{
+	return RayTrianglePacket_Scalar(ray, tris, pDist);
+}
+
+#endif
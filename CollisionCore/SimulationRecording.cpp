@@ -0,0 +1,297 @@
+#include "SimulationRecording.h"
+#include "Random.h"
+#include "SphereWorld.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char SIMULATION_FILE_MAGIC[4] = { 'S', 'R', 'E', 'C' };
+static const uint32_t SIMULATION_FILE_VERSION = 1;
+
+// Past these a file is taken to be corrupt rather than replayed, so a bad
+// count can't ask for more memory than any real session would use
+static const uint32_t MAX_HEIGHTMAP_NAME_BYTES = 4096;
+static const int64_t MAX_RECORDED_BODIES = 1 << 22;
+
+struct SimulationFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	int32_t tickRate;
+	float radius;
+	float gravity;
+	float restitution;
+	float rollingResistance;
+	float dropHeight;
+	float dropSpeed;
+	int32_t showerSize;
+	float gridSize;
+	float heightRange;
+	int32_t tickCount;
+	int32_t eventCount;
+	uint32_t hasFinalChecksum;
+	uint32_t heightMapNameBytes;		// Follows the header, with no terminator
+	uint64_t finalChecksum;
+};
+
+template<typename T> static bool WriteValue( FILE* pFile, const T& value )
+{
+	return fwrite(&value, sizeof value, 1, pFile) == 1;
+}
+
+template<typename T> static bool ReadValue( FILE* pFile, T& value )
+{
+	return fread(&value, sizeof value, 1, pFile) == 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+SimulationRecording::SimulationRecording()
+{
+	memset(&m_Settings, 0, sizeof m_Settings);
+	m_TickCount = 0;
+	m_HasFinalChecksum = false;
+	m_FinalChecksum = 0;
+}
+
+void SimulationRecording::Reset( const Settings& settings, const char* pHeightMapFile )
+{
+	m_Settings = settings;
+	m_HeightMapFile = pHeightMapFile;
+	m_Events.clear();
+	m_TickCount = 0;
+	m_HasFinalChecksum = false;
+	m_FinalChecksum = 0;
+}
+
+SimulationRecording::Event SimulationRecording::MakeDrop( float x, float z )
+{
+	Event event;
+	memset(&event, 0, sizeof event);
+
+	event.type = EVENT_DROP;
+	event.x = x;
+	event.z = z;
+
+	return event;
+}
+
+SimulationRecording::Event SimulationRecording::MakeDropAgain( void )
+{
+	Event event;
+	memset(&event, 0, sizeof event);
+
+	event.type = EVENT_DROP_AGAIN;
+
+	return event;
+}
+
+SimulationRecording::Event SimulationRecording::MakeShower( uint32_t seed, int count )
+{
+	Event event;
+	memset(&event, 0, sizeof event);
+
+	event.type = EVENT_SHOWER;
+	event.seed = seed;
+	event.count = count;
+
+	return event;
+}
+
+void SimulationRecording::SetupWorld( SphereWorld& world ) const
+{
+	world.SetGravity(XMFLOAT3(0.0f, m_Settings.gravity, 0.0f));
+	world.SetRestitution(m_Settings.restitution);
+	world.SetRollingResistance(m_Settings.rollingResistance);
+}
+
+void SimulationRecording::Apply( const Event& event, SphereWorld& world ) const
+{
+	XMFLOAT3 dropVelocity(0.0f, m_Settings.dropSpeed, 0.0f);
+
+	switch( event.type )
+	{
+	case EVENT_DROP:
+		world.AddBody(XMFLOAT3(event.x, m_Settings.dropHeight, event.z), dropVelocity);
+		break;
+
+	case EVENT_DROP_AGAIN:
+		for( int i = 0; i < world.GetBodyCount(); ++i )
+		{
+			XMFLOAT3 pos = world.GetPosition(i);
+			world.SetBody(i, XMFLOAT3(pos.x, m_Settings.dropHeight, pos.z), dropVelocity);
+		}
+		break;
+
+	case EVENT_SHOWER:
+		{
+			// Its own generator, so the drops don't depend on rand()
+			Random random(event.seed);
+			uint32_t span = m_Settings.showerSize > 0 ? (uint32_t)m_Settings.showerSize * 2 : 1;
+
+			for( int i = 0; i < event.count; ++i )
+			{
+				float x = (float)((int)(random.Next() % span) - m_Settings.showerSize);
+				float z = (float)((int)(random.Next() % span) - m_Settings.showerSize);
+
+				world.AddBody(XMFLOAT3(x, m_Settings.dropHeight, z), dropVelocity);
+			}
+		}
+		break;
+	}
+}
+
+void SimulationRecording::AddEvent( const Event& event )
+{
+	m_Events.push_back(event);
+	m_Events.back().tick = m_TickCount;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Save
+//////////////////////////////////////////////////////////////////////
+bool SimulationRecording::Save( const char* filename ) const
+{
+	SimulationFileHeader header;
+	memset(&header, 0, sizeof header);
+
+	memcpy(header.magic, SIMULATION_FILE_MAGIC, sizeof header.magic);
+	header.version = SIMULATION_FILE_VERSION;
+	header.tickRate = m_Settings.tickRate;
+	header.radius = m_Settings.radius;
+	header.gravity = m_Settings.gravity;
+	header.restitution = m_Settings.restitution;
+	header.rollingResistance = m_Settings.rollingResistance;
+	header.dropHeight = m_Settings.dropHeight;
+	header.dropSpeed = m_Settings.dropSpeed;
+	header.showerSize = m_Settings.showerSize;
+	header.gridSize = m_Settings.gridSize;
+	header.heightRange = m_Settings.heightRange;
+	header.tickCount = m_TickCount;
+	header.eventCount = (int32_t)m_Events.size();
+	header.hasFinalChecksum = m_HasFinalChecksum ? 1 : 0;
+	header.heightMapNameBytes = (uint32_t)m_HeightMapFile.size();
+	header.finalChecksum = m_FinalChecksum;
+
+	FILE* pFile = fopen(filename, "wb");
+
+	if( !pFile )
+		return false;
+
+	bool written = WriteValue(pFile, header) &&
+				   fwrite(m_HeightMapFile.data(), 1, m_HeightMapFile.size(), pFile) == m_HeightMapFile.size();
+
+	for( size_t i = 0; written && i < m_Events.size(); ++i )
+	{
+		const Event& event = m_Events[i];
+
+		written = WriteValue(pFile, (int32_t)event.tick) && WriteValue(pFile, (uint8_t)event.type);
+
+		if( written && event.type == EVENT_DROP )
+			written = WriteValue(pFile, event.x) && WriteValue(pFile, event.z);
+		else if( written && event.type == EVENT_SHOWER )
+			written = WriteValue(pFile, event.seed) && WriteValue(pFile, (int32_t)event.count);
+	}
+
+	if( fclose(pFile) != 0 )
+		written = false;
+
+	return written;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Load
+// Events have to be in tick order and within the recording, so a
+// replay can take them as it goes.
+//////////////////////////////////////////////////////////////////////
+bool SimulationRecording::Load( const char* filename )
+{
+	Settings empty;
+	memset(&empty, 0, sizeof empty);
+	Reset(empty, "");
+
+	FILE* pFile = fopen(filename, "rb");
+
+	if( !pFile )
+		return false;
+
+	SimulationFileHeader header;
+	bool valid = ReadValue(pFile, header) &&
+				 memcmp(header.magic, SIMULATION_FILE_MAGIC, sizeof header.magic) == 0 &&
+				 header.version == SIMULATION_FILE_VERSION &&
+				 header.tickRate > 0 && header.tickCount >= 0 && header.eventCount >= 0 &&
+				 header.heightMapNameBytes < MAX_HEIGHTMAP_NAME_BYTES;
+
+	std::string heightMapFile;
+
+	if( valid )
+	{
+		heightMapFile.resize(header.heightMapNameBytes);
+		valid = header.heightMapNameBytes == 0 || fread(&heightMapFile[0], 1, header.heightMapNameBytes, pFile) == header.heightMapNameBytes;
+	}
+
+	std::vector<Event> events;
+	int lastTick = 0;
+	int64_t bodyCount = 0;
+
+	for( int i = 0; valid && i < header.eventCount; ++i )
+	{
+		int32_t tick = 0;
+		uint8_t type = 0;
+		Event event = MakeDropAgain();
+
+		valid = ReadValue(pFile, tick) && ReadValue(pFile, type) &&
+				tick >= lastTick && tick <= header.tickCount;
+
+		if( !valid )
+			break;
+
+		if( type == EVENT_DROP )
+		{
+			event = MakeDrop(0.0f, 0.0f);
+			valid = ReadValue(pFile, event.x) && ReadValue(pFile, event.z);
+			bodyCount += 1;
+		}
+		else if( type == EVENT_SHOWER )
+		{
+			int32_t count = 0;
+			event = MakeShower(0, 0);
+			valid = ReadValue(pFile, event.seed) && ReadValue(pFile, count) && count >= 0;
+			event.count = count;
+			bodyCount += count;
+		}
+		else if( type != EVENT_DROP_AGAIN )
+			valid = false;
+
+		if( bodyCount > MAX_RECORDED_BODIES )
+			valid = false;
+
+		event.tick = tick;
+		lastTick = tick;
+		events.push_back(event);
+	}
+
+	fclose(pFile);
+
+	if( !valid )
+		return false;
+
+	m_Settings.tickRate = header.tickRate;
+	m_Settings.radius = header.radius;
+	m_Settings.gravity = header.gravity;
+	m_Settings.restitution = header.restitution;
+	m_Settings.rollingResistance = header.rollingResistance;
+	m_Settings.dropHeight = header.dropHeight;
+	m_Settings.dropSpeed = header.dropSpeed;
+	m_Settings.showerSize = header.showerSize;
+	m_Settings.gridSize = header.gridSize;
+	m_Settings.heightRange = header.heightRange;
+	m_HeightMapFile = heightMapFile;
+	m_Events.swap(events);
+	m_TickCount = header.tickCount;
+	m_HasFinalChecksum = header.hasFinalChecksum != 0;
+	m_FinalChecksum = header.finalChecksum;
+
+	return true;
+}
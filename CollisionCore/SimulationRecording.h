@@ -0,0 +1,120 @@
+#ifndef SIMULATIONRECORDING_H
+#define SIMULATIONRECORDING_H
+
+//**********************************************************************
+// File:			SimulationRecording.h
+// Description:		The inputs to a SphereWorld, tick by tick, so a session
+//					can be run again exactly
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Everything that adds or moves bodies goes through an
+//					Event, applied with Apply and kept with AddEvent, stamped
+//					with the number of ticks stepped before it. Random drops
+//					are kept as where they landed; a shower is kept as the
+//					seed its positions come from, so it's a few bytes however
+//					many spheres it drops.
+//
+//					Replaying is: for each tick, Apply its events, then
+//					Step. Steps only depend on the bodies and the ground, so
+//					the same build gives the same bodies at the end; the
+//					checksum saved with the recording says whether it did.
+//					Other compilers and instruction sets can round
+//					differently and drift apart.
+//
+//					Files are little-endian, as HeightField's binary files
+//					are: a header, the heightmap's name, then each event as
+//					its tick, its type and only the fields that type uses.
+//**********************************************************************
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class SphereWorld;
+
+class SimulationRecording
+{
+public:
+	enum EventType
+	{
+		EVENT_DROP,				// One sphere at x, z
+		EVENT_DROP_AGAIN,		// Every sphere lifted back up from where it is
+		EVENT_SHOWER,			// count spheres at random whole x and z within showerSize, from seed
+	};
+
+	struct Event
+	{
+		int tick;				// Ticks stepped before it happened
+		EventType type;
+		float x, z;
+		uint32_t seed;
+		int count;
+	};
+
+	// What's needed to run the events the same way again
+	struct Settings
+	{
+		int tickRate;			// Ticks a second
+		float radius;
+		float gravity;			// Down is negative
+		float restitution;		// As SphereWorld's
+		float rollingResistance;
+		float dropHeight;		// Spheres start this high...
+		float dropSpeed;		// ...going up at this speed
+		int showerSize;			// Showers land from -showerSize to showerSize-1
+		float gridSize;			// The heightmap as HeightField loaded it
+		float heightRange;
+	};
+
+	SimulationRecording();
+
+	// Starts again with no events or ticks
+	void Reset( const Settings& settings, const char* pHeightMapFile );
+
+	const Settings& GetSettings() const { return m_Settings; }
+	const char* GetHeightMapFile() const { return m_HeightMapFile.c_str(); }
+
+	// Events for Apply and AddEvent, which fills in the tick
+	static Event MakeDrop( float x, float z );
+	static Event MakeDropAgain( void );
+	static Event MakeShower( uint32_t seed, int count );
+
+	// Gives world the gravity, restitution and rolling resistance above.
+	// It has to have been made with the radius.
+	void SetupWorld( SphereWorld& world ) const;
+
+	// Does what the event says to world. Every recorded event must go
+	// through here, or a replay won't do the same.
+	void Apply( const Event& event, SphereWorld& world ) const;
+
+	// Keeps the event, at the current tick
+	void AddEvent( const Event& event );
+
+	// Called after each Step
+	void EndTick( void ) { ++m_TickCount; }
+
+	int GetTickCount() const { return m_TickCount; }
+	int GetEventCount() const { return (int)m_Events.size(); }
+	const Event& GetEvent( int event ) const { return m_Events[event]; }
+
+	// SphereWorld::GetStateChecksum at the end of the recording, if it was
+	// set before it was saved
+	void SetFinalChecksum( uint64_t checksum ) { m_FinalChecksum = checksum; m_HasFinalChecksum = true; }
+	bool HasFinalChecksum() const { return m_HasFinalChecksum; }
+	uint64_t GetFinalChecksum() const { return m_FinalChecksum; }
+
+	bool Save( const char* filename ) const;
+
+	// On failure, including a file asking for more bodies than any real
+	// session would, the recording is left empty
+	bool Load( const char* filename );
+
+private:
+	Settings m_Settings;
+	std::string m_HeightMapFile;
+	std::vector<Event> m_Events;
+	int m_TickCount;
+	bool m_HasFinalChecksum;
+	uint64_t m_FinalChecksum;
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "SphereWorld.h"
+#include "QueryThreadPool.h"
+
+#include <algorithm>
+#include <string.h>
+
+// One thread's count of bodies on the ground, padded so the counts don't
+// share a cache line
+struct StepTotals
+{
+	int touching;
+	char padding[64 - sizeof(int)];
+};
+
+struct StepJob
+{
+	SphereWorld* pWorld;
+	float dt;
+	StepTotals* pTotals;
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+SphereWorld::SphereWorld( float radius )
+{
+	m_pHeightField = NULL;
+	m_Radius = radius;
+	m_Gravity = XMFLOAT3(0.0f, -9.8f, 0.0f);
+	m_Restitution = 0.0f;
+	m_RollingResistance = 0.5f;
+}
+
+int SphereWorld::AddBody( const XMFLOAT3& pos, const XMFLOAT3& vel )
+{
+	int body = GetBodyCount();
+	int count = body + 1;
+
+	m_PosX.resize(count);
+	m_PosY.resize(count);
+	m_PosZ.resize(count);
+	m_PrevX.resize(count);
+	m_PrevY.resize(count);
+	m_PrevZ.resize(count);
+	m_VelX.resize(count);
+	m_VelY.resize(count);
+	m_VelZ.resize(count);
+	m_Touching.resize(count);
+
+	m_GroundY.resize(count);
+	m_NormX.resize(count);
+	m_NormY.resize(count);
+	m_NormZ.resize(count);
+	m_OnMap.resize(count);
+
+	SetBody(body, pos, vel);
+
+	return body;
+}
+
+void SphereWorld::SetBody( int body, const XMFLOAT3& pos, const XMFLOAT3& vel )
+{
+	m_PosX[body] = pos.x;
+	m_PosY[body] = pos.y;
+	m_PosZ[body] = pos.z;
+	m_PrevX[body] = pos.x;
+	m_PrevY[body] = pos.y;
+	m_PrevZ[body] = pos.z;
+	m_VelX[body] = vel.x;
+	m_VelY[body] = vel.y;
+	m_VelZ[body] = vel.z;
+	m_Touching[body] = 0;
+}
+
+void SphereWorld::Clear( void )
+{
+	m_PosX.clear();
+	m_PosY.clear();
+	m_PosZ.clear();
+	m_PrevX.clear();
+	m_PrevY.clear();
+	m_PrevZ.clear();
+	m_VelX.clear();
+	m_VelY.clear();
+	m_VelZ.clear();
+	m_Touching.clear();
+
+	m_GroundY.clear();
+	m_NormX.clear();
+	m_NormY.clear();
+	m_NormZ.clear();
+	m_OnMap.clear();
+}
+
+int SphereWorld::Step( float dt )
+{
+	return StepRange(0, GetBodyCount(), dt);
+}
+
+int SphereWorld::Step( float dt, QueryThreadPool& pool, int chunkSize )
+{
+	std::vector<StepTotals> totals(pool.GetThreadCount());
+	memset(&totals[0], 0, totals.size() * sizeof totals[0]);
+
+	StepJob job;
+	job.pWorld = this;
+	job.dt = dt;
+	job.pTotals = &totals[0];
+
+	pool.ParallelFor(GetBodyCount(), chunkSize, StepChunk, &job);
+
+	int touching = 0;
+
+	for( size_t i = 0; i < totals.size(); ++i )
+		touching += totals[i].touching;
+
+	return touching;
+}
+
+void SphereWorld::StepChunk( void* pContext, int first, int last, int thread )
+{
+	const StepJob& job = *(const StepJob*)pContext;
+
+	job.pTotals[thread].touching += job.pWorld->StepRange(first, last, job.dt);
+}
+
+//////////////////////////////////////////////////////////////////////
+// StepRange
+// Semi-implicit Euler, then any body closer to the plane under it than
+// its radius is pushed out along the normal, loses its speed into the
+// ground (less what bounces) and starts to slow down.
+//////////////////////////////////////////////////////////////////////
+int SphereWorld::StepRange( int first, int last, float dt )
+{
+	int count = last - first;
+
+	if( count <= 0 )
+		return 0;
+
+	float* pPosX = &m_PosX[first];
+	float* pPosY = &m_PosY[first];
+	float* pPosZ = &m_PosZ[first];
+	float* pVelX = &m_VelX[first];
+	float* pVelY = &m_VelY[first];
+	float* pVelZ = &m_VelZ[first];
+	unsigned char* pTouching = &m_Touching[first];
+
+	memcpy(&m_PrevX[first], pPosX, count * sizeof(float));
+	memcpy(&m_PrevY[first], pPosY, count * sizeof(float));
+	memcpy(&m_PrevZ[first], pPosZ, count * sizeof(float));
+
+	float gravityX = m_Gravity.x * dt;
+	float gravityY = m_Gravity.y * dt;
+	float gravityZ = m_Gravity.z * dt;
+
+	for( int i = 0; i < count; ++i )
+	{
+		pVelX[i] += gravityX;
+		pVelY[i] += gravityY;
+		pVelZ[i] += gravityZ;
+
+		pPosX[i] += pVelX[i] * dt;
+		pPosY[i] += pVelY[i] * dt;
+		pPosZ[i] += pVelZ[i] * dt;
+	}
+
+	if( !m_pHeightField )
+	{
+		memset(pTouching, 0, count);
+		return 0;
+	}
+
+	float* pGroundY = &m_GroundY[first];
+	float* pNormX = &m_NormX[first];
+	float* pNormY = &m_NormY[first];
+	float* pNormZ = &m_NormZ[first];
+	unsigned char* pOnMap = &m_OnMap[first];
+
+	m_pHeightField->GetGroundBatch(count, pPosX, pPosZ, pGroundY, pNormX, pNormY, pNormZ, pOnMap);
+
+	float bounce = 1.0f + m_Restitution;
+	float keep = std::max(1.0f - (m_RollingResistance * dt), 0.0f);
+	int touching = 0;
+
+	for( int i = 0; i < count; ++i )
+	{
+		// The plane passes through (x, ground, z), straight below or above
+		// the centre, so the centre's distance from it is just the height
+		// difference along the normal
+		float distance = (pPosY[i] - pGroundY[i]) * pNormY[i];
+
+		pTouching[i] = 0;
+
+		if( !pOnMap[i] || distance >= m_Radius )
+			continue;
+
+		float push = m_Radius - distance;
+
+		pPosX[i] += pNormX[i] * push;
+		pPosY[i] += pNormY[i] * push;
+		pPosZ[i] += pNormZ[i] * push;
+
+		float intoGround = (pVelX[i] * pNormX[i]) + (pVelY[i] * pNormY[i]) + (pVelZ[i] * pNormZ[i]);
+
+		if( intoGround < 0.0f )
+		{
+			pVelX[i] -= pNormX[i] * intoGround * bounce;
+			pVelY[i] -= pNormY[i] * intoGround * bounce;
+			pVelZ[i] -= pNormZ[i] * intoGround * bounce;
+		}
+
+		pVelX[i] *= keep;
+		pVelY[i] *= keep;
+		pVelZ[i] *= keep;
+
+		pTouching[i] = 1;
+		++touching;
+	}
+
+	return touching;
+}
+
+XMFLOAT3 SphereWorld::GetInterpolatedPosition( int body, float fraction ) const
+{
+	return XMFLOAT3(m_PrevX[body] + ((m_PosX[body] - m_PrevX[body]) * fraction),
+		m_PrevY[body] + ((m_PosY[body] - m_PrevY[body]) * fraction),
+		m_PrevZ[body] + ((m_PosZ[body] - m_PrevZ[body]) * fraction));
+}
+
+void SphereWorld::WriteInstances( int first, int count, XMFLOAT4* pInstances, float fraction ) const
+{
+	for( int i = 0; i < count; ++i )
+	{
+		XMFLOAT3 pos = GetInterpolatedPosition(first + i, fraction);
+		pInstances[i] = XMFLOAT4(pos.x, pos.y, pos.z, m_Radius);
+	}
+}
+
+uint64_t SphereWorld::GetStateChecksum() const
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for( int i = 0; i < GetBodyCount(); ++i )
+	{
+		float values[6] = { m_PosX[i], m_PosY[i], m_PosZ[i], m_VelX[i], m_VelY[i], m_VelZ[i] };
+		const unsigned char* pBytes = (const unsigned char*)values;
+
+		for( size_t b = 0; b < sizeof values; ++b )
+		{
+			hash ^= pBytes[b];
+			hash *= 1099511628211ull;
+		}
+	}
+
+	return hash;
+}
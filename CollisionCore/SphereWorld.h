@@ -0,0 +1,115 @@
+#ifndef SPHEREWORLD_H
+#define SPHEREWORLD_H
+
+//**********************************************************************
+// File:			SphereWorld.h
+// Description:		Many spheres falling onto and rolling over a HeightField
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			Bodies are kept as structure-of-arrays, one array per
+//					coordinate, so each tick is a few straight passes over
+//					them: integrate, look the ground up with
+//					HeightField::GetGroundBatch, then push out of the ground.
+//
+//					A body touches the plane of the triangle under its
+//					centre. That's much cheaper than SphereCollision's sweep,
+//					which is what lets a tick cover 100,000 bodies, but a
+//					sphere wider than a cell can overlap a ridge beside it.
+//
+//					Velocities are in units per second, and a tick's length
+//					is whatever Step is given. Where each body was before the
+//					last Step is kept too, so frames drawn between ticks can
+//					put it part way along.
+//**********************************************************************
+
+#include <stdint.h>
+#include <vector>
+
+#include "HeightField.h"
+
+class QueryThreadPool;
+
+class SphereWorld
+{
+public:
+	// Bodies handed to each thread at a time by the pooled Step
+	static const int STEP_CHUNK_SIZE = 4096;
+
+	explicit SphereWorld( float radius );
+
+	// Bodies fall through nothing until there's a field. It must outlive
+	// the world or the next call.
+	void SetHeightField( const HeightField* pField ) { m_pHeightField = pField; }
+
+	void SetGravity( const XMFLOAT3& gravity ) { m_Gravity = gravity; }
+
+	// How much of the speed into the ground a bounce keeps, 0 to 1
+	void SetRestitution( float restitution ) { m_Restitution = restitution; }
+
+	// The fraction of its speed a body on the ground loses each second
+	void SetRollingResistance( float resistance ) { m_RollingResistance = resistance; }
+
+	// Returns the new body's index. Indices stay the same until Clear. A
+	// body that's added or set doesn't move between ticks until it's
+	// been stepped.
+	int AddBody( const XMFLOAT3& pos, const XMFLOAT3& vel );
+	void SetBody( int body, const XMFLOAT3& pos, const XMFLOAT3& vel );
+	void Clear( void );
+
+	// Moves every body on by dt seconds. Returns how many of them are
+	// touching the ground.
+	int Step( float dt );
+
+	// As above, with the bodies split into chunks and stepped on pool's
+	// threads
+	int Step( float dt, QueryThreadPool& pool, int chunkSize = STEP_CHUNK_SIZE );
+
+	int GetBodyCount() const { return (int)m_PosX.size(); }
+	float GetRadius() const { return m_Radius; }
+
+	XMFLOAT3 GetPosition( int body ) const { return XMFLOAT3(m_PosX[body], m_PosY[body], m_PosZ[body]); }
+	XMFLOAT3 GetVelocity( int body ) const { return XMFLOAT3(m_VelX[body], m_VelY[body], m_VelZ[body]); }
+	bool IsTouchingGround( int body ) const { return m_Touching[body] != 0; }
+
+	// fraction of the way from where the body was before the last Step to
+	// where it is now
+	XMFLOAT3 GetInterpolatedPosition( int body, float fraction ) const;
+
+	// GetBodyCount() of each, for copying into an instance buffer. Only
+	// valid until the next AddBody.
+	const float* GetPositionsX() const { return m_PosX.empty() ? NULL : &m_PosX[0]; }
+	const float* GetPositionsY() const { return m_PosY.empty() ? NULL : &m_PosY[0]; }
+	const float* GetPositionsZ() const { return m_PosZ.empty() ? NULL : &m_PosZ[0]; }
+
+	// Writes count bodies from first as (x, y, z, radius), the usual layout
+	// of a per-instance vertex stream, at GetInterpolatedPosition's
+	// positions
+	void WriteInstances( int first, int count, XMFLOAT4* pInstances, float fraction = 1.0f ) const;
+
+	// FNV-1a over the bits of every body's position and velocity, for
+	// telling whether two runs ended up in the same place
+	uint64_t GetStateChecksum() const;
+
+private:
+	// A QueryThreadPool::ChunkFn, with a StepJob for its context
+	static void StepChunk( void* pContext, int first, int last, int thread );
+
+	int StepRange( int first, int last, float dt );
+
+	const HeightField* m_pHeightField;
+	float m_Radius;
+	XMFLOAT3 m_Gravity;
+	float m_Restitution;
+	float m_RollingResistance;
+
+	std::vector<float> m_PosX, m_PosY, m_PosZ;
+	std::vector<float> m_PrevX, m_PrevY, m_PrevZ;		// Before the last Step
+	std::vector<float> m_VelX, m_VelY, m_VelZ;
+	std::vector<unsigned char> m_Touching;
+
+	// The ground under each body this tick
+	std::vector<float> m_GroundY;
+	std::vector<float> m_NormX, m_NormY, m_NormZ;
+	std::vector<unsigned char> m_OnMap;
+};
+
+#endif
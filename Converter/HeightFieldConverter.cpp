@@ -0,0 +1,115 @@
+//**********************************************************************
+// File:			HeightFieldConverter.cpp
+// Description:		Converts a heightmap bitmap to HeightField's binary format
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			The output is written by HeightField::SaveBinary, with the
+//					quadtree and triangle packets already built, so loading
+//					it is just mapping the file.
+//
+//					With --tile-samples the output is a world for
+//					PagedHeightField instead: output.hfw describes it and
+//					each tile is written next to it as output_x_z.hfd.
+//
+//					Usage: HeightFieldConverter input.bmp output.hfd
+//							[--grid-size size] [--height-range range]
+//							[--storage float4|uint16] [--layout rows|tiled]
+//							[--samples-only] [--tile-samples n]
+//**********************************************************************
+
+#include "HeightField.h"
+#include "HeightFieldTools.h"
+#include "PagedHeightField.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same settings as Application::HandleStart
+static const float DEFAULT_GRID_SIZE = 2.0f;
+static const float DEFAULT_HEIGHT_RANGE = 0.75f;
+
+struct Options
+{
+	const char* pInputFile;
+	const char* pOutputFile;
+	float gridSize;
+	float heightRange;
+	HeightField::HeightStorage storage;
+	HeightField::HeightLayout layout;
+	bool samplesOnly;
+	int tileSamples;		// 0 to write a single HeightField
+};
+
+static bool ParseOptions( int argc, char** argv, Options& options )
+{
+	options.pInputFile = NULL;
+	options.pOutputFile = NULL;
+	options.gridSize = DEFAULT_GRID_SIZE;
+	options.heightRange = DEFAULT_HEIGHT_RANGE;
+	options.storage = HeightField::HEIGHT_STORAGE_FLOAT4;
+	options.layout = HeightField::HEIGHT_LAYOUT_ROW_MAJOR;
+	options.samplesOnly = false;
+	options.tileSamples = 0;
+
+	for( int i = 1; i < argc; ++i )
+	{
+		bool hasValue = i+1 < argc;
+
+		if( strcmp(argv[i], "--grid-size") == 0 && hasValue )
+			options.gridSize = (float)atof(argv[++i]);
+		else if( strcmp(argv[i], "--height-range") == 0 && hasValue )
+			options.heightRange = (float)atof(argv[++i]);
+		else if( strcmp(argv[i], "--storage") == 0 && hasValue && ParseHeightStorage(argv[i+1], options.storage) )
+			++i;
+		else if( strcmp(argv[i], "--layout") == 0 && hasValue && ParseHeightLayout(argv[i+1], options.layout) )
+			++i;
+		else if( strcmp(argv[i], "--samples-only") == 0 )
+			options.samplesOnly = true;
+		else if( strcmp(argv[i], "--tile-samples") == 0 && hasValue && atoi(argv[i+1]) >= 2 )
+			options.tileSamples = atoi(argv[++i]);
+		else if( argv[i][0] != '-' && !options.pInputFile )
+			options.pInputFile = argv[i];
+		else if( argv[i][0] != '-' && !options.pOutputFile )
+			options.pOutputFile = argv[i];
+		else
+			return false;
+	}
+
+	return options.pInputFile && options.pOutputFile;
+}
+
+int main( int argc, char** argv )
+{
+	Options options;
+
+	if( !ParseOptions(argc, argv, options) )
+	{
+		printf("Usage: %s input.bmp output.hfd [--grid-size size] [--height-range range] [--storage float4|uint16] [--layout rows|tiled] [--samples-only] [--tile-samples n]\n", argv[0]);
+		return 1;
+	}
+
+	HeightField field(options.pInputFile, options.gridSize, options.heightRange, options.storage);
+
+	if( !field.IsLoaded() )
+	{
+		printf("Couldn't load %s\n", options.pInputFile);
+		return 1;
+	}
+
+	field.SetHeightLayout(options.layout);
+
+	// Without the collision data the file is smaller, but whatever loads it
+	// has to build it again
+	bool written = options.tileSamples ? PagedHeightField::WriteWorld(options.pOutputFile, field, options.tileSamples, !options.samplesOnly)
+									   : field.SaveBinary(options.pOutputFile, !options.samplesOnly);
+
+	if( !written )
+	{
+		printf("Couldn't write %s\n", options.pOutputFile);
+		return 1;
+	}
+
+	printf("%s: %dx%d samples written to %s\n", options.pInputFile, field.GetWidth(), field.GetLength(), options.pOutputFile);
+
+	return 0;
+}
@@ -0,0 +1,419 @@
+//**********************************************************************
+// File:			SimulationRunner.cpp
+// Description:		Steps a SphereWorld over a HeightField with no window
+// Module:			Real-Time 3D Techniques for Games
+// Notes:			For regression runs and capacity tests on machines with
+//					no GPU. The map is a heightmap file, as CollisionBenchmark
+//					loads them, or a synthetic one of --synthetic samples
+//					square. --bodies spheres are dropped over it from up to
+//					--drop-height above the ground and stepped --ticks times
+//					at --tick-rate, as fast as they'll go.
+//
+//					Each tick's time is measured, and the totals printed at
+//					the end with a checksum of every body's final position
+//					and velocity. Bodies don't affect each other, so the
+//					checksum is the same whatever --threads is, and two runs
+//					with the same settings on the same build should match.
+//					--state writes the final bodies out as CSV.
+//
+//					--replay runs a session the viewer recorded instead,
+//					with its settings, its map unless --heightmap or
+//					--synthetic is given, and its drops at the ticks they
+//					happened, and exits with 1 if it doesn't end with the
+//					recording's checksum. --realtime runs it, or any other
+//					run, at the tick rate rather than flat out.
+//
+//					Usage: SimulationRunner [--heightmap file.bmp|file.hfd]
+//							[--synthetic size] [--storage float4|uint16]
+//							[--layout rows|tiled] [--bodies n] [--ticks n]
+//							[--tick-rate hz] [--threads n] [--seed n]
+//							[--radius r] [--gravity g] [--restitution r]
+//							[--rolling-resistance r] [--drop-height h]
+//							[--report-every ticks] [--state file.csv]
+//							[--replay file.simrec] [--realtime]
+//**********************************************************************
+
+#include "HeightField.h"
+#include "HeightFieldTools.h"
+#include "QueryThreadPool.h"
+#include "Random.h"
+#include "SimulationRecording.h"
+#include "SphereWorld.h"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifndef COLLISION_RESOURCE_DIR
+#define COLLISION_RESOURCE_DIR "../Collision/Resources"
+#endif
+
+// Same settings as Application::HandleStart
+static const float GRID_SIZE = 2.0f;
+static const float HEIGHT_RANGE = 0.75f;
+
+// Same as the viewer's spheres
+static const int DEFAULT_TICK_RATE = 120;
+static const float DEFAULT_RADIUS = 1.0f;
+static const float DEFAULT_GRAVITY = -180.0f;
+static const float DEFAULT_DROP_HEIGHT = 20.0f;
+
+static const int DEFAULT_BODIES = 100000;
+static const int DEFAULT_TICKS = 1200;
+
+struct Options
+{
+	const char* pHeightMapFile;	// NULL for the viewer's, or the recording's
+	int syntheticSize;			// 0 to load pHeightMapFile
+	HeightField::HeightStorage storage;
+	HeightField::HeightLayout layout;
+	int bodyCount;
+	int tickCount;
+	int tickRate;
+	int threadCount;			// 1 steps on this thread alone
+	unsigned seed;
+	float radius;
+	float gravity;
+	float restitution;
+	float rollingResistance;
+	float dropHeight;
+	int reportEvery;			// 0 for no progress lines
+	const char* pStateFile;
+	const char* pReplayFile;
+	bool realtime;				// Tick no faster than tickRate
+};
+
+//////////////////////////////////////////////////////////////////////
+// Options
+//////////////////////////////////////////////////////////////////////
+
+static bool ParseOptions( int argc, char** argv, Options& options )
+{
+	options.pHeightMapFile = NULL;
+	options.syntheticSize = 0;
+	options.storage = HeightField::HEIGHT_STORAGE_FLOAT4;
+	options.layout = HeightField::HEIGHT_LAYOUT_ROW_MAJOR;
+	options.bodyCount = DEFAULT_BODIES;
+	options.tickCount = DEFAULT_TICKS;
+	options.tickRate = DEFAULT_TICK_RATE;
+	options.threadCount = 0;
+	options.seed = 7;
+	options.radius = DEFAULT_RADIUS;
+	options.gravity = DEFAULT_GRAVITY;
+	options.restitution = 0.0f;
+	options.rollingResistance = 0.5f;
+	options.dropHeight = DEFAULT_DROP_HEIGHT;
+	options.reportEvery = 0;
+	options.pStateFile = NULL;
+	options.pReplayFile = NULL;
+	options.realtime = false;
+
+	for( int i = 1; i < argc; ++i )
+	{
+		bool hasValue = i+1 < argc;
+
+		if( strcmp(argv[i], "--heightmap") == 0 && hasValue )
+			options.pHeightMapFile = argv[++i];
+		else if( strcmp(argv[i], "--synthetic") == 0 && hasValue && atoi(argv[i+1]) >= 2 )
+			options.syntheticSize = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--storage") == 0 && hasValue && ParseHeightStorage(argv[i+1], options.storage) )
+			++i;
+		else if( strcmp(argv[i], "--layout") == 0 && hasValue && ParseHeightLayout(argv[i+1], options.layout) )
+			++i;
+		else if( strcmp(argv[i], "--bodies") == 0 && hasValue && atoi(argv[i+1]) >= 0 )
+			options.bodyCount = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--ticks") == 0 && hasValue && atoi(argv[i+1]) >= 0 )
+			options.tickCount = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--tick-rate") == 0 && hasValue && atoi(argv[i+1]) > 0 )
+			options.tickRate = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--threads") == 0 && hasValue )
+			options.threadCount = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--seed") == 0 && hasValue )
+			options.seed = (unsigned)strtoul(argv[++i], NULL, 10);
+		else if( strcmp(argv[i], "--radius") == 0 && hasValue && atof(argv[i+1]) > 0.0 )
+			options.radius = (float)atof(argv[++i]);
+		else if( strcmp(argv[i], "--gravity") == 0 && hasValue )
+			options.gravity = (float)atof(argv[++i]);
+		else if( strcmp(argv[i], "--restitution") == 0 && hasValue )
+			options.restitution = (float)atof(argv[++i]);
+		else if( strcmp(argv[i], "--rolling-resistance") == 0 && hasValue )
+			options.rollingResistance = (float)atof(argv[++i]);
+		else if( strcmp(argv[i], "--drop-height") == 0 && hasValue )
+			options.dropHeight = (float)atof(argv[++i]);
+		else if( strcmp(argv[i], "--report-every") == 0 && hasValue )
+			options.reportEvery = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--state") == 0 && hasValue )
+			options.pStateFile = argv[++i];
+		else if( strcmp(argv[i], "--replay") == 0 && hasValue )
+			options.pReplayFile = argv[++i];
+		else if( strcmp(argv[i], "--realtime") == 0 )
+			options.realtime = true;
+		else
+		{
+			printf("Usage: %s [--heightmap file.bmp|file.hfd] [--synthetic size] [--storage float4|uint16] [--layout rows|tiled] [--bodies n] [--ticks n] [--tick-rate hz] [--threads n] [--seed n] [--radius r] [--gravity g] [--restitution r] [--rolling-resistance r] [--drop-height h] [--report-every ticks] [--state file.csv] [--replay file.simrec] [--realtime]\n", argv[0]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// The world
+//////////////////////////////////////////////////////////////////////
+
+static HeightField* CreateHeightField( const Options& options, const char* pHeightMapFile, float gridSize, float heightRange )
+{
+	if( options.syntheticSize )
+	{
+		std::vector<float> heights;
+		MakeSyntheticHeights(options.syntheticSize, heights);
+
+		return new HeightField(options.syntheticSize, options.syntheticSize, gridSize, &heights[0], options.storage);
+	}
+
+	if( IsBinaryHeightFieldFile(pHeightMapFile) )
+		return new HeightField(pHeightMapFile);
+
+	return new HeightField(pHeightMapFile, gridSize, heightRange, options.storage);
+}
+
+// Drops the bodies anywhere over the map, each a random height up to
+// dropHeight above the ground under it, drifting a little sideways
+static void AddBodies( const Options& options, const HeightField& field, SphereWorld& world )
+{
+	float maxX = ((field.GetWidth()-1) / 2.0f) * field.GetGridSize();
+	float maxZ = ((field.GetLength()-1) / 2.0f) * field.GetGridSize();
+
+	Random random(options.seed);
+
+	for( int i = 0; i < options.bodyCount; ++i )
+	{
+		XMFLOAT3 pos(random.Range(-maxX, maxX), 0.0f, random.Range(-maxZ, maxZ));
+		XMFLOAT3 vel(random.Range(-1.0f, 1.0f), 0.0f, random.Range(-1.0f, 1.0f));
+
+		float ground = 0.0f;
+		field.GetHeightAt(pos.x, pos.z, ground);
+		pos.y = ground + options.radius + random.Range(0.0f, options.dropHeight);
+
+		world.AddBody(pos, vel);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// RunTicks
+// Steps the world tickCount times, applying the recording's events, if
+// there is one, before the ticks they happened before. With --realtime
+// each tick waits for its time to come round, as the viewer's would.
+//////////////////////////////////////////////////////////////////////
+
+struct TickTimes
+{
+	double totalSeconds;
+	double minTickSeconds;
+	double maxTickSeconds;
+	double bodyTicks;			// Bodies stepped, over all the ticks
+	int touching;				// After the last tick
+};
+
+static void RunTicks( const Options& options, SphereWorld& world, QueryThreadPool& pool, int tickCount, int tickRate, const SimulationRecording* pRecording, TickTimes& times )
+{
+	bool pooled = pool.GetThreadCount() > 1;
+	float dt = 1.0f / tickRate;
+	int nextEvent = 0;
+
+	times.totalSeconds = 0.0;
+	times.minTickSeconds = 0.0;
+	times.maxTickSeconds = 0.0;
+	times.bodyTicks = 0.0;
+	times.touching = 0;
+
+	std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now();
+
+	for( int tick = 0; tick <= tickCount; ++tick )
+	{
+		for( ; pRecording && nextEvent < pRecording->GetEventCount() && pRecording->GetEvent(nextEvent).tick == tick; ++nextEvent )
+			pRecording->Apply(pRecording->GetEvent(nextEvent), world);
+
+		// The last events came after the last tick
+		if( tick == tickCount )
+			break;
+
+		if( options.realtime )
+			std::this_thread::sleep_until(runStart + std::chrono::duration<double>((double)tick / tickRate));
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		times.touching = pooled ? world.Step(dt, pool) : world.Step(dt);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		times.totalSeconds += seconds;
+		times.minTickSeconds = tick == 0 ? seconds : std::min(times.minTickSeconds, seconds);
+		times.maxTickSeconds = std::max(times.maxTickSeconds, seconds);
+		times.bodyTicks += world.GetBodyCount();
+
+		if( options.reportEvery > 0 && (tick+1) % options.reportEvery == 0 )
+			printf("  tick %d: %d of %d touching, %.3f ms\n", tick+1, times.touching, world.GetBodyCount(), seconds * 1000.0);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Results
+//////////////////////////////////////////////////////////////////////
+
+static void PrintTimes( const SphereWorld& world, int tickCount, int tickRate, const TickTimes& times )
+{
+	if( tickCount > 0 )
+	{
+		printf("Stepped in %.1f ms: %.3f ms/tick (min %.3f, max %.3f), %.1f ns/body, %.1fM bodies/s\n",
+			times.totalSeconds * 1000.0, (times.totalSeconds / tickCount) * 1000.0, times.minTickSeconds * 1000.0, times.maxTickSeconds * 1000.0,
+			times.bodyTicks > 0.0 ? (times.totalSeconds / times.bodyTicks) * 1e9 : 0.0,
+			times.totalSeconds > 0.0 ? (times.bodyTicks / times.totalSeconds) / 1e6 : 0.0);
+	}
+
+	printf("%d of %d bodies touching, %.3f simulated seconds, checksum %016llx\n",
+		times.touching, world.GetBodyCount(), tickCount / (double)tickRate, (unsigned long long)world.GetStateChecksum());
+}
+
+static bool WriteState( const char* pFilename, const SphereWorld& world )
+{
+	FILE* pFile = fopen(pFilename, "w");
+
+	if( !pFile )
+		return false;
+
+	fprintf(pFile, "body,x,y,z,vx,vy,vz,touching\n");
+
+	for( int i = 0; i < world.GetBodyCount(); ++i )
+	{
+		XMFLOAT3 pos = world.GetPosition(i);
+		XMFLOAT3 vel = world.GetVelocity(i);
+
+		// 9 significant figures is enough to read every float back exactly
+		fprintf(pFile, "%d,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%d\n", i, pos.x, pos.y, pos.z, vel.x, vel.y, vel.z, world.IsTouchingGround(i) ? 1 : 0);
+	}
+
+	return fclose(pFile) == 0;
+}
+
+int main( int argc, char** argv )
+{
+	Options options;
+
+	if( !ParseOptions(argc, argv, options) )
+		return 1;
+
+	SimulationRecording recording;
+	bool replaying = options.pReplayFile != NULL;
+
+	if( replaying && !recording.Load(options.pReplayFile) )
+	{
+		printf("Couldn't load the recording %s\n", options.pReplayFile);
+		return 1;
+	}
+
+	// A replay uses the map it was recorded on unless told otherwise
+	const char* pHeightMapFile = options.pHeightMapFile ? options.pHeightMapFile :
+								 replaying ? recording.GetHeightMapFile() : COLLISION_RESOURCE_DIR "/heightmap.bmp";
+	float gridSize = replaying ? recording.GetSettings().gridSize : GRID_SIZE;
+	float heightRange = replaying ? recording.GetSettings().heightRange : HEIGHT_RANGE;
+
+	std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+	HeightField* pField = NULL;
+
+	// The largest maps need more memory than a 32 bit build can always find
+	try
+	{
+		pField = CreateHeightField(options, pHeightMapFile, gridSize, heightRange);
+	}
+	catch( const std::bad_alloc& )
+	{
+		pField = NULL;
+	}
+
+	double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+
+	if( !pField || !pField->IsLoaded() )
+	{
+		printf("Couldn't load %s\n", options.syntheticSize ? "the synthetic map" : pHeightMapFile);
+		delete pField;
+		return 1;
+	}
+
+	// A binary map keeps the layout it was saved with
+	if( options.syntheticSize || !IsBinaryHeightFieldFile(pHeightMapFile) )
+		pField->SetHeightLayout(options.layout);
+
+	printf("%s: %dx%d samples, loaded in %.1f ms\n",
+		options.syntheticSize ? "synthetic" : pHeightMapFile, pField->GetWidth(), pField->GetLength(), loadSeconds * 1000.0);
+
+	SphereWorld world(replaying ? recording.GetSettings().radius : options.radius);
+	world.SetHeightField(pField);
+
+	if( replaying )
+		recording.SetupWorld(world);
+	else
+	{
+		world.SetGravity(XMFLOAT3(0.0f, options.gravity, 0.0f));
+		world.SetRestitution(options.restitution);
+		world.SetRollingResistance(options.rollingResistance);
+
+		AddBodies(options, *pField, world);
+	}
+
+	int tickCount = replaying ? recording.GetTickCount() : options.tickCount;
+	int tickRate = replaying ? recording.GetSettings().tickRate : options.tickRate;
+
+	// --threads 0, the default, means one per hardware thread
+	QueryThreadPool pool(options.threadCount);
+
+	if( replaying )
+	{
+		printf("Replaying %s: %d events over %d ticks at %d Hz, %d thread%s%s\n", options.pReplayFile, recording.GetEventCount(),
+			tickCount, tickRate, pool.GetThreadCount(), pool.GetThreadCount() > 1 ? "s" : "", options.realtime ? ", in real time" : "");
+	}
+	else
+	{
+		printf("%d bodies, %d ticks at %d Hz, %d thread%s%s\n", world.GetBodyCount(), tickCount, tickRate,
+			pool.GetThreadCount(), pool.GetThreadCount() > 1 ? "s" : "", options.realtime ? ", in real time" : "");
+	}
+
+	TickTimes times;
+	RunTicks(options, world, pool, tickCount, tickRate, replaying ? &recording : NULL, times);
+	PrintTimes(world, tickCount, tickRate, times);
+
+	int result = 0;
+
+	// Only the same build is expected to match; see SimulationRecording.h
+	if( replaying && recording.HasFinalChecksum() )
+	{
+		if( world.GetStateChecksum() == recording.GetFinalChecksum() )
+			printf("Matches the recording\n");
+		else
+		{
+			printf("Differs from the recording, which ended with checksum %016llx\n", (unsigned long long)recording.GetFinalChecksum());
+			result = 1;
+		}
+	}
+
+	if( options.pStateFile )
+	{
+		if( WriteState(options.pStateFile, world) )
+			printf("State written to %s\n", options.pStateFile);
+		else
+		{
+			printf("Couldn't write %s\n", options.pStateFile);
+			result = 1;
+		}
+	}
+
+	delete pField;
+
+	return result;
+}
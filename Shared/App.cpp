@@ -38,6 +38,10 @@ m_pD3DDepthStencilBuffer(NULL),
 m_renderTargetWidth(0),
 m_renderTargetHeight(0),
 m_isInFocus(false),
+m_tickRate(60),
+m_frameRate(60),
+m_maxTicksPerFrame(8),
+m_tickFraction(0.0f),
 m_pStartErrorMessage(NULL)
 {
 }
@@ -223,6 +227,51 @@ bool App::CanRender() const
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+void App::SetTickRate(int ticksPerSecond)
+{
+	if (ticksPerSecond > 0)
+		m_tickRate = ticksPerSecond;
+}
+
+int App::GetTickRate() const
+{
+	return m_tickRate;
+}
+
+float App::GetTickSeconds() const
+{
+	return 1.0f / m_tickRate;
+}
+
+void App::SetFrameRate(int framesPerSecond)
+{
+	m_frameRate = framesPerSecond > 0 ? framesPerSecond : 0;
+}
+
+int App::GetFrameRate() const
+{
+	return m_frameRate;
+}
+
+void App::SetMaxTicksPerFrame(int maxTicks)
+{
+	if (maxTicks > 0)
+		m_maxTicksPerFrame = maxTicks;
+}
+
+int App::GetMaxTicksPerFrame() const
+{
+	return m_maxTicksPerFrame;
+}
+
+float App::GetTickFraction() const
+{
+	return m_tickFraction;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 void App::ClearStateAndFlushDeviceContext()
 {
 	if (!m_pD3DDeviceContext)
@@ -544,9 +593,8 @@ int Run(App *pApp)
 
 	ShowWindow(hWnd, SW_SHOW);
 
-	LARGE_INTEGER oneFrame;
-	QueryPerformanceFrequency(&oneFrame);
-	oneFrame.QuadPart /= 60;
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
 
 	// If there is more than sleepGap time left, sleep for 1ms.
 	// (sleepGap itself is rather more than 1ms, because sleeping
@@ -561,22 +609,25 @@ int Run(App *pApp)
 	// This makes Sleep more accurate.
 	timeBeginPeriod(1);
 
-	// Time for next update.
-	LARGE_INTEGER nextUpdate;
-	QueryPerformanceCounter(&nextUpdate);
-	nextUpdate.QuadPart += oneFrame.QuadPart;
+	// Time for next frame, and the time that's passed and not yet been
+	// ticked through.
+	LARGE_INTEGER nextFrame;
+	QueryPerformanceCounter(&nextFrame);
+
+	LARGE_INTEGER lastTime = nextFrame;
+	LONGLONG untickedTime = 0;
 
 	while (DoMessages())
 	{
-		// Wait until the next 60th-of-a-second boundary has
-		// arrived (or been and gone).
+		// Wait until the next frame's boundary has arrived (or been
+		// and gone).
 		LARGE_INTEGER now;
 
 		for(;;)
 		{
 			QueryPerformanceCounter(&now);
 
-			LONGLONG delayTimeLeft = nextUpdate.QuadPart - now.QuadPart;
+			LONGLONG delayTimeLeft = nextFrame.QuadPart - now.QuadPart;
 
 			if (delayTimeLeft <= 0)
 				break;
@@ -585,9 +636,30 @@ int Run(App *pApp)
 				Sleep(1);
 		}
 
-		nextUpdate.QuadPart = now.QuadPart + oneFrame.QuadPart;
+		LONGLONG oneFrame = pApp->m_frameRate > 0 ? frequency.QuadPart / pApp->m_frameRate : 0;
+		LONGLONG oneTick = frequency.QuadPart / pApp->m_tickRate;
+
+		nextFrame.QuadPart = now.QuadPart + oneFrame;
+
+		untickedTime += now.QuadPart - lastTime.QuadPart;
+		lastTime = now;
+
+		// Tick through the time since the last frame, in fixed steps.
+		int ticks = 0;
+
+		while (untickedTime >= oneTick && ticks < pApp->m_maxTicksPerFrame)
+		{
+			pApp->Update();
+
+			untickedTime -= oneTick;
+			++ticks;
+		}
+
+		// Too far behind to catch up; drop whole ticks, keeping the
+		// fraction of one.
+		untickedTime %= oneTick;
 
-		pApp->Update();
+		pApp->m_tickFraction = float(untickedTime) / float(oneTick);
 
 		pApp->Render();
 	}
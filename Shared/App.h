@@ -53,7 +53,29 @@ public:
 
 	//
 	void Render();
+
+	// HandleUpdate is called this many times a second of real time,
+	// however often frames are rendered. 60 by default.
+	void SetTickRate(int ticksPerSecond);
+	int GetTickRate() const;
+	float GetTickSeconds() const;
+
+	// Frames are rendered at most this many times a second, 0 meaning as
+	// often as possible. 60 by default.
+	void SetFrameRate(int framesPerSecond);
+	int GetFrameRate() const;
+
+	// A frame that's fallen further behind than this many ticks drops the
+	// rest, so a slow frame slows the simulation down rather than making
+	// the next frame slower still. 8 by default.
+	void SetMaxTicksPerFrame(int maxTicks);
+	int GetMaxTicksPerFrame() const;
 protected:
+	// How far the frame being rendered is from the last tick towards the
+	// next, 0 to 1, for drawing things between where the last two ticks
+	// left them.
+	float GetTickFraction() const;
+
 	bool CanRender() const;
 
 	// Call this before deleting anything. As its name suggests, it
@@ -83,7 +105,8 @@ protected:
 	// Default implementation does nothing.
 	virtual void HandleRender();
 
-	// Gets called at roughly 60Hz.
+	// Gets called GetTickRate() times a second, catching up with any
+	// time rendering has taken (see SetMaxTicksPerFrame).
 	//
 	// Default implementation does nothing.
 	virtual void HandleUpdate();
@@ -123,6 +146,11 @@ private:
 
 	bool m_isInFocus;
 
+	int m_tickRate;
+	int m_frameRate;
+	int m_maxTicksPerFrame;
+	float m_tickFraction;
+
 	void ReleaseRenderTargetsAndViews();
 	void RecreateRenderTargetsAndViews();
 
@@ -130,6 +158,8 @@ private:
 
 	App(const App &);
 	App &operator=(const App &);
+
+	friend int Run(App *pApp);
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -57,6 +57,9 @@ const char g_aShader[]=
 	"#ifdef TEXTURED\n"
 	"    float2 tex:TEXCOORD;\n"
 	"#endif//TEXTURED\n"
+	"#ifdef INSTANCED\n"
+	"    float4 instance:INSTANCE;\n"//(x,y,z offset,unused)
+	"#endif//INSTANCED\n"
 	"};\n"
 	"\n"
 	"struct PSInput\n"
@@ -119,14 +122,20 @@ const char g_aShader[]=
 	"\n"
 	"void VSMain(const VSInput input, out PSInput output)\n"
 	"{\n"
-	"    output.pos = mul(input.pos, g_WVP);\n"
+	"    float4 pos = input.pos;\n"
+	"\n"
+	"#ifdef INSTANCED\n"
+	"    pos.xyz += input.instance.xyz;\n"
+	"#endif//INSTANCED\n"
+	"\n"
+	"    output.pos = mul(pos, g_WVP);\n"
 	"\n"
 	"#ifdef LIT\n"
 	"\n"
 	"    float3 N = mul(input.normal, g_InvXposeW);\n"
 	"    N = normalize(N);\n"
 	"\n"
-	"    float3 worldPos = mul(input.pos, g_W);\n"
+	"    float3 worldPos = mul(pos, g_W);\n"
 	"\n"
 	"    output.colour = GetLightingColour(worldPos, N) * g_constantColour * input.colour;\n"
 	"\n"
@@ -237,6 +246,18 @@ extern const unsigned g_vertexDescSize_Pos3fColour4ubNormal3f = sizeof g_aVertex
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+extern const D3D11_INPUT_ELEMENT_DESC g_aVertexDesc_Pos3fColour4ubNormal3f_Instance4f[] = {
+	{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex_Pos3fColour4ubNormal3f, pos), D3D11_INPUT_PER_VERTEX_DATA, 0, },
+	{"COLOUR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, offsetof(Vertex_Pos3fColour4ubNormal3f, colour), D3D11_INPUT_PER_VERTEX_DATA, 0,},
+	{"NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex_Pos3fColour4ubNormal3f, normal), D3D11_INPUT_PER_VERTEX_DATA, 0,},
+	{"INSTANCE", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1,},
+};
+
+extern const unsigned g_vertexDescSize_Pos3fColour4ubNormal3f_Instance4f = sizeof g_aVertexDesc_Pos3fColour4ubNormal3f_Instance4f / sizeof g_aVertexDesc_Pos3fColour4ubNormal3f_Instance4f[0];
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 Vertex_Pos3fColour4ubTex2f::Vertex_Pos3fColour4ubTex2f():
 pos(0.f, 0.f, 0.f),
 tex(0.f, 0.f)
@@ -376,6 +397,19 @@ bool CommonApp::HandleStart()
 			return false;
 	}
 
+	// Tex NO, Lit YES, Instanced YES
+	{
+		const D3D_SHADER_MACRO aMacros[] = {
+			{"MAX_NUM_LIGHTS", maxNumLightsValue},
+			{"LIT",NULL},
+			{"INSTANCED",NULL},
+			{NULL},
+		};
+
+		if (!this->CompileShaderFromString(&m_shaderUntexturedLitInstanced, g_aShader, aMacros, g_aVertexDesc_Pos3fColour4ubNormal3f_Instance4f, g_vertexDescSize_Pos3fColour4ubNormal3f_Instance4f))
+			return false;
+	}
+
 	// Tex YES, Lit NO
 	{
 		const D3D_SHADER_MACRO aMacros[] = {
@@ -522,6 +556,7 @@ void CommonApp::HandleStop()
 
 	m_shaderUntextured.Reset();
 	m_shaderUntexturedLit.Reset();
+	m_shaderUntexturedLitInstanced.Reset();
 	m_shaderTextured.Reset();
 	m_shaderTexturedLit.Reset();
 }
@@ -643,7 +678,7 @@ void CommonApp::DrawTexturedLit(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-void CommonApp::DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader)
+void CommonApp::SetUpShader(ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader)
 {
 	if (pShader->pVSCBuffer || pShader->pPSCBuffer)
 	{
@@ -806,6 +841,32 @@ void CommonApp::DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *
 
 		m_pD3DDeviceContext->PSSetSamplers(pShader->psSampler, 1, apSamplerStates);
 	}
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::UnbindShaderTexture(Shader *pShader)
+{
+	if (pShader->psTexture >= 0)
+	{
+		// Strictly speaking, this isn't necessary. It makes use of render
+		// targets a bit simpler though.
+
+		ID3D11ShaderResourceView *apTextureViews[1] = {
+			NULL,
+		};
+
+		m_pD3DDeviceContext->PSSetShaderResources(pShader->psTexture, 1, apTextureViews);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader, DXGI_FORMAT indexFormat)
+{
+	this->SetUpShader(pTextureView, pTextureSampler, pShader);
 
 	// Draw
 	m_pD3DDeviceContext->IASetPrimitiveTopology(topology);
@@ -825,24 +886,57 @@ void CommonApp::DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *
 
 	if (pIndexBuffer)
 	{
-		m_pD3DDeviceContext->IASetIndexBuffer(pIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+		m_pD3DDeviceContext->IASetIndexBuffer(pIndexBuffer, indexFormat, 0);
 
 		m_pD3DDeviceContext->DrawIndexed(numItems, firstItem, 0);
 	}
 	else
 		m_pD3DDeviceContext->Draw(numItems, firstItem);
 
-	if (pShader->psTexture >= 0)
-	{
-		// Strictly speaking, this isn't necessary. It makes use of render
-		// targets a bit simpler though.
+	this->UnbindShaderTexture(pShader);
+}
 
-		ID3D11ShaderResourceView *apTextureViews[1] = {
-			NULL,
-		};
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
 
-		m_pD3DDeviceContext->PSSetShaderResources(pShader->psTexture, 1, apTextureViews);
+void CommonApp::DrawInstancedWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader, DXGI_FORMAT indexFormat)
+{
+	this->SetUpShader(pTextureView, pTextureSampler, pShader);
+
+	// Draw
+	m_pD3DDeviceContext->IASetPrimitiveTopology(topology);
+
+	m_pD3DDeviceContext->IASetInputLayout(pShader->pIL);
+
+	ID3D11Buffer *apVertexBuffers[2] = {
+		pVertexBuffer,
+		pInstanceBuffer,
+	};
+	UINT aStrides[2] = {
+		(UINT)vertexStride,
+		(UINT)instanceStride,
+	};
+	UINT aOffsets[2] = {
+		0,
+		0,
+	};
+	m_pD3DDeviceContext->IASetVertexBuffers(0, 2, apVertexBuffers, aStrides, aOffsets);
+
+	if (pIndexBuffer)
+	{
+		m_pD3DDeviceContext->IASetIndexBuffer(pIndexBuffer, indexFormat, 0);
+
+		m_pD3DDeviceContext->DrawIndexedInstanced(numItems, numInstances, firstItem, 0, 0);
 	}
+	else
+		m_pD3DDeviceContext->DrawInstanced(numItems, numInstances, firstItem, 0);
+
+	// Leave slot 1 empty for the draws that don't use it
+	ID3D11Buffer *pNoBuffer = NULL;
+	UINT zero = 0;
+	m_pD3DDeviceContext->IASetVertexBuffers(1, 1, &pNoBuffer, &zero, &zero);
+
+	this->UnbindShaderTexture(pShader);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -1188,6 +1282,14 @@ CommonApp::Shader *CommonApp::GetUntexturedLitShader()
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+CommonApp::Shader *CommonApp::GetUntexturedLitInstancedShader()
+{
+	return &m_shaderUntexturedLitInstanced;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 CommonApp::Shader *CommonApp::GetTexturedShader()
 {
 	return &m_shaderTextured;
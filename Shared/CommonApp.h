@@ -84,6 +84,13 @@ struct Vertex_Pos3fColour4ubNormal3f
 extern const D3D11_INPUT_ELEMENT_DESC g_aVertexDesc_Pos3fColour4ubNormal3f[];
 extern const unsigned g_vertexDescSize_Pos3fColour4ubNormal3f;
 
+// The same, plus an XMFLOAT4 per instance in vertex buffer slot 1, for
+// GetUntexturedLitInstancedShader. Its xyz is added to each vertex's
+// position.
+
+extern const D3D11_INPUT_ELEMENT_DESC g_aVertexDesc_Pos3fColour4ubNormal3f_Instance4f[];
+extern const unsigned g_vertexDescSize_Pos3fColour4ubNormal3f_Instance4f;
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
@@ -213,8 +220,16 @@ public:
 	// MAX_NUM_LIGHTS. They are filled in contiguously, even if the
 	// enabled lights aren't contiguous.
 	//
+	// indexFormat is DXGI_FORMAT_R16_UINT or DXGI_FORMAT_R32_UINT, for meshes
+	// with more than 65536 vertices.
+	//
 	class Shader;
-	void DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader);
+	void DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader, DXGI_FORMAT indexFormat = DXGI_FORMAT_R16_UINT);
+
+	// As DrawWithShader, numInstances times, with pInstanceBuffer's
+	// elements in vertex buffer slot 1, one per instance. The shader's
+	// input layout has to take them from there.
+	void DrawInstancedWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader, DXGI_FORMAT indexFormat = DXGI_FORMAT_R16_UINT);
 
 	// Set constant colour.
 	void SetConstantColour(const XMFLOAT4& constantColour);
@@ -334,6 +349,7 @@ public:
 
 	Shader *GetUntexturedShader();
 	Shader *GetUntexturedLitShader();
+	Shader *GetUntexturedLitInstancedShader();
 	Shader *GetTexturedShader();
 	Shader *GetTexturedLitShader();
 protected:
@@ -395,6 +411,7 @@ private:
 
 	Shader m_shaderUntextured;
 	Shader m_shaderUntexturedLit;
+	Shader m_shaderUntexturedLitInstanced;
 	Shader m_shaderTextured;
 	Shader m_shaderTexturedLit;
 
@@ -406,6 +423,10 @@ private:
 
 	XMMATRIX GetWVP() const;
 
+	// The parts of DrawWithShader before and after the draw itself
+	void SetUpShader(ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader);
+	void UnbindShaderTexture(Shader *pShader);
+
 	Light *GetLight(int light);
 };
 
@@ -396,6 +396,20 @@ void CommonMesh::DrawSubset(size_t subsetIndex)
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void CommonMesh::DrawInstanced(ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances, CommonApp::Shader *pShader)
+{
+	for (size_t i = 0; i < m_numSubsets; ++i)
+	{
+		const Subset *pSubset = &m_pSubsets[i];
+
+		m_pApp->DrawInstancedWithShader(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, pSubset->pVertexBuffer, pSubset->vtxStride, pInstanceBuffer, instanceStride, numInstances,
+			pSubset->pIndexBuffer, pSubset->firstItem, pSubset->numItems, pSubset->pTextureView, pSubset->pSamplerState, pShader);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
 void CommonMesh::GetSubsetLocalAABB(size_t subsetIndex, XMFLOAT3 *pLocalAABBMin, XMFLOAT3 *pLocalAABBMax) const
 {
 	assert(subsetIndex < m_numSubsets);
@@ -26,6 +26,12 @@ public:
 
 	void Draw();
 
+	// Every subset numInstances times, with pShader in place of the
+	// subsets' own. pShader has to take the subsets' vertex type, plus
+	// pInstanceBuffer's elements in slot 1: for example the sphere, box,
+	// cylinder and torus meshes with GetUntexturedLitInstancedShader.
+	void DrawInstanced(ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances, CommonApp::Shader *pShader);
+
 	// With care, shaders can be replaced.
 	//
 	// Remember that the vertex type and the shader are related by the input